@@ -0,0 +1,55 @@
+import esphome.codegen as cg
+import esphome.config_validation as cv
+from esphome.const import CONF_ID
+from esphome.components.basic_espnowex import BasicESPNowEx
+from esphome.components.basic_loraex import BasicLoRaEx
+from esphome.components.basic_reliable import mac_expression
+
+DEPENDENCIES = ["basic_espnowex", "basic_loraex"]
+AUTO_LOAD = ["basic_reliable"]
+
+basic_bridge_ns = cg.esphome_ns.namespace("bridge")
+BasicBridge = basic_bridge_ns.class_("BasicBridge", cg.Component)
+
+CONF_ESPNOW_ID = "espnow_id"
+CONF_LORA_ID = "lora_id"
+CONF_ROUTES = "routes"
+CONF_ESPNOW_MAC = "espnow_mac"
+CONF_LORA_MAC = "lora_mac"
+CONF_LORA_WINDOW = "lora_window"
+CONF_LORA_MIN_INTERVAL = "lora_min_interval"
+CONF_MAX_QUEUED = "max_queued"
+
+ROUTE_SCHEMA = cv.Schema({
+    cv.Required(CONF_ESPNOW_MAC): cv.mac_address,
+    cv.Required(CONF_LORA_MAC): cv.mac_address,
+})
+
+CONFIG_SCHEMA = cv.Schema({
+    cv.GenerateID(): cv.declare_id(BasicBridge),
+    cv.GenerateID(CONF_ESPNOW_ID): cv.use_id(BasicESPNowEx),
+    cv.GenerateID(CONF_LORA_ID): cv.use_id(BasicLoRaEx),
+    cv.Required(CONF_ROUTES): cv.ensure_list(ROUTE_SCHEMA),
+    cv.Optional(CONF_LORA_WINDOW, default=1): cv.int_range(min=1, max=16),
+    cv.Optional(CONF_LORA_MIN_INTERVAL, default="100ms"): cv.positive_time_period_milliseconds,
+    cv.Optional(CONF_MAX_QUEUED, default=16): cv.int_range(min=1, max=256),
+}).extend(cv.COMPONENT_SCHEMA)
+
+
+async def to_code(config):
+    var = cg.new_Pvariable(config[CONF_ID])
+    await cg.register_component(var, config)
+
+    espnow = await cg.get_variable(config[CONF_ESPNOW_ID])
+    lora = await cg.get_variable(config[CONF_LORA_ID])
+    cg.add(var.set_espnow(espnow))
+    cg.add(var.set_lora(lora))
+
+    for route in config[CONF_ROUTES]:
+        cg.add(var.add_route(mac_expression(route[CONF_ESPNOW_MAC]), mac_expression(route[CONF_LORA_MAC])))
+
+    cg.add(var.set_lora_window(config[CONF_LORA_WINDOW]))
+    cg.add(var.set_lora_min_interval(config[CONF_LORA_MIN_INTERVAL].total_milliseconds))
+    cg.add(var.set_max_queued(config[CONF_MAX_QUEUED]))
+
+    return var
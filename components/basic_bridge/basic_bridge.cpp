@@ -0,0 +1,299 @@
+#include "basic_bridge.h"
+#include "esphome/core/log.h"
+#include "esp_timer.h"
+
+#include <algorithm>
+#include <mutex>
+
+namespace esphome {
+namespace bridge {
+
+static const char *const TAG = "basic_bridge";
+
+static const size_t MAX_BRIDGE_ENTRIES = 64;
+static const int64_t ENTRY_TTL_US = 60000000;  // 60 s - okno deduplikacji ponowień od źródła
+
+void BasicBridge::setup() {
+  this->entries_.reserve(MAX_BRIDGE_ENTRIES);
+
+  this->espnow_->set_forward_handler([this](const std::array<uint8_t, 6> &src, const reliable::FrameHeader &header,
+                                            const uint8_t *payload, size_t len) {
+    return this->on_espnow_frame(src, header, payload, len);
+  });
+  this->lora_->set_forward_handler([this](const std::array<uint8_t, 6> &src, const reliable::FrameHeader &header,
+                                          const uint8_t *payload, size_t len) {
+    return this->on_lora_frame(src, header, payload, len);
+  });
+  this->espnow_->add_on_recv_ack_callback([this](std::array<uint8_t, 6> mac, std::array<uint8_t, 3> id) {
+    this->on_espnow_ack(mac, id);
+  });
+  this->lora_->add_on_recv_ack_callback([this](std::array<uint8_t, 6> mac, std::array<uint8_t, 3> id) {
+    this->on_lora_ack(mac, id);
+  });
+
+  ESP_LOGCONFIG(TAG, "ESP-NOW <-> LoRa bridge: %u routes, LoRa window %u, min interval %lld ms",
+                (unsigned) this->routes_.size(), this->lora_window_, this->lora_min_interval_us_ / 1000);
+}
+
+void BasicBridge::loop() {
+  const int64_t now = esp_timer_get_time();
+  std::vector<ForwardEntry> lora_acks;
+  LoRaJob job;
+  bool release = false;
+  {
+    std::lock_guard<reliable::FreeRtosMutex> lock(this->mutex_);
+    for (auto &entry : this->entries_) {
+      if (entry.ack_due) {
+        lora_acks.push_back(entry);
+        entry.ack_due = false;
+      }
+      // LoRa porzuciła ramkę po wyczerpaniu prób - zwalniamy okno, ponowienie od źródła przekaże ją znowu
+      if (entry.to_lora && entry.state == FORWARD_IN_FLIGHT && !this->lora_->is_pending(entry.dst, entry.dst_id)) {
+        entry.state = FORWARD_FAILED;
+        entry.timestamp = now;
+      }
+    }
+    this->entries_.erase(std::remove_if(this->entries_.begin(), this->entries_.end(),
+                                        [now](const ForwardEntry &e) {
+                                          return (e.state == FORWARD_DELIVERED || e.state == FORWARD_FAILED) &&
+                                                 now - e.timestamp > ENTRY_TTL_US;
+                                        }),
+                         this->entries_.end());
+
+    // Dopasowanie tempa: do radia LoRa trafia kolejna ramka dopiero, gdy zwolni się okno
+    if (!this->lora_jobs_.empty() && this->lora_in_flight_locked() < this->lora_window_ &&
+        now - this->last_lora_release_ >= this->lora_min_interval_us_) {
+      job = std::move(this->lora_jobs_.front());
+      this->lora_jobs_.pop_front();
+      this->last_lora_release_ = now;
+      for (auto &entry : this->entries_) {
+        if (entry.to_lora && entry.state == FORWARD_QUEUED && entry.dst == job.dst && entry.dst_id == job.dst_id) {
+          entry.state = FORWARD_IN_FLIGHT;
+          entry.timestamp = now;
+          break;
+        }
+      }
+      release = true;
+    }
+  }
+
+  for (const auto &ack : lora_acks) {
+    this->lora_->acknowledge(ack.src, ack.src_id, ack.src_qos);
+  }
+
+  if (release) {
+    const auto dst = job.dst;
+    const auto dst_id = job.dst_id;
+    RELIABLE_TRACE(reliable::trace::SRC_BRIDGE, EV_TX, dst.data(), dst_id.data(), 0, this->lora_jobs_.size(),
+                   job.frame.size());
+    if (!reliable::is_enqueued(this->lora_->send_frame(std::move(job.frame), dst))) {
+      std::lock_guard<reliable::FreeRtosMutex> lock(this->mutex_);
+      for (auto &entry : this->entries_) {
+        if (entry.to_lora && entry.dst == dst && entry.dst_id == dst_id) {
+          entry.state = FORWARD_FAILED;
+          break;
+        }
+      }
+      this->backpressure_count_++;
+    } else {
+      this->forwarded_count_++;
+    }
+  }
+}
+
+bool BasicBridge::on_espnow_frame(const std::array<uint8_t, 6> &src, const reliable::FrameHeader &header,
+                                  const uint8_t *payload, size_t len) {
+  const BridgeRoute *route = this->route_from_espnow(src);
+  if (route == nullptr) {
+    return false;  // ruch lokalny
+  }
+  if (lora::TOPIC_HEADER_SIZE + len > lora::MAX_PACKET_SIZE) {
+    ESP_LOGW(TAG, "Frame of %u bytes too long for LoRa, delivered locally", (unsigned) len);
+    return false;
+  }
+
+  // QoS 0: bez śledzenia i bez ACK - przy pełnej kolejce ramka po prostu przepada
+  if (header.qos == reliable::QOS_AT_MOST_ONCE) {
+    std::lock_guard<reliable::FreeRtosMutex> lock(this->mutex_);
+    if (this->lora_jobs_.size() < this->max_queued_) {
+      reliable::FrameHeader out = header;
+      out.id = this->lora_->generate_message_id();
+      this->lora_jobs_.push_back({route->lora_mac, out.id,
+                                  reliable::build_frame<lora::LoRaTransport>(route->lora_mac, out, payload, len)});
+    }
+    return true;
+  }
+
+  const int64_t now = esp_timer_get_time();
+  bool ack_again = false;
+  {
+    std::lock_guard<reliable::FreeRtosMutex> lock(this->mutex_);
+    ForwardEntry *entry = this->find_entry_locked(true, src, header.id);
+    if (entry != nullptr && entry->state == FORWARD_DELIVERED) {
+      ack_again = true;  // już dostarczona - poprzedni ACK do źródła zaginął
+    } else if (entry != nullptr && entry->state != FORWARD_FAILED) {
+      return true;  // ponowienie ramki, która czeka w kolejce lub jest w drodze
+    } else if (this->lora_jobs_.size() >= this->max_queued_ ||
+               (entry == nullptr && (entry = this->make_entry_locked()) == nullptr)) {
+      // Bez ACK - źródło zachowa ramkę i ponowi, gdy LoRa nadrobi
+      this->backpressure_count_++;
+      RELIABLE_TRACE(reliable::trace::SRC_BRIDGE, EV_DROP, src.data(), header.id.data(), 0, this->lora_jobs_.size(), len);
+      return true;
+    } else {
+      reliable::FrameHeader out = header;
+      out.id = this->lora_->generate_message_id();
+      *entry = ForwardEntry{true, FORWARD_QUEUED, false, header.qos, src, header.id, route->lora_mac, out.id, now};
+      this->lora_jobs_.push_back({route->lora_mac, out.id,
+                                  reliable::build_frame<lora::LoRaTransport>(route->lora_mac, out, payload, len)});
+      RELIABLE_TRACE(reliable::trace::SRC_BRIDGE, EV_ENQUEUE, route->lora_mac.data(), out.id.data(), 0,
+                     this->lora_jobs_.size(), len);
+    }
+  }
+  if (ack_again) {
+    this->espnow_->acknowledge(src, header.id, header.qos);
+  }
+  return true;
+}
+
+bool BasicBridge::on_lora_frame(const std::array<uint8_t, 6> &src, const reliable::FrameHeader &header,
+                                const uint8_t *payload, size_t len) {
+  const BridgeRoute *route = this->route_from_lora(src);
+  if (route == nullptr) {
+    return false;
+  }
+  if (len == 0 || espnow::TOPIC_HEADER_SIZE + len > ESP_NOW_MAX_DATA_LEN) {
+    ESP_LOGW(TAG, "Frame of %u bytes cannot be forwarded to ESP-NOW, delivered locally", (unsigned) len);
+    return false;
+  }
+
+  reliable::FrameHeader out = header;
+  if (header.qos == reliable::QOS_AT_MOST_ONCE) {
+    out.id = this->espnow_->generate_message_id();
+    this->espnow_->send_frame(reliable::build_frame<espnow::EspNowTransport>(route->espnow_mac, out, payload, len),
+                              route->espnow_mac);
+    return true;
+  }
+
+  const int64_t now = esp_timer_get_time();
+  bool ack_again = false;
+  {
+    std::lock_guard<reliable::FreeRtosMutex> lock(this->mutex_);
+    ForwardEntry *entry = this->find_entry_locked(false, src, header.id);
+    if (entry != nullptr && entry->state == FORWARD_DELIVERED) {
+      ack_again = true;
+    } else if (entry != nullptr && entry->state == FORWARD_IN_FLIGHT &&
+               this->espnow_->is_pending(entry->dst, entry->dst_id)) {
+      return true;
+    } else if (entry == nullptr && (entry = this->make_entry_locked()) == nullptr) {
+      this->backpressure_count_++;
+      return true;
+    } else {
+      out.id = this->espnow_->generate_message_id();
+      *entry = ForwardEntry{false, FORWARD_IN_FLIGHT, false, header.qos, src, header.id, route->espnow_mac, out.id, now};
+    }
+  }
+  if (ack_again) {
+    this->lora_->acknowledge(src, header.id, header.qos);
+    return true;
+  }
+
+  // ESP-NOW jest szybsze od LoRa - przekazujemy od razu, bez kolejki mostu
+  if (!reliable::is_enqueued(this->espnow_->send_frame(
+          reliable::build_frame<espnow::EspNowTransport>(route->espnow_mac, out, payload, len), route->espnow_mac))) {
+    std::lock_guard<reliable::FreeRtosMutex> lock(this->mutex_);
+    ForwardEntry *entry = this->find_entry_locked(false, src, header.id);
+    if (entry != nullptr) {
+      entry->state = FORWARD_FAILED;
+    }
+    this->backpressure_count_++;
+  } else {
+    this->forwarded_count_++;
+  }
+  return true;
+}
+
+void BasicBridge::on_espnow_ack(const std::array<uint8_t, 6> &mac, const MessageId &id) {
+  std::lock_guard<reliable::FreeRtosMutex> lock(this->mutex_);
+  for (auto &entry : this->entries_) {
+    if (!entry.to_lora && entry.state != FORWARD_DELIVERED && entry.dst == mac && entry.dst_id == id) {
+      // ACK do źródła LoRa wysyłamy z loop() - SPI nie z zadania WiFi
+      entry.state = FORWARD_DELIVERED;
+      entry.ack_due = true;
+      entry.timestamp = esp_timer_get_time();
+      return;
+    }
+  }
+}
+
+void BasicBridge::on_lora_ack(const std::array<uint8_t, 6> &mac, const MessageId &id) {
+  std::array<uint8_t, 6> src;
+  MessageId src_id;
+  reliable::QoS src_qos;
+  {
+    std::lock_guard<reliable::FreeRtosMutex> lock(this->mutex_);
+    auto it = std::find_if(this->entries_.begin(), this->entries_.end(), [&](const ForwardEntry &e) {
+      return e.to_lora && e.state != FORWARD_DELIVERED && e.dst == mac && e.dst_id == id;
+    });
+    if (it == this->entries_.end()) {
+      return;
+    }
+    it->state = FORWARD_DELIVERED;
+    it->timestamp = esp_timer_get_time();
+    src = it->src;
+    src_id = it->src_id;
+    src_qos = it->src_qos;
+  }
+  // Nadawca ESP-NOW dostaje ACK dopiero teraz - potwierdza on dostarczenie przez LoRa
+  this->espnow_->acknowledge(src, src_id, src_qos);
+}
+
+const BridgeRoute *BasicBridge::route_from_espnow(const std::array<uint8_t, 6> &mac) const {
+  for (const auto &route : this->routes_) {
+    if (route.espnow_mac == mac) {
+      return &route;
+    }
+  }
+  return nullptr;
+}
+
+const BridgeRoute *BasicBridge::route_from_lora(const std::array<uint8_t, 6> &mac) const {
+  for (const auto &route : this->routes_) {
+    if (route.lora_mac == mac) {
+      return &route;
+    }
+  }
+  return nullptr;
+}
+
+ForwardEntry *BasicBridge::find_entry_locked(bool to_lora, const std::array<uint8_t, 6> &src, const MessageId &id) {
+  for (auto &entry : this->entries_) {
+    if (entry.to_lora == to_lora && entry.src_id == id && entry.src == src) {
+      return &entry;
+    }
+  }
+  return nullptr;
+}
+
+ForwardEntry *BasicBridge::make_entry_locked() {
+  if (this->entries_.size() < MAX_BRIDGE_ENTRIES) {
+    this->entries_.emplace_back();
+    return &this->entries_.back();
+  }
+  // Pełna tabela - zastępujemy najstarszy zakończony wpis
+  ForwardEntry *oldest = nullptr;
+  for (auto &entry : this->entries_) {
+    if ((entry.state == FORWARD_DELIVERED || entry.state == FORWARD_FAILED) && !entry.ack_due &&
+        (oldest == nullptr || entry.timestamp < oldest->timestamp)) {
+      oldest = &entry;
+    }
+  }
+  return oldest;
+}
+
+size_t BasicBridge::lora_in_flight_locked() const {
+  return std::count_if(this->entries_.begin(), this->entries_.end(),
+                       [](const ForwardEntry &e) { return e.to_lora && e.state == FORWARD_IN_FLIGHT; });
+}
+
+}  // namespace bridge
+}  // namespace esphome
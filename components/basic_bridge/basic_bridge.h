@@ -0,0 +1,103 @@
+#pragma once
+
+#include "esphome/core/component.h"
+#include "esphome/components/basic_espnowex/basic_espnowex.h"
+#include "esphome/components/basic_loraex/basic_loraex.h"
+#include "esphome/components/basic_reliable/freertos_mutex.h"
+
+#include <array>
+#include <deque>
+#include <vector>
+
+namespace esphome {
+namespace bridge {
+
+using reliable::MessageId;
+
+// Para adresów: urządzenie po stronie ESP-NOW <-> urządzenie po stronie LoRa
+struct BridgeRoute {
+  std::array<uint8_t, 6> espnow_mac;
+  std::array<uint8_t, 6> lora_mac;
+};
+
+enum ForwardState : uint8_t {
+  FORWARD_QUEUED = 0,  // czeka w kolejce na wysłanie przez LoRa
+  FORWARD_IN_FLIGHT,   // przekazana, czeka na ACK od docelowego urządzenia
+  FORWARD_DELIVERED,   // potwierdzona przez cel - źródło dostało (lub dostanie) ACK
+  FORWARD_FAILED,      // cel nie potwierdził - ponowienie od źródła przekaże ją jeszcze raz
+};
+
+// Przekazana ramka: identyfikator u źródła i odpowiadający mu identyfikator po drugiej stronie
+struct ForwardEntry {
+  bool to_lora;
+  ForwardState state;
+  bool ack_due;  // ACK do źródła LoRa czeka na wysłanie z loop()
+  reliable::QoS src_qos;  // QoS 2 - źródło dostaje REC zamiast ACK
+  std::array<uint8_t, 6> src;
+  MessageId src_id;
+  std::array<uint8_t, 6> dst;
+  MessageId dst_id;
+  int64_t timestamp;
+};
+
+// Ramka czekająca na LoRa - już zakodowana z nagłówkiem LoRa, trafia do kolejki radia przez move
+struct LoRaJob {
+  std::array<uint8_t, 6> dst;
+  MessageId dst_id;
+  std::vector<uint8_t> frame;
+};
+
+class BasicBridge : public Component {
+ public:
+  void setup() override;
+  void loop() override;
+  float get_setup_priority() const override { return setup_priority::DATA; }
+
+  void set_espnow(espnow::BasicESPNowEx *espnow) { this->espnow_ = espnow; }
+  void set_lora(lora::BasicLoRaEx *lora) { this->lora_ = lora; }
+  void add_route(std::array<uint8_t, 6> espnow_mac, std::array<uint8_t, 6> lora_mac) {
+    this->routes_.push_back({espnow_mac, lora_mac});
+  }
+  // Dopasowanie tempa do LoRa: ile przekazanych ramek naraz w powietrzu i minimalny odstęp między nimi
+  void set_lora_window(uint8_t window) { this->lora_window_ = window; }
+  void set_lora_min_interval(uint32_t interval_ms) { this->lora_min_interval_us_ = int64_t(interval_ms) * 1000; }
+  void set_max_queued(size_t max_queued) { this->max_queued_ = max_queued; }
+
+  uint32_t get_forwarded_count() const { return this->forwarded_count_; }
+  uint32_t get_backpressure_count() const { return this->backpressure_count_; }
+
+ protected:
+  // Wywoływane z recv_cb (zadanie WiFi) - tylko kopia do kolejki, bez SPI
+  bool on_espnow_frame(const std::array<uint8_t, 6> &src, const reliable::FrameHeader &header, const uint8_t *payload,
+                       size_t len);
+  // Wywoływane z loop() basic_loraex - ESP-NOW jest szybsze, więc wysyłamy od razu
+  bool on_lora_frame(const std::array<uint8_t, 6> &src, const reliable::FrameHeader &header, const uint8_t *payload,
+                     size_t len);
+  void on_espnow_ack(const std::array<uint8_t, 6> &mac, const MessageId &id);
+  void on_lora_ack(const std::array<uint8_t, 6> &mac, const MessageId &id);
+
+  const BridgeRoute *route_from_espnow(const std::array<uint8_t, 6> &mac) const;
+  const BridgeRoute *route_from_lora(const std::array<uint8_t, 6> &mac) const;
+  ForwardEntry *find_entry_locked(bool to_lora, const std::array<uint8_t, 6> &src, const MessageId &id);
+  ForwardEntry *make_entry_locked();
+  size_t lora_in_flight_locked() const;
+
+  espnow::BasicESPNowEx *espnow_{nullptr};
+  lora::BasicLoRaEx *lora_{nullptr};
+  std::vector<BridgeRoute> routes_;
+
+  std::vector<ForwardEntry> entries_;
+  std::deque<LoRaJob> lora_jobs_;
+  reliable::FreeRtosMutex mutex_;
+
+  uint8_t lora_window_{1};
+  int64_t lora_min_interval_us_{100000};
+  size_t max_queued_{16};
+  int64_t last_lora_release_{0};
+
+  uint32_t forwarded_count_{0};
+  uint32_t backpressure_count_{0};
+};
+
+}  // namespace bridge
+}  // namespace esphome
@@ -2,6 +2,15 @@ import esphome.codegen as cg
 import esphome.config_validation as cv
 from esphome.const import CONF_ID, CONF_MAC_ADDRESS, CONF_TRIGGER_ID, CONF_NUM_ATTEMPTS, CONF_TIMEOUT
 from esphome import automation
+from esphome.components.basic_reliable import (
+    CONF_MAILBOX, CONF_MESSAGES, CONF_ON_TOPIC, CONF_PEER_HEALTH, CONF_RECEIVE_WINDOW, MAILBOX_SCHEMA,
+    OVERFLOW_POLICIES, PEER_HEALTH_SCHEMA, RECEIVE_WINDOW_SCHEMA, SendAction, SendCmdAction, SendMessageAction,
+    mailbox_to_code, message_triggers_to_code, messages_schema, messages_structs_to_code, on_topic_schema,
+    peer_health_to_code, send_action_schema, send_action_to_code, send_cmd_action_schema, send_cmd_action_to_code,
+    send_message_action_schema, send_message_action_to_code, topic_triggers_to_code
+)
+
+AUTO_LOAD = ["basic_reliable"]
 
 # Dodanie definicji std_array, której brakuje w codegen
 std_array = cg.std_ns.class_("array")
@@ -31,27 +40,113 @@ OnRecvDataTrigger = basic_espnowex_ns.class_(
     automation.Trigger.template(cg.std_array.template(cg.uint8, 6), cg.std_vector.template(cg.uint8)),
     cg.Component,
 )
+OnTopicTrigger = basic_espnowex_ns.class_(
+    "OnTopicTrigger",
+    automation.Trigger.template(cg.std_array.template(cg.uint8, 6), cg.std_vector.template(cg.uint8)),
+    cg.Component,
+)
+OnImageCompleteTrigger = basic_espnowex_ns.class_(
+    "OnImageCompleteTrigger",
+    automation.Trigger.template(cg.uint32, cg.uint32),
+    cg.Component,
+)
+
+PhyRate = basic_espnowex_ns.enum("PhyRate")
+PHY_RATES = {
+    "lr_250k": PhyRate.PHY_RATE_LR_250K,
+    "lr_500k": PhyRate.PHY_RATE_LR_500K,
+    "1m": PhyRate.PHY_RATE_1M,
+    "6m": PhyRate.PHY_RATE_6M,
+    "12m": PhyRate.PHY_RATE_12M,
+    "24m": PhyRate.PHY_RATE_24M,
+    "54m": PhyRate.PHY_RATE_54M,
+}
 
 CONF_PEER_MAC = "peer_mac"
 CONF_MAX_RETRIES = "max_retries"
 CONF_TIMEOUT_US = "timeout_us"
+CONF_MAX_QUEUE_MESSAGES = "max_queue_messages"
+CONF_MAX_QUEUE_BYTES = "max_queue_bytes"
+CONF_OVERFLOW_POLICY = "overflow_policy"
 CONF_ON_MESSAGE = "on_message"
 CONF_ON_RECV_DATA = "on_recv_data"
 CONF_ON_RECV_ACK = "on_recv_ack"
 CONF_ON_RECV_CMD = "on_recv_cmd"
+CONF_DEEP_SLEEP_MODE = "deep_sleep_mode"
+CONF_SLEEP_DURATION = "sleep_duration"
+CONF_ACK_DEADLINE = "ack_deadline"
+CONF_MAIL_WINDOW = "mail_window"
+CONF_POLL_ON_WAKE = "poll_on_wake"
+CONF_IMAGE_DISTRIBUTION = "image_distribution"
+CONF_BLOCK_SIZE = "block_size"
+CONF_BLOCK_INTERVAL = "block_interval"
+CONF_NACK_WINDOW = "nack_window"
+CONF_MAX_ROUNDS = "max_rounds"
+CONF_EXPECTED_NODES = "expected_nodes"
+CONF_ON_IMAGE_COMPLETE = "on_image_complete"
+CONF_RATE_CONTROL = "rate_control"
+CONF_LONG_RANGE = "long_range"
+CONF_PEERS = "peers"
+CONF_RATE = "rate"
+
+
+def validate_rate_control(config):
+    if not config[CONF_LONG_RANGE]:
+        for peer in config[CONF_PEERS]:
+            if peer[CONF_RATE] in ("lr_250k", "lr_500k"):
+                raise cv.Invalid(f"Rate '{peer[CONF_RATE]}' requires long_range: true")
+    return config
+
+# ESP_NOW_MAX_DATA_LEN (250) minus nagłówek bloku (5)
+IMAGE_MAX_BLOCK_SIZE = 245
+# ESP_NOW_MAX_DATA_LEN minus nagłówek ramki tematu (6)
+MESSAGE_MAX_SIZE = 244
+
 
 CONFIG_SCHEMA = cv.Schema({
     cv.GenerateID(): cv.declare_id(BasicESPNowEx),
     cv.Optional(CONF_PEER_MAC): cv.mac_address,
     cv.Optional(CONF_MAX_RETRIES): cv.positive_int,
     cv.Optional(CONF_TIMEOUT_US): cv.positive_int,
+    cv.Optional(CONF_MAX_QUEUE_MESSAGES, default=32): cv.int_range(min=1, max=1024),
+    cv.Optional(CONF_MAX_QUEUE_BYTES, default=4096): cv.int_range(min=256),
+    cv.Optional(CONF_OVERFLOW_POLICY, default="drop_oldest"): cv.enum(OVERFLOW_POLICIES, lower=True),
+    cv.Optional(CONF_PEER_HEALTH, default={}): PEER_HEALTH_SCHEMA,
+    cv.Optional(CONF_RECEIVE_WINDOW, default=0): RECEIVE_WINDOW_SCHEMA,
+    cv.Optional(CONF_MAILBOX): MAILBOX_SCHEMA,
+    cv.Optional(CONF_MESSAGES, default=[]): messages_schema(MESSAGE_MAX_SIZE),
+    cv.Optional(CONF_DEEP_SLEEP_MODE): cv.Schema({
+        cv.Optional(CONF_SLEEP_DURATION, default="60s"): cv.positive_time_period_milliseconds,
+        cv.Optional(CONF_ACK_DEADLINE, default="30ms"): cv.positive_time_period_milliseconds,
+        cv.Optional(CONF_MAIL_WINDOW, default="5ms"): cv.positive_time_period_milliseconds,
+        cv.Optional(CONF_POLL_ON_WAKE, default=False): cv.boolean,
+    }),
+    cv.Optional(CONF_IMAGE_DISTRIBUTION): cv.Schema({
+        cv.Optional(CONF_BLOCK_SIZE, default=IMAGE_MAX_BLOCK_SIZE): cv.int_range(min=16, max=IMAGE_MAX_BLOCK_SIZE),
+        cv.Optional(CONF_BLOCK_INTERVAL, default="4ms"): cv.positive_time_period_milliseconds,
+        cv.Optional(CONF_NACK_WINDOW, default="300ms"): cv.All(
+            cv.positive_time_period_milliseconds, cv.Range(max=cv.TimePeriod(milliseconds=65535))
+        ),
+        cv.Optional(CONF_MAX_ROUNDS, default=20): cv.int_range(min=1, max=255),
+        cv.Optional(CONF_EXPECTED_NODES): cv.int_range(min=1, max=65535),
+    }),
+    cv.Optional(CONF_RATE_CONTROL): cv.All(cv.Schema({
+        cv.Optional(CONF_LONG_RANGE, default=False): cv.boolean,
+        cv.Optional(CONF_PEERS, default=[]): cv.ensure_list(cv.Schema({
+            cv.Required(CONF_MAC_ADDRESS): cv.mac_address,
+            cv.Required(CONF_RATE): cv.one_of(*PHY_RATES, lower=True),
+        })),
+    }), validate_rate_control),
+    cv.Optional(CONF_ON_IMAGE_COMPLETE): automation.validate_automation({cv.GenerateID(CONF_TRIGGER_ID): cv.declare_id(OnImageCompleteTrigger)}),
     cv.Optional(CONF_ON_MESSAGE): automation.validate_automation({cv.GenerateID(CONF_TRIGGER_ID): cv.declare_id(OnMessageTrigger)}),
     cv.Optional(CONF_ON_RECV_ACK): automation.validate_automation({cv.GenerateID(CONF_TRIGGER_ID): cv.declare_id(OnRecvAckTrigger)}),
     cv.Optional(CONF_ON_RECV_DATA): automation.validate_automation({cv.GenerateID(CONF_TRIGGER_ID): cv.declare_id(OnRecvDataTrigger)}),
     cv.Optional(CONF_ON_RECV_CMD): automation.validate_automation({cv.GenerateID(CONF_TRIGGER_ID): cv.declare_id(OnRecvCmdTrigger)}),
+    cv.Optional(CONF_ON_TOPIC): on_topic_schema(OnTopicTrigger),
 }).extend(cv.COMPONENT_SCHEMA)
 
 async def to_code(config):
+    messages_structs_to_code(basic_espnowex_ns, config[CONF_MESSAGES])
     var = cg.new_Pvariable(config[CONF_ID])
     await cg.register_component(var, config)
 
@@ -69,6 +164,50 @@ async def to_code(config):
         timeout_us_int = config[CONF_TIMEOUT_US].to_int()
         cg.add(var.set_timeout_us(timeout_us_int))
 
+    cg.add(var.set_max_queue_messages(config[CONF_MAX_QUEUE_MESSAGES]))
+    cg.add(var.set_max_queue_bytes(config[CONF_MAX_QUEUE_BYTES]))
+    cg.add(var.set_overflow_policy(config[CONF_OVERFLOW_POLICY]))
+    peer_health_to_code(var, config[CONF_PEER_HEALTH])
+    cg.add(var.set_receive_window(config[CONF_RECEIVE_WINDOW]))
+    if CONF_MAILBOX in config:
+        mailbox_to_code(var, config[CONF_MAILBOX])
+
+    if CONF_DEEP_SLEEP_MODE in config:
+        sleep_conf = config[CONF_DEEP_SLEEP_MODE]
+        cg.add(var.set_deep_sleep_mode(True))
+        cg.add(var.set_sleep_duration(sleep_conf[CONF_SLEEP_DURATION].total_milliseconds))
+        cg.add(var.set_ack_deadline(sleep_conf[CONF_ACK_DEADLINE].total_milliseconds))
+        cg.add(var.set_mail_window(sleep_conf[CONF_MAIL_WINDOW].total_milliseconds))
+        cg.add(var.set_poll_on_wake(sleep_conf[CONF_POLL_ON_WAKE]))
+
+    if CONF_IMAGE_DISTRIBUTION in config:
+        image_conf = config[CONF_IMAGE_DISTRIBUTION]
+        cg.add(var.set_image_block_size(image_conf[CONF_BLOCK_SIZE]))
+        cg.add(var.set_image_block_interval(image_conf[CONF_BLOCK_INTERVAL].total_milliseconds))
+        cg.add(var.set_image_nack_window(image_conf[CONF_NACK_WINDOW].total_milliseconds))
+        cg.add(var.set_image_max_rounds(image_conf[CONF_MAX_ROUNDS]))
+        if CONF_EXPECTED_NODES in image_conf:
+            cg.add(var.set_image_expected_nodes(image_conf[CONF_EXPECTED_NODES]))
+
+    if CONF_RATE_CONTROL in config:
+        rate_conf = config[CONF_RATE_CONTROL]
+        cg.add(var.set_rate_control(True))
+        cg.add(var.set_long_range(rate_conf[CONF_LONG_RANGE]))
+        for peer in rate_conf[CONF_PEERS]:
+            mac_ints = [int(x, 16) for x in peer[CONF_MAC_ADDRESS].to_string().split(":")]
+            mac_expr = cg.RawExpression(f"std::array<uint8_t, 6>{{{', '.join(map(str, mac_ints))}}}")
+            cg.add(var.set_peer_rate(mac_expr, PHY_RATES[peer[CONF_RATE]]))
+
+    await message_triggers_to_code(var, BasicESPNowEx, basic_espnowex_ns, config[CONF_MESSAGES])
+
+    for conf in config.get(CONF_ON_IMAGE_COMPLETE, []):
+        trigger = cg.new_Pvariable(conf[CONF_TRIGGER_ID], var)
+        await automation.build_automation(
+            trigger,
+            [(cg.uint32, "size"), (cg.uint32, "crc32")],
+            conf,
+        )
+
     for conf in config.get(CONF_ON_MESSAGE, []):
         trigger = cg.new_Pvariable(conf[CONF_TRIGGER_ID], var)
         await automation.build_automation(
@@ -101,4 +240,25 @@ async def to_code(config):
             conf,
         )
 
+    await topic_triggers_to_code(var, config.get(CONF_ON_TOPIC, []))
+
     return var
+
+
+@automation.register_action(
+    "basic_espnowex.send_message", SendMessageAction, send_message_action_schema(BasicESPNowEx)
+)
+async def send_message_to_code(config, action_id, template_arg, args):
+    return await send_message_action_to_code(
+        config, action_id, template_arg, args, BasicESPNowEx, basic_espnowex_ns, "basic_espnowex"
+    )
+
+
+@automation.register_action("basic_espnowex.send", SendAction, send_action_schema(BasicESPNowEx))
+async def send_to_code(config, action_id, template_arg, args):
+    return await send_action_to_code(config, action_id, template_arg, args, BasicESPNowEx)
+
+
+@automation.register_action("basic_espnowex.send_cmd", SendCmdAction, send_cmd_action_schema(BasicESPNowEx))
+async def send_cmd_to_code(config, action_id, template_arg, args):
+    return await send_cmd_action_to_code(config, action_id, template_arg, args, BasicESPNowEx)
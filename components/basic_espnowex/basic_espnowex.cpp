@@ -2,6 +2,8 @@
 #include "esp_wifi.h"
 #include "esp_event.h"
 #include "esp_log.h"
+#include "esp_attr.h"
+#include "esp_sleep.h"
 #include "freertos/semphr.h"
 #include <functional>
 
@@ -10,6 +12,31 @@ namespace espnow {
 
 BasicESPNowEx *BasicESPNowEx::instance_ = nullptr;
 
+// Stan przechowywany w pamięci RTC między cyklami deep sleep
+static const uint32_t RTC_STATE_MAGIC = 0x45534E31;  // "ESN1"
+static const size_t RTC_MAX_PEERS = 8;
+static const size_t RTC_MAX_PENDING = 4;
+
+struct RtcPendingFrame {
+  uint8_t mac[6];
+  uint8_t retry_count;
+  uint8_t priority;
+  uint8_t len;
+  uint8_t data[ESP_NOW_MAX_DATA_LEN];
+};
+
+struct RtcState {
+  uint32_t magic;
+  uint8_t channel;
+  uint8_t peer_count;
+  uint8_t peers[RTC_MAX_PEERS][6];
+  uint32_t srtt_us;
+  uint8_t pending_count;
+  RtcPendingFrame pending[RTC_MAX_PENDING];
+};
+
+static RTC_DATA_ATTR RtcState rtc_state;
+
 // deklaracja funkcji pomocniczej
 void BasicESPNowEx::static_wifi_event(void* arg, esp_event_base_t base, int32_t id, void* data) {
   // przekaż dalej do instancji
@@ -25,25 +52,37 @@ void BasicESPNowEx::setup() {
   //esp_wifi_init(&cfg);
   //esp_wifi_set_mode(WIFI_MODE_STA);
   //esp_wifi_start();
-  
-  esp_event_handler_instance_register(
-    WIFI_EVENT, WIFI_EVENT_STA_CONNECTED,
-    &BasicESPNowEx::static_wifi_event, this, nullptr);
-	
-  // Sprawdzić czy WiFi jest już zainicjalizowane
-  wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
-  esp_err_t err = esp_wifi_init(&cfg);
-  if (err == ESP_ERR_WIFI_INIT_STATE) {
-    // WiFi już zainicjalizowane - to normalne w ESPHome
-    ESP_LOGI("basic_espnowex", "WiFi already initialized");
-  } else if (err != ESP_OK) {
-    ESP_LOGE("basic_espnowex", "WiFi init failed: %s", esp_err_to_name(err));
-    return;
+
+  // Wybudzenie z deep sleep z poprawnym stanem RTC - pomijamy pełną inicjalizację
+  const bool warm_wake = this->deep_sleep_mode_ && rtc_state.magic == RTC_STATE_MAGIC &&
+                         esp_sleep_get_wakeup_cause() != ESP_SLEEP_WAKEUP_UNDEFINED;
+  if (!warm_wake) {
+    rtc_state = {};
   }
 
-  uint8_t wifi_channel;
-  esp_wifi_get_channel(&wifi_channel, nullptr);
-  esp_wifi_set_channel(wifi_channel, WIFI_SECOND_CHAN_NONE);
+  if (this->deep_sleep_mode_) {
+    this->init_radio_minimal(warm_wake ? rtc_state.channel : 0);
+  } else {
+    esp_event_handler_instance_register(
+      WIFI_EVENT, WIFI_EVENT_STA_CONNECTED,
+      &BasicESPNowEx::static_wifi_event, this, nullptr);
+
+    // Sprawdzić czy WiFi jest już zainicjalizowane
+    wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
+    esp_err_t err = esp_wifi_init(&cfg);
+    if (err == ESP_ERR_WIFI_INIT_STATE) {
+      // WiFi już zainicjalizowane - to normalne w ESPHome
+      ESP_LOGI("basic_espnowex", "WiFi already initialized");
+    } else if (err != ESP_OK) {
+      ESP_LOGE("basic_espnowex", "WiFi init failed: %s", esp_err_to_name(err));
+      return;
+    }
+
+    uint8_t wifi_channel;
+    esp_wifi_get_channel(&wifi_channel, nullptr);
+    esp_wifi_set_channel(wifi_channel, WIFI_SECOND_CHAN_NONE);
+  }
+  this->enable_long_range();
 	
   esp_now_init();
   esp_now_register_recv_cb(&BasicESPNowEx::recv_cb);
@@ -51,18 +90,14 @@ void BasicESPNowEx::setup() {
 
   instance_ = this;
 
-  esp_now_peer_info_t peer = {};
-  memcpy(peer.peer_addr, this->peer_mac_.data(), 6);
-  peer.channel = 0; //wifi_channel;
-  peer.encrypt = false;
+  this->ensure_peer(this->peer_mac_.data());
 
-  if (!esp_now_is_peer_exist(peer.peer_addr)) {
-    esp_now_add_peer(&peer);
+  // Po wybudzeniu retransmisje z timeoutem liczonym z RTT zamiast pełnego timeout_us
+  this->engine_.set_adaptive_timeout(this->deep_sleep_mode_);
+  if (warm_wake) {
+    this->restore_rtc_state();
   }
-	
-  // 1) Utwórz semafor
-  this->queue_mutex_ = xSemaphoreCreateMutex();
-  this->history_mutex_ = xSemaphoreCreateMutex();
+  this->exactly_once_store_.setup(fnv1_hash("basic_espnowex_exactly_once"), this->engine_);
 	
   // Konfiguracja timera do okresowej weryfikacji kolejki
   const esp_timer_create_args_t timer_args = {
@@ -76,7 +111,158 @@ void BasicESPNowEx::setup() {
   ESP_ERROR_CHECK(esp_timer_create(&timer_args, &this->retry_timer_));
   ESP_ERROR_CHECK(esp_timer_start_periodic(this->retry_timer_, 400000)); // 100ms
 
-  ESP_LOGI("basic_espnowex", "ESP-NOW initialized");
+  ESP_LOGI("basic_espnowex", "ESP-NOW initialized%s", warm_wake ? " (RTC state restored)" : "");
+  if (this->poll_on_wake_) {
+    this->poll_mailbox();
+  }
+}
+
+void BasicESPNowEx::init_radio_minimal(uint8_t channel) {
+  // Tylko to, czego wymaga ESP-NOW: bez netif, bez zapisu konfiguracji WiFi do NVS, bez skanowania
+  esp_event_loop_create_default();
+  wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
+  esp_err_t err = esp_wifi_init(&cfg);
+  if (err != ESP_OK && err != ESP_ERR_WIFI_INIT_STATE) {
+    ESP_LOGE("basic_espnowex", "WiFi init failed: %s", esp_err_to_name(err));
+    return;
+  }
+  esp_wifi_set_storage(WIFI_STORAGE_RAM);
+  esp_wifi_set_mode(WIFI_MODE_STA);
+  esp_wifi_start();
+  if (channel == 0) {
+    esp_wifi_get_channel(&channel, nullptr);
+  }
+  esp_wifi_set_channel(channel, WIFI_SECOND_CHAN_NONE);
+  rtc_state.channel = channel;
+}
+
+void BasicESPNowEx::enable_long_range() {
+  if (!this->rate_control_.is_long_range()) {
+    return;
+  }
+  // LR dokładamy do protokołów 802.11b/g/n - połączenie z AP działa dalej normalnie
+  esp_err_t err = esp_wifi_set_protocol(WIFI_IF_STA, WIFI_PROTOCOL_11B | WIFI_PROTOCOL_11G | WIFI_PROTOCOL_11N |
+                                                         WIFI_PROTOCOL_LR);
+  if (err != ESP_OK) {
+    ESP_LOGW("basic_espnowex", "Enabling long range mode failed: %s", esp_err_to_name(err));
+  }
+}
+
+void BasicESPNowEx::restore_rtc_state() {
+  for (uint8_t i = 0; i < rtc_state.peer_count && i < RTC_MAX_PEERS; i++) {
+    this->ensure_peer(rtc_state.peers[i]);
+  }
+  this->engine_.set_srtt_us(rtc_state.srtt_us);
+
+  for (uint8_t i = 0; i < rtc_state.pending_count && i < RTC_MAX_PENDING; i++) {
+    const RtcPendingFrame &frame = rtc_state.pending[i];
+    std::array<uint8_t, 6> mac;
+    std::copy_n(frame.mac, 6, mac.begin());
+    this->engine_.restore_pending(mac, frame.data, frame.len, frame.retry_count, frame.priority);
+  }
+  ESP_LOGD("basic_espnowex", "RTC restore: channel %u, %u peers, %u pending frames",
+           rtc_state.channel, rtc_state.peer_count, rtc_state.pending_count);
+  rtc_state.pending_count = 0;
+}
+
+void BasicESPNowEx::persist_rtc_state() {
+  rtc_state.magic = RTC_STATE_MAGIC;
+  rtc_state.srtt_us = this->engine_.get_srtt_us();
+  rtc_state.pending_count = 0;
+  const uint8_t max_retries = this->engine_.get_max_retries();
+  this->engine_.for_each_pending([max_retries](const reliable::PendingMessage<std::array<uint8_t, 6>> &msg) {
+    if (rtc_state.pending_count >= RTC_MAX_PENDING || msg.acked || msg.retry_count >= max_retries ||
+        msg.payload.size() > ESP_NOW_MAX_DATA_LEN) {
+      return;
+    }
+    RtcPendingFrame &frame = rtc_state.pending[rtc_state.pending_count++];
+    std::copy(msg.mac.begin(), msg.mac.end(), frame.mac);
+    frame.retry_count = msg.retry_count;
+    frame.priority = msg.priority;
+    frame.len = msg.payload.size();
+    std::copy(msg.payload.begin(), msg.payload.end(), frame.data);
+  });
+}
+
+void BasicESPNowEx::sleep_when_done(uint32_t sleep_duration_ms) {
+  if (sleep_duration_ms != 0) {
+    this->sleep_duration_ms_ = sleep_duration_ms;
+  }
+  this->sleep_requested_ = true;
+  this->sleep_requested_at_ = esp_timer_get_time();
+}
+
+void BasicESPNowEx::loop() {
+  this->update_peer_sensors();
+  // QoS 2: zapis identyfikatorów do flasha, potem dostarczenie i REC - poza zadaniem WiFi
+  this->engine_.flush_exactly_once([this](const std::vector<reliable::ExactlyOnceRecord<std::array<uint8_t, 6>>> &records) {
+    return this->exactly_once_store_.save(records);
+  });
+  this->engine_.process_inbox();
+  this->image_sender_.loop();
+  this->image_receiver_.loop();
+  this->rate_control_.loop();
+  if (!this->sleep_requested_) {
+    return;
+  }
+  // Retransmisje z pętli zamiast z timera 400 ms - liczy się każda milisekunda czuwania
+  this->process_send_queue();
+  const bool done = this->get_pending_count() == 0;
+  // Poczta z bramki przychodzi seriami zaraz po ACK - czekamy tylko, dopóki kolejne ramki nadchodzą
+  if ((done || esp_timer_get_time() - this->sleep_requested_at_ > this->ack_deadline_us_) &&
+      !this->engine_.awaiting_mail()) {
+    this->enter_deep_sleep();
+  }
+}
+
+void BasicESPNowEx::update_peer_sensors() {
+#ifdef USE_BINARY_SENSOR
+  // Stan zmienia się w zadaniu WiFi/timerze - publikujemy tylko z loop(), gdy licznik zmian drgnął
+  const uint32_t epoch = this->engine_.get_peer_state_epoch();
+  if (epoch == this->peer_state_epoch_) {
+    return;
+  }
+  this->peer_state_epoch_ = epoch;
+  for (auto &peer : this->peer_sensors_) {
+    const reliable::PeerState state = this->engine_.get_peer_state(peer.mac);
+    if (state != reliable::PEER_UNKNOWN) {
+      peer.sensor->publish_state(state == reliable::PEER_UP);
+    }
+  }
+#endif
+}
+
+void BasicESPNowEx::enter_deep_sleep() {
+  this->persist_rtc_state();
+  ESP_LOGI("basic_espnowex", "Awake for %lld ms, %u frames kept in RTC, sleeping %u ms",
+           esp_timer_get_time() / 1000, rtc_state.pending_count, this->sleep_duration_ms_);
+  esp_sleep_enable_timer_wakeup(uint64_t(this->sleep_duration_ms_) * 1000);
+  esp_deep_sleep_start();
+}
+
+bool BasicESPNowEx::ensure_peer(const uint8_t *mac) {
+  if (esp_now_is_peer_exist(mac)) {
+    return true;
+  }
+  ESP_LOGD("basic_espnowex", "Peer not registered, adding...");
+  esp_now_peer_info_t peer_info = {};
+  memcpy(peer_info.peer_addr, mac, 6);
+  peer_info.channel = 0;  // bieżący kanał WiFi
+  peer_info.encrypt = false;
+  esp_err_t add_status = esp_now_add_peer(&peer_info);
+  if (add_status != ESP_OK) {
+    ESP_LOGE("basic_espnowex", "Failed to add peer: %s", esp_err_to_name(add_status));
+    return false;
+  }
+  this->rate_control_.on_peer_added(mac);
+  if (this->deep_sleep_mode_ && rtc_state.peer_count < RTC_MAX_PEERS) {
+    auto known = std::find_if(rtc_state.peers, rtc_state.peers + rtc_state.peer_count,
+                              [mac](const uint8_t *p) { return memcmp(p, mac, 6) == 0; });
+    if (known == rtc_state.peers + rtc_state.peer_count) {
+      memcpy(rtc_state.peers[rtc_state.peer_count++], mac, 6);
+    }
+  }
+  return true;
 }
 
 void BasicESPNowEx::on_wifi_event(esp_event_base_t base, int32_t id, void* data) {
@@ -90,26 +276,20 @@ void BasicESPNowEx::on_wifi_event(esp_event_base_t base, int32_t id, void* data)
     esp_now_init();
     esp_now_register_recv_cb(&BasicESPNowEx::recv_cb);
     esp_now_register_send_cb(&BasicESPNowEx::send_cb);
+    this->rate_control_.on_peers_cleared();
   
     // Ponowna inicjalizacja peerów
-    esp_now_peer_info_t peer = {};
-    memcpy(peer.peer_addr, this->peer_mac_.data(), 6);
-    peer.channel = 0; // Kanał będzie aktualizowany dynamicznie
-    peer.encrypt = false;
-  
-    if (!esp_now_is_peer_exist(peer.peer_addr)) {
-      esp_now_add_peer(&peer);
-    }
+    this->ensure_peer(this->peer_mac_.data());
   }
 }
 void BasicESPNowEx::set_peer_mac(std::array<uint8_t, 6> mac) {
   this->peer_mac_ = mac;
 }
 void BasicESPNowEx::set_max_retries(uint8_t max_retries_) {
-  this->max_retries = max_retries_;
+  this->engine_.set_max_retries(max_retries_);
 }
 void BasicESPNowEx::set_timeout_us(int64_t timeout_us_) {
-  this->timeout_us = timeout_us_*1000;
+  this->engine_.set_timeout_us(timeout_us_*1000);
 }
 void BasicESPNowEx::send_broadcast(const std::vector<uint8_t> &msg) {
   uint8_t broadcast[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
@@ -127,264 +307,173 @@ void BasicESPNowEx::send_broadcast_str(const std::string &message) {
   }
 }
 
-void BasicESPNowEx::send_to_peer(const std::vector<uint8_t> &msg) {
-  this->send_espnow(msg, this->peer_mac_);
+EnqueueResult BasicESPNowEx::send_to_peer(const std::vector<uint8_t> &msg, uint8_t priority, QoS qos) {
+  return this->send_espnow(msg, this->peer_mac_, priority, qos);
 }
 
-void BasicESPNowEx::send_to_peer_str(const std::string &message) {
+EnqueueResult BasicESPNowEx::send_to_peer_str(const std::string &message, uint8_t priority, QoS qos) {
   std::vector<uint8_t> msg(message.begin(), message.end());
-  this->send_espnow(msg, this->peer_mac_);
+  return this->send_espnow(msg, this->peer_mac_, priority, qos);
 }
 
-void BasicESPNowEx::send_espnow_str(std::string message, const std::array<uint8_t, 6> &peer_mac) {
+EnqueueResult BasicESPNowEx::send_espnow_str(std::string message, const std::array<uint8_t, 6> &peer_mac, uint8_t priority,
+                                             QoS qos) {
   std::vector<uint8_t> msg(message.begin(), message.end());
-  this->send_espnow(msg, peer_mac);
-}
-void BasicESPNowEx::send_espnow_cmd(int16_t cmd, const std::array<uint8_t, 6> &peer_mac) {
-    std::vector<uint8_t> msg(4);
-    msg[0] = static_cast<uint8_t>((cmd >> 8) & 0xFF);
-    msg[1] = static_cast<uint8_t>(cmd & 0xFF);
-    msg[2] = msg[0];
-    msg[3] = msg[1];
-    if (xSemaphoreTake(this->queue_mutex_, portMAX_DELAY) == pdTRUE) {
-        auto it = std::find_if(
-            this->pending_messages_.begin(),
-            this->pending_messages_.end(),
-            [&](PendingMessage& m) {
-                // warunek 1: ten sam peer_mac
-                if (m.mac != peer_mac)
-                    return false;
-                // warunek 2: niezaakceptowana wiadomość
-                if (m.acked)
-                    return false;
-                // warunek 3: payload ma dokładnie 8 bajtów
-                if (m.payload.size() != 8)
-                    return false;
-                // warunek 4: bajty 5-8 payloadu są identyczne jak msg
-                // (zakładamy, że msg ma co najmniej 4 bajty)
-                return std::equal(m.payload.begin() + 4, m.payload.begin() + 8, msg.begin());
-            }
-        );
-	bool should_send = false;
-        if (it != this->pending_messages_.end()) {
-            it->peer_add_attempts = 0;
-            it->retry_count = 0;
-            it->timestamp = esp_timer_get_time();
-            // nie wysyłamy ponownie
-        } else {
-            should_send = true;
-        }
-        xSemaphoreGive(this->queue_mutex_);
-	if (should_send) {
-    		this->send_espnow(msg, peer_mac);
-	}
-    }
+  return this->send_espnow(msg, peer_mac, priority, qos);
+}
+EnqueueResult BasicESPNowEx::send_espnow_cmd(int16_t cmd, const std::array<uint8_t, 6> &peer_mac, uint8_t priority,
+                                             QoS qos) {
+  return this->engine_.send_cmd(cmd, peer_mac, priority, qos);
+}
+
+EnqueueResult BasicESPNowEx::send_latest(uint16_t key, const std::vector<uint8_t> &msg,
+                                         const std::array<uint8_t, 6> &peer_mac, uint8_t priority) {
+  return this->engine_.send_latest(key, msg, peer_mac, priority);
+}
+
+EnqueueResult BasicESPNowEx::send_latest_str(const std::string &key, const std::string &message,
+                                             const std::array<uint8_t, 6> &peer_mac, uint8_t priority) {
+  std::vector<uint8_t> msg(message.begin(), message.end());
+  return this->send_latest(topic_hash(key), msg, peer_mac, priority);
 }
 
 void BasicESPNowEx::clear_pending_messages() {
-    if (xSemaphoreTake(this->queue_mutex_, portMAX_DELAY) == pdTRUE) {
-        this->pending_messages_.clear(); // Usuwa wszystkie elementy z kolejki
-        xSemaphoreGive(this->queue_mutex_);
-    }
+  this->engine_.clear();
 }
 
 size_t BasicESPNowEx::get_pending_count() {
-    size_t count = 0;
-    if (xSemaphoreTake(this->queue_mutex_, portMAX_DELAY) == pdTRUE) {
-        count = this->pending_messages_.size();
-        xSemaphoreGive(this->queue_mutex_);
-    }
-    return count;
+  return this->engine_.pending_count();
 }
 
-void BasicESPNowEx::send_espnow(const std::vector<uint8_t>& msg, const std::array<uint8_t, 6>& peer_mac) {
-  
-  if (xSemaphoreTake(this->queue_mutex_, portMAX_DELAY) == pdTRUE) {
-  
-	PendingMessage pending;
-	pending.mac = peer_mac;
-	pending.message_id = this->generate_message_id();
-	pending.peer_add_attempts = 0;
-	pending.retry_count = 0;
-	pending.timestamp = esp_timer_get_time();
-	pending.acked = false;
-	// Dodanie nagłówka 0x00 + message_id
-        pending.payload.reserve(4 + msg.size());
-        pending.payload.push_back(0x00);
-        pending.payload.insert(pending.payload.end(), pending.message_id.begin(), pending.message_id.end());
-        pending.payload.insert(pending.payload.end(), msg.begin(), msg.end());
-  
-  	pending_messages_.push_back(pending);
-    	xSemaphoreGive(this->queue_mutex_);
-  }
-  process_send_queue();
+EnqueueResult BasicESPNowEx::send_espnow(const std::vector<uint8_t>& msg, const std::array<uint8_t, 6>& peer_mac,
+                                         uint8_t priority, QoS qos) {
+  return this->engine_.send(msg, peer_mac, priority, qos);
+}
+
+EnqueueResult BasicESPNowEx::publish(uint16_t topic, const std::vector<uint8_t> &msg,
+                                     const std::array<uint8_t, 6> &peer_mac, uint8_t priority, QoS qos) {
+  return this->engine_.publish(topic, msg, peer_mac, priority, qos);
+}
+
+EnqueueResult BasicESPNowEx::publish(const std::string &topic, const std::vector<uint8_t> &msg,
+                                     const std::array<uint8_t, 6> &peer_mac, uint8_t priority, QoS qos) {
+  return this->publish(topic_hash(topic), msg, peer_mac, priority, qos);
+}
+
+EnqueueResult BasicESPNowEx::publish_str(const std::string &topic, const std::string &message,
+                                         const std::array<uint8_t, 6> &peer_mac, uint8_t priority, QoS qos) {
+  std::vector<uint8_t> msg(message.begin(), message.end());
+  return this->publish(topic_hash(topic), msg, peer_mac, priority, qos);
+}
+
+EnqueueResult BasicESPNowEx::publish_to_peer_str(const std::string &topic, const std::string &message, uint8_t priority,
+                                                 QoS qos) {
+  return this->publish_str(topic, message, this->peer_mac_, priority, qos);
 }
 
 void BasicESPNowEx::process_send_queue() {
-  const int64_t now = esp_timer_get_time();
-
-  // Lock
-  if (xSemaphoreTake(this->queue_mutex_, 0) == pdTRUE) {
-	  // Usuń potwierdzone lub przekroczone limity czasu
-	  this->pending_messages_.erase(
-	    std::remove_if(this->pending_messages_.begin(), this->pending_messages_.end(),
-	      [now, this](const PendingMessage& m) {
-	        return m.acked || ((now - m.timestamp) > this->timeout_us && m.retry_count >= this->max_retries);
-	      }),
-	    this->pending_messages_.end());
-	
-	  for (auto& msg : this->pending_messages_) {
-	    if (!msg.acked && (now - msg.timestamp) > this->timeout_us && msg.retry_count < this->max_retries) {
-
-		// Sprawdź czy peer istnieje
-                if (!esp_now_is_peer_exist(msg.mac.data())) {
-                    ESP_LOGD("basic_espnowex", "Peer not registered, adding...");
-                    esp_now_peer_info_t peer_info = {};
-                    memcpy(peer_info.peer_addr, msg.mac.data(), 6);
-                    // Pobierz aktualny kanał WiFi
-                    ///uint8_t current_channel;
-                    //esp_wifi_get_channel(&current_channel, nullptr);
-                    peer_info.channel = 0; //current_channel;
-                    peer_info.encrypt = false;
-                    
-                    esp_err_t add_status = esp_now_add_peer(&peer_info);
-                    if (add_status != ESP_OK) {
-                        ESP_LOGE("basic_espnowex", "Failed to add peer: %s", esp_err_to_name(add_status));
-			msg.peer_add_attempts++;
-			if (msg.peer_add_attempts > 3) {
-				msg.acked = true; // Wymuszenie usunięcia z kolejki
-			}
-                        continue; // Pominięcie wysyłki przy błędzie
-                    }
-                }
-		    
-	      esp_err_t result = esp_now_send(msg.mac.data(), msg.payload.data(), msg.payload.size());
-	      if (result == ESP_OK) {
-	        msg.retry_count++;
-	        msg.timestamp = now;
-	        ESP_LOGD("basic_espnowex", "Retransmit to %02X:%02X:%02X:%02X:%02X:%02X, ID %02X%02X%02X, attempt %d",
-	                 msg.mac[0], msg.mac[1], msg.mac[2], msg.mac[3], msg.mac[4], msg.mac[5], msg.message_id[0], msg.message_id[1], msg.message_id[2], msg.retry_count);
-	        }
-	      }
-	    }
-	  xSemaphoreGive(this->queue_mutex_);
+  this->engine_.process_queue();
+}
+
+size_t EspNowTransport::encode_header(uint8_t *out, const Address &, const reliable::FrameHeader &header) {
+  out[0] = reliable::encode_frame_type(header);
+  std::copy(header.id.begin(), header.id.end(), out + 1);
+  if (header.type == reliable::FRAME_ACK && header.credits != reliable::NO_CREDITS) {
+    out[4] = header.credits;
+    return FRAME_HEADER_SIZE + 1;
+  }
+  if (header.type != reliable::FRAME_TOPIC) {
+    return FRAME_HEADER_SIZE;
+  }
+  out[4] = header.topic >> 8;
+  out[5] = header.topic & 0xFF;
+  return TOPIC_HEADER_SIZE;
+}
+
+size_t EspNowTransport::decode_header(const uint8_t *data, size_t len, Address &, reliable::FrameHeader &header) {
+  // Nadawca pochodzi z warstwy łącza (recv_cb) - nagłówek ESP-NOW nie zawiera adresu
+  if (len < FRAME_HEADER_SIZE) {
+    return 0;
+  }
+  if (!reliable::decode_frame_type(data[0], header)) {
+    return 0;
+  }
+  header.id = {data[1], data[2], data[3]};
+  switch (header.type) {
+    case reliable::FRAME_ACK:
+      // Opcjonalny bajt kredytów - odbiorca z kontrolą przepływu
+      if (len == FRAME_HEADER_SIZE + 1) {
+        header.credits = data[4];
+        return len;
+      }
+      return len == FRAME_HEADER_SIZE ? FRAME_HEADER_SIZE : 0;
+    case reliable::FRAME_REC:
+    case reliable::FRAME_REL:
+    case reliable::FRAME_COMP:
+      return len == FRAME_HEADER_SIZE ? FRAME_HEADER_SIZE : 0;
+    case reliable::FRAME_DATA:
+      return len > FRAME_HEADER_SIZE ? FRAME_HEADER_SIZE : 0;
+    case reliable::FRAME_TOPIC:
+      if (len < TOPIC_HEADER_SIZE) {
+        return 0;
+      }
+      header.topic = (data[4] << 8) | data[5];
+      return TOPIC_HEADER_SIZE;
+    default:
+      return 0;
   }
 }
 
-std::array<uint8_t, 3> BasicESPNowEx::generate_message_id() {
-    uint32_t random_part = esp_random();
-    int64_t timestamp = esp_timer_get_time();
-    return {
-        static_cast<uint8_t>((random_part ^ timestamp) & 0xFF),
-        static_cast<uint8_t>((random_part >> 8 ^ timestamp >> 8) & 0xFF),
-        static_cast<uint8_t>((random_part >> 16 ^ timestamp >> 16) & 0xFF)
-    };
+bool EspNowTransport::send(const Address &peer, const uint8_t *frame, size_t len) {
+  if (!this->parent->ensure_peer(peer.data())) {
+    return false;
+  }
+  return esp_now_send(peer.data(), frame, len) == ESP_OK;
 }
 
+void EspNowTransport::send_ack(const Address &peer, const uint8_t *frame, size_t len) {
+  this->parent->ensure_peer(peer.data());
+  esp_now_send(peer.data(), frame, len);
+}
+
+#ifdef ESPNOWEX_HAS_RECV_INFO
+void BasicESPNowEx::recv_cb(const esp_now_recv_info_t *info, const uint8_t *data, int len) {
+  if (!instance_ || !info || !info->src_addr || !data || len < 1) return;
+  const uint8_t *mac = info->src_addr;
+  if (info->rx_ctrl != nullptr) {
+    instance_->rate_control_.on_rx(mac, info->rx_ctrl->rssi);
+  }
+#else
 void BasicESPNowEx::recv_cb(const uint8_t *mac, const uint8_t *data, int len) {
-	if (!instance_ || !mac || !data || len < 1) return;
-	std::array<uint8_t, 6> sender_mac;
-	std::copy_n(mac, 6, sender_mac.begin());
-
-	// Obsługa ACK (4 bajty: 0x01 + message_id)
-	if (len == 4 && data[0] == 0x01) {
-        	std::array<uint8_t, 3> ack_id{data[1], data[2], data[3]};
-		bool should_handle_ack = false;
-        	if (xSemaphoreTake(instance_->queue_mutex_, portMAX_DELAY) == pdTRUE) {
-            		auto it = std::find_if(instance_->pending_messages_.begin(), instance_->pending_messages_.end(),
-	                [&](const PendingMessage& m) {
-	                    return memcmp(m.mac.data(), sender_mac.data(), 6) == 0 &&
-	                           m.message_id == ack_id;
-	                });
-	            if (it != instance_->pending_messages_.end()) {
-			if (!it->acked){
-	                	it->acked = true;
-	                	ESP_LOGD("basic_espnowex", "ACK received for message %02X%02X%02X", ack_id[0], ack_id[1], ack_id[2]);
-				should_handle_ack = true;
-	            	}
-		    }
-	            xSemaphoreGive(instance_->queue_mutex_);
-        	}
-		if (should_handle_ack) {
-    			instance_->on_recv_ack_callback_.call(sender_mac, ack_id);
-		}
-        	return;
-    	}
-	// Walidacja podstawowej wiadomości
-	if (len < 5 || data[0] != 0x00) {
-		ESP_LOGE("basic_espnowex", "Invalid message format");
-		return;
-	}	
-	// Wysyłanie ACK
-	std::array<uint8_t, 3> msg_id{data[1], data[2], data[3]};
-	std::vector<uint8_t> ack_packet{0x01, msg_id[0], msg_id[1], msg_id[2]};
-	if (!esp_now_is_peer_exist(sender_mac.data())) {
-		esp_now_peer_info_t peer_info = {};
-		memcpy(peer_info.peer_addr, sender_mac.data(), 6);
-		peer_info.channel = 0;
-		peer_info.encrypt = false;
-		esp_now_add_peer(&peer_info);
-	}
-	esp_now_send(sender_mac.data(), ack_packet.data(), ack_packet.size());
-
-	int64_t now = esp_timer_get_time();
-	bool is_duplicate = false;
-	// Mutex chroniący dostęp do historii
-	if (xSemaphoreTake(instance_->history_mutex_, portMAX_DELAY) == pdTRUE) {
-		// Usuń stare wpisy (>300s)
-		auto &history = instance_->received_history_;
-		
-		history.erase(
-			std::remove_if(history.begin(), history.end(),
-			[now](const ReceivedMessageInfo &info) {
-		          return (now - info.timestamp) > 300000000; // 300s
-			}),
-		      history.end());
-	
-		is_duplicate = std::any_of(history.begin(), history.end(),
-			[&](const ReceivedMessageInfo &info) {
-			return info.mac == sender_mac &&
-				info.data.size() == len &&
-				std::equal(info.data.begin(), info.data.end(), data);
-		});
-	
-		if (!is_duplicate) {
-			constexpr size_t MAX_HISTORY_SIZE = 1000;
-			if (history.size() >= MAX_HISTORY_SIZE) {
-				history.erase(history.begin());
-			}
-			history.push_back({sender_mac, now, std::vector<uint8_t>(data, data + len)});
-		}
-	
-		xSemaphoreGive(instance_->history_mutex_);
-	}
-	
-	if (is_duplicate) {
-		return;
-	}
-
-	// 4. Przetwarzanie payloadu po usunięciu nagłówka
-	 std::vector<uint8_t> payload(data + 4, data + len);
-
-	// 5. Dekodowanie komendy (jeśli payload ma dokładnie 4 bajty i pierwszy dwój jest taki sam jak ostatni dwój)
-	if (payload.size() == 4 && memcmp(payload.data(), payload.data() + 2, 2) == 0) {
-		int16_t cmd = (payload[0] << 8) | payload[1]; // Big-endian
-		instance_->on_recv_cmd_callback_.call(sender_mac, cmd);
-		ESP_LOGD("basic_espnowex", "CMD received for message...");
-	}
-	
-	// 6. Przekazanie danych i wiadomości tekstowej
-	instance_->on_recv_data_callback_.call(sender_mac, payload);  
-	if (!payload.empty()) {
-		std::string msg(payload.begin(), payload.end());
-		instance_->on_message_callback_.call(sender_mac, msg);
-	}
+  if (!instance_ || !mac || !data || len < 1) return;
+#endif
+  // Ramki rozsyłania obrazu omijają silnik - bez ACK, bez historii duplikatów
+  switch (data[0]) {
+    case IMG_OFFER:
+      instance_->image_receiver_.on_offer(mac, data, len);
+      return;
+    case IMG_BLOCK:
+      instance_->image_receiver_.on_block(data, len);
+      return;
+    case IMG_NACK:
+      instance_->image_sender_.on_nack(mac, data, len);
+      return;
+    default:
+      break;
+  }
+  std::array<uint8_t, 6> sender_mac;
+  std::copy_n(mac, 6, sender_mac.begin());
+  instance_->engine_.on_frame(sender_mac, data, len);
 }
 
 void BasicESPNowEx::send_cb(const uint8_t *mac, esp_now_send_status_t status) {
+  RELIABLE_TRACE(reliable::trace::SRC_ESPNOW, EV_SEND_DONE, mac, nullptr, status, 0, 0);
   ESP_LOGD("basic_espnowex", "Send to %02X:%02X:%02X:%02X:%02X:%02X %s",
            mac[0], mac[1], mac[2], mac[3], mac[4], mac[5],
            status == ESP_NOW_SEND_SUCCESS ? "succeeded" : "failed");
+  if (instance_ && mac) {
+    instance_->rate_control_.on_tx_done(mac, status == ESP_NOW_SEND_SUCCESS);
+  }
 }
 
 OnMessageTrigger::OnMessageTrigger(BasicESPNowEx *parent) {
@@ -408,12 +497,21 @@ OnRecvDataTrigger::OnRecvDataTrigger(BasicESPNowEx *parent) {
     });
 }
 
+OnTopicTrigger::OnTopicTrigger(BasicESPNowEx *parent, uint16_t topic) {
+    parent->add_on_topic_callback(topic, [this](const std::array<uint8_t, 6> mac, const std::vector<uint8_t> dt) {
+        trigger(mac, dt);
+    });
+}
+
+OnImageCompleteTrigger::OnImageCompleteTrigger(BasicESPNowEx *parent) {
+    parent->add_on_image_complete_callback([this](uint32_t size, uint32_t crc32) {
+        trigger(size, crc32);
+    });
+}
+
 BasicESPNowEx::~BasicESPNowEx() {
   esp_timer_stop(this->retry_timer_);
   esp_timer_delete(this->retry_timer_);
-  // Usuń semafor
-  vSemaphoreDelete(this->queue_mutex_);
-  vSemaphoreDelete(this->history_mutex_);
 }
 
 }  // namespace espnow
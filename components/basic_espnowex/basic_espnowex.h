@@ -2,8 +2,20 @@
 
 #include "esphome/core/component.h"
 #include "esphome/core/automation.h"
+#include "esphome/components/basic_reliable/reliable_engine.h"
+#include "esphome/components/basic_reliable/freertos_mutex.h"
+#include "esphome/components/basic_reliable/exactly_once_store.h"
+#include "esphome/components/basic_reliable/message_schema.h"
+#include "esphome/components/basic_reliable/send_action.h"
+#include "image_distribution.h"
+#include "rate_control.h"
+
+#ifdef USE_BINARY_SENSOR
+#include "esphome/components/binary_sensor/binary_sensor.h"
+#endif
 #include "esp_now.h"
 #include "esp_timer.h"
+#include "esp_random.h"
 
 // FreeRTOS
 #include "freertos/FreeRTOS.h"
@@ -14,27 +26,44 @@
 #include <string>
 #include <chrono>
 #include <algorithm>
+#include <functional>
 
 namespace esphome {
 namespace espnow {
 
-struct PendingMessage {
-  std::array<uint8_t, 6> mac;
-  std::array<uint8_t, 3> message_id;
-  uint8_t peer_add_attempts;
-  uint8_t retry_count;
-  int64_t timestamp;
-  bool acked;
-  std::vector<uint8_t> payload;
-};
-struct ReceivedMessageInfo {
-    std::array<uint8_t, 6> mac;
-    int64_t timestamp;
-    std::vector<uint8_t> data;
-};
+using reliable::EnqueueResult;
+using reliable::MessageId;
+using reliable::OverflowPolicy;
+using reliable::QoS;
+using reliable::topic_hash;
+
+// Rozmiar nagłówka: typ(1) + message_id(3) [+ temat(2) dla FRAME_TOPIC]
+static const size_t FRAME_HEADER_SIZE = 4;
+static const size_t TOPIC_HEADER_SIZE = FRAME_HEADER_SIZE + 2;
 
 class BasicESPNowEx;
 
+// Polityka transportu ESP-NOW dla reliable::ReliableEngine
+struct EspNowTransport {
+  using Address = std::array<uint8_t, 6>;
+  using Mutex = reliable::FreeRtosMutex;
+  static constexpr size_t MTU = ESP_NOW_MAX_DATA_LEN;
+  static constexpr size_t MAX_HEADER_SIZE = TOPIC_HEADER_SIZE;
+  static constexpr const char *TAG = "basic_espnowex";
+#ifdef USE_RELIABLE_TRACE
+  static constexpr uint8_t TRACE_SOURCE = reliable::trace::SRC_ESPNOW;
+#endif
+
+  static int64_t now_us() { return esp_timer_get_time(); }
+  static uint32_t random32() { return esp_random(); }
+  static size_t encode_header(uint8_t *out, const Address &peer, const reliable::FrameHeader &header);
+  static size_t decode_header(const uint8_t *data, size_t len, Address &peer, reliable::FrameHeader &header);
+  bool send(const Address &peer, const uint8_t *frame, size_t len);
+  void send_ack(const Address &peer, const uint8_t *frame, size_t len);
+  int64_t min_ack_timeout_us(const Address &, size_t) { return 0; }
+
+  BasicESPNowEx *parent;
+};
 
 class OnMessageTrigger : public ::esphome::Trigger<std::array<uint8_t, 6>, std::string>, public Component {
   public:
@@ -52,11 +81,19 @@ class OnRecvDataTrigger : public ::esphome::Trigger<std::array<uint8_t, 6>, std:
   public:
     explicit OnRecvDataTrigger(BasicESPNowEx *parent);
 };
+class OnTopicTrigger : public ::esphome::Trigger<std::array<uint8_t, 6>, std::vector<uint8_t>>, public Component {
+  public:
+    OnTopicTrigger(BasicESPNowEx *parent, uint16_t topic);
+};
+class OnImageCompleteTrigger : public ::esphome::Trigger<uint32_t, uint32_t>, public Component {
+  public:
+    explicit OnImageCompleteTrigger(BasicESPNowEx *parent);
+};
 
 class BasicESPNowEx : public Component {
  public:
   void setup() override;
-  void loop() override {}
+  void loop() override;
 
   void on_wifi_event(esp_event_base_t base, int32_t id, void* data);
      
@@ -81,19 +118,156 @@ class BasicESPNowEx : public Component {
   }
   CallbackManager<void(std::array<uint8_t,6>, std::vector<uint8_t>)> on_recv_data_callback_;
 
+  // Subskrypcje tematów - posortowane po skrócie, wyszukiwanie binarne w recv_cb.
+  // Ramki FRAME_TOPIC trafiają wyłącznie do subskrybentów swojego tematu.
+  void add_on_topic_callback(uint16_t topic, std::function<void(std::array<uint8_t,6>, std::vector<uint8_t>)> &&cb) {
+    this->engine_.add_topic_callback(topic, std::move(cb));
+  }
+  bool has_topic_subscribers(uint16_t topic) const { return this->engine_.has_topic_subscribers(topic); }
+
   void set_peer_mac(std::array<uint8_t, 6> mac);
   void set_max_retries(uint8_t max_retries_);
   void set_timeout_us(int64_t timeout_us_);
+
+  // Tryb zoptymalizowany pod deep sleep: kanał, peery, RTT i niepotwierdzone ramki
+  // przechowywane w pamięci RTC, minimalna inicjalizacja radia po wybudzeniu.
+  void set_deep_sleep_mode(bool enabled) { this->deep_sleep_mode_ = enabled; }
+  void set_sleep_duration(uint32_t sleep_duration_ms) { this->sleep_duration_ms_ = sleep_duration_ms; }
+  void set_ack_deadline(uint32_t ack_deadline_ms) { this->ack_deadline_us_ = int64_t(ack_deadline_ms) * 1000; }
+  // Po ACK z flagą poczty węzeł czeka na nią mail_window od ostatniej ramki; poll_on_wake pyta
+  // bramkę o pocztę zaraz po starcie, także gdy nie ma nic do wysłania
+  void set_mail_window(uint32_t mail_window_ms) { this->engine_.set_mail_window_us(int64_t(mail_window_ms) * 1000); }
+  void set_poll_on_wake(bool poll_on_wake) { this->poll_on_wake_ = poll_on_wake; }
+  // Uśpienie po potwierdzeniu wszystkich ramek z kolejki i odebraniu poczty (lub po upływie ack_deadline)
+  void sleep_when_done(uint32_t sleep_duration_ms = 0);
   void send_broadcast(const std::vector<uint8_t> &msg);
   void send_broadcast_str(const std::string &message);
-  void send_to_peer(const std::vector<uint8_t> &msg);
-  void send_to_peer_str(const std::string &message);
-  void send_espnow_str(std::string message, const std::array<uint8_t, 6> &peer_mac);
-  void send_espnow(const std::vector<uint8_t> &msg, const std::array<uint8_t, 6> &peer_mac);
-  void send_espnow_cmd(int16_t cmd, const std::array<uint8_t, 6> &peer_mac);
+  // QoS: QOS_AT_MOST_ONCE - bez ACK i bez kolejki, QOS_AT_LEAST_ONCE - domyślny,
+  // QOS_EXACTLY_ONCE - dokładnie raz, także po restarcie odbiorcy (identyfikatory zapisane we flashu)
+  EnqueueResult send_to_peer(const std::vector<uint8_t> &msg, uint8_t priority = 0, QoS qos = reliable::QOS_AT_LEAST_ONCE);
+  EnqueueResult send_to_peer_str(const std::string &message, uint8_t priority = 0, QoS qos = reliable::QOS_AT_LEAST_ONCE);
+  EnqueueResult send_espnow_str(std::string message, const std::array<uint8_t, 6> &peer_mac, uint8_t priority = 0,
+                                QoS qos = reliable::QOS_AT_LEAST_ONCE);
+  EnqueueResult send_espnow(const std::vector<uint8_t> &msg, const std::array<uint8_t, 6> &peer_mac, uint8_t priority = 0,
+                            QoS qos = reliable::QOS_AT_LEAST_ONCE);
+  EnqueueResult send_espnow_cmd(int16_t cmd, const std::array<uint8_t, 6> &peer_mac, uint8_t priority = 0,
+                                QoS qos = reliable::QOS_AT_LEAST_ONCE);
+  // Akcje send/send_cmd z YAML (send_action.h): treść bez kopii pośrednich
+  EnqueueResult send_raw(const uint8_t *data, size_t len, const std::array<uint8_t, 6> &peer_mac, uint8_t priority,
+                         QoS qos) {
+    return this->engine_.send(data, len, peer_mac, priority, qos);
+  }
+  EnqueueResult publish_raw(uint16_t topic, const uint8_t *data, size_t len, const std::array<uint8_t, 6> &peer_mac,
+                            uint8_t priority, QoS qos) {
+    return this->engine_.publish(topic, data, len, peer_mac, priority, qos);
+  }
+  EnqueueResult send_cmd(int16_t cmd, const std::array<uint8_t, 6> &peer_mac, uint8_t priority, QoS qos) {
+    return this->send_espnow_cmd(cmd, peer_mac, priority, qos);
+  }
+  const std::array<uint8_t, 6> &get_peer_mac() const { return this->peer_mac_; }
+  // Wysyłka stanu "ostatnia wartość wygrywa": nowsza wiadomość z tym samym kluczem zastępuje
+  // niepotwierdzoną wiadomość w kolejce, więc retransmitowany jest tylko najnowszy stan.
+  EnqueueResult send_latest(uint16_t key, const std::vector<uint8_t> &msg, const std::array<uint8_t, 6> &peer_mac,
+                            uint8_t priority = 0);
+  EnqueueResult send_latest_str(const std::string &key, const std::string &message,
+                                const std::array<uint8_t, 6> &peer_mac, uint8_t priority = 0);
+  EnqueueResult publish(uint16_t topic, const std::vector<uint8_t> &msg, const std::array<uint8_t, 6> &peer_mac,
+                        uint8_t priority = 0, QoS qos = reliable::QOS_AT_LEAST_ONCE);
+  EnqueueResult publish(const std::string &topic, const std::vector<uint8_t> &msg,
+                        const std::array<uint8_t, 6> &peer_mac, uint8_t priority = 0,
+                        QoS qos = reliable::QOS_AT_LEAST_ONCE);
+  EnqueueResult publish_str(const std::string &topic, const std::string &message,
+                            const std::array<uint8_t, 6> &peer_mac, uint8_t priority = 0,
+                            QoS qos = reliable::QOS_AT_LEAST_ONCE);
+  EnqueueResult publish_to_peer_str(const std::string &topic, const std::string &message, uint8_t priority = 0,
+                                    QoS qos = reliable::QOS_AT_LEAST_ONCE);
+  // Wiadomości ze schematu YAML (messages:) - spakowane pola pod tematem Message::TOPIC, bez sterty
+  template<typename Message>
+  EnqueueResult send_message(const Message &msg, const std::array<uint8_t, 6> &peer_mac, uint8_t priority = 0,
+                             QoS qos = reliable::QOS_AT_LEAST_ONCE) {
+    uint8_t payload[Message::SIZE];
+    msg.encode(payload);
+    return this->engine_.publish(Message::TOPIC, payload, Message::SIZE, peer_mac, priority, qos);
+  }
+  template<typename Message>
+  EnqueueResult send_message_to_peer(const Message &msg, uint8_t priority = 0, QoS qos = reliable::QOS_AT_LEAST_ONCE) {
+    return this->send_message(msg, this->peer_mac_, priority, qos);
+  }
   void clear_pending_messages();
   size_t get_pending_count();
 
+  // Przejmowanie ramek (basic_bridge, basic_failover): handler zwraca true, jeśli przejął ramkę -
+  // wtedy nie jest ona potwierdzana ani dostarczana lokalnie, a ACK wysyła się przez acknowledge().
+  using ForwardHandler = std::function<bool(const std::array<uint8_t, 6> &, const reliable::FrameHeader &,
+                                            const uint8_t *, size_t)>;
+  void set_forward_handler(ForwardHandler &&handler) { this->forward_handler_ = std::move(handler); }
+  EnqueueResult send_frame(std::vector<uint8_t> &&frame, const std::array<uint8_t, 6> &peer_mac, uint8_t priority = 0) {
+    return this->engine_.enqueue_frame(std::move(frame), peer_mac, priority);
+  }
+  void acknowledge(const std::array<uint8_t, 6> &peer_mac, const MessageId &id, QoS qos = reliable::QOS_AT_LEAST_ONCE) {
+    this->engine_.acknowledge(peer_mac, id, qos);
+  }
+  bool is_pending(const std::array<uint8_t, 6> &peer_mac, const MessageId &id) { return this->engine_.is_pending(peer_mac, id); }
+  bool cancel(const std::array<uint8_t, 6> &peer_mac, const MessageId &id) { return this->engine_.cancel(peer_mac, id); }
+  MessageId generate_message_id() { return this->engine_.generate_message_id(); }
+
+  // Rozsyłanie obrazu (OTA) do wielu węzłów broadcastem z naprawą przez NACK - image_distribution.h.
+  // Bramka: reader czyta fragmenty obrazu (np. z partycji), węzeł: sink zapisuje bloki pod ich offsetem.
+  bool start_image_distribution(uint32_t size, uint32_t crc32, ImageReadHandler &&reader) {
+    return this->image_sender_.start(size, crc32, std::move(reader));
+  }
+  void abort_image_distribution() { this->image_sender_.abort(); }
+  bool is_image_distribution_active() const { return this->image_sender_.is_active(); }
+  void set_image_sink(ImageBeginHandler &&begin, ImageWriteHandler &&write) {
+    this->image_receiver_.set_sink(std::move(begin), std::move(write));
+  }
+  void add_on_image_complete_callback(std::function<void(uint32_t, uint32_t)> &&cb) {
+    this->image_receiver_.add_on_complete_callback(std::move(cb));
+  }
+  void set_image_block_size(uint16_t block_size) { this->image_sender_.set_block_size(block_size); }
+  void set_image_block_interval(uint32_t interval_ms) { this->image_sender_.set_block_interval(interval_ms); }
+  void set_image_nack_window(uint32_t window_ms) { this->image_sender_.set_nack_window(window_ms); }
+  void set_image_max_rounds(uint8_t max_rounds) { this->image_sender_.set_max_rounds(max_rounds); }
+  void set_image_expected_nodes(uint16_t expected_nodes) { this->image_sender_.set_expected_nodes(expected_nodes); }
+
+  // Dobór szybkości PHY per peer (RSSI + skuteczność dostarczenia) - rate_control.h
+  void set_rate_control(bool enabled) { this->rate_control_.set_enabled(enabled); }
+  void set_long_range(bool long_range) { this->rate_control_.set_long_range(long_range); }
+  void set_peer_rate(const std::array<uint8_t, 6> &peer_mac, PhyRate rate) { this->rate_control_.set_peer_rate(peer_mac, rate); }
+  PhyRate get_peer_rate(const std::array<uint8_t, 6> &peer_mac) { return this->rate_control_.get_peer_rate(peer_mac); }
+
+  // Limity kolejki wysyłkowej
+  void set_max_queue_messages(size_t max_messages) { this->engine_.set_max_queue_messages(max_messages); }
+  void set_max_queue_bytes(size_t max_bytes) { this->engine_.set_max_queue_bytes(max_bytes); }
+  void set_overflow_policy(OverflowPolicy policy) { this->engine_.set_overflow_policy(policy); }
+  size_t get_queue_high_water_mark() const { return this->engine_.get_queue_high_water_mark(); }
+  size_t get_queued_bytes() const { return this->engine_.get_queued_bytes(); }
+  uint32_t get_dropped_count() const { return this->engine_.get_dropped_count(); }
+
+  // Stan peerów (circuit breaker): po failure_threshold kolejnych transmisjach bez ACK ramki do
+  // peera czekają w kolejce (lub są odrzucane), a co probe_interval wychodzi jedna próba.
+  void set_peer_failure_threshold(uint8_t threshold) { this->engine_.set_peer_failure_threshold(threshold); }
+  void set_peer_probe_interval(uint32_t interval_ms) { this->engine_.set_peer_probe_interval_us(int64_t(interval_ms) * 1000); }
+  void set_peer_down_policy(reliable::PeerDownPolicy policy) { this->engine_.set_peer_down_policy(policy); }
+  // Kontrola przepływu: ramki dostarczane z loop(), wolne miejsca ogłaszane nadawcom w ACK
+  void set_receive_window(uint8_t window) { this->engine_.set_receive_window(window); }
+  // Skrzynka (bramka): ramki do śpiących peerów czekają na ich pobudkę zamiast przepadać po max_retries
+  void add_sleepy_peer(std::array<uint8_t, 6> peer_mac) { this->engine_.add_sleepy_peer(peer_mac); }
+  void set_mailbox_retention(uint32_t retention_ms) {
+    this->engine_.set_mailbox_retention_us(int64_t(retention_ms) * 1000);
+  }
+  void set_mailbox_capacity(uint8_t capacity) { this->engine_.set_mailbox_capacity(capacity); }
+  // Węzeł: zapytanie bramki (peer_mac) o pocztę bez wysyłania danych
+  EnqueueResult poll_mailbox() {
+    return this->engine_.publish(reliable::MAILBOX_POLL_TOPIC, nullptr, 0, this->peer_mac_);
+  }
+  reliable::PeerState get_peer_state(const std::array<uint8_t, 6> &peer_mac) { return this->engine_.get_peer_state(peer_mac); }
+#ifdef USE_BINARY_SENSOR
+  void add_peer_sensor(std::array<uint8_t, 6> peer_mac, binary_sensor::BinarySensor *sensor) {
+    this->peer_sensors_.push_back({peer_mac, sensor});
+  }
+#endif
+
   //void add_on_message_trigger(OnMessageTrigger *trigger);
   //void add_on_recv_ack_trigger(OnRecvAckTrigger *trigger);
   //void add_on_recv_cmd_trigger(OnRecvCmdTrigger *trigger);
@@ -101,21 +275,55 @@ class BasicESPNowEx : public Component {
   ~BasicESPNowEx();
 
  protected:
-  std::array<uint8_t, 3> generate_message_id();
+  friend class reliable::ReliableEngine<EspNowTransport, BasicESPNowEx>;
+  friend struct EspNowTransport;
+  friend class ImageSender;
+  friend class ImageReceiver;
+
   void process_send_queue();
-  std::vector<PendingMessage> pending_messages_;
-  std::vector<ReceivedMessageInfo> received_history_;
-  SemaphoreHandle_t queue_mutex_;
-  SemaphoreHandle_t history_mutex_;
+
+  // Zdarzenia z silnika (Sink)
+  bool on_engine_forward(const std::array<uint8_t, 6> &mac, const reliable::FrameHeader &header, const uint8_t *payload,
+                         size_t len) {
+    return this->forward_handler_ && this->forward_handler_(mac, header, payload, len);
+  }
+  void on_engine_ack(const std::array<uint8_t, 6> &mac, const MessageId &id) { this->on_recv_ack_callback_.call(mac, id); }
+  void on_engine_cmd(const std::array<uint8_t, 6> &mac, int16_t cmd) { this->on_recv_cmd_callback_.call(mac, cmd); }
+  void on_engine_data(const std::array<uint8_t, 6> &mac, const std::vector<uint8_t> &data) {
+    this->on_recv_data_callback_.call(mac, data);
+  }
+  void on_engine_message(const std::array<uint8_t, 6> &mac, const std::string &msg) {
+    this->on_message_callback_.call(mac, msg);
+  }
+
+  EspNowTransport transport_{this};
+  reliable::ReliableEngine<EspNowTransport, BasicESPNowEx> engine_{&this->transport_, this};
+  ForwardHandler forward_handler_;
+  reliable::ExactlyOnceStore<std::array<uint8_t, 6>> exactly_once_store_;
+  ImageSender image_sender_{this};
+  ImageReceiver image_receiver_{this};
+  RateControl rate_control_;
+
+#ifdef USE_BINARY_SENSOR
+  struct PeerSensor {
+    std::array<uint8_t, 6> mac;
+    binary_sensor::BinarySensor *sensor;
+  };
+  std::vector<PeerSensor> peer_sensors_;
+  uint32_t peer_state_epoch_{0};
+#endif
+  void update_peer_sensors();
 
   esp_timer_handle_t retry_timer_;
   static void static_wifi_event(void* arg, esp_event_base_t base, int32_t id, void* data);
+#ifdef ESPNOWEX_HAS_RECV_INFO
+  static void recv_cb(const esp_now_recv_info_t *info, const uint8_t *data, int len);
+#else
   static void recv_cb(const uint8_t *mac, const uint8_t *data, int len);
+#endif
   static void send_cb(const uint8_t *mac, esp_now_send_status_t status);
   void handle_msg(std::array<uint8_t, 6> &mac, std::string &msg);
 
-  int64_t timeout_us = 200 * 1000; // 200ms
-  uint8_t max_retries = 5;
   std::array<uint8_t, 6> peer_mac_{{0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF}};
   static BasicESPNowEx *instance_;
   //std::vector<OnMessageTrigger *> msg_triggers_;
@@ -125,6 +333,20 @@ class BasicESPNowEx : public Component {
   void handle_cmd(std::array<uint8_t, 6> &mac, int16_t cmd);
   //std::vector<OnRecvCmdTrigger *> cmd_triggers_;
   void handle_data(std::array<uint8_t, 6> &mac, std::vector<uint8_t> &dt);
+
+  bool ensure_peer(const uint8_t *mac);
+  void init_radio_minimal(uint8_t channel);
+  void enable_long_range();
+  void restore_rtc_state();
+  void persist_rtc_state();
+  void enter_deep_sleep();
+
+  bool deep_sleep_mode_{false};
+  bool sleep_requested_{false};
+  bool poll_on_wake_{false};
+  int64_t sleep_requested_at_{0};
+  uint32_t sleep_duration_ms_{60000};
+  int64_t ack_deadline_us_{30000};
   //std::vector<OnRecvDataTrigger *> data_triggers_;
   
 
@@ -0,0 +1,25 @@
+import esphome.codegen as cg
+import esphome.config_validation as cv
+from esphome.components import binary_sensor
+from esphome.const import CONF_MAC_ADDRESS, DEVICE_CLASS_CONNECTIVITY
+from . import BasicESPNowEx
+
+DEPENDENCIES = ["basic_espnowex"]
+
+CONF_BASIC_ESPNOWEX_ID = "basic_espnowex_id"
+
+# Dostępność peera według circuit breakera (peer_health) - jeden sensor na peera
+CONFIG_SCHEMA = binary_sensor.binary_sensor_schema(
+    device_class=DEVICE_CLASS_CONNECTIVITY,
+).extend({
+    cv.GenerateID(CONF_BASIC_ESPNOWEX_ID): cv.use_id(BasicESPNowEx),
+    cv.Required(CONF_MAC_ADDRESS): cv.mac_address,
+})
+
+
+async def to_code(config):
+    parent = await cg.get_variable(config[CONF_BASIC_ESPNOWEX_ID])
+    var = await binary_sensor.new_binary_sensor(config)
+    mac_ints = [int(x, 16) for x in config[CONF_MAC_ADDRESS].to_string().split(":")]
+    mac_expr = cg.RawExpression(f"std::array<uint8_t, 6>{{{', '.join(map(str, mac_ints))}}}")
+    cg.add(parent.add_peer_sensor(mac_expr, var))
@@ -0,0 +1,389 @@
+#include "image_distribution.h"
+#include "basic_espnowex.h"
+#include "esp_log.h"
+#include "esp_random.h"
+#include "esp_timer.h"
+
+#include <algorithm>
+#include <mutex>
+
+namespace esphome {
+namespace espnow {
+
+static const char *const TAG = "basic_espnowex.image";
+
+static const uint8_t BROADCAST_MAC[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+static const uint8_t ANNOUNCE_REPEATS = 3;
+static const int64_t ANNOUNCE_INTERVAL_US = 50000;
+static const uint8_t QUIET_ROUNDS_TO_FINISH = 3;  // zapytania bez żadnego NACK z brakami
+
+static inline uint16_t get_u16(const uint8_t *p) { return (p[0] << 8) | p[1]; }
+static inline uint32_t get_u32(const uint8_t *p) {
+  return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | p[3];
+}
+static inline void put_u16(uint8_t *p, uint16_t v) {
+  p[0] = v >> 8;
+  p[1] = v & 0xFF;
+}
+static inline void put_u32(uint8_t *p, uint32_t v) {
+  p[0] = v >> 24;
+  p[1] = (v >> 16) & 0xFF;
+  p[2] = (v >> 8) & 0xFF;
+  p[3] = v & 0xFF;
+}
+
+// ---------------------------------------------------------------- bramka
+
+bool ImageSender::start(uint32_t size, uint32_t crc32, ImageReadHandler &&reader) {
+  const uint32_t block_count = (size + this->block_size_ - 1) / this->block_size_;
+  if (size == 0 || block_count > 0xFFFF || !reader) {
+    ESP_LOGE(TAG, "Cannot distribute image of %u bytes in %u-byte blocks", size, this->block_size_);
+    return false;
+  }
+  this->parent_->ensure_peer(BROADCAST_MAC);
+
+  std::lock_guard<reliable::FreeRtosMutex> lock(this->mutex_);
+  this->reader_ = std::move(reader);
+  this->session_ = static_cast<uint16_t>(esp_random() | 1);  // 0 = brak sesji po stronie węzła
+  this->size_ = size;
+  this->crc32_ = crc32;
+  this->block_count_ = block_count;
+  this->to_send_.assign((block_count + 7) / 8, 0xFF);
+  if (block_count & 7) {
+    this->to_send_.back() = (1 << (block_count & 7)) - 1;
+  }
+  this->cursor_ = 0;
+  this->round_ = 0;
+  this->announce_left_ = ANNOUNCE_REPEATS;
+  this->quiet_rounds_ = 0;
+  this->blocks_sent_ = 0;
+  this->done_nodes_.clear();
+  this->next_action_ = 0;
+  this->state_ = STATE_ANNOUNCE;
+  ESP_LOGI(TAG, "Distributing image: %u bytes, %u blocks, session %04X", size, block_count, this->session_);
+  return true;
+}
+
+void ImageSender::abort() {
+  std::lock_guard<reliable::FreeRtosMutex> lock(this->mutex_);
+  this->finish(false);
+}
+
+void ImageSender::finish(bool complete) {
+  if (this->state_ == STATE_IDLE) {
+    return;
+  }
+  ESP_LOGI(TAG, "Image session %04X %s after %u polls: %u block transmissions for %u blocks, %u nodes reported done",
+           this->session_, complete ? "finished" : "stopped", this->round_, this->blocks_sent_, this->block_count_,
+           this->done_nodes_.size());
+  this->state_ = STATE_IDLE;
+  this->to_send_.clear();
+  this->to_send_.shrink_to_fit();
+  this->reader_ = nullptr;
+}
+
+void ImageSender::poll(int64_t now) {
+  if (this->round_ >= this->max_rounds_) {
+    this->finish(false);
+    return;
+  }
+  this->send_offer(++this->round_);
+  this->next_action_ = now + int64_t(this->nack_window_ms_) * 1000;
+}
+
+bool ImageSender::send_offer(uint8_t round) {
+  uint8_t frame[IMG_OFFER_SIZE];
+  frame[0] = IMG_OFFER;
+  put_u16(frame + 1, this->session_);
+  put_u32(frame + 3, this->size_);
+  put_u16(frame + 7, this->block_size_);
+  put_u32(frame + 9, this->crc32_);
+  frame[13] = round;
+  put_u16(frame + 14, this->nack_window_ms_);
+  return esp_now_send(BROADCAST_MAC, frame, sizeof(frame)) == ESP_OK;
+}
+
+bool ImageSender::send_block(uint16_t index) {
+  uint8_t frame[ESP_NOW_MAX_DATA_LEN];
+  const uint32_t offset = uint32_t(index) * this->block_size_;
+  const size_t len = std::min<uint32_t>(this->block_size_, this->size_ - offset);
+  if (!this->reader_(offset, frame + IMG_BLOCK_HEADER_SIZE, len)) {
+    ESP_LOGE(TAG, "Image read failed at offset %u", offset);
+    return false;
+  }
+  frame[0] = IMG_BLOCK;
+  put_u16(frame + 1, this->session_);
+  put_u16(frame + 3, index);
+  return esp_now_send(BROADCAST_MAC, frame, IMG_BLOCK_HEADER_SIZE + len) == ESP_OK;
+}
+
+void ImageSender::loop() {
+  if (this->state_ == STATE_IDLE) {
+    return;
+  }
+  const int64_t now = esp_timer_get_time();
+  if (now < this->next_action_) {
+    return;
+  }
+  std::lock_guard<reliable::FreeRtosMutex> lock(this->mutex_);
+
+  switch (this->state_) {
+    case STATE_ANNOUNCE:
+      if (this->send_offer(0) && --this->announce_left_ == 0) {
+        this->state_ = STATE_SENDING;
+      }
+      this->next_action_ = now + ANNOUNCE_INTERVAL_US;
+      break;
+
+    case STATE_SENDING: {
+      // Następny zaznaczony blok od kursora; bloki dopisane przez NACK za kursorem trafią do tego przebiegu
+      while (this->cursor_ < this->block_count_ &&
+             !(this->to_send_[this->cursor_ >> 3] & (1 << (this->cursor_ & 7)))) {
+        this->cursor_++;
+      }
+      if (this->cursor_ >= this->block_count_) {
+        this->quiet_rounds_ = 0;
+        this->state_ = STATE_POLLING;
+        this->poll(now);
+        break;
+      }
+      // Błąd wysyłki (np. pełna kolejka ESP-NOW) - ten sam blok w następnym kroku
+      if (this->send_block(this->cursor_)) {
+        this->to_send_[this->cursor_ >> 3] &= ~(1 << (this->cursor_ & 7));
+        this->blocks_sent_++;
+        this->cursor_++;
+      }
+      this->next_action_ = now + this->block_interval_us_;
+      break;
+    }
+
+    case STATE_POLLING: {
+      const bool pending = std::any_of(this->to_send_.begin(), this->to_send_.end(), [](uint8_t b) { return b != 0; });
+      if (pending) {
+        this->cursor_ = 0;
+        this->state_ = STATE_SENDING;
+        ESP_LOGD(TAG, "Poll %u: repairing missing blocks", this->round_);
+        break;
+      }
+      if (this->expected_nodes_ != 0 ? this->done_nodes_.size() >= this->expected_nodes_
+                                     : ++this->quiet_rounds_ >= QUIET_ROUNDS_TO_FINISH) {
+        this->finish(true);
+        return;
+      }
+      // Cisza po zapytaniu - powtórka na wypadek zgubionych zapytań lub NACK
+      this->poll(now);
+      break;
+    }
+
+    default:
+      break;
+  }
+}
+
+void ImageSender::on_nack(const uint8_t *mac, const uint8_t *data, size_t len) {
+  if (len < IMG_NACK_HEADER_SIZE || this->state_ == STATE_IDLE) {
+    return;
+  }
+  std::lock_guard<reliable::FreeRtosMutex> lock(this->mutex_);
+  if (get_u16(data + 1) != this->session_) {
+    return;
+  }
+  const size_t ranges = std::min<size_t>(data[3], (len - IMG_NACK_HEADER_SIZE) / 4);
+  if (data[3] == 0) {
+    std::array<uint8_t, 6> node;
+    std::copy_n(mac, 6, node.begin());
+    if (std::find(this->done_nodes_.begin(), this->done_nodes_.end(), node) == this->done_nodes_.end()) {
+      this->done_nodes_.push_back(node);
+      ESP_LOGD(TAG, "%02X:%02X:%02X:%02X:%02X:%02X has the complete image", mac[0], mac[1], mac[2], mac[3], mac[4],
+               mac[5]);
+    }
+    return;
+  }
+  // Suma zakresów od wszystkich węzłów - każdy brakujący blok nadany raz na rundę
+  for (size_t r = 0; r < ranges; r++) {
+    const uint8_t *range = data + IMG_NACK_HEADER_SIZE + r * 4;
+    const uint32_t first = get_u16(range);
+    const uint32_t last = std::min<uint32_t>(first + get_u16(range + 2), this->block_count_);
+    for (uint32_t i = first; i < last; i++) {
+      this->to_send_[i >> 3] |= 1 << (i & 7);
+    }
+    if (first < last && first < this->cursor_) {
+      this->cursor_ = first;
+    }
+  }
+}
+
+// ---------------------------------------------------------------- węzeł
+
+void ImageReceiver::on_offer(const uint8_t *mac, const uint8_t *data, size_t len) {
+  if (len < IMG_OFFER_SIZE || !this->is_enabled()) {
+    return;
+  }
+  const uint16_t session = get_u16(data + 1);
+  const uint8_t round = data[13];
+  std::lock_guard<reliable::FreeRtosMutex> lock(this->mutex_);
+  if (session == this->rejected_session_ || (this->offer_pending_ && session == this->offer_.session)) {
+    return;
+  }
+
+  if (!this->active_ || session != this->session_) {
+    // Nowa sesja - begin() sinka (np. kasowanie partycji) wywoła loop(), nie zadanie WiFi
+    const uint32_t size = get_u32(data + 3);
+    const uint16_t block_size = get_u16(data + 7);
+    const uint32_t block_count = block_size == 0 ? 0 : (size + block_size - 1) / block_size;
+    if (block_size == 0 || block_size > IMG_MAX_BLOCK_SIZE || block_count == 0 || block_count > 0xFFFF) {
+      return;
+    }
+    this->offer_.session = session;
+    std::copy_n(mac, 6, this->offer_.gateway.begin());
+    this->offer_.size = size;
+    this->offer_.block_size = block_size;
+    this->offer_.crc32 = get_u32(data + 9);
+    this->offer_pending_ = true;
+    return;
+  }
+
+  // Zapytanie o braki: odpowiedź z losowym opóźnieniem w oknie, żeby węzły nie nadawały naraz
+  if (round != 0 && round != this->answered_round_) {
+    this->answered_round_ = round;
+    const uint32_t window_us = uint32_t(get_u16(data + 14)) * 1000;
+    this->nack_due_ = esp_timer_get_time() + 1 + esp_random() % std::max<uint32_t>(window_us * 3 / 4, 1);
+  }
+}
+
+void ImageReceiver::on_block(const uint8_t *data, size_t len) {
+  if (len <= IMG_BLOCK_HEADER_SIZE) {
+    return;
+  }
+  std::lock_guard<reliable::FreeRtosMutex> lock(this->mutex_);
+  if (!this->active_ || this->complete_) {
+    return;
+  }
+  const uint16_t index = get_u16(data + 3);
+  const size_t block_len = len - IMG_BLOCK_HEADER_SIZE;
+  if (get_u16(data + 1) != this->session_ || index >= this->block_count_ || this->has_block_locked(index) ||
+      block_len > this->block_size_ || this->slot_count_ == SLOT_COUNT) {
+    return;
+  }
+  BlockSlot &slot = this->slots_[(this->slot_head_ + this->slot_count_) % SLOT_COUNT];
+  slot.index = index;
+  slot.len = block_len;
+  memcpy(slot.data, data + IMG_BLOCK_HEADER_SIZE, block_len);
+  this->slot_count_++;
+}
+
+void ImageReceiver::begin_session() {
+  ImageOffer offer;
+  {
+    std::lock_guard<reliable::FreeRtosMutex> lock(this->mutex_);
+    offer = this->offer_;
+    // Porzucenie poprzedniej sesji - bloki z recv_cb przestają być przyjmowane
+    this->active_ = false;
+  }
+  const bool accepted = !this->begin_ || this->begin_(offer.size, offer.crc32);
+  std::lock_guard<reliable::FreeRtosMutex> lock(this->mutex_);
+  // W trakcie begin() mogła przyjść oferta kolejnej sesji - zostaje na następny obieg loop()
+  this->offer_pending_ = this->offer_.session != offer.session;
+  if (!accepted) {
+    this->rejected_session_ = offer.session;
+    ESP_LOGI(TAG, "Image session %04X rejected by sink", offer.session);
+    return;
+  }
+  const uint16_t block_count = (offer.size + offer.block_size - 1) / offer.block_size;
+  this->active_ = true;
+  this->complete_ = false;
+  this->session_ = offer.session;
+  this->gateway_ = offer.gateway;
+  this->size_ = offer.size;
+  this->crc32_ = offer.crc32;
+  this->block_size_ = offer.block_size;
+  this->block_count_ = block_count;
+  this->received_ = 0;
+  this->bitmap_.assign((block_count + 7) / 8, 0);
+  this->answered_round_ = 0;
+  this->nack_due_ = 0;
+  this->slots_.resize(SLOT_COUNT);
+  this->slot_head_ = 0;
+  this->slot_count_ = 0;
+  ESP_LOGI(TAG, "Receiving image session %04X: %u bytes in %u blocks", offer.session, offer.size, block_count);
+}
+
+void ImageReceiver::loop() {
+  if (this->offer_pending_) {
+    this->begin_session();
+  }
+  if (!this->active_) {
+    return;
+  }
+  // Zapis przez sink poza zadaniem WiFi (flash może blokować na kilka ms)
+  while (true) {
+    BlockSlot *slot;
+    {
+      std::lock_guard<reliable::FreeRtosMutex> lock(this->mutex_);
+      if (this->slot_count_ == 0) {
+        break;
+      }
+      slot = &this->slots_[this->slot_head_];
+      if (this->has_block_locked(slot->index)) {
+        this->slot_head_ = (this->slot_head_ + 1) % SLOT_COUNT;
+        this->slot_count_--;
+        continue;
+      }
+    }
+    // Slot w głowie bufora nie jest nadpisywany przez on_block, dopóki slot_count_ go obejmuje
+    const bool ok = this->write_(uint32_t(slot->index) * this->block_size_, slot->data, slot->len);
+    std::lock_guard<reliable::FreeRtosMutex> lock(this->mutex_);
+    if (ok) {
+      this->bitmap_[slot->index >> 3] |= 1 << (slot->index & 7);
+      this->received_++;
+    } else {
+      ESP_LOGW(TAG, "Sink rejected block %u", slot->index);
+    }
+    this->slot_head_ = (this->slot_head_ + 1) % SLOT_COUNT;
+    this->slot_count_--;
+  }
+
+  if (!this->complete_ && this->received_ == this->block_count_) {
+    this->complete_ = true;
+    ESP_LOGI(TAG, "Image session %04X complete (%u bytes)", this->session_, this->size_);
+    this->on_complete_callback_.call(this->size_, this->crc32_);
+  }
+  if (this->nack_due_ != 0 && esp_timer_get_time() >= this->nack_due_) {
+    this->nack_due_ = 0;
+    this->send_nack();
+  }
+}
+
+void ImageReceiver::send_nack() {
+  uint8_t frame[ESP_NOW_MAX_DATA_LEN];
+  size_t ranges = 0;
+  {
+    std::lock_guard<reliable::FreeRtosMutex> lock(this->mutex_);
+    frame[0] = IMG_NACK;
+    put_u16(frame + 1, this->session_);
+    // Ciągłe zakresy brakujących bloków; nadmiarowe zakresy pójdą w następnej rundzie
+    uint32_t i = 0;
+    while (i < this->block_count_ && ranges < IMG_MAX_NACK_RANGES) {
+      if (this->has_block_locked(i)) {
+        i++;
+        continue;
+      }
+      const uint32_t first = i;
+      while (i < this->block_count_ && !this->has_block_locked(i) && i - first < 0xFFFF) {
+        i++;
+      }
+      uint8_t *range = frame + IMG_NACK_HEADER_SIZE + ranges * 4;
+      put_u16(range, first);
+      put_u16(range + 2, i - first);
+      ranges++;
+    }
+    frame[3] = ranges;
+  }
+  if (!this->parent_->ensure_peer(this->gateway_.data())) {
+    return;
+  }
+  esp_now_send(this->gateway_.data(), frame, IMG_NACK_HEADER_SIZE + ranges * 4);
+}
+
+}  // namespace espnow
+}  // namespace esphome
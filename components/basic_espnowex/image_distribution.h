@@ -0,0 +1,172 @@
+#pragma once
+
+// Rozsyłanie obrazu (np. firmware OTA) do wielu węzłów naraz przez broadcast ESP-NOW.
+//
+// Bramka nadaje każdy blok raz, broadcastem. Węzły zapisują bloki przez strumieniowy sink
+// (bez buforowania całego obrazu) i zaznaczają je w bitmapie. Po każdym przebiegu bramka
+// nadaje zapytanie (OFFER z numerem rundy > 0), a węzły odpowiadają zwięzłymi zakresami
+// brakujących bloków (NACK). Bramka nadaje ponownie tylko sumę brakujących zakresów, więc
+// czas zajęcia eteru rośnie z rozmiarem obrazu i stratami, a nie z liczbą węzłów.
+//
+// Ramki (poza silnikiem niezawodnego dostarczania - bez ACK i bez kolejki):
+//   IMG_OFFER [typ][sesja 2][rozmiar 4][rozmiar bloku 2][crc32 4][runda 1][okno NACK ms 2]
+//   IMG_BLOCK [typ][sesja 2][numer bloku 2][dane]
+//   IMG_NACK  [typ][sesja 2][liczba zakresów 1]([początek 2][liczba 2]) x n, n = 0 -> komplet
+//
+// Węzeł odpowiada na każde zapytanie (także po skompletowaniu obrazu), więc zgubiony NACK
+// wraca przy następnym zapytaniu.
+
+#include "esphome/core/helpers.h"
+#include "esphome/components/basic_reliable/freertos_mutex.h"
+#include "esp_now.h"
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace esphome {
+namespace espnow {
+
+class BasicESPNowEx;
+
+static const uint8_t IMG_OFFER = 0x20;
+static const uint8_t IMG_BLOCK = 0x21;
+static const uint8_t IMG_NACK = 0x22;
+
+static const size_t IMG_OFFER_SIZE = 16;
+static const size_t IMG_BLOCK_HEADER_SIZE = 5;
+static const size_t IMG_NACK_HEADER_SIZE = 4;
+static const size_t IMG_MAX_BLOCK_SIZE = ESP_NOW_MAX_DATA_LEN - IMG_BLOCK_HEADER_SIZE;
+static const size_t IMG_MAX_NACK_RANGES = (ESP_NOW_MAX_DATA_LEN - IMG_NACK_HEADER_SIZE) / 4;
+
+// Odczyt fragmentu obrazu po stronie bramki (np. z partycji flash) - obraz nie jest trzymany w RAM
+using ImageReadHandler = std::function<bool(uint32_t offset, uint8_t *out, size_t len)>;
+// Sink po stronie węzła: begin przy nowej sesji (false = odrzuć obraz), write dla każdego bloku.
+// Bloki z rund naprawczych przychodzą poza kolejnością - offset wskazuje miejsce zapisu.
+using ImageBeginHandler = std::function<bool(uint32_t size, uint32_t crc32)>;
+using ImageWriteHandler = std::function<bool(uint32_t offset, const uint8_t *data, size_t len)>;
+
+// Strona nadawcza (bramka). Stan maszyny zmienia loop(), NACK-i dopisuje on_nack() z recv_cb.
+class ImageSender {
+ public:
+  explicit ImageSender(BasicESPNowEx *parent) : parent_(parent) {}
+
+  void set_block_size(uint16_t block_size) { this->block_size_ = block_size; }
+  void set_block_interval(uint32_t interval_ms) { this->block_interval_us_ = int64_t(interval_ms) * 1000; }
+  void set_nack_window(uint32_t window_ms) { this->nack_window_ms_ = window_ms; }
+  void set_max_rounds(uint8_t max_rounds) { this->max_rounds_ = max_rounds; }
+  // Znana liczba węzłów: koniec dopiero, gdy wszystkie zgłoszą komplet (albo po max_rounds)
+  void set_expected_nodes(uint16_t expected_nodes) { this->expected_nodes_ = expected_nodes; }
+
+  bool start(uint32_t size, uint32_t crc32, ImageReadHandler &&reader);
+  void abort();
+  bool is_active() const { return this->state_ != STATE_IDLE; }
+  uint32_t get_blocks_sent() const { return this->blocks_sent_; }
+  size_t get_nodes_complete() const { return this->done_nodes_.size(); }
+
+  void loop();
+  void on_nack(const uint8_t *mac, const uint8_t *data, size_t len);
+
+ protected:
+  enum State : uint8_t { STATE_IDLE = 0, STATE_ANNOUNCE, STATE_SENDING, STATE_POLLING };
+
+  void poll(int64_t now);
+  bool send_offer(uint8_t round);
+  bool send_block(uint16_t index);
+  void finish(bool complete);
+
+  BasicESPNowEx *parent_;
+  reliable::FreeRtosMutex mutex_;
+  ImageReadHandler reader_;
+
+  uint16_t block_size_{IMG_MAX_BLOCK_SIZE};
+  int64_t block_interval_us_{4000};
+  uint32_t nack_window_ms_{300};
+  uint8_t max_rounds_{20};
+  uint16_t expected_nodes_{0};
+
+  State state_{STATE_IDLE};
+  uint16_t session_{0};
+  uint32_t size_{0};
+  uint32_t crc32_{0};
+  uint16_t block_count_{0};
+  std::vector<uint8_t> to_send_;  // bitmapa bloków do nadania w bieżącym przebiegu
+  uint16_t cursor_{0};
+  uint8_t round_{0};  // numer zapytania o braki (każde zapytanie ma nowy numer)
+  uint8_t announce_left_{0};
+  uint8_t quiet_rounds_{0};
+  int64_t next_action_{0};
+  uint32_t blocks_sent_{0};
+  std::vector<std::array<uint8_t, 6>> done_nodes_;  // węzły, które zgłosiły komplet
+};
+
+// Strona odbiorcza (węzeł). Bloki z recv_cb trafiają do małego bufora, zapis przez sink w loop().
+class ImageReceiver {
+ public:
+  explicit ImageReceiver(BasicESPNowEx *parent) : parent_(parent) {}
+
+  void set_sink(ImageBeginHandler &&begin, ImageWriteHandler &&write) {
+    this->begin_ = std::move(begin);
+    this->write_ = std::move(write);
+  }
+  bool is_enabled() const { return static_cast<bool>(this->write_); }
+  void add_on_complete_callback(std::function<void(uint32_t, uint32_t)> &&cb) {
+    this->on_complete_callback_.add(std::move(cb));
+  }
+
+  void loop();
+  void on_offer(const uint8_t *mac, const uint8_t *data, size_t len);
+  void on_block(const uint8_t *data, size_t len);
+
+ protected:
+  // Bufor bloków między zadaniem WiFi a loop(); przy przepełnieniu blok przepada i wróci w NACK
+  static const size_t SLOT_COUNT = 8;
+  struct BlockSlot {
+    uint16_t index;
+    uint8_t len;
+    uint8_t data[IMG_MAX_BLOCK_SIZE];
+  };
+
+  // Parametry z ostatniego OFFER nowej sesji - przejmowane w loop()
+  struct ImageOffer {
+    uint16_t session;
+    std::array<uint8_t, 6> gateway;
+    uint32_t size;
+    uint16_t block_size;
+    uint32_t crc32;
+  };
+
+  bool has_block_locked(uint16_t index) const { return this->bitmap_[index >> 3] & (1 << (index & 7)); }
+  void begin_session();
+  void send_nack();
+
+  BasicESPNowEx *parent_;
+  reliable::FreeRtosMutex mutex_;
+  ImageBeginHandler begin_;
+  ImageWriteHandler write_;
+  CallbackManager<void(uint32_t, uint32_t)> on_complete_callback_;
+
+  ImageOffer offer_{};
+  bool offer_pending_{false};
+  bool active_{false};
+  bool complete_{false};
+  uint16_t session_{0};
+  uint16_t rejected_session_{0};
+  std::array<uint8_t, 6> gateway_{};
+  uint32_t size_{0};
+  uint32_t crc32_{0};
+  uint16_t block_size_{0};
+  uint16_t block_count_{0};
+  uint16_t received_{0};
+  std::vector<uint8_t> bitmap_;
+  uint8_t answered_round_{0};
+  int64_t nack_due_{0};  // 0 = brak zaplanowanej odpowiedzi
+
+  std::vector<BlockSlot> slots_;  // przydzielane przy pierwszej sesji
+  size_t slot_head_{0};
+  size_t slot_count_{0};
+};
+
+}  // namespace espnow
+}  // namespace esphome
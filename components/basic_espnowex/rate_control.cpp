@@ -0,0 +1,223 @@
+#include "rate_control.h"
+#include "esphome/core/log.h"
+#include "esp_timer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+
+namespace esphome {
+namespace espnow {
+
+static const char *const TAG = "basic_espnowex.rate";
+
+static const int64_t EVAL_INTERVAL_US = 1000000;
+static const uint8_t MIN_WINDOW_FRAMES = 8;  // mniej transmisji w oknie - za mało, by oceniać skuteczność
+static const int RSSI_HYSTERESIS = 4;        // dB zapasu przy przejściu na szybszy poziom
+
+// Minimalne RSSI (dBm) dla poziomu - z zapasem względem czułości odbiornika ESP32
+static const int8_t MIN_RSSI[PHY_RATE_COUNT] = {-128, -94, -89, -84, -80, -74, -67};
+static const char *const RATE_NAMES[PHY_RATE_COUNT] = {"LR 250k", "LR 500k", "1M", "6M", "12M", "24M", "54M"};
+
+#ifdef ESPNOWEX_HAS_PEER_RATE
+static esp_now_rate_config_t rate_config(uint8_t level) {
+  esp_now_rate_config_t config = {};
+  switch (level) {
+    case PHY_RATE_LR_250K:
+      config.phymode = WIFI_PHY_MODE_LR;
+      config.rate = WIFI_PHY_RATE_LORA_250K;
+      break;
+    case PHY_RATE_LR_500K:
+      config.phymode = WIFI_PHY_MODE_LR;
+      config.rate = WIFI_PHY_RATE_LORA_500K;
+      break;
+    case PHY_RATE_1M:
+      config.phymode = WIFI_PHY_MODE_11B;
+      config.rate = WIFI_PHY_RATE_1M_L;
+      break;
+    case PHY_RATE_6M:
+      config.phymode = WIFI_PHY_MODE_11G;
+      config.rate = WIFI_PHY_RATE_6M;
+      break;
+    case PHY_RATE_12M:
+      config.phymode = WIFI_PHY_MODE_11G;
+      config.rate = WIFI_PHY_RATE_12M;
+      break;
+    case PHY_RATE_24M:
+      config.phymode = WIFI_PHY_MODE_11G;
+      config.rate = WIFI_PHY_RATE_24M;
+      break;
+    default:
+      config.phymode = WIFI_PHY_MODE_11G;
+      config.rate = WIFI_PHY_RATE_54M;
+      break;
+  }
+  return config;
+}
+#endif
+
+void RateControl::set_peer_rate(const std::array<uint8_t, 6> &mac, PhyRate rate) {
+  std::lock_guard<reliable::FreeRtosMutex> lock(this->mutex_);
+  PeerRate *peer = this->track_locked(mac.data());
+  if (peer != nullptr) {
+    peer->fixed = rate;
+    peer->level = rate == PHY_RATE_AUTO ? PHY_RATE_1M : rate;
+  }
+}
+
+PhyRate RateControl::get_peer_rate(const std::array<uint8_t, 6> &mac) {
+  std::lock_guard<reliable::FreeRtosMutex> lock(this->mutex_);
+  const PeerRate *peer = this->find_locked(mac.data());
+  return peer == nullptr ? PHY_RATE_AUTO : static_cast<PhyRate>(peer->level);
+}
+
+void RateControl::on_rx(const uint8_t *mac, int8_t rssi) {
+  if (!this->enabled_) {
+    return;
+  }
+  std::lock_guard<reliable::FreeRtosMutex> lock(this->mutex_);
+  PeerRate *peer = this->track_locked(mac);
+  if (peer == nullptr) {
+    return;
+  }
+  if (!peer->has_rssi) {
+    peer->rssi_avg = rssi * 8;
+    peer->has_rssi = true;
+  } else {
+    peer->rssi_avg += rssi - peer->rssi_avg / 8;
+  }
+}
+
+void RateControl::on_tx_done(const uint8_t *mac, bool success) {
+  if (!this->enabled_) {
+    return;
+  }
+  std::lock_guard<reliable::FreeRtosMutex> lock(this->mutex_);
+  PeerRate *peer = this->track_locked(mac);
+  if (peer == nullptr) {
+    return;
+  }
+  if (peer->sent == 0xFF) {
+    peer->sent /= 2;
+    peer->failed /= 2;
+  }
+  peer->sent++;
+  if (!success) {
+    peer->failed++;
+  }
+}
+
+void RateControl::on_peer_added(const uint8_t *mac) {
+  std::lock_guard<reliable::FreeRtosMutex> lock(this->mutex_);
+  PeerRate *peer = this->find_locked(mac);
+  if (peer != nullptr) {
+    peer->applied = NOT_APPLIED;
+  }
+}
+
+void RateControl::on_peers_cleared() {
+  std::lock_guard<reliable::FreeRtosMutex> lock(this->mutex_);
+  for (auto &peer : this->peers_) {
+    peer.applied = NOT_APPLIED;
+  }
+}
+
+void RateControl::loop() {
+  const int64_t now = esp_timer_get_time();
+  if (now < this->next_eval_ || this->peers_.empty()) {
+    return;
+  }
+  this->next_eval_ = now + EVAL_INTERVAL_US;
+
+  // Konfiguracja sterownika poza blokadą - callbacki ESP-NOW nie mogą na nią czekać
+  std::vector<std::pair<std::array<uint8_t, 6>, uint8_t>> changes;
+  {
+    std::lock_guard<reliable::FreeRtosMutex> lock(this->mutex_);
+    for (auto &peer : this->peers_) {
+      if (peer.fixed == PHY_RATE_AUTO && this->enabled_) {
+        const uint8_t level = this->choose_level(peer);
+        if (level != peer.level) {
+          ESP_LOGD(TAG, "%02X:%02X:%02X:%02X:%02X:%02X: %s -> %s (RSSI %d dBm)", peer.mac[0], peer.mac[1],
+                   peer.mac[2], peer.mac[3], peer.mac[4], peer.mac[5], RATE_NAMES[peer.level], RATE_NAMES[level],
+                   peer.has_rssi ? peer.rssi_avg / 8 : 0);
+          peer.level = level;
+        }
+      }
+      if (peer.level != peer.applied && esp_now_is_peer_exist(peer.mac.data())) {
+        changes.push_back({peer.mac, peer.level});
+      }
+    }
+  }
+  for (const auto &change : changes) {
+#ifdef ESPNOWEX_HAS_PEER_RATE
+    esp_now_rate_config_t config = rate_config(change.second);
+    const esp_err_t err = esp_now_set_peer_rate_config(change.first.data(), &config);
+    if (err != ESP_OK) {
+      ESP_LOGW(TAG, "Setting rate %s failed: %s", RATE_NAMES[change.second], esp_err_to_name(err));
+      continue;
+    }
+#endif
+    std::lock_guard<reliable::FreeRtosMutex> lock(this->mutex_);
+    PeerRate *peer = this->find_locked(change.first.data());
+    if (peer != nullptr) {
+      peer->applied = change.second;
+    }
+  }
+}
+
+uint8_t RateControl::choose_level(PeerRate &peer) {
+  const int min_level = this->long_range_ ? PHY_RATE_LR_250K : PHY_RATE_1M;
+  const int max_level = PHY_RATE_COUNT - 1;
+
+  // Poziom z RSSI - najszybszy, którego próg się mieści; bez pomiaru zaczynamy od 1 Mbps
+  int base = PHY_RATE_1M;
+  if (peer.has_rssi) {
+    const int rssi = peer.rssi_avg / 8;
+    base = min_level;
+    for (int level = max_level; level > min_level; level--) {
+      const int margin = level > peer.level ? RSSI_HYSTERESIS : 0;
+      if (rssi >= MIN_RSSI[level] + margin) {
+        base = level;
+        break;
+      }
+    }
+  }
+
+  // Korekta ze skuteczności: straty obniżają poziom, czyste okno cofa obniżkę. Bez RSSI czyste
+  // okna podnoszą poziom ponad 1 Mbps; z RSSI pomiar jest górną granicą.
+  if (peer.sent >= MIN_WINDOW_FRAMES) {
+    if (peer.failed * 4 > peer.sent) {
+      peer.offset--;
+    } else if (peer.failed == 0 && (peer.offset < 0 || !peer.has_rssi)) {
+      peer.offset++;
+    }
+    peer.sent = 0;
+    peer.failed = 0;
+  }
+  peer.offset = std::max<int>(min_level - base, std::min<int>(max_level - base, peer.offset));
+  return base + peer.offset;
+}
+
+RateControl::PeerRate *RateControl::find_locked(const uint8_t *mac) {
+  auto it = std::find_if(this->peers_.begin(), this->peers_.end(),
+                         [mac](const PeerRate &p) { return memcmp(p.mac.data(), mac, 6) == 0; });
+  return it == this->peers_.end() ? nullptr : &*it;
+}
+
+RateControl::PeerRate *RateControl::track_locked(const uint8_t *mac) {
+  PeerRate *peer = this->find_locked(mac);
+  // Broadcast/multicast idzie domyślną szybkością sterownika
+  if (peer != nullptr || (mac[0] & 0x01) != 0 || this->peers_.size() >= ESP_NOW_MAX_TOTAL_PEER_NUM) {
+    return peer;
+  }
+  PeerRate entry{};
+  std::copy_n(mac, 6, entry.mac.begin());
+  entry.fixed = PHY_RATE_AUTO;
+  entry.level = PHY_RATE_1M;
+  entry.applied = NOT_APPLIED;
+  this->peers_.push_back(entry);
+  return &this->peers_.back();
+}
+
+}  // namespace espnow
+}  // namespace esphome
@@ -0,0 +1,92 @@
+#pragma once
+
+// Dobór szybkości PHY ESP-NOW osobno dla każdego peera.
+//
+// Punkt wyjścia to RSSI ramek odebranych od peera (średnia krocząca): najszybszy poziom, którego
+// próg czułości mieści się w zmierzonym RSSI. Skuteczność dostarczenia (status z send_cb) koryguje
+// wybór w dół: okno z ponad 25% nieudanych transmisji obniża poziom o jeden krok, czyste okno
+// cofa korektę. Bez pomiaru RSSI (ESP-IDF < 5.0) punktem wyjścia jest 1 Mbps, a czyste okna
+// podnoszą poziom stopniowo. Tryb LR (802.11 LR, 250/500 kbps) wymaga long_range po obu stronach.
+//
+// Statystyki zbierają callbacki ESP-NOW (zadanie WiFi), decyzje i esp_now_set_peer_rate_config
+// zapadają w loop() - sterownika nie konfigurujemy z jego własnych callbacków.
+
+#include "esphome/components/basic_reliable/freertos_mutex.h"
+#include "esp_idf_version.h"
+#include "esp_now.h"
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+// esp_now_recv_info_t (RSSI odebranej ramki) od ESP-IDF 5.0, konfiguracja szybkości per peer od 5.1
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
+#define ESPNOWEX_HAS_RECV_INFO
+#endif
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 1, 0)
+#define ESPNOWEX_HAS_PEER_RATE
+#endif
+
+namespace esphome {
+namespace espnow {
+
+// Poziomy od najodporniejszego do najszybszego
+enum PhyRate : uint8_t {
+  PHY_RATE_LR_250K = 0,
+  PHY_RATE_LR_500K,
+  PHY_RATE_1M,
+  PHY_RATE_6M,
+  PHY_RATE_12M,
+  PHY_RATE_24M,
+  PHY_RATE_54M,
+  PHY_RATE_COUNT,
+  PHY_RATE_AUTO = 0xFF,  // dobór automatyczny (brak nadpisania w YAML)
+};
+
+class RateControl {
+ public:
+  void set_enabled(bool enabled) { this->enabled_ = enabled; }
+  void set_long_range(bool long_range) { this->long_range_ = long_range; }
+  bool is_enabled() const { return this->enabled_; }
+  bool is_long_range() const { return this->long_range_; }
+  // Stała szybkość dla peera z YAML - automatyka go pomija
+  void set_peer_rate(const std::array<uint8_t, 6> &mac, PhyRate rate);
+  PhyRate get_peer_rate(const std::array<uint8_t, 6> &mac);
+
+  // Z callbacków ESP-NOW
+  void on_rx(const uint8_t *mac, int8_t rssi);
+  void on_tx_done(const uint8_t *mac, bool success);
+  // Peer dodany od nowa do tablicy sterownika - konfiguracja szybkości przepadła
+  void on_peer_added(const uint8_t *mac);
+  void on_peers_cleared();
+
+  void loop();
+
+ protected:
+  static const uint8_t NOT_APPLIED = 0xFE;
+
+  struct PeerRate {
+    std::array<uint8_t, 6> mac;
+    PhyRate fixed;
+    uint8_t level;
+    uint8_t applied;  // poziom ustawiony w sterowniku, NOT_APPLIED = domyślny sterownika
+    int8_t offset;    // korekta ze skuteczności dostarczenia (kroki względem poziomu z RSSI)
+    bool has_rssi;
+    int16_t rssi_avg;  // RSSI * 8 (EWMA 1/8)
+    uint8_t sent;
+    uint8_t failed;
+  };
+
+  PeerRate *find_locked(const uint8_t *mac);
+  PeerRate *track_locked(const uint8_t *mac);
+  uint8_t choose_level(PeerRate &peer);
+
+  reliable::FreeRtosMutex mutex_;
+  std::vector<PeerRate> peers_;
+  bool enabled_{false};
+  bool long_range_{false};
+  int64_t next_eval_{0};
+};
+
+}  // namespace espnow
+}  // namespace esphome
@@ -0,0 +1,79 @@
+import esphome.codegen as cg
+import esphome.config_validation as cv
+from esphome import automation
+from esphome.const import CONF_ID, CONF_TRIGGER_ID
+from esphome.components.basic_espnowex import BasicESPNowEx
+from esphome.components.basic_loraex import BasicLoRaEx
+from esphome.components.basic_reliable import mac_expression
+
+DEPENDENCIES = ["basic_espnowex", "basic_loraex"]
+AUTO_LOAD = ["basic_reliable"]
+# Oba komponenty przejmują ramki tym samym handlerem przekazywania w radiach
+CONFLICTS_WITH = ["basic_bridge"]
+
+basic_failover_ns = cg.esphome_ns.namespace("failover")
+BasicFailover = basic_failover_ns.class_("BasicFailover", cg.Component)
+OnMessageTrigger = basic_failover_ns.class_(
+    "OnMessageTrigger",
+    automation.Trigger.template(cg.std_array.template(cg.uint8, 6), cg.std_vector.template(cg.uint8)),
+)
+
+CONF_ESPNOW_ID = "espnow_id"
+CONF_LORA_ID = "lora_id"
+CONF_PEERS = "peers"
+CONF_ESPNOW_MAC = "espnow_mac"
+CONF_LORA_MAC = "lora_mac"
+CONF_FAILOVER_TIMEOUT = "failover_timeout"
+CONF_PROBE_INTERVAL = "probe_interval"
+CONF_MAX_PENDING = "max_pending"
+CONF_ON_MESSAGE = "on_message"
+
+# Bez lora_mac urządzenie używa po stronie LoRa tego samego adresu co w ESP-NOW
+PEER_SCHEMA = cv.Schema({
+    cv.Required(CONF_ESPNOW_MAC): cv.mac_address,
+    cv.Optional(CONF_LORA_MAC): cv.mac_address,
+})
+
+CONFIG_SCHEMA = cv.Schema({
+    cv.GenerateID(): cv.declare_id(BasicFailover),
+    cv.GenerateID(CONF_ESPNOW_ID): cv.use_id(BasicESPNowEx),
+    cv.GenerateID(CONF_LORA_ID): cv.use_id(BasicLoRaEx),
+    cv.Required(CONF_PEERS): cv.ensure_list(PEER_SCHEMA),
+    cv.Optional(CONF_FAILOVER_TIMEOUT, default="150ms"): cv.All(
+        cv.positive_time_period_milliseconds,
+        cv.Range(min=cv.TimePeriod(milliseconds=10), max=cv.TimePeriod(seconds=10)),
+    ),
+    cv.Optional(CONF_PROBE_INTERVAL, default="10s"): cv.positive_time_period_milliseconds,
+    cv.Optional(CONF_MAX_PENDING, default=16): cv.int_range(min=1, max=64),
+    cv.Optional(CONF_ON_MESSAGE): automation.validate_automation({
+        cv.GenerateID(CONF_TRIGGER_ID): cv.declare_id(OnMessageTrigger),
+    }),
+}).extend(cv.COMPONENT_SCHEMA)
+
+
+async def to_code(config):
+    var = cg.new_Pvariable(config[CONF_ID])
+    await cg.register_component(var, config)
+
+    espnow = await cg.get_variable(config[CONF_ESPNOW_ID])
+    lora = await cg.get_variable(config[CONF_LORA_ID])
+    cg.add(var.set_espnow(espnow))
+    cg.add(var.set_lora(lora))
+
+    for peer in config[CONF_PEERS]:
+        lora_mac = peer.get(CONF_LORA_MAC, peer[CONF_ESPNOW_MAC])
+        cg.add(var.add_peer(mac_expression(peer[CONF_ESPNOW_MAC]), mac_expression(lora_mac)))
+
+    cg.add(var.set_failover_timeout(config[CONF_FAILOVER_TIMEOUT].total_milliseconds))
+    cg.add(var.set_probe_interval(config[CONF_PROBE_INTERVAL].total_milliseconds))
+    cg.add(var.set_max_pending(config[CONF_MAX_PENDING]))
+
+    for conf in config.get(CONF_ON_MESSAGE, []):
+        trigger = cg.new_Pvariable(conf[CONF_TRIGGER_ID], var)
+        await automation.build_automation(
+            trigger,
+            [(cg.std_array.template(cg.uint8, 6), "mac"), (cg.std_vector.template(cg.uint8), "data")],
+            conf,
+        )
+
+    return var
@@ -0,0 +1,310 @@
+#include "basic_failover.h"
+#include "esphome/core/log.h"
+#include "esp_timer.h"
+
+#include <algorithm>
+#include <mutex>
+
+namespace esphome {
+namespace failover {
+
+static const char *const TAG = "basic_failover";
+
+static const size_t MAX_DELIVERED = 256;  // ~4 KB; przy zwykłym ruchu identyfikatory wygasają wcześniej
+static const size_t MAX_INBOX = 16;
+// Wiadomość musi się zmieścić w ramce każdego z radiów
+static const size_t MAX_PAYLOAD = std::min<size_t>(ESP_NOW_MAX_DATA_LEN - espnow::TOPIC_HEADER_SIZE,
+                                                   lora::MAX_PACKET_SIZE - lora::TOPIC_HEADER_SIZE);
+
+void BasicFailover::setup() {
+  this->entries_.reserve(this->max_pending_);
+  // Kopia przychodzi drugim radiem najpóźniej po terminie przełączenia i wszystkich próbach LoRa
+  // (nadawca z tą samą konfiguracją radia)
+  this->delivered_.set_ttl_us(this->failover_timeout_us_ + this->lora_->get_retry_span_us());
+  this->delivered_.set_capacity(MAX_DELIVERED);
+
+  this->espnow_->set_forward_handler([this](const std::array<uint8_t, 6> &src, const reliable::FrameHeader &header,
+                                            const uint8_t *payload, size_t len) {
+    return this->on_frame(false, src, header, payload, len);
+  });
+  this->lora_->set_forward_handler([this](const std::array<uint8_t, 6> &src, const reliable::FrameHeader &header,
+                                          const uint8_t *payload, size_t len) {
+    return this->on_frame(true, src, header, payload, len);
+  });
+  this->espnow_->add_on_recv_ack_callback([this](std::array<uint8_t, 6> mac, std::array<uint8_t, 3> id) {
+    this->on_espnow_ack(mac, id);
+  });
+  this->lora_->add_on_recv_ack_callback([this](std::array<uint8_t, 6> mac, std::array<uint8_t, 3> id) {
+    this->on_lora_ack(mac, id);
+  });
+
+  ESP_LOGCONFIG(TAG,
+                "ESP-NOW/LoRa failover: %u peers, failover after %lld ms, ESP-NOW probe every %lld s, "
+                "duplicates tracked for %lld ms",
+                (unsigned) this->peers_.size(), this->failover_timeout_us_ / 1000, this->probe_interval_us_ / 1000000,
+                this->delivered_.get_ttl_us() / 1000);
+}
+
+void BasicFailover::loop() {
+  const int64_t now = esp_timer_get_time();
+
+  // Stan silników sprawdzany bez własnej blokady - ich callbacki (ACK) biorą ją z zadania WiFi
+  struct Check {
+    uint8_t peer;
+    MessageId id;
+    FailoverPath path;
+    int64_t deadline;
+  };
+  std::vector<Check> checks;
+  std::vector<FailoverDelivery> inbox;
+  {
+    std::lock_guard<reliable::FreeRtosMutex> lock(this->mutex_);
+    for (const auto &entry : this->entries_) {
+      checks.push_back({entry.peer, entry.id, entry.path, entry.deadline});
+    }
+    inbox.swap(this->inbox_);
+  }
+
+  std::vector<Check> to_lora;
+  std::vector<Check> lost;
+  for (const auto &check : checks) {
+    const FailoverPeer &peer = this->peers_[check.peer];
+    if (check.path == PATH_ESPNOW) {
+      // Termin minął, silnik ESP-NOW porzucił ramkę albo uznał peera za niedostępnego
+      if (now >= check.deadline || !this->espnow_->is_pending(peer.espnow_mac, check.id) ||
+          this->espnow_->get_peer_state(peer.espnow_mac) == reliable::PEER_DOWN) {
+        to_lora.push_back(check);
+      }
+    } else if (!this->lora_->is_pending(peer.lora_mac, check.id)) {
+      lost.push_back(check);
+    }
+  }
+
+  std::vector<FailoverEntry> moved;
+  if (!to_lora.empty() || !lost.empty()) {
+    std::lock_guard<reliable::FreeRtosMutex> lock(this->mutex_);
+    for (auto &entry : this->entries_) {
+      if (entry.path != PATH_ESPNOW || std::none_of(to_lora.begin(), to_lora.end(), [&](const Check &c) {
+            return c.peer == entry.peer && c.id == entry.id;
+          })) {
+        continue;
+      }
+      FailoverPeer &peer = this->peers_[entry.peer];
+      if (!peer.degraded) {
+        ESP_LOGW(TAG, "%02X:%02X:%02X:%02X:%02X:%02X: ESP-NOW not acknowledging, switching to LoRa",
+                 peer.espnow_mac[0], peer.espnow_mac[1], peer.espnow_mac[2], peer.espnow_mac[3], peer.espnow_mac[4],
+                 peer.espnow_mac[5]);
+        peer.degraded = true;
+      }
+      peer.next_probe = now + this->probe_interval_us_;
+      entry.path = PATH_LORA;
+      moved.push_back({entry.peer, entry.id, PATH_LORA, entry.priority, entry.deadline, std::move(entry.payload)});
+      entry.payload.clear();
+      this->failover_count_++;
+    }
+    this->entries_.erase(std::remove_if(this->entries_.begin(), this->entries_.end(),
+                                        [&](const FailoverEntry &e) {
+                                          return e.path == PATH_LORA &&
+                                                 std::any_of(lost.begin(), lost.end(), [&](const Check &c) {
+                                                   return c.peer == e.peer && c.id == e.id;
+                                                 });
+                                        }),
+                         this->entries_.end());
+  }
+  if (!lost.empty()) {
+    ESP_LOGW(TAG, "%u messages not delivered over either link", (unsigned) lost.size());
+  }
+
+  // Ta sama wiadomość z tym samym identyfikatorem przez LoRa; kopia ESP-NOW przestaje być ponawiana
+  for (auto &entry : moved) {
+    const FailoverPeer &peer = this->peers_[entry.peer];
+    this->espnow_->cancel(peer.espnow_mac, entry.id);
+    const auto result = this->lora_->send_frame(
+        reliable::build_frame<lora::LoRaTransport>(peer.lora_mac, this->make_header(entry.id), entry.payload.data(),
+                                                   entry.payload.size()),
+        peer.lora_mac, entry.priority);
+    if (!reliable::is_enqueued(result)) {
+      std::lock_guard<reliable::FreeRtosMutex> lock(this->mutex_);
+      this->entries_.erase(
+          std::remove_if(this->entries_.begin(), this->entries_.end(),
+                         [&](const FailoverEntry &e) { return e.peer == entry.peer && e.id == entry.id; }),
+          this->entries_.end());
+    }
+  }
+
+  for (auto &delivery : inbox) {
+    this->on_message_callback_.call(delivery.mac, std::move(delivery.payload));
+  }
+}
+
+EnqueueResult BasicFailover::send(const std::vector<uint8_t> &msg, const std::array<uint8_t, 6> &mac,
+                                  uint8_t priority) {
+  const int index = this->find_peer(false, mac);
+  if (index < 0) {
+    ESP_LOGW(TAG, "%02X:%02X:%02X:%02X:%02X:%02X is not a failover peer", mac[0], mac[1], mac[2], mac[3], mac[4],
+             mac[5]);
+    return reliable::ENQUEUE_REJECTED;
+  }
+  if (msg.size() > MAX_PAYLOAD) {
+    ESP_LOGW(TAG, "Message of %u bytes too long (max %u)", (unsigned) msg.size(), (unsigned) MAX_PAYLOAD);
+    return reliable::ENQUEUE_REJECTED;
+  }
+  const FailoverPeer &peer = this->peers_[index];
+  const int64_t now = esp_timer_get_time();
+  const MessageId id = this->espnow_->generate_message_id();
+  const reliable::FrameHeader header = this->make_header(id);
+
+  FailoverPath path = PATH_ESPNOW;
+  {
+    std::lock_guard<reliable::FreeRtosMutex> lock(this->mutex_);
+    if (this->entries_.size() >= this->max_pending_) {
+      return reliable::ENQUEUE_REJECTED;
+    }
+    FailoverPeer &state = this->peers_[index];
+    if (state.degraded) {
+      if (now >= state.next_probe) {
+        state.next_probe = now + this->probe_interval_us_;  // ta wiadomość sprawdza, czy ESP-NOW wróciło
+      } else {
+        path = PATH_LORA;
+      }
+    }
+    // Wpis przed wysłaniem - ACK może przyjść, zanim send_frame wróci
+    this->entries_.push_back({uint8_t(index), id, path, priority, now + this->failover_timeout_us_,
+                              path == PATH_ESPNOW ? msg : std::vector<uint8_t>{}});
+  }
+
+  if (path == PATH_ESPNOW) {
+    const auto result = this->espnow_->send_frame(
+        reliable::build_frame<espnow::EspNowTransport>(peer.espnow_mac, header, msg.data(), msg.size()),
+        peer.espnow_mac, priority);
+    if (reliable::is_enqueued(result)) {
+      return result;
+    }
+    // ESP-NOW nie przyjęło wiadomości (pełna kolejka, peer niedostępny) - od razu LoRa
+    std::lock_guard<reliable::FreeRtosMutex> lock(this->mutex_);
+    for (auto &entry : this->entries_) {
+      if (entry.peer == index && entry.id == id) {
+        entry.path = PATH_LORA;
+        entry.payload.clear();
+        break;
+      }
+    }
+    this->failover_count_++;
+  }
+
+  const auto result = this->lora_->send_frame(
+      reliable::build_frame<lora::LoRaTransport>(peer.lora_mac, header, msg.data(), msg.size()), peer.lora_mac,
+      priority);
+  if (!reliable::is_enqueued(result)) {
+    std::lock_guard<reliable::FreeRtosMutex> lock(this->mutex_);
+    this->entries_.erase(std::remove_if(this->entries_.begin(), this->entries_.end(),
+                                        [&](const FailoverEntry &e) { return e.peer == index && e.id == id; }),
+                         this->entries_.end());
+  }
+  return result;
+}
+
+bool BasicFailover::is_degraded(const std::array<uint8_t, 6> &mac) {
+  const int index = this->find_peer(false, mac);
+  std::lock_guard<reliable::FreeRtosMutex> lock(this->mutex_);
+  return index >= 0 && this->peers_[index].degraded;
+}
+
+bool BasicFailover::on_frame(bool via_lora, const std::array<uint8_t, 6> &src, const reliable::FrameHeader &header,
+                             const uint8_t *payload, size_t len) {
+  if (header.type != reliable::FRAME_TOPIC || header.topic != this->topic_) {
+    return false;
+  }
+  const int index = this->find_peer(via_lora, src);
+  if (index < 0) {
+    return false;  // temat od urządzenia spoza listy - zwykłe dostarczenie
+  }
+
+  const int64_t now = esp_timer_get_time();
+  {
+    std::lock_guard<reliable::FreeRtosMutex> lock(this->mutex_);
+    if (!via_lora) {
+      this->recover_locked(this->peers_[index]);
+    }
+    // Ta sama wiadomość mogła już przyjść drugim radiem - wtedy tylko ACK
+    if (this->delivered_.contains(uint8_t(index), header.id, now)) {
+      this->duplicate_count_++;
+    } else if (this->inbox_.size() >= MAX_INBOX) {
+      return true;  // bez ACK - nadawca powtórzy, gdy loop() opróżni kolejkę
+    } else {
+      this->delivered_.remember(uint8_t(index), header.id, now);
+      this->inbox_.push_back({this->peers_[index].espnow_mac, std::vector<uint8_t>(payload, payload + len)});
+    }
+  }
+
+  if (via_lora) {
+    this->lora_->acknowledge(src, header.id, header.qos);
+  } else {
+    this->espnow_->acknowledge(src, header.id, header.qos);
+  }
+  return true;
+}
+
+void BasicFailover::on_espnow_ack(const std::array<uint8_t, 6> &mac, const MessageId &id) {
+  const int index = this->find_peer(false, mac);
+  if (index < 0) {
+    return;
+  }
+  bool cancel_lora = false;
+  {
+    std::lock_guard<reliable::FreeRtosMutex> lock(this->mutex_);
+    this->recover_locked(this->peers_[index]);
+    auto it = std::find_if(this->entries_.begin(), this->entries_.end(),
+                           [&](const FailoverEntry &e) { return e.peer == index && e.id == id; });
+    if (it == this->entries_.end()) {
+      return;
+    }
+    // ACK spóźnionej kopii ESP-NOW - kopia LoRa jest już zbędna
+    cancel_lora = it->path == PATH_LORA;
+    this->entries_.erase(it);
+  }
+  if (cancel_lora) {
+    this->lora_->cancel(this->peers_[index].lora_mac, id);
+  }
+}
+
+void BasicFailover::on_lora_ack(const std::array<uint8_t, 6> &mac, const MessageId &id) {
+  const int index = this->find_peer(true, mac);
+  if (index < 0) {
+    return;
+  }
+  std::lock_guard<reliable::FreeRtosMutex> lock(this->mutex_);
+  this->entries_.erase(std::remove_if(this->entries_.begin(), this->entries_.end(),
+                                      [&](const FailoverEntry &e) {
+                                        return e.peer == index && e.id == id && e.path == PATH_LORA;
+                                      }),
+                       this->entries_.end());
+}
+
+int BasicFailover::find_peer(bool lora, const std::array<uint8_t, 6> &mac) const {
+  for (size_t i = 0; i < this->peers_.size(); i++) {
+    if ((lora ? this->peers_[i].lora_mac : this->peers_[i].espnow_mac) == mac) {
+      return int(i);
+    }
+  }
+  return -1;
+}
+
+void BasicFailover::recover_locked(FailoverPeer &peer) {
+  if (peer.degraded) {
+    ESP_LOGI(TAG, "%02X:%02X:%02X:%02X:%02X:%02X: ESP-NOW is back", peer.espnow_mac[0], peer.espnow_mac[1],
+             peer.espnow_mac[2], peer.espnow_mac[3], peer.espnow_mac[4], peer.espnow_mac[5]);
+    peer.degraded = false;
+  }
+}
+
+reliable::FrameHeader BasicFailover::make_header(const MessageId &id) const {
+  reliable::FrameHeader header;
+  header.type = reliable::FRAME_TOPIC;
+  header.id = id;
+  header.topic = this->topic_;
+  return header;
+}
+
+}  // namespace failover
+}  // namespace esphome
@@ -0,0 +1,120 @@
+#pragma once
+
+#include "esphome/core/automation.h"
+#include "esphome/core/component.h"
+#include "esphome/components/basic_espnowex/basic_espnowex.h"
+#include "esphome/components/basic_loraex/basic_loraex.h"
+#include "esphome/components/basic_reliable/freertos_mutex.h"
+#include "delivered_history.h"
+
+#include <array>
+#include <string>
+#include <vector>
+
+namespace esphome {
+namespace failover {
+
+using reliable::EnqueueResult;
+using reliable::MessageId;
+
+// Urządzenie osiągalne obydwoma radiami. Tożsamością dla aplikacji jest adres ESP-NOW.
+struct FailoverPeer {
+  std::array<uint8_t, 6> espnow_mac;
+  std::array<uint8_t, 6> lora_mac;
+  bool degraded;       // ESP-NOW zawiodło - wiadomości idą od razu przez LoRa
+  int64_t next_probe;  // kiedy kolejna wiadomość spróbuje znowu ESP-NOW
+};
+
+enum FailoverPath : uint8_t {
+  PATH_ESPNOW = 0,  // czeka na ACK przez ESP-NOW do upływu terminu
+  PATH_LORA,        // przełączona na LoRa (albo wysłana nią od razu)
+};
+
+// Wiadomość w drodze. Ten sam identyfikator na obu radiach - odbiorca rozpoznaje po nim kopię.
+struct FailoverEntry {
+  uint8_t peer;
+  MessageId id;
+  FailoverPath path;
+  uint8_t priority;
+  int64_t deadline;
+  std::vector<uint8_t> payload;  // tylko PATH_ESPNOW - do ponownego wysłania przez LoRa
+};
+
+struct FailoverDelivery {
+  std::array<uint8_t, 6> mac;
+  std::vector<uint8_t> payload;
+};
+
+class BasicFailover : public Component {
+ public:
+  void setup() override;
+  void loop() override;
+  float get_setup_priority() const override { return setup_priority::DATA; }
+
+  void set_espnow(espnow::BasicESPNowEx *espnow) { this->espnow_ = espnow; }
+  void set_lora(lora::BasicLoRaEx *lora) { this->lora_ = lora; }
+  void add_peer(std::array<uint8_t, 6> espnow_mac, std::array<uint8_t, 6> lora_mac) {
+    this->peers_.push_back({espnow_mac, lora_mac, false, 0});
+  }
+  // Termin na ACK przez ESP-NOW, po którym wiadomość idzie przez LoRa
+  void set_failover_timeout(uint32_t timeout_ms) { this->failover_timeout_us_ = int64_t(timeout_ms) * 1000; }
+  // Jak często peer przełączony na LoRa dostaje próbę przez ESP-NOW
+  void set_probe_interval(uint32_t interval_ms) { this->probe_interval_us_ = int64_t(interval_ms) * 1000; }
+  void set_max_pending(size_t max_pending) { this->max_pending_ = max_pending; }
+
+  // Wysyłka do peera po jego adresie ESP-NOW (QoS 1). Najpierw ESP-NOW, po terminie LoRa.
+  EnqueueResult send(const std::vector<uint8_t> &msg, const std::array<uint8_t, 6> &mac, uint8_t priority = 0);
+  EnqueueResult send_str(const std::string &message, const std::array<uint8_t, 6> &mac, uint8_t priority = 0) {
+    return this->send(std::vector<uint8_t>(message.begin(), message.end()), mac, priority);
+  }
+  bool is_degraded(const std::array<uint8_t, 6> &mac);
+  uint32_t get_failover_count() const { return this->failover_count_; }
+  uint32_t get_duplicate_count() const { return this->duplicate_count_; }
+
+  // Odebrane wiadomości (z pętli komponentu), adres ESP-NOW nadawcy niezależnie od radia
+  void add_on_message_callback(std::function<void(std::array<uint8_t, 6>, std::vector<uint8_t>)> &&cb) {
+    this->on_message_callback_.add(std::move(cb));
+  }
+
+ protected:
+  // ESP-NOW: z recv_cb (zadanie WiFi), LoRa: z loop() basic_loraex
+  bool on_frame(bool via_lora, const std::array<uint8_t, 6> &src, const reliable::FrameHeader &header,
+                const uint8_t *payload, size_t len);
+  void on_espnow_ack(const std::array<uint8_t, 6> &mac, const MessageId &id);
+  void on_lora_ack(const std::array<uint8_t, 6> &mac, const MessageId &id);
+
+  int find_peer(bool lora, const std::array<uint8_t, 6> &mac) const;
+  void recover_locked(FailoverPeer &peer);
+  reliable::FrameHeader make_header(const MessageId &id) const;
+
+  espnow::BasicESPNowEx *espnow_{nullptr};
+  lora::BasicLoRaEx *lora_{nullptr};
+  std::vector<FailoverPeer> peers_;
+  uint16_t topic_{reliable::topic_hash("basic_failover")};
+
+  std::vector<FailoverEntry> entries_;
+  // Wiadomości dostarczone lokalnie - deduplikacja niezależna od radia, którym przyszły
+  DeliveredHistory<MessageId> delivered_;
+  std::vector<FailoverDelivery> inbox_;
+  reliable::FreeRtosMutex mutex_;
+
+  int64_t failover_timeout_us_{150000};
+  int64_t probe_interval_us_{10000000};
+  size_t max_pending_{16};
+
+  uint32_t failover_count_{0};
+  uint32_t duplicate_count_{0};
+
+  CallbackManager<void(std::array<uint8_t, 6>, std::vector<uint8_t>)> on_message_callback_;
+};
+
+class OnMessageTrigger : public Trigger<std::array<uint8_t, 6>, std::vector<uint8_t>> {
+ public:
+  explicit OnMessageTrigger(BasicFailover *parent) {
+    parent->add_on_message_callback(
+        [this](std::array<uint8_t, 6> mac, std::vector<uint8_t> data) { this->trigger(mac, data); });
+  }
+};
+
+}  // namespace failover
+}  // namespace esphome
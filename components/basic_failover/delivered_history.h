@@ -0,0 +1,62 @@
+#pragma once
+
+// Historia wiadomości dostarczonych przez basic_failover - rozpoznaje kopię, która przyszła drugim radiem.
+// Bez zależności od ESP-IDF, testowana na hoście (tests/).
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+
+namespace esphome {
+namespace failover {
+
+template<typename Id> struct DeliveredId {
+  uint8_t peer;
+  Id id;
+  int64_t timestamp;
+};
+
+// Identyfikator żyje tak długo, jak kopia może jeszcze przyjść drugim radiem: termin przełączenia na LoRa
+// plus wszystkie próby LoRa. Liczba wiadomości w tym czasie nie ma znaczenia - limit pamięci tylko chroni
+// przed zalewem: po jego przekroczeniu najstarszy identyfikator jest zapominany, a jego spóźniona kopia
+// zostałaby dostarczona drugi raz (QoS 1 na to pozwala), zamiast wstrzymywać nowe wiadomości bez ACK.
+template<typename Id> class DeliveredHistory {
+ public:
+  void set_ttl_us(int64_t ttl_us) { this->ttl_us_ = ttl_us; }
+  void set_capacity(size_t capacity) { this->capacity_ = std::max<size_t>(capacity, 1); }
+
+  bool contains(uint8_t peer, const Id &id, int64_t now) {
+    this->expire(now);
+    return std::any_of(this->entries_.begin(), this->entries_.end(),
+                       [&](const DeliveredId<Id> &d) { return d.peer == peer && d.id == id; });
+  }
+  void remember(uint8_t peer, const Id &id, int64_t now) {
+    this->expire(now);
+    if (this->entries_.size() >= this->capacity_) {
+      this->entries_.pop_front();
+      this->evicted_count_++;
+    }
+    this->entries_.push_back({peer, id, now});
+  }
+
+  size_t size() const { return this->entries_.size(); }
+  int64_t get_ttl_us() const { return this->ttl_us_; }
+  uint32_t get_evicted_count() const { return this->evicted_count_; }
+
+ protected:
+  // Wpisy dopisywane w kolejności czasu - wygasłe są zawsze na początku
+  void expire(int64_t now) {
+    while (!this->entries_.empty() && now - this->entries_.front().timestamp > this->ttl_us_) {
+      this->entries_.pop_front();
+    }
+  }
+
+  std::deque<DeliveredId<Id>> entries_;
+  int64_t ttl_us_{0};
+  size_t capacity_{1};
+  uint32_t evicted_count_{0};
+};
+
+}  // namespace failover
+}  // namespace esphome
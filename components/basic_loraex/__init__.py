@@ -1,17 +1,26 @@
 import esphome.codegen as cg
 import esphome.config_validation as cv
 from esphome.const import (
-    CONF_ID, CONF_TRIGGER_ID, CONF_FREQUENCY, 
+    CONF_ID, CONF_NAME, CONF_TRIGGER_ID, CONF_FREQUENCY, 
     CONF_CS_PIN, CONF_RST_PIN, CONF_SPI_ID
 )
 from esphome import automation, pins
 from esphome.components import spi
+from esphome.components.basic_reliable import (
+    CONF_MAILBOX, CONF_MESSAGES, CONF_ON_TOPIC, CONF_PEER_HEALTH, CONF_RECEIVE_WINDOW, MAILBOX_SCHEMA,
+    OVERFLOW_POLICIES, PEER_HEALTH_SCHEMA, RECEIVE_WINDOW_SCHEMA, SendAction, SendCmdAction, SendMessageAction,
+    mac_expression, mailbox_to_code, message_size, message_triggers_to_code, messages_schema,
+    messages_structs_to_code, on_topic_schema, peer_health_to_code, send_action_schema, send_action_to_code,
+    send_cmd_action_schema, send_cmd_action_to_code, send_message_action_schema, send_message_action_to_code,
+    topic_triggers_to_code
+)
 
 # Dodanie definicji std_array, której brakuje w codegen
 std_array = cg.std_ns.class_("array")
 cg.std_array = std_array
 
 DEPENDENCIES = ["spi"]
+AUTO_LOAD = ["basic_reliable"]
 
 basic_loraex_ns = cg.esphome_ns.namespace("lora")
 BasicLoRaEx = basic_loraex_ns.class_("BasicLoRaEx", cg.Component, spi.SPIDevice)
@@ -40,6 +49,12 @@ OnRecvDataTrigger = basic_loraex_ns.class_(
     cg.Component,
 )
 
+OnTopicTrigger = basic_loraex_ns.class_(
+    "OnTopicTrigger",
+    automation.Trigger.template(cg.std_array.template(cg.uint8, 6), cg.std_vector.template(cg.uint8)),
+    cg.Component,
+)
+
 # Konfiguracja pinów LoRa
 CONF_DIO0_PIN = "dio0_pin"
 CONF_DIO1_PIN = "dio1_pin"
@@ -54,15 +69,73 @@ CONF_SYNC_WORD = "sync_word"
 CONF_PREAMBLE_LENGTH = "preamble_length"
 CONF_ENABLE_CRC = "enable_crc"
 CONF_IMPLICIT_HEADER = "implicit_header"
+CONF_PAYLOAD_LENGTH = "payload_length"
 
 # Parametry komunikacji
 CONF_PEER_MAC = "peer_mac"
 CONF_MAX_RETRIES = "max_retries"
 CONF_TIMEOUT_US = "timeout_us"
+CONF_MAX_QUEUE_MESSAGES = "max_queue_messages"
+CONF_MAX_QUEUE_BYTES = "max_queue_bytes"
+CONF_OVERFLOW_POLICY = "overflow_policy"
 CONF_ON_MESSAGE = "on_message"
 CONF_ON_RECV_DATA = "on_recv_data"
 CONF_ON_RECV_ACK = "on_recv_ack"
 CONF_ON_RECV_CMD = "on_recv_cmd"
+# MAX_PACKET_SIZE (255) minus nagłówek ramki tematu przy największym address_size (10)
+MESSAGE_MAX_SIZE = 245
+
+# Limity wypełnienia (duty cycle)
+CONF_DUTY_CYCLE = "duty_cycle"
+CONF_REGION = "region"
+CONF_SUB_BANDS = "sub_bands"
+CONF_MIN_FREQUENCY = "min_frequency"
+CONF_MAX_FREQUENCY = "max_frequency"
+CONF_LIMIT = "limit"
+CONF_WINDOW = "window"
+
+# ADR - adaptacyjny SF nasłuchu i moc do peerów
+CONF_ADR = "adr"
+CONF_MIN_SPREADING_FACTOR = "min_spreading_factor"
+CONF_MAX_SPREADING_FACTOR = "max_spreading_factor"
+CONF_MARGIN = "margin"
+CONF_MIN_TX_POWER = "min_tx_power"
+CONF_REPORT_INTERVAL = "report_interval"
+CONF_FALLBACK_LOSSES = "fallback_losses"
+
+# Krótkie adresy węzłów w nagłówku ramki
+CONF_NODE_ID = "node_id"
+CONF_ADDRESS_SIZE = "address_size"
+CONF_NODES = "nodes"
+CONF_MAC_ADDRESS = "mac_address"
+
+# Plan kanałów i skakanie po częstotliwościach
+CONF_CHANNELS = "channels"
+CONF_FREQUENCIES = "frequencies"
+CONF_HOPPING = "hopping"
+ChannelHopping = basic_loraex_ns.enum("ChannelHopping")
+CHANNEL_HOPPING = {
+    "random": ChannelHopping.HOP_RANDOM,
+    "sequence": ChannelHopping.HOP_SEQUENCE,
+}
+
+# Nasłuch przed nadaniem (CAD)
+CONF_LISTEN_BEFORE_TALK = "listen_before_talk"
+CONF_BACKOFF = "backoff"
+CONF_MAX_ATTEMPTS = "max_attempts"
+
+# ETSI EN 300 220: pod-pasma SRD (Hz, limit w setnych procenta)
+DUTY_CYCLE_REGIONS = {
+    "eu433": [(433050000, 434790000, 1000)],
+    "eu868": [
+        (863000000, 865000000, 10),
+        (865000000, 868000000, 100),
+        (868000000, 868600000, 100),
+        (868700000, 869200000, 10),
+        (869400000, 869650000, 1000),
+        (869700000, 870000000, 100),
+    ],
+}
 
 def validate_frequency(value):
     """Walidacja częstotliwości LoRa"""
@@ -89,12 +162,160 @@ def validate_coding_rate(value):
     cr = cv.int_range(min=5, max=8)(value)
     return cr
 
+def validate_sub_band(config):
+    if config[CONF_MIN_FREQUENCY] >= config[CONF_MAX_FREQUENCY]:
+        raise cv.Invalid("min_frequency must be below max_frequency")
+    return config
+
+
+DUTY_CYCLE_SCHEMA = cv.All(
+    cv.Schema({
+        cv.Optional(CONF_REGION): cv.one_of(*DUTY_CYCLE_REGIONS, lower=True),
+        cv.Optional(CONF_SUB_BANDS): cv.ensure_list(cv.All(cv.Schema({
+            cv.Required(CONF_MIN_FREQUENCY): validate_frequency,
+            cv.Required(CONF_MAX_FREQUENCY): validate_frequency,
+            cv.Required(CONF_LIMIT): cv.All(cv.percentage, cv.Range(min=0.0001, max=1.0)),
+        }), validate_sub_band)),
+        cv.Optional(CONF_WINDOW, default="1h"): cv.All(
+            cv.positive_time_period_milliseconds, cv.Range(min=cv.TimePeriod(seconds=1), max=cv.TimePeriod(hours=24))
+        ),
+    }),
+    cv.has_at_least_one_key(CONF_REGION, CONF_SUB_BANDS),
+)
+
+
+def duty_cycle_to_code(var, config):
+    bands = list(DUTY_CYCLE_REGIONS.get(config.get(CONF_REGION), []))
+    # Własne pod-pasma mają pierwszeństwo przed regionem (pierwsze pasujące wiadro)
+    bands[:0] = [
+        (band[CONF_MIN_FREQUENCY], band[CONF_MAX_FREQUENCY], max(1, round(band[CONF_LIMIT] * 10000)))
+        for band in config.get(CONF_SUB_BANDS, [])
+    ]
+    cg.add(var.set_duty_cycle_window(config[CONF_WINDOW]))
+    for min_frequency, max_frequency, limit_bp in bands:
+        cg.add(var.add_duty_cycle_band(min_frequency, max_frequency, limit_bp))
+
+
+def validate_channel_plan(config):
+    if len(set(config[CONF_FREQUENCIES])) != len(config[CONF_FREQUENCIES]):
+        raise cv.Invalid("channels: frequencies must be unique")
+    return config
+
+
+CHANNELS_SCHEMA = cv.All(
+    cv.Schema({
+        cv.Required(CONF_FREQUENCIES): cv.All(cv.ensure_list(validate_frequency), cv.Length(min=2, max=16)),
+        cv.Optional(CONF_HOPPING, default="random"): cv.enum(CHANNEL_HOPPING, lower=True),
+    }),
+    validate_channel_plan,
+)
+
+
+def validate_channels(config):
+    if CONF_CHANNELS not in config:
+        return config
+    # Odbiornik skanuje kanały CAD-em (~2 symbole na kanał) - preambuła musi przetrwać pełny obieg
+    # skanu i jeszcze zsynchronizować odbiór
+    min_preamble = 2 * (len(config[CONF_CHANNELS][CONF_FREQUENCIES]) + 1) + 6
+    if config[CONF_PREAMBLE_LENGTH] < min_preamble:
+        raise cv.Invalid(f"channels: preamble_length must be at least {min_preamble} to cover a channel scan")
+    return config
+
+
+LISTEN_BEFORE_TALK_SCHEMA = cv.Schema({
+    cv.Optional(CONF_BACKOFF, default="100ms"): cv.All(
+        cv.positive_time_period_milliseconds,
+        cv.Range(min=cv.TimePeriod(milliseconds=1), max=cv.TimePeriod(seconds=10)),
+    ),
+    cv.Optional(CONF_MAX_ATTEMPTS, default=6): cv.int_range(min=1, max=15),
+})
+
+
+# SF6 wymaga nagłówka niejawnego - ADR działa na SF7-SF12
+ADR_SCHEMA = cv.Schema({
+    cv.Optional(CONF_MIN_SPREADING_FACTOR, default=7): cv.int_range(min=7, max=12),
+    cv.Optional(CONF_MAX_SPREADING_FACTOR, default=12): cv.int_range(min=7, max=12),
+    cv.Optional(CONF_MARGIN, default=10): cv.int_range(min=0, max=30),
+    cv.Optional(CONF_MIN_TX_POWER, default=2): cv.int_range(min=2, max=20),
+    cv.Optional(CONF_REPORT_INTERVAL, default="60s"): cv.All(
+        cv.positive_time_period_milliseconds, cv.Range(min=cv.TimePeriod(seconds=5))
+    ),
+    cv.Optional(CONF_FALLBACK_LOSSES, default=3): cv.int_range(min=1, max=20),
+})
+
+
+def validate_adr(config):
+    if CONF_ADR not in config:
+        return config
+    adr = config[CONF_ADR]
+    if adr[CONF_MIN_SPREADING_FACTOR] > adr[CONF_MAX_SPREADING_FACTOR]:
+        raise cv.Invalid("adr: min_spreading_factor must not exceed max_spreading_factor")
+    if not adr[CONF_MIN_SPREADING_FACTOR] <= config[CONF_SPREADING_FACTOR] <= adr[CONF_MAX_SPREADING_FACTOR]:
+        raise cv.Invalid("spreading_factor must lie within the adr spreading factor range")
+    if adr[CONF_MIN_TX_POWER] > config[CONF_TX_POWER]:
+        raise cv.Invalid("adr: min_tx_power must not exceed tx_power")
+    return config
+
+
+NODE_SCHEMA = cv.Schema({
+    cv.Required(CONF_MAC_ADDRESS): cv.mac_address,
+    cv.Required(CONF_NODE_ID): cv.int_range(min=1, max=65534),
+})
+
+
+def validate_addresses(config):
+    # Identyfikator z samymi jedynkami to broadcast
+    max_id = 254 if config[CONF_ADDRESS_SIZE] == 1 else 65534
+    if config[CONF_NODE_ID] > max_id:
+        raise cv.Invalid(f"node_id must not exceed {max_id} with address_size {config[CONF_ADDRESS_SIZE]}")
+    macs = set()
+    ids = set()
+    for node in config[CONF_NODES]:
+        mac = node[CONF_MAC_ADDRESS].to_string()
+        if node[CONF_NODE_ID] > max_id:
+            raise cv.Invalid(f"nodes: node_id {node[CONF_NODE_ID]} exceeds {max_id}")
+        if mac in macs or node[CONF_NODE_ID] in ids:
+            raise cv.Invalid(f"nodes: duplicate entry for {mac} / {node[CONF_NODE_ID]}")
+        macs.add(mac)
+        ids.add(node[CONF_NODE_ID])
+    return config
+
+
+def validate_implicit_header(config):
+    if config[CONF_SPREADING_FACTOR] == 6 and not config[CONF_IMPLICIT_HEADER]:
+        raise cv.Invalid("spreading_factor 6 requires implicit_header")
+    if not config[CONF_IMPLICIT_HEADER]:
+        return config
+    if CONF_PAYLOAD_LENGTH not in config:
+        raise cv.Invalid("implicit_header requires payload_length")
+    # Bajt długości + nagłówek tematu (cel, nadawca, typ, id, temat) - mniejsza ramka nie zmieści tematu
+    min_length = 1 + 2 * config[CONF_ADDRESS_SIZE] + 6
+    if config[CONF_PAYLOAD_LENGTH] < min_length:
+        raise cv.Invalid(f"payload_length must be at least {min_length} with address_size {config[CONF_ADDRESS_SIZE]}")
+    for message in config[CONF_MESSAGES]:
+        if min_length + message_size(message) > config[CONF_PAYLOAD_LENGTH]:
+            raise cv.Invalid(
+                f"Message '{message[CONF_NAME]}' takes {message_size(message)} bytes, "
+                f"at most {config[CONF_PAYLOAD_LENGTH] - min_length} fit in payload_length {config[CONF_PAYLOAD_LENGTH]}"
+            )
+    return config
+
+
+def adr_to_code(var, config):
+    cg.add(var.set_adr(True))
+    cg.add(var.set_adr_spreading_factor_range(config[CONF_MIN_SPREADING_FACTOR], config[CONF_MAX_SPREADING_FACTOR]))
+    cg.add(var.set_adr_margin(config[CONF_MARGIN]))
+    cg.add(var.set_adr_min_tx_power(config[CONF_MIN_TX_POWER]))
+    cg.add(var.set_adr_report_interval(config[CONF_REPORT_INTERVAL]))
+    cg.add(var.set_adr_fallback_losses(config[CONF_FALLBACK_LOSSES]))
+
+
 CONFIG_SCHEMA = cv.All(
     cv.Schema({
         cv.GenerateID(): cv.declare_id(BasicLoRaEx),
         cv.Required(CONF_CS_PIN): pins.gpio_output_pin_schema,
-        cv.Required(CONF_DIO0_PIN): pins.gpio_input_pin_schema,
-        cv.Optional(CONF_DIO1_PIN): pins.gpio_input_pin_schema,
+        cv.Required(CONF_DIO0_PIN): pins.internal_gpio_input_pin_schema,
+        cv.Optional(CONF_DIO1_PIN): pins.internal_gpio_input_pin_schema,
         cv.Optional(CONF_DIO2_PIN): pins.gpio_input_pin_schema,
         cv.Optional(CONF_RST_PIN): pins.gpio_output_pin_schema,
         
@@ -108,11 +329,26 @@ CONFIG_SCHEMA = cv.All(
         cv.Optional(CONF_PREAMBLE_LENGTH, default=8): cv.positive_int,
         cv.Optional(CONF_ENABLE_CRC, default=True): cv.boolean,
         cv.Optional(CONF_IMPLICIT_HEADER, default=False): cv.boolean,
+        cv.Optional(CONF_PAYLOAD_LENGTH): cv.int_range(min=1, max=255),
+        cv.Optional(CONF_DUTY_CYCLE): DUTY_CYCLE_SCHEMA,
+        cv.Optional(CONF_ADR): ADR_SCHEMA,
+        cv.Optional(CONF_LISTEN_BEFORE_TALK): LISTEN_BEFORE_TALK_SCHEMA,
+        cv.Optional(CONF_CHANNELS): CHANNELS_SCHEMA,
         
         # Parametry komunikacji (zgodność z ESP-NOW)
+        cv.Required(CONF_NODE_ID): cv.int_range(min=1, max=65534),
+        cv.Optional(CONF_ADDRESS_SIZE, default=1): cv.int_range(min=1, max=2),
+        cv.Optional(CONF_NODES, default=[]): cv.ensure_list(NODE_SCHEMA),
         cv.Optional(CONF_PEER_MAC): cv.mac_address,
         cv.Optional(CONF_MAX_RETRIES, default=5): cv.positive_int,
         cv.Optional(CONF_TIMEOUT_US, default=200000): cv.positive_int,
+        cv.Optional(CONF_MAX_QUEUE_MESSAGES, default=16): cv.int_range(min=1, max=1024),
+        cv.Optional(CONF_MAX_QUEUE_BYTES, default=2048): cv.int_range(min=256),
+        cv.Optional(CONF_OVERFLOW_POLICY, default="drop_oldest"): cv.enum(OVERFLOW_POLICIES, lower=True),
+        cv.Optional(CONF_PEER_HEALTH, default={}): PEER_HEALTH_SCHEMA,
+        cv.Optional(CONF_RECEIVE_WINDOW, default=0): RECEIVE_WINDOW_SCHEMA,
+        cv.Optional(CONF_MAILBOX): MAILBOX_SCHEMA,
+        cv.Optional(CONF_MESSAGES, default=[]): messages_schema(MESSAGE_MAX_SIZE),
         
         # Triggery automatyzacji
         cv.Optional(CONF_ON_MESSAGE): automation.validate_automation({
@@ -127,12 +363,18 @@ CONFIG_SCHEMA = cv.All(
         cv.Optional(CONF_ON_RECV_CMD): automation.validate_automation({
             cv.GenerateID(CONF_TRIGGER_ID): cv.declare_id(OnRecvCmdTrigger)
         }),
+        cv.Optional(CONF_ON_TOPIC): on_topic_schema(OnTopicTrigger),
     })
     .extend(cv.COMPONENT_SCHEMA)
-    .extend(spi.spi_device_schema())
+    .extend(spi.spi_device_schema()),
+    validate_adr,
+    validate_addresses,
+    validate_implicit_header,
+    validate_channels,
 )
 
 async def to_code(config):
+    messages_structs_to_code(basic_loraex_ns, config[CONF_MESSAGES])
     var = cg.new_Pvariable(config[CONF_ID])
     await cg.register_component(var, config)
     await spi.register_spi_device(var, config)
@@ -166,16 +408,39 @@ async def to_code(config):
     cg.add(var.set_preamble_length(config[CONF_PREAMBLE_LENGTH]))
     cg.add(var.set_enable_crc(config[CONF_ENABLE_CRC]))
     cg.add(var.set_implicit_header(config[CONF_IMPLICIT_HEADER]))
+    if CONF_PAYLOAD_LENGTH in config:
+        cg.add(var.set_payload_length(config[CONF_PAYLOAD_LENGTH]))
+    if CONF_DUTY_CYCLE in config:
+        duty_cycle_to_code(var, config[CONF_DUTY_CYCLE])
+    if CONF_ADR in config:
+        adr_to_code(var, config[CONF_ADR])
+    if CONF_LISTEN_BEFORE_TALK in config:
+        lbt = config[CONF_LISTEN_BEFORE_TALK]
+        cg.add(var.set_lbt(True))
+        cg.add(var.set_lbt_backoff(lbt[CONF_BACKOFF]))
+        cg.add(var.set_lbt_max_attempts(lbt[CONF_MAX_ATTEMPTS]))
+    if CONF_CHANNELS in config:
+        for frequency in config[CONF_CHANNELS][CONF_FREQUENCIES]:
+            cg.add(var.add_channel(frequency))
+        cg.add(var.set_channel_hopping(config[CONF_CHANNELS][CONF_HOPPING]))
 
     # Parametry komunikacji
+    cg.add(var.set_node_id(config[CONF_NODE_ID]))
+    cg.add(var.set_address_size(config[CONF_ADDRESS_SIZE]))
+    for node in config[CONF_NODES]:
+        cg.add(var.add_node(mac_expression(node[CONF_MAC_ADDRESS]), node[CONF_NODE_ID]))
     if CONF_PEER_MAC in config:
-        mac_str = config[CONF_PEER_MAC].to_string()
-        mac_ints = [int(x, 16) for x in mac_str.split(":")]
-        mac_expr = cg.RawExpression(f"std::array<uint8_t, 6>{{{', '.join(map(str, mac_ints))}}}")
-        cg.add(var.set_peer_mac(mac_expr))
+        cg.add(var.set_peer_mac(mac_expression(config[CONF_PEER_MAC])))
 
     cg.add(var.set_max_retries(config[CONF_MAX_RETRIES]))
     cg.add(var.set_timeout_us(config[CONF_TIMEOUT_US]))
+    cg.add(var.set_max_queue_messages(config[CONF_MAX_QUEUE_MESSAGES]))
+    cg.add(var.set_max_queue_bytes(config[CONF_MAX_QUEUE_BYTES]))
+    cg.add(var.set_overflow_policy(config[CONF_OVERFLOW_POLICY]))
+    peer_health_to_code(var, config[CONF_PEER_HEALTH])
+    cg.add(var.set_receive_window(config[CONF_RECEIVE_WINDOW]))
+    if CONF_MAILBOX in config:
+        mailbox_to_code(var, config[CONF_MAILBOX])
 
     # Triggery automatyzacji
     for conf in config.get(CONF_ON_MESSAGE, []):
@@ -210,4 +475,26 @@ async def to_code(config):
             conf,
         )
 
+    await topic_triggers_to_code(var, config.get(CONF_ON_TOPIC, []))
+    await message_triggers_to_code(var, BasicLoRaEx, basic_loraex_ns, config[CONF_MESSAGES])
+
     return var
+
+
+@automation.register_action("basic_loraex.send", SendAction, send_action_schema(BasicLoRaEx))
+async def send_to_code(config, action_id, template_arg, args):
+    return await send_action_to_code(config, action_id, template_arg, args, BasicLoRaEx)
+
+
+@automation.register_action("basic_loraex.send_cmd", SendCmdAction, send_cmd_action_schema(BasicLoRaEx))
+async def send_cmd_to_code(config, action_id, template_arg, args):
+    return await send_cmd_action_to_code(config, action_id, template_arg, args, BasicLoRaEx)
+
+
+@automation.register_action(
+    "basic_loraex.send_message", SendMessageAction, send_message_action_schema(BasicLoRaEx)
+)
+async def send_message_to_code(config, action_id, template_arg, args):
+    return await send_message_action_to_code(
+        config, action_id, template_arg, args, BasicLoRaEx, basic_loraex_ns, "basic_loraex"
+    )
@@ -0,0 +1,214 @@
+#include "adr.h"
+#include "esphome/core/log.h"
+
+#include <algorithm>
+#include <mutex>
+
+namespace esphome {
+namespace lora {
+
+static const char *const TAG = "basic_loraex.adr";
+
+static const int64_t EVAL_INTERVAL_US = 1000000;
+static const size_t MAX_ADR_PEERS = 16;
+// Próg demodulacji SX127x (SNR w 1/4 dB) dla SF6-SF12: od -5 dB do -20 dB
+static const int8_t DEMOD_FLOOR_X4[7] = {-20, -30, -40, -50, -60, -70, -80};
+static const int SF_HYSTERESIS_X4 = 3 * 4;  // dodatkowy zapas przy zejściu na niższy SF
+static const int POWER_STEP_MARGIN_DB = 5;   // zapas ponad margines, przy którym moc spada
+static const uint8_t POWER_STEP_DB = 2;
+static const uint8_t POWER_HOLD_REPORTS = 4;  // EWMA 1/4 - po czterech raportach ~70% zmiany
+
+void AdrControl::set_base(uint8_t spreading_factor, uint8_t tx_power) {
+  this->base_sf_ = spreading_factor;
+  this->base_tx_power_ = tx_power;
+  this->listen_sf_ = spreading_factor;
+}
+
+uint8_t AdrControl::get_tx_sf(const std::array<uint8_t, 6> &mac) {
+  std::lock_guard<reliable::FreeRtosMutex> lock(this->mutex_);
+  const AdrPeer *peer = this->find_locked(mac);
+  return peer == nullptr ? this->base_sf_ : peer->last_tx_sf;
+}
+
+void AdrControl::tx_params(const std::array<uint8_t, 6> &mac, bool expects_reply, uint8_t &sf, uint8_t &power) {
+  std::lock_guard<reliable::FreeRtosMutex> lock(this->mutex_);
+  AdrPeer *peer = this->track_locked(mac);
+  if (peer == nullptr) {
+    sf = this->base_sf_;
+    power = this->base_tx_power_;
+    return;
+  }
+  if (expects_reply && peer->losses < 0xFF) {
+    peer->losses++;
+  }
+  if (peer->losses > this->fallback_losses_) {
+    // Peer nie odpowiada na swoim SF - pełna moc i kolejne SF od najodporniejszego
+    const uint8_t span = this->max_sf_ - this->min_sf_ + 1;
+    sf = this->max_sf_ - (peer->losses - this->fallback_losses_ - 1) % span;
+    peer->tx_power = this->base_tx_power_;
+  } else {
+    sf = peer->sf;
+  }
+  power = peer->tx_power;
+  peer->last_tx_sf = sf;
+}
+
+void AdrControl::broadcast_sfs(std::vector<uint8_t> &sfs) {
+  std::lock_guard<reliable::FreeRtosMutex> lock(this->mutex_);
+  for (const auto &peer : this->peers_) {
+    if (std::find(sfs.begin(), sfs.end(), peer.sf) == sfs.end()) {
+      sfs.push_back(peer.sf);
+    }
+  }
+  if (sfs.empty()) {
+    sfs.push_back(this->base_sf_);
+  }
+}
+
+void AdrControl::on_ack(const std::array<uint8_t, 6> &mac) {
+  std::lock_guard<reliable::FreeRtosMutex> lock(this->mutex_);
+  AdrPeer *peer = this->find_locked(mac);
+  if (peer == nullptr) {
+    return;
+  }
+  if (peer->losses > this->fallback_losses_ && peer->sf != peer->last_tx_sf) {
+    ESP_LOGI(TAG, "%02X:%02X:%02X:%02X:%02X:%02X answered on SF%u", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5],
+             peer->last_tx_sf);
+    peer->sf = peer->last_tx_sf;
+  }
+  peer->losses = 0;
+}
+
+void AdrControl::on_report(const std::array<uint8_t, 6> &mac, uint8_t listen_sf, int8_t margin_db, int8_t snr_x4,
+                           int64_t now) {
+  std::lock_guard<reliable::FreeRtosMutex> lock(this->mutex_);
+  AdrPeer *peer = this->track_locked(mac);
+  if (peer == nullptr) {
+    return;
+  }
+  if (!peer->has_snr) {
+    peer->snr_avg = snr_x4 * 4;
+    peer->has_snr = true;
+  } else {
+    peer->snr_avg += snr_x4 - peer->snr_avg / 4;
+  }
+  peer->last_heard = now;
+  this->last_report_rx_ = now;
+  peer->losses = 0;
+  if (listen_sf >= this->min_sf_ && listen_sf <= this->max_sf_ && listen_sf != peer->sf) {
+    ESP_LOGD(TAG, "%02X:%02X:%02X:%02X:%02X:%02X listens on SF%u", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5],
+             listen_sf);
+    peer->sf = listen_sf;
+  }
+  if (margin_db == ADR_NO_MARGIN) {
+    return;
+  }
+
+  // Najpierw SF (peer schodzi do min_sf), dopiero potem moc
+  uint8_t power = peer->tx_power;
+  if (peer->sf > this->min_sf_ || margin_db < this->margin_db_) {
+    power = this->base_tx_power_;
+  } else if (peer->power_hold > 0) {
+    peer->power_hold--;
+  } else if (margin_db >= this->margin_db_ + POWER_STEP_MARGIN_DB) {
+    power = std::max<int>(this->min_tx_power_, peer->tx_power - POWER_STEP_DB);
+  }
+  if (power != peer->tx_power) {
+    ESP_LOGD(TAG, "%02X:%02X:%02X:%02X:%02X:%02X: TX power %u -> %u dBm (margin %d dB)", mac[0], mac[1], mac[2],
+             mac[3], mac[4], mac[5], peer->tx_power, power, margin_db);
+    peer->tx_power = power;
+    peer->power_hold = POWER_HOLD_REPORTS;
+  }
+}
+
+void AdrControl::loop(int64_t now, std::vector<AdrReport> &reports) {
+  if (!this->enabled_ || now < this->next_eval_) {
+    return;
+  }
+  this->next_eval_ = now + EVAL_INTERVAL_US;
+  std::lock_guard<reliable::FreeRtosMutex> lock(this->mutex_);
+
+  if (this->pending_sf_ == 0) {
+    // SF nasłuchu wyznacza najsłabszy aktywny peer
+    uint8_t target = 0;
+    for (const auto &peer : this->peers_) {
+      if (this->is_active(peer, now)) {
+        target = std::max(target, this->required_sf(peer));
+      }
+    }
+    // Nikt nas nie słyszy albo my nie słyszymy nikogo - punkt wyjścia z konfiguracji
+    const bool silent = now - this->last_report_rx_ >= 3 * this->report_interval_us_;
+    if (target == 0 && silent && this->listen_sf_ != this->base_sf_) {
+      target = this->base_sf_;
+    }
+    if (target != 0 && target != this->listen_sf_) {
+      ESP_LOGI(TAG, "Listen SF%u -> SF%u", this->listen_sf_.load(), target);
+      this->pending_sf_ = target;
+      for (auto &peer : this->peers_) {
+        reports.push_back({peer.mac, target, this->margin_at(peer, target), true});
+        peer.next_report = now + this->report_interval_us_;
+      }
+    }
+  }
+
+  for (auto &peer : this->peers_) {
+    if (now >= peer.next_report) {
+      reports.push_back({peer.mac, this->listen_sf_, this->margin_at(peer, this->listen_sf_), false});
+      // Rozrzut po MAC - raporty wielu węzłów nie zderzają się co okres
+      peer.next_report = now + this->report_interval_us_ + this->report_interval_us_ * peer.mac[5] / 1024;
+    }
+  }
+}
+
+void AdrControl::commit_switch() {
+  std::lock_guard<reliable::FreeRtosMutex> lock(this->mutex_);
+  if (this->pending_sf_ != 0) {
+    this->listen_sf_ = this->pending_sf_;
+    this->pending_sf_ = 0;
+  }
+}
+
+uint8_t AdrControl::required_sf(const AdrPeer &peer) const {
+  const int snr = peer.snr_avg / 4;
+  for (uint8_t sf = this->min_sf_; sf < this->max_sf_; sf++) {
+    // Zejście poniżej bieżącego SF z histerezą - pomiar na granicy nie przełącza tam i z powrotem
+    const int hysteresis = sf < this->listen_sf_ ? SF_HYSTERESIS_X4 : 0;
+    if (snr - DEMOD_FLOOR_X4[sf - 6] >= this->margin_db_ * 4 + hysteresis) {
+      return sf;
+    }
+  }
+  return this->max_sf_;
+}
+
+int8_t AdrControl::margin_at(const AdrPeer &peer, uint8_t sf) const {
+  if (!peer.has_snr) {
+    return ADR_NO_MARGIN;
+  }
+  const int margin = (peer.snr_avg / 4 - DEMOD_FLOOR_X4[sf - 6]) / 4;
+  return std::max(-127, std::min(127, margin));
+}
+
+AdrControl::AdrPeer *AdrControl::find_locked(const std::array<uint8_t, 6> &mac) {
+  auto it = std::find_if(this->peers_.begin(), this->peers_.end(), [&mac](const AdrPeer &p) { return p.mac == mac; });
+  return it == this->peers_.end() ? nullptr : &*it;
+}
+
+AdrControl::AdrPeer *AdrControl::track_locked(const std::array<uint8_t, 6> &mac) {
+  AdrPeer *peer = this->find_locked(mac);
+  // Broadcast/multicast idzie kopiami na SF wszystkich peerów (broadcast_sfs)
+  if (peer != nullptr || (mac[0] & 0x01) != 0 || this->peers_.size() >= MAX_ADR_PEERS) {
+    return peer;
+  }
+  AdrPeer entry{};
+  entry.mac = mac;
+  entry.sf = this->base_sf_;
+  entry.tx_power = this->base_tx_power_;
+  entry.last_tx_sf = this->base_sf_;
+  // Pierwszy raport od razu - peer pozna nasz SF nasłuchu i zacznie mierzyć łącze
+  entry.next_report = 0;
+  this->peers_.push_back(entry);
+  return &this->peers_.back();
+}
+
+}  // namespace lora
+}  // namespace esphome
@@ -0,0 +1,120 @@
+#pragma once
+
+// Adaptacyjny dobór SF i mocy nadawania (ADR) dla LoRa, osobno dla każdego peera.
+//
+// SX1278 demoduluje tylko ten SF, na którym słucha, więc każdy węzeł wybiera jeden SF nasłuchu -
+// najniższy, przy którym najsłabszy aktywny peer ma zadany zapas (margines) SNR ponad próg
+// demodulacji - i ogłasza go peerom. Nadawca przełącza SF i moc dla każdej ramki: ramka do peera
+// idzie na jego SF nasłuchu, a po niej nadawca przez chwilę słucha na tym samym SF odpowiedzi (ACK).
+// Odpowiedzi (ACK, REC, COMP) idą zawsze na SF, na którym przyszła ramka, czyli własny SF nasłuchu.
+//
+// Pomiar i negocjacja: raporty na zarezerwowanym temacie (ADR_TOPIC) niosą SF nasłuchu nadawcy
+// i margines, z jakim dochodzą do niego ramki odbiorcy; nadawcę wskazuje nagłówek ramki. Odbiorca raportu mierzy na nim SNR
+// w drugą stronę. Moc ramek do peera spada dopiero, gdy peer słucha już na min_sf, a zapas wciąż
+// jest duży; za mały zapas przywraca pełną moc.
+//
+// Bezpieczny powrót: po fallback_losses kolejnych ramkach bez ACK nadawca wraca do pełnej mocy
+// i próbuje kolejnych SF od max_sf w dół, aż któraś ramka zostanie potwierdzona. Węzeł, który
+// przez trzy okresy raportów nie usłyszał żadnego raportu, wraca do bazowego SF z konfiguracji.
+
+#include "esphome/components/basic_reliable/freertos_mutex.h"
+
+#include <array>
+#include <atomic>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace esphome {
+namespace lora {
+
+// Temat raportów ADR - topic_hash("lora/adr")
+static const uint16_t ADR_TOPIC = 0x51A4;
+// Raport: SF nasłuchu(1) + margines dB(1, ADR_NO_MARGIN = brak pomiaru)
+static const size_t ADR_REPORT_SIZE = 2;
+static const int8_t ADR_NO_MARGIN = INT8_MIN;
+
+struct AdrReport {
+  std::array<uint8_t, 6> peer;
+  uint8_t listen_sf;
+  int8_t margin_db;
+  bool announce;  // zmiana SF nasłuchu - wysyłany z potwierdzeniem
+};
+
+class AdrControl {
+ public:
+  void set_enabled(bool enabled) { this->enabled_ = enabled; }
+  bool is_enabled() const { return this->enabled_; }
+  // Bazowy SF i moc z konfiguracji radia - punkt startu i powrotu
+  void set_base(uint8_t spreading_factor, uint8_t tx_power);
+  void set_spreading_factor_range(uint8_t min_sf, uint8_t max_sf) {
+    this->min_sf_ = min_sf;
+    this->max_sf_ = max_sf;
+  }
+  void set_margin_db(uint8_t margin) { this->margin_db_ = margin; }
+  void set_min_tx_power(uint8_t power) { this->min_tx_power_ = power; }
+  void set_report_interval_us(int64_t interval) { this->report_interval_us_ = interval; }
+  void set_fallback_losses(uint8_t losses) { this->fallback_losses_ = losses; }
+
+  uint8_t get_listen_sf() const { return this->listen_sf_; }
+  uint8_t get_max_sf() const { return this->max_sf_; }
+  // SF ostatniej ramki do peera (bazowy dla nieznanego) - na nim wraca ACK
+  uint8_t get_tx_sf(const std::array<uint8_t, 6> &mac);
+
+  // Z dowolnego zadania (transport): parametry ramki do peera; expects_reply - ramka czeka na ACK
+  void tx_params(const std::array<uint8_t, 6> &mac, bool expects_reply, uint8_t &sf, uint8_t &power);
+  // Broadcast: jedna kopia na każdy SF nasłuchu znanych peerów
+  void broadcast_sfs(std::vector<uint8_t> &sfs);
+
+  // Z loop()
+  void on_ack(const std::array<uint8_t, 6> &mac);
+  void on_report(const std::array<uint8_t, 6> &mac, uint8_t listen_sf, int8_t margin_db, int8_t snr_x4,
+                 int64_t now);
+  // Decyzje o SF nasłuchu i raporty do wysłania
+  void loop(int64_t now, std::vector<AdrReport> &reports);
+  // Ogłoszenie zmiany SF nasłuchu w drodze - komponent przełącza radio po commit_switch()
+  bool is_switch_pending() const { return this->pending_sf_ != 0; }
+  void commit_switch();
+
+ protected:
+  struct AdrPeer {
+    std::array<uint8_t, 6> mac;
+    uint8_t sf;          // SF nasłuchu peera (ostatni raport lub potwierdzona próba)
+    uint8_t tx_power;    // moc ramek do peera
+    uint8_t last_tx_sf;  // SF ostatniej ramki do peera
+    uint8_t losses;      // kolejne ramki bez ACK
+    uint8_t power_hold;  // raporty do odczekania po zmianie mocy, zanim pomiar ją odzwierciedli
+    bool has_snr;
+    int16_t snr_avg;     // SNR raportów peera w 1/4 dB * 4 (EWMA 1/4)
+    int64_t last_heard;
+    int64_t next_report;
+  };
+
+  AdrPeer *find_locked(const std::array<uint8_t, 6> &mac);
+  AdrPeer *track_locked(const std::array<uint8_t, 6> &mac);
+  bool is_active(const AdrPeer &peer, int64_t now) const {
+    return peer.has_snr && now - peer.last_heard < 3 * this->report_interval_us_;
+  }
+  uint8_t required_sf(const AdrPeer &peer) const;
+  int8_t margin_at(const AdrPeer &peer, uint8_t sf) const;
+
+  reliable::FreeRtosMutex mutex_;
+  std::vector<AdrPeer> peers_;
+  bool enabled_{false};
+  uint8_t base_sf_{9};
+  uint8_t base_tx_power_{14};
+  uint8_t min_sf_{7};
+  uint8_t max_sf_{12};
+  uint8_t margin_db_{10};
+  uint8_t min_tx_power_{2};
+  uint8_t fallback_losses_{3};
+  int64_t report_interval_us_{60000000};
+  std::atomic<uint8_t> listen_sf_{9};
+  uint8_t pending_sf_{0};
+  int64_t last_report_rx_{0};
+  int64_t next_eval_{0};
+};
+
+}  // namespace lora
+}  // namespace esphome
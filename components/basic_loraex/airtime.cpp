@@ -0,0 +1,65 @@
+#include "airtime.h"
+
+#include <algorithm>
+
+namespace esphome {
+namespace lora {
+
+bool needs_low_data_rate_optimize(uint8_t spreading_factor, uint32_t bandwidth) {
+  // T_sym = 2^SF / BW > 16 ms
+  return (uint64_t(1) << spreading_factor) * 1000 > uint64_t(16) * bandwidth;
+}
+
+uint32_t time_on_air_us(const LoRaModulation &modulation, size_t payload_len) {
+  const int32_t sf = modulation.spreading_factor;
+  const int32_t de = needs_low_data_rate_optimize(modulation.spreading_factor, modulation.bandwidth) ? 1 : 0;
+  const int32_t numerator =
+      8 * int32_t(payload_len) - 4 * sf + 28 + (modulation.crc ? 16 : 0) - (modulation.implicit_header ? 20 : 0);
+  const int32_t denominator = 4 * (sf - 2 * de);
+  const int32_t blocks = numerator > 0 ? (numerator + denominator - 1) / denominator : 0;
+  const int64_t payload_symbols = 8 + int64_t(blocks) * modulation.coding_rate;
+
+  // W ćwiartkach symbolu: preambuła + 4,25 + symbole treści
+  const int64_t quarter_symbols = 4 * int64_t(modulation.preamble_length) + 17 + 4 * payload_symbols;
+  return uint32_t(quarter_symbols * (int64_t(1) << sf) * 1000000 / (4 * int64_t(modulation.bandwidth)));
+}
+
+void DutyCycleBucket::reset(int64_t window_us, int64_t now) {
+  this->capacity_us_ = window_us * this->limit_bp_ / 10000;
+  this->tokens_us_ = this->capacity_us_;
+  this->last_refill_ = now;
+}
+
+void DutyCycleBucket::refill(int64_t now) {
+  const int64_t elapsed = now - this->last_refill_;
+  if (elapsed <= 0) {
+    return;
+  }
+  this->tokens_us_ = std::min(this->capacity_us_, this->tokens_us_ + elapsed * this->limit_bp_ / 10000);
+  this->last_refill_ = now;
+}
+
+int64_t DutyCycleBucket::wait_us(int64_t now, uint32_t airtime_us) {
+  if (int64_t(airtime_us) > this->capacity_us_) {
+    return -1;
+  }
+  this->refill(now);
+  const int64_t missing = int64_t(airtime_us) - this->tokens_us_;
+  if (missing <= 0) {
+    return 0;
+  }
+  return (missing * 10000 + this->limit_bp_ - 1) / this->limit_bp_;
+}
+
+void DutyCycleBucket::consume(int64_t now, uint32_t airtime_us) {
+  this->refill(now);
+  this->tokens_us_ -= airtime_us;
+}
+
+int64_t DutyCycleBucket::remaining_us(int64_t now) {
+  this->refill(now);
+  return std::max<int64_t>(this->tokens_us_, 0);
+}
+
+}  // namespace lora
+}  // namespace esphome
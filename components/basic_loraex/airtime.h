@@ -0,0 +1,59 @@
+#pragma once
+
+// Czas w eterze ramki LoRa i limity wypełnienia (duty cycle) pasm regulowanych.
+//
+// time_on_air_us() liczy dokładnie według wzoru z noty SX1276/77/78 (rozdz. 4.1.1.7): preambuła
+// + 4,25 symbolu synchronizacji + symbole nagłówka i treści zależne od SF, CR, CRC, trybu nagłówka
+// i optymalizacji niskiej szybkości (wymuszanej przez sterownik, gdy symbol trwa ponad 16 ms).
+//
+// DutyCycleBucket to wiadro żetonów na pod-pasmo: pojemność = limit * okno (np. 1% z godziny to 36 s
+// nadawania), uzupełniane w tempie limitu. Ramka, dla której brakuje żetonów, czeka w kolejce TX.
+
+#include <cstddef>
+#include <cstdint>
+
+namespace esphome {
+namespace lora {
+
+struct LoRaModulation {
+  uint8_t spreading_factor;
+  uint32_t bandwidth;
+  uint8_t coding_rate;  // 5-8 dla 4/5-4/8
+  uint16_t preamble_length;
+  bool crc;
+  bool implicit_header;
+};
+
+// Symbol dłuższy niż 16 ms (SF11/SF12 przy 125 kHz i węższych pasmach) wymaga LowDataRateOptimize
+bool needs_low_data_rate_optimize(uint8_t spreading_factor, uint32_t bandwidth);
+uint32_t time_on_air_us(const LoRaModulation &modulation, size_t payload_len);
+
+class DutyCycleBucket {
+ public:
+  DutyCycleBucket(uint32_t min_frequency, uint32_t max_frequency, uint16_t limit_bp)
+      : min_frequency_(min_frequency), max_frequency_(max_frequency), limit_bp_(limit_bp) {}
+
+  // Pełne wiadro dla okna pomiaru window_us
+  void reset(int64_t window_us, int64_t now);
+  bool contains(uint32_t frequency) const {
+    return frequency >= this->min_frequency_ && frequency <= this->max_frequency_;
+  }
+  // 0 - można nadawać teraz, inaczej czas do uzbierania airtime_us; ujemne - ramka nigdy się nie zmieści
+  int64_t wait_us(int64_t now, uint32_t airtime_us);
+  void consume(int64_t now, uint32_t airtime_us);
+  int64_t remaining_us(int64_t now);
+  int64_t capacity_us() const { return this->capacity_us_; }
+
+ protected:
+  void refill(int64_t now);
+
+  uint32_t min_frequency_;
+  uint32_t max_frequency_;
+  uint16_t limit_bp_;  // setne części procenta: 10 = 0,1%, 100 = 1%, 1000 = 10%
+  int64_t capacity_us_{0};
+  int64_t tokens_us_{0};
+  int64_t last_refill_{0};
+};
+
+}  // namespace lora
+}  // namespace esphome
@@ -15,6 +15,9 @@ void BasicLoRaEx::setup() {
   ESP_LOGCONFIG(TAG, "Setting up BasicLoRaEx...");
   
   instance_ = this;
+  this->spi_setup();
+  this->adr_.set_base(this->spreading_factor_, this->tx_power_);
+  this->rx_sf_ = this->spreading_factor_;
 
   // Inicjalizacja pinów
   if (this->cs_pin_ != nullptr) {
@@ -28,16 +31,9 @@ void BasicLoRaEx::setup() {
   
   if (this->dio0_pin_ != nullptr) {
     this->dio0_pin_->setup();
-    this->dio0_pin_->attach_interrupt(BasicLoRaEx::dio0_isr, this, gpio::INTERRUPT_RISING_EDGE);
   }
-
-  // Inicjalizacja mutexów
-  this->queue_mutex_ = xSemaphoreCreateMutex();
-  this->history_mutex_ = xSemaphoreCreateMutex();
-  
-  if (!this->queue_mutex_ || !this->history_mutex_) {
-    ESP_LOGE(TAG, "Failed to create mutexes");
-    return;
+  if (this->dio1_pin_ != nullptr) {
+    this->dio1_pin_->setup();
   }
 
   // Reset modułu i inicjalizacja LoRa
@@ -58,16 +54,50 @@ void BasicLoRaEx::setup() {
   ESP_ERROR_CHECK(esp_timer_create(&timer_args, &this->retry_timer_));
   ESP_ERROR_CHECK(esp_timer_start_periodic(this->retry_timer_, 400000)); // 400ms
 
+  this->exactly_once_store_.setup(fnv1_hash("basic_loraex_exactly_once"), this->engine_);
+
+  for (auto &bucket : this->duty_cycle_) {
+    bucket.reset(this->duty_cycle_window_us_, esp_timer_get_time());
+  }
+
+  // Flagi IRQ obsługuje wyłącznie zadanie radia; przerwanie tylko je budzi
+  if (xTaskCreate(BasicLoRaEx::radio_task, "lora_radio", RADIO_TASK_STACK_SIZE, this, RADIO_TASK_PRIORITY,
+                  &this->radio_task_) != pdPASS) {
+    ESP_LOGE(TAG, "Failed to create radio task");
+    this->mark_failed();
+    return;
+  }
+  if (this->dio0_pin_ != nullptr) {
+    this->dio0_pin_->attach_interrupt(BasicLoRaEx::dio_isr, this, gpio::INTERRUPT_RISING_EDGE);
+  }
+  if (this->dio1_pin_ != nullptr) {
+    this->dio1_pin_->attach_interrupt(BasicLoRaEx::dio_isr, this, gpio::INTERRUPT_RISING_EDGE);
+  }
+
   // Przejście do trybu odbiorczego
-  this->set_mode(MODE_LONG_RANGE_MODE | MODE_RX_CONTINUOUS);
-  this->receiving_ = true;
+  {
+    std::lock_guard<reliable::FreeRtosMutex> lock(this->radio_mutex_);
+    this->set_mode(MODE_LONG_RANGE_MODE | MODE_RX_CONTINUOUS);
+    this->radio_state_ = RADIO_RX;
+  }
 
   ESP_LOGCONFIG(TAG, "LoRa initialized successfully");
   ESP_LOGCONFIG(TAG, "  Frequency: %.3f MHz", this->frequency_ / 1000000.0);
+  for (uint32_t channel : this->channels_) {
+    ESP_LOGCONFIG(TAG, "  Channel: %.3f MHz", channel / 1000000.0);
+  }
   ESP_LOGCONFIG(TAG, "  Spreading Factor: %d", this->spreading_factor_);
   ESP_LOGCONFIG(TAG, "  Bandwidth: %.1f kHz", this->bandwidth_ / 1000.0);
   ESP_LOGCONFIG(TAG, "  Coding Rate: 4/%d", this->coding_rate_);
   ESP_LOGCONFIG(TAG, "  TX Power: %d dBm", this->tx_power_);
+  ESP_LOGCONFIG(TAG, "  Node ID: %u (%u-byte addresses, %u known nodes)", LoRaTransport::node_id,
+                LoRaTransport::address_size, (unsigned) LoRaTransport::nodes.size());
+  if (this->implicit_header_) {
+    ESP_LOGCONFIG(TAG, "  Implicit header: %u-byte frames", this->payload_length_);
+  }
+  ESP_LOGCONFIG(TAG, "  Time on air (max frame): %u ms", (unsigned) (this->get_time_on_air_us(MAX_PACKET_SIZE) / 1000));
+  ESP_LOGCONFIG(TAG, "  ADR: %s", this->adr_.is_enabled() ? "enabled" : "disabled");
+  ESP_LOGCONFIG(TAG, "  Listen before talk: %s", this->lbt_enabled_ ? "enabled" : "disabled");
 }
 
 void BasicLoRaEx::reset_module() {
@@ -77,6 +107,12 @@ void BasicLoRaEx::reset_module() {
     this->rst_pin_->digital_write(true);
     delay(10);
   }
+  // Rejestry wracają do wartości domyślnych - kopia jest nieaktualna
+  this->shadow_valid_.reset();
+  this->mode_ = 0xFF;
+  this->active_sf_ = 0;
+  this->active_tx_power_ = 0;
+  this->active_channel_ = NO_CHANNEL;
 }
 
 bool BasicLoRaEx::init_lora() {
@@ -99,14 +135,14 @@ bool BasicLoRaEx::init_lora() {
 
   // Konfiguracja parametrów LoRa
   this->set_frequency_internal();
-  this->set_spreading_factor_internal();
+  this->set_spreading_factor_internal(this->rx_sf_);
   this->set_bandwidth_internal();
   this->set_coding_rate_internal();
-  this->set_tx_power_internal();
+  this->set_tx_power_internal(this->tx_power_);
 
   // Konfiguracja preambuły
-  this->write_register(REG_PREAMBLE_MSB, (this->preamble_length_ >> 8) & 0xFF);
-  this->write_register(REG_PREAMBLE_LSB, this->preamble_length_ & 0xFF);
+  const uint8_t preamble[2] = {(uint8_t)(this->preamble_length_ >> 8), (uint8_t)(this->preamble_length_ & 0xFF)};
+  this->write_registers(REG_PREAMBLE_MSB, preamble, sizeof(preamble));
 
   // Sync word
   this->write_register(REG_SYNC_WORD, this->sync_word_);
@@ -115,8 +151,8 @@ bool BasicLoRaEx::init_lora() {
   this->write_register(REG_FIFO_TX_BASE_ADDR, 0x00);
   this->write_register(REG_FIFO_RX_BASE_ADDR, 0x00);
 
-  // Konfiguracja DIO0 dla RX/TX Done
-  this->write_register(REG_DIO_MAPPING_1, 0x00); // DIO0 = RxDone/TxDone
+  // DIO0 = RxDone, DIO1 = RxTimeout; TX i CAD przestawiają mapowanie na czas swojej fazy
+  this->write_register(REG_DIO_MAPPING_1, DIO_MAPPING_RX);
 
   // Konfiguracja CRC
   uint8_t modem_config_2 = this->read_register(REG_MODEM_CONFIG_2);
@@ -127,30 +163,47 @@ bool BasicLoRaEx::init_lora() {
   }
   this->write_register(REG_MODEM_CONFIG_2, modem_config_2);
 
+  // Skan kanałów: po wykryciu preambuły RX single czeka na synchronizację najwyżej długość preambuły
+  if (!this->channels_.empty()) {
+    this->write_register(REG_SYMB_TIMEOUT_LSB, std::min<uint16_t>(this->preamble_length_, 0xFF));
+  }
+
+  // Nagłówek niejawny: odbiornik nie zna długości z eteru - czeka na stałą liczbę bajtów
+  uint8_t modem_config_1 = this->read_register(REG_MODEM_CONFIG_1);
+  if (this->implicit_header_) {
+    modem_config_1 |= 0x01;  // ImplicitHeaderModeOn
+    this->write_register(REG_PAYLOAD_LENGTH, this->payload_length_);
+  } else {
+    modem_config_1 &= ~0x01;
+  }
+  this->write_register(REG_MODEM_CONFIG_1, modem_config_1);
+
   this->lora_initialized_ = true;
   return true;
 }
 
 void BasicLoRaEx::set_frequency_internal() {
   uint64_t frf = ((uint64_t)this->frequency_ << 19) / 32000000;
-  this->write_register(REG_FRF_MSB, (uint8_t)(frf >> 16));
-  this->write_register(REG_FRF_MID, (uint8_t)(frf >> 8));
-  this->write_register(REG_FRF_LSB, (uint8_t)(frf >> 0));
+  const uint8_t frf_bytes[3] = {(uint8_t)(frf >> 16), (uint8_t)(frf >> 8), (uint8_t)(frf >> 0)};
+  this->write_registers(REG_FRF_MSB, frf_bytes, sizeof(frf_bytes));
 }
 
-void BasicLoRaEx::set_spreading_factor_internal() {
+// Także przełączanie SF między ramkami (ADR) - kopia rejestrów ogranicza je do faktycznych zmian
+void BasicLoRaEx::set_spreading_factor_internal(uint8_t sf) {
+  this->active_sf_ = sf;
   uint8_t modem_config_2 = this->read_register(REG_MODEM_CONFIG_2);
-  modem_config_2 = (modem_config_2 & 0x0F) | ((this->spreading_factor_ << 4) & 0xF0);
+  modem_config_2 = (modem_config_2 & 0x0F) | ((sf << 4) & 0xF0);
   this->write_register(REG_MODEM_CONFIG_2, modem_config_2);
 
   // Optimalizacja dla SF6
-  if (this->spreading_factor_ == 6) {
-    this->write_register(0x31, 0xC5);  // SF6 optimization
-    this->write_register(0x37, 0x0C);  // SF6 optimization
+  if (sf == 6) {
+    this->write_register(REG_DETECTION_OPTIMIZE, 0xC5);  // SF6 optimization
+    this->write_register(REG_DETECTION_THRESHOLD, 0x0C);  // SF6 optimization
   } else {
-    this->write_register(0x31, 0xC3);  // Normal mode
-    this->write_register(0x37, 0x0A);  // Normal mode
+    this->write_register(REG_DETECTION_OPTIMIZE, 0xC3);  // Normal mode
+    this->write_register(REG_DETECTION_THRESHOLD, 0x0A);  // Normal mode
   }
+  this->set_low_data_rate_optimize_internal();
 }
 
 void BasicLoRaEx::set_bandwidth_internal() {
@@ -172,6 +225,18 @@ void BasicLoRaEx::set_bandwidth_internal() {
   uint8_t modem_config_1 = this->read_register(REG_MODEM_CONFIG_1);
   modem_config_1 = (modem_config_1 & 0x0F) | (bw_value << 4);
   this->write_register(REG_MODEM_CONFIG_1, modem_config_1);
+  this->set_low_data_rate_optimize_internal();
+}
+
+// Zależy od SF i szerokości pasma - ta sama reguła co w time_on_air_us()
+void BasicLoRaEx::set_low_data_rate_optimize_internal() {
+  uint8_t modem_config_3 = this->read_register(REG_MODEM_CONFIG_3);
+  if (needs_low_data_rate_optimize(this->active_sf_, this->bandwidth_)) {
+    modem_config_3 |= 0x08;
+  } else {
+    modem_config_3 &= ~0x08;
+  }
+  this->write_register(REG_MODEM_CONFIG_3, modem_config_3);
 }
 
 void BasicLoRaEx::set_coding_rate_internal() {
@@ -181,395 +246,896 @@ void BasicLoRaEx::set_coding_rate_internal() {
   this->write_register(REG_MODEM_CONFIG_1, modem_config_1);
 }
 
-void BasicLoRaEx::set_tx_power_internal() {
+void BasicLoRaEx::set_tx_power_internal(uint8_t power) {
+  this->active_tx_power_ = power;
   uint8_t pa_config;
-  if (this->tx_power_ > 17) {
+  if (power > 17) {
     // High power mode (PA_BOOST)
-    pa_config = 0x80 | (this->tx_power_ - 2);
+    pa_config = 0x80 | (power - 2);
   } else {
     // Regular power mode (RFO)
-    pa_config = 0x70 | this->tx_power_;
+    pa_config = 0x70 | power;
   }
   this->write_register(REG_PA_CONFIG, pa_config);
 }
 
+// Rejestry zmieniane wyłącznie przez sterownik - modem nie nadpisuje ich sam
+bool BasicLoRaEx::is_shadowed(uint8_t reg) {
+  switch (reg) {
+    case REG_FRF_MSB:
+    case REG_FRF_MID:
+    case REG_FRF_LSB:
+    case REG_PA_CONFIG:
+    case REG_LNA:
+    case REG_FIFO_TX_BASE_ADDR:
+    case REG_FIFO_RX_BASE_ADDR:
+    case REG_IRQ_FLAGS_MASK:
+    case REG_MODEM_CONFIG_1:
+    case REG_MODEM_CONFIG_2:
+    case REG_PREAMBLE_MSB:
+    case REG_PREAMBLE_LSB:
+    case REG_PAYLOAD_LENGTH:
+    case REG_SYMB_TIMEOUT_LSB:
+    case REG_MODEM_CONFIG_3:
+    case REG_DETECTION_OPTIMIZE:
+    case REG_DETECTION_THRESHOLD:
+    case REG_SYNC_WORD:
+    case REG_DIO_MAPPING_1:
+    case REG_DIO_MAPPING_2:
+      return true;
+    default:
+      return false;
+  }
+}
+
 uint8_t BasicLoRaEx::read_register(uint8_t reg) {
+  if (is_shadowed(reg) && this->shadow_valid_[reg]) {
+    return this->shadow_[reg];
+  }
   this->enable();
   this->write_byte(reg & 0x7F); // MSB = 0 for read
   uint8_t value = this->read_byte();
   this->disable();
+  if (is_shadowed(reg)) {
+    this->shadow_[reg] = value;
+    this->shadow_valid_[reg] = true;
+  }
   return value;
 }
 
 void BasicLoRaEx::write_register(uint8_t reg, uint8_t value) {
+  this->write_registers(reg, &value, 1);
+}
+
+void BasicLoRaEx::read_registers(uint8_t reg, uint8_t *out, size_t len) {
+  this->enable();
+  this->write_byte(reg & 0x7F);
+  this->read_array(out, len);
+  this->disable();
+}
+
+void BasicLoRaEx::write_registers(uint8_t reg, const uint8_t *data, size_t len) {
+  // Zapis pomijany, gdy wszystkie rejestry mają już tę wartość
+  bool changed = false;
+  for (size_t i = 0; i < len && !changed; i++) {
+    const uint8_t r = reg + i;
+    changed = !is_shadowed(r) || !this->shadow_valid_[r] || this->shadow_[r] != data[i];
+  }
+  if (!changed) {
+    return;
+  }
   this->enable();
   this->write_byte(reg | 0x80); // MSB = 1 for write
-  this->write_byte(value);
+  this->write_array(data, len);
   this->disable();
+  for (size_t i = 0; i < len; i++) {
+    const uint8_t r = reg + i;
+    if (is_shadowed(r)) {
+      this->shadow_[r] = data[i];
+      this->shadow_valid_[r] = true;
+    }
+  }
 }
 
+// FIFO jednym transferem blokowym - sterownik SPI przesyła długie bufory przez DMA
+void BasicLoRaEx::read_fifo(uint8_t *out, size_t len) {
+  this->enable();
+  this->write_byte(REG_FIFO & 0x7F);
+  this->read_array(out, len);
+  this->disable();
+}
+
+void BasicLoRaEx::write_fifo(const uint8_t *data, size_t len) {
+  this->enable();
+  this->write_byte(REG_FIFO | 0x80);
+  this->write_array(data, len);
+  this->disable();
+}
+
+// Bez oczekiwania: modem przyjmuje kolejne polecenia SPI w trakcie zmiany trybu
 void BasicLoRaEx::set_mode(uint8_t mode) {
+  // TX, CAD i RX single same wracają do standby, więc pomijany jest tylko zapis trybu ustalonego
+  const uint8_t op = mode & MODE_MASK;
+  if (mode == this->mode_ && (op == MODE_SLEEP || op == MODE_STDBY || op == MODE_RX_CONTINUOUS)) {
+    return;
+  }
   this->write_register(REG_OP_MODE, mode);
-  delay(2); // Czekaj na zmianę trybu
+  this->mode_ = mode;
 }
 // Kontynuacja basic_loraex.cpp...
 
 void BasicLoRaEx::loop() {
-  // Sprawdź czy są dane do odebrania
-  if (this->receiving_) {
-    std::vector<uint8_t> received_data;
-    if (this->receive_packet(received_data)) {
-      this->handle_received_data(received_data);
+  this->update_peer_sensors();
+  // Ramki odczytane przez zadanie radia - bez dostępu do SPI, gdy radio milczy
+  std::vector<RxFrame> received;
+  {
+    std::lock_guard<reliable::FreeRtosMutex> lock(this->rx_mutex_);
+    received.swap(this->rx_queue_);
+  }
+  for (const auto &frame : received) {
+    // Adres nadawcy niesie nagłówek ramki - dekoduje go LoRaTransport
+    this->rx_snr_x4_ = frame.snr_x4;
+    if (frame.channel != NO_CHANNEL) {
+      this->remember_peer_channel(LoRaTransport::read_id(frame.data.data() + LoRaTransport::address_size), frame.channel);
+    }
+    this->engine_.on_frame({}, frame.data.data(), frame.data.size());
+  }
+  this->adr_loop();
+  // QoS 2: zapis identyfikatorów do flasha, potem dostarczenie i REC
+  this->engine_.flush_exactly_once([this](const std::vector<reliable::ExactlyOnceRecord<std::array<uint8_t, 6>>> &records) {
+    return this->exactly_once_store_.save(records);
+  });
+  this->engine_.process_inbox();
+  this->publish_airtime();
+}
+
+void BasicLoRaEx::update_peer_sensors() {
+#ifdef USE_BINARY_SENSOR
+  // Stan zmienia się w zadaniu WiFi/timerze - publikujemy tylko z loop(), gdy licznik zmian drgnął
+  const uint32_t epoch = this->engine_.get_peer_state_epoch();
+  if (epoch == this->peer_state_epoch_) {
+    return;
+  }
+  this->peer_state_epoch_ = epoch;
+  for (auto &peer : this->peer_sensors_) {
+    const reliable::PeerState state = this->engine_.get_peer_state(peer.mac);
+    if (state != reliable::PEER_UNKNOWN) {
+      peer.sensor->publish_state(state == reliable::PEER_UP);
+    }
+  }
+#endif
+}
+
+// Raporty ADR i przełączenie SF nasłuchu, gdy peery potwierdziły ogłoszenie
+void BasicLoRaEx::adr_loop() {
+  if (!this->adr_.is_enabled()) {
+    return;
+  }
+  std::vector<AdrReport> reports;
+  this->adr_.loop(esp_timer_get_time(), reports);
+  for (const auto &report : reports) {
+    uint8_t payload[ADR_REPORT_SIZE] = {report.listen_sf, uint8_t(report.margin_db)};
+    if (!report.announce) {
+      // Okresowy raport bez ACK - zgubiony zastąpi następny
+      this->engine_.publish(ADR_TOPIC, payload, sizeof(payload), report.peer, 0, reliable::QOS_AT_MOST_ONCE);
+      continue;
+    }
+    reliable::FrameHeader header;
+    header.type = reliable::FRAME_TOPIC;
+    header.topic = ADR_TOPIC;
+    header.id = this->engine_.generate_message_id();
+    const EnqueueResult result = this->engine_.enqueue_frame(
+        reliable::build_frame<LoRaTransport>(report.peer, header, payload, sizeof(payload)), report.peer);
+    if (reliable::is_enqueued(result)) {
+      this->adr_announcements_.push_back({report.peer, header.id});
     }
   }
+
+  if (!this->adr_.is_switch_pending()) {
+    return;
+  }
+  // Ogłoszenie potwierdzone albo porzucone przez silnik - peer, który go nie dostał, trafi na nowy
+  // SF próbami po fallback_losses stratach
+  auto &announcements = this->adr_announcements_;
+  announcements.erase(std::remove_if(announcements.begin(), announcements.end(),
+                                     [this](const std::pair<std::array<uint8_t, 6>, MessageId> &a) {
+                                       return !this->engine_.is_pending(a.first, a.second);
+                                     }),
+                      announcements.end());
+  if (!announcements.empty()) {
+    return;
+  }
+  this->adr_.commit_switch();
+  {
+    std::lock_guard<reliable::FreeRtosMutex> lock(this->radio_mutex_);
+    this->rx_sf_ = this->adr_.get_listen_sf();
+  }
+  xTaskNotifyGive(this->radio_task_);
+}
+
+// mac - nadawca raportu z nagłówka; ramki do innych węzłów odrzuciło już zadanie radia
+void BasicLoRaEx::handle_adr_report(const std::array<uint8_t, 6> &mac, const reliable::FrameHeader &header,
+                                    const uint8_t *payload, size_t len) {
+  // Ogłoszenie potwierdzane także z wyłączonym ADR - nadawca nie czeka na nie do wyczerpania prób
+  if (header.qos == reliable::QOS_AT_LEAST_ONCE) {
+    this->engine_.acknowledge(mac, header.id);
+  }
+  if (!this->adr_.is_enabled() || len != ADR_REPORT_SIZE) {
+    return;
+  }
+  this->adr_.on_report(mac, payload[0], int8_t(payload[1]), this->rx_snr_x4_, esp_timer_get_time());
 }
 
 // API komunikacji - zgodność z ESP-NOW
-void BasicLoRaEx::send_broadcast(const std::vector<uint8_t> &msg) {
+EnqueueResult BasicLoRaEx::send_broadcast(const std::vector<uint8_t> &msg, uint8_t priority) {
+  // Broadcast nie jest potwierdzany (jak esp_now_send w basic_espnowex) - QoS 0, bez kolejki retransmisji
   std::array<uint8_t, 6> broadcast_mac = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
-  this->send_lora(msg, broadcast_mac);
+  return this->send_lora(msg, broadcast_mac, priority, reliable::QOS_AT_MOST_ONCE);
 }
 
-void BasicLoRaEx::send_broadcast_str(const std::string &message) {
+EnqueueResult BasicLoRaEx::send_broadcast_str(const std::string &message, uint8_t priority) {
   std::vector<uint8_t> msg(message.begin(), message.end());
-  this->send_broadcast(msg);
+  return this->send_broadcast(msg, priority);
 }
 
-void BasicLoRaEx::send_to_peer(const std::vector<uint8_t> &msg) {
-  this->send_lora(msg, this->peer_mac_);
+EnqueueResult BasicLoRaEx::send_to_peer(const std::vector<uint8_t> &msg, uint8_t priority, QoS qos) {
+  return this->send_lora(msg, this->peer_mac_, priority, qos);
 }
 
-void BasicLoRaEx::send_to_peer_str(const std::string &message) {
+EnqueueResult BasicLoRaEx::send_to_peer_str(const std::string &message, uint8_t priority, QoS qos) {
   std::vector<uint8_t> msg(message.begin(), message.end());
-  this->send_to_peer(msg);
+  return this->send_to_peer(msg, priority, qos);
 }
 
-void BasicLoRaEx::send_lora_str(std::string message, const std::array<uint8_t, 6> &peer_mac) {
+EnqueueResult BasicLoRaEx::send_lora_str(std::string message, const std::array<uint8_t, 6> &peer_mac, uint8_t priority,
+                                         QoS qos) {
   std::vector<uint8_t> msg(message.begin(), message.end());
-  this->send_lora(msg, peer_mac);
+  return this->send_lora(msg, peer_mac, priority, qos);
 }
 
-void BasicLoRaEx::send_lora_cmd(int16_t cmd, const std::array<uint8_t, 6> &peer_mac) {
-  std::vector<uint8_t> msg(4);
-  msg[0] = static_cast<uint8_t>((cmd >> 8) & 0xFF);
-  msg[1] = static_cast<uint8_t>(cmd & 0xFF);
-  msg[2] = msg[0]; // Duplikacja dla weryfikacji
-  msg[3] = msg[1];
-  
-  if (xSemaphoreTake(this->queue_mutex_, portMAX_DELAY) == pdTRUE) {
-    // Sprawdź czy identyczna komenda już nie czeka w kolejce
-    auto it = std::find_if(
-      this->pending_messages_.begin(),
-      this->pending_messages_.end(),
-      [&](PendingMessage& m) {
-        return m.mac == peer_mac && !m.acked && 
-               m.payload.size() == 8 && // header(4) + cmd(4)
-               std::equal(m.payload.begin() + 4, m.payload.begin() + 8, msg.begin());
-      }
-    );
-    
-    bool should_send = false;
-    if (it != this->pending_messages_.end()) {
-      // Reset retry counter dla istniejącej komendy
-      it->retry_count = 0;
-      it->timestamp = esp_timer_get_time();
-    } else {
-      should_send = true;
+EnqueueResult BasicLoRaEx::send_lora_cmd(int16_t cmd, const std::array<uint8_t, 6> &peer_mac, uint8_t priority,
+                                         QoS qos) {
+  return this->engine_.send_cmd(cmd, peer_mac, priority, qos);
+}
+
+EnqueueResult BasicLoRaEx::send_lora(const std::vector<uint8_t>& msg, const std::array<uint8_t, 6>& peer_mac,
+                                     uint8_t priority, QoS qos) {
+  return this->engine_.send(msg, peer_mac, priority, qos);
+}
+
+void BasicLoRaEx::process_send_queue() {
+  this->engine_.process_queue();
+}
+
+// Węzły spoza tablicy "nodes" - identyfikator w dwóch ostatnich bajtach lokalnie administrowanego MAC
+static const uint8_t SYNTHETIC_MAC_PREFIX[4] = {0x02, 0x4C, 0x52, 0x00};
+
+uint16_t LoRaTransport::node_id_of(const Address &mac) {
+  if (std::all_of(mac.begin(), mac.end(), [](uint8_t b) { return b == 0xFF; })) {
+    return broadcast_id();
+  }
+  for (const auto &node : nodes) {
+    if (node.first == mac) {
+      return node.second;
     }
-    xSemaphoreGive(this->queue_mutex_);
-    
-    if (should_send) {
-      this->send_lora(msg, peer_mac);
+  }
+  if (std::equal(SYNTHETIC_MAC_PREFIX, SYNTHETIC_MAC_PREFIX + 4, mac.begin())) {
+    const uint16_t id = (mac[4] << 8) | mac[5];
+    return id < broadcast_id() ? id : 0;
+  }
+  return 0;
+}
+
+LoRaTransport::Address LoRaTransport::mac_of(uint16_t id) {
+  if (id == broadcast_id()) {
+    return {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+  }
+  for (const auto &node : nodes) {
+    if (node.second == id) {
+      return node.first;
     }
   }
+  return {SYNTHETIC_MAC_PREFIX[0], SYNTHETIC_MAC_PREFIX[1], SYNTHETIC_MAC_PREFIX[2], SYNTHETIC_MAC_PREFIX[3],
+          uint8_t(id >> 8), uint8_t(id & 0xFF)};
 }
 
-void BasicLoRaEx::send_lora(const std::vector<uint8_t>& msg, const std::array<uint8_t, 6>& peer_mac) {
-  if (xSemaphoreTake(this->queue_mutex_, portMAX_DELAY) == pdTRUE) {
-    PendingMessage pending;
-    pending.mac = peer_mac;
-    pending.message_id = this->generate_message_id();
-    pending.retry_count = 0;
-    pending.timestamp = esp_timer_get_time();
-    pending.acked = false;
-    
-    // Tworzenie pakietu: peer_mac(6) + type(1) + msg_id(3) + payload
-    pending.payload.reserve(10 + msg.size());
-    pending.payload.insert(pending.payload.end(), peer_mac.begin(), peer_mac.end());
-    pending.payload.push_back(0x00); // Type: DATA
-    pending.payload.insert(pending.payload.end(), pending.message_id.begin(), pending.message_id.end());
-    pending.payload.insert(pending.payload.end(), msg.begin(), msg.end());
-    
-    this->pending_messages_.push_back(pending);
-    xSemaphoreGive(this->queue_mutex_);
+static uint8_t *write_id(uint8_t *out, uint16_t id) {
+  if (LoRaTransport::address_size == 2) {
+    *out++ = id >> 8;
   }
-  
-  this->process_send_queue();
+  *out++ = id & 0xFF;
+  return out;
 }
 
-std::array<uint8_t, 3> BasicLoRaEx::generate_message_id() {
-  uint32_t random_part = esp_random();
-  int64_t timestamp = esp_timer_get_time();
-  return {
-    static_cast<uint8_t>((random_part ^ timestamp) & 0xFF),
-    static_cast<uint8_t>((random_part >> 8 ^ timestamp >> 8) & 0xFF),
-    static_cast<uint8_t>((random_part >> 16 ^ timestamp >> 16) & 0xFF)
-  };
+// Nagłówek: cel, nadawca, typ, id - cel pierwszy, żeby radio odrzuciło cudzą ramkę po 1-2 bajtach
+size_t LoRaTransport::encode_header(uint8_t *out, const Address &peer, const reliable::FrameHeader &header) {
+  const size_t base = header_size();
+  uint8_t *p = write_id(out, node_id_of(peer));
+  p = write_id(p, node_id);
+  *p++ = reliable::encode_frame_type(header);
+  std::copy(header.id.begin(), header.id.end(), p);
+  if (header.type == reliable::FRAME_ACK && header.credits != reliable::NO_CREDITS) {
+    out[base] = header.credits;
+    return base + 1;
+  }
+  if (header.type != reliable::FRAME_TOPIC) {
+    return base;
+  }
+  out[base] = header.topic >> 8;
+  out[base + 1] = header.topic & 0xFF;
+  return base + 2;
 }
 
-void BasicLoRaEx::process_send_queue() {
-  const int64_t now = esp_timer_get_time();
+// peer - nadawca ramki; adres celu sprawdziło już zadanie radia (receive_packet)
+size_t LoRaTransport::decode_header(const uint8_t *data, size_t len, Address &peer, reliable::FrameHeader &header) {
+  const size_t base = header_size();
+  if (len < base) {
+    return 0;
+  }
+  peer = mac_of(read_id(data + address_size));
+  const uint8_t *p = data + 2 * address_size;
+  if (!reliable::decode_frame_type(p[0], header)) {
+    return 0;
+  }
+  header.id = {p[1], p[2], p[3]};
+  switch (header.type) {
+    case reliable::FRAME_ACK:
+      // Opcjonalny bajt kredytów - odbiorca z kontrolą przepływu
+      if (len == base + 1) {
+        header.credits = data[base];
+        return len;
+      }
+      return len == base ? base : 0;
+    case reliable::FRAME_REC:
+    case reliable::FRAME_REL:
+    case reliable::FRAME_COMP:
+      return len == base ? base : 0;
+    case reliable::FRAME_DATA:
+      return base;
+    case reliable::FRAME_TOPIC:
+      if (len < base + 2) {
+        return 0;
+      }
+      header.topic = (data[base] << 8) | data[base + 1];
+      return base + 2;
+    default:
+      return 0;
+  }
+}
+
+bool LoRaTransport::send(const Address &peer, const uint8_t *frame, size_t len) {
+  if (node_id_of(peer) == 0) {
+    ESP_LOGW(TAG, "No node_id for %02X:%02X:%02X:%02X:%02X:%02X - add it to nodes", peer[0], peer[1], peer[2],
+             peer[3], peer[4], peer[5]);
+    return false;
+  }
+  AdrControl &adr = this->parent->adr_;
+  reliable::FrameHeader header;
+  if (!adr.is_enabled() || len < header_size() || !reliable::decode_frame_type(frame[2 * address_size], header)) {
+    return this->parent->transmit_packet(frame, len);
+  }
+  // REC i COMP odpowiadają na ramkę odebraną na własnym SF nasłuchu - tam czeka nadawca, jak na ACK
+  if (header.type == reliable::FRAME_REC || header.type == reliable::FRAME_COMP) {
+    return this->parent->transmit_packet(frame, len);
+  }
+  if (std::all_of(peer.begin(), peer.end(), [](uint8_t b) { return b == 0xFF; })) {
+    std::vector<uint8_t> sfs;
+    adr.broadcast_sfs(sfs);
+    bool queued = false;
+    for (uint8_t sf : sfs) {
+      queued |= this->parent->transmit_packet(frame, len, false, sf, this->parent->tx_power_);
+    }
+    return queued;
+  }
+  const bool expects_reply = header.type == reliable::FRAME_REL ||
+                             ((header.type == reliable::FRAME_DATA || header.type == reliable::FRAME_TOPIC) &&
+                              header.qos != reliable::QOS_AT_MOST_ONCE);
+  uint8_t sf;
+  uint8_t power;
+  adr.tx_params(peer, expects_reply, sf, power);
+  const uint32_t reply_window =
+      expects_reply ? this->parent->get_time_on_air_us(header_size() + 1, sf) + ACK_TURNAROUND_US : 0;
+  return this->parent->transmit_packet(frame, len, false, sf, power, reply_window);
+}
 
-  if (xSemaphoreTake(this->queue_mutex_, 0) == pdTRUE) {
-    // Usuń potwierdzone lub przekroczone wiadomości
-    this->pending_messages_.erase(
-      std::remove_if(this->pending_messages_.begin(), this->pending_messages_.end(),
-        [now, this](const PendingMessage& m) {
-          return m.acked || ((now - m.timestamp) > this->timeout_us_ && 
-                            m.retry_count >= this->max_retries_);
-        }),
-      this->pending_messages_.end()
-    );
-
-    for (auto& msg : this->pending_messages_) {
-      if (!msg.acked && (now - msg.timestamp) > this->timeout_us_ && 
-          msg.retry_count < this->max_retries_) {
-        
-        // Ponowna transmisja
-        ESP_LOGD(TAG, "Retransmitting message ID %02X%02X%02X, attempt %d",
-                 msg.message_id[0], msg.message_id[1], msg.message_id[2], 
-                 msg.retry_count + 1);
-        
-        this->transmit_packet(msg.payload);
-        msg.retry_count++;
-        msg.timestamp = now;
+void LoRaTransport::send_ack(const Address &peer, const uint8_t *frame, size_t len) {
+  this->parent->transmit_packet(frame, len, true);
+}
+
+// Ramka i ACK w eterze (na SF ramki do peera), obsługa u odbiorcy oraz czekanie na budżet duty cycle
+int64_t LoRaTransport::min_ack_timeout_us(const Address &peer, size_t len) {
+  const uint8_t sf = this->parent->adr_.is_enabled() ? this->parent->adr_.get_tx_sf(peer) : 0;
+  int64_t timeout = int64_t(this->parent->get_time_on_air_us(len, sf)) +
+                    this->parent->get_time_on_air_us(header_size() + 1, sf) + ACK_TURNAROUND_US;
+  std::lock_guard<reliable::FreeRtosMutex> lock(this->parent->tx_mutex_);
+  const int64_t backlog = std::max(this->parent->tx_wait_until_, this->parent->lbt_until_) - esp_timer_get_time();
+  return backlog > 0 ? timeout + backlog : timeout;
+}
+
+// Kolejkuje ramkę i budzi zadanie radia - nie dotyka modemu i nie blokuje wywołującego
+bool BasicLoRaEx::transmit_packet(const uint8_t *data, size_t len, bool ack, uint8_t sf, uint8_t tx_power,
+                                  uint32_t reply_window_us) {
+  if (!this->lora_initialized_ || this->radio_task_ == nullptr || len == 0 || len > MAX_PACKET_SIZE) {
+    return false;
+  }
+  if (sf == 0) {
+    sf = this->get_listen_spreading_factor();
+  }
+  if (tx_power == 0) {
+    tx_power = this->tx_power_;
+  }
+  std::vector<uint8_t> air(data, data + len);
+  if (this->implicit_header_) {
+    // Stała długość w eterze: bajt długości ramki, ramka, zera do payload_length
+    if (len + 1 > this->payload_length_) {
+      ESP_LOGW(TAG, "Frame of %u bytes does not fit payload_length %u, dropped", (unsigned) len,
+               this->payload_length_);
+      return false;
+    }
+    air.assign(this->payload_length_, 0);
+    air[0] = len;
+    std::copy(data, data + len, air.begin() + 1);
+  }
+  {
+    std::lock_guard<reliable::FreeRtosMutex> lock(this->tx_mutex_);
+    // Retransmisja ramki, która wciąż czeka (np. na budżet duty cycle), nie dubluje jej w kolejce
+    for (const auto &queued : this->tx_queue_) {
+      if (queued.spreading_factor == sf && queued.data == air) {
+        return true;
+      }
+    }
+    auto first_data = std::find_if(this->tx_queue_.begin(), this->tx_queue_.end(),
+                                   [](const TxFrame &frame) { return !frame.ack; });
+    if (this->tx_queue_.size() >= MAX_TX_QUEUE) {
+      // ACK wypiera ostatnią ramkę danych - tę silnik i tak powtórzy po timeoucie
+      if (!ack || first_data == this->tx_queue_.end()) {
+        this->tx_dropped_count_++;
+        return false;
       }
+      this->tx_queue_.pop_back();
+      this->tx_dropped_count_++;
+      first_data = std::find_if(this->tx_queue_.begin(), this->tx_queue_.end(),
+                                [](const TxFrame &frame) { return !frame.ack; });
     }
-    xSemaphoreGive(this->queue_mutex_);
+    // ACK wraca na kanale ostatniej ramki od odbiorcy, na którym czeka; dane dostają kanał dopiero przy nadaniu
+    const uint8_t channel = ack && !this->channels_.empty() ? this->peer_channel_locked(LoRaTransport::read_id(data))
+                                                              : NO_CHANNEL;
+    TxFrame frame{std::move(air), ack, sf, tx_power, reply_window_us, channel};
+    this->tx_queue_.insert(ack ? first_data : this->tx_queue_.end(), std::move(frame));
   }
+  xTaskNotifyGive(this->radio_task_);
+  return true;
 }
 
-void BasicLoRaEx::transmit_packet(const std::vector<uint8_t> &data) {
-  if (!this->lora_initialized_ || data.empty() || data.size() > 255) {
-    return;
+// Zadanie radia, pod radio_mutex_: następna ramka tylko wtedy, gdy modem nie nadaje i pod-pasmo
+// ma budżet. Zwraca, za ile ms zadanie ma się obudzić bez przerwania.
+uint32_t BasicLoRaEx::service_tx() {
+  const int64_t now = esp_timer_get_time();
+  if (this->radio_state_ == RADIO_TX_ACTIVE) {
+    if (now < this->tx_deadline_) {
+      return std::min<uint32_t>(RADIO_IDLE_CHECK_MS, (this->tx_deadline_ - now) / 1000 + 1);
+    }
+    ESP_LOGW(TAG, "No TxDone, resetting radio to RX");
+    this->set_mode(MODE_LONG_RANGE_MODE | MODE_STDBY);
+    this->radio_state_ = RADIO_RX;
+    this->reply_until_ = 0;
+  }
+  if (this->radio_state_ == RADIO_CAD) {
+    if (now < this->cad_deadline_) {
+      return std::min<uint32_t>(RADIO_IDLE_CHECK_MS, (this->cad_deadline_ - now) / 1000 + 1);
+    }
+    // Bez wyniku CAD ramka idzie bez nasłuchu - LBT nie może zablokować nadawania
+    ESP_LOGW(TAG, "No CadDone, transmitting without LBT");
+    this->set_mode(MODE_LONG_RANGE_MODE | MODE_STDBY);
+    this->radio_state_ = RADIO_RX;
+    std::lock_guard<reliable::FreeRtosMutex> lock(this->tx_mutex_);
+    this->channel_clear_ = true;
+  }
+  if (this->radio_state_ == RADIO_RX_SINGLE) {
+    // Skan wykrył preambułę - nadawanie czeka, aż ramka zostanie odebrana albo minie timeout
+    // synchronizacji (flaga RxTimeout odczytywana przy przebudzeniu, także bez DIO1)
+    const int64_t until = now < this->rx_sync_deadline_ ? this->rx_sync_deadline_ : this->rx_single_deadline_;
+    if (now < until) {
+      return std::min<uint32_t>(RADIO_IDLE_CHECK_MS, (until - now) / 1000 + 1);
+    }
+    this->set_mode(MODE_LONG_RANGE_MODE | MODE_STDBY);
+    this->radio_state_ = RADIO_RX;
   }
 
-  // Przejście do trybu standby
-  this->set_mode(MODE_LONG_RANGE_MODE | MODE_STDBY);
-  this->receiving_ = false;
+  TxFrame frame{};
+  uint32_t airtime = 0;
+  uint32_t wake_ms = RADIO_IDLE_CHECK_MS;
+  uint8_t cad_sf = 0;
+  uint8_t cad_channel = NO_CHANNEL;
+  {
+    std::lock_guard<reliable::FreeRtosMutex> lock(this->tx_mutex_);
+    while (!this->tx_queue_.empty()) {
+      TxFrame &front = this->tx_queue_.front();
+      airtime = this->get_time_on_air_us(front.data.size(), front.spreading_factor);
+      if (!this->channels_.empty() &&
+          (front.channel == NO_CHANNEL || (!front.ack && this->tx_wait_until_ > now))) {
+        // Kanał dla ramki - przy czekaniu na budżet ponowny wybór może trafić na inne pod-pasmo
+        front.channel = this->pick_channel_locked(now, airtime);
+        this->channel_clear_ = false;
+      }
+      DutyCycleBucket *bucket = this->find_duty_cycle_locked(this->channel_frequency(front.channel));
+      const int64_t wait = bucket != nullptr ? bucket->wait_us(now, airtime) : 0;
+      if (wait < 0) {
+        // Dłuższa niż cały budżet okna - nie zmieści się nigdy
+        ESP_LOGW(TAG, "Frame of %u us exceeds the duty-cycle budget, dropped", (unsigned) airtime);
+        this->duty_cycle_dropped_count_++;
+        this->tx_queue_.erase(this->tx_queue_.begin());
+        continue;
+      }
+      if (wait > 0) {
+        this->tx_wait_until_ = now + wait;
+        wake_ms = std::min<uint32_t>(wake_ms, wait / 1000 + 1);
+        break;
+      }
+      // ACK odpowiada na ramkę, której nadawca właśnie czeka - idzie bez nasłuchu, jak w 802.11 po SIFS
+      if (this->lbt_enabled_ && !this->channel_clear_ && !front.ack) {
+        if (this->lbt_attempts_ >= this->lbt_max_attempts_) {
+          // Kanał stale zajęty - ramka idzie mimo to, kolejka nie może stać bez końca
+          this->lbt_forced_count_++;
+        } else if (now < this->lbt_until_) {
+          // Odczekanie po zajętym CAD - w tym czasie radio odbiera
+          wake_ms = std::min<uint32_t>(wake_ms, (this->lbt_until_ - now) / 1000 + 1);
+          break;
+        } else {
+          cad_sf = front.spreading_factor;
+          cad_channel = front.channel;
+          break;
+        }
+      }
+      if (bucket != nullptr) {
+        bucket->consume(now, airtime);
+      }
+      this->tx_wait_until_ = 0;
+      if (!front.ack) {
+        this->channel_clear_ = false;
+        this->lbt_attempts_ = 0;
+        this->lbt_until_ = 0;
+      }
+      frame = std::move(this->tx_queue_.front());
+      this->tx_queue_.erase(this->tx_queue_.begin());
+      break;
+    }
+  }
+  if (cad_sf != 0) {
+    this->start_cad(cad_sf, cad_channel);
+    return std::min<uint32_t>(RADIO_IDLE_CHECK_MS, (this->cad_deadline_ - now) / 1000 + 1);
+  }
+  if (frame.data.empty()) {
+    // Nasłuch na SF nasłuchu, a w oknie odpowiedzi na SF i kanale ostatniej ramki; zmiany tylko w standby
+    uint8_t listen_sf = this->rx_sf_;
+    uint8_t channel = NO_CHANNEL;
+    if (now < this->reply_until_) {
+      listen_sf = this->reply_sf_;
+      channel = this->reply_channel_;
+      wake_ms = std::min<uint32_t>(wake_ms, (this->reply_until_ - now) / 1000 + 1);
+    } else if (!this->channels_.empty()) {
+      return std::min(wake_ms, this->service_scan(now, listen_sf));
+    }
+    if (listen_sf != this->active_sf_ || (channel != NO_CHANNEL && channel != this->active_channel_)) {
+      this->set_mode(MODE_LONG_RANGE_MODE | MODE_STDBY);
+      this->set_spreading_factor_internal(listen_sf);
+      this->tune_channel(channel);
+    }
+    this->write_register(REG_DIO_MAPPING_1, DIO_MAPPING_RX);
+    this->set_mode(MODE_LONG_RANGE_MODE | MODE_RX_CONTINUOUS);
+    return wake_ms;
+  }
+  this->radio_state_ = RADIO_TX_PENDING;
+  this->start_transmit(frame);
+  this->tx_deadline_ = now + 2 * int64_t(airtime) + TX_WATCHDOG_MARGIN_US;
+  return std::min<uint32_t>(RADIO_IDLE_CHECK_MS, (this->tx_deadline_ - now) / 1000 + 1);
+}
 
-  // Reset flag IRQ
-  this->write_register(REG_IRQ_FLAGS, 0xFF);
+// Odbiór z planem kanałów: CAD po kolei na każdym kanale. Preambuła nadawcy jest dłuższa niż pełny
+// obieg skanu, więc wykrycie zdąży przed jej końcem; RX single przejmuje ramkę na tym kanale.
+uint32_t BasicLoRaEx::service_scan(int64_t now, uint8_t sf) {
+  if (this->radio_state_ == RADIO_SCAN && now < this->cad_deadline_) {
+    return (this->cad_deadline_ - now) / 1000 + 1;
+  }
+  // Brak CadDone (watchdog) albo koniec poprzedniego kroku - następny kanał
+  this->scan_channel_ = (this->scan_channel_ + 1) % this->channels_.size();
+  this->start_cad(sf, this->scan_channel_);
+  this->radio_state_ = RADIO_SCAN;
+  return (this->cad_deadline_ - now) / 1000 + 1;
+}
 
-  // Ustaw adres FIFO na początek
-  this->write_register(REG_FIFO_ADDR_PTR, 0);
+// Szybkie przestrojenie: tylko REG_FRF_* z wartości policzonych w add_channel(), jednym zapisem
+void BasicLoRaEx::tune_channel(uint8_t channel) {
+  if (channel == NO_CHANNEL || channel == this->active_channel_) {
+    return;
+  }
+  this->write_registers(REG_FRF_MSB, this->channel_frf_[channel].data(), 3);
+  this->active_channel_ = channel;
+}
 
-  // Zapisz dane do FIFO
-  this->enable();
-  this->write_byte(REG_FIFO | 0x80);
-  for (uint8_t byte : data) {
-    this->write_byte(byte);
+// Pod tx_mutex_: kanał z polityki skakania, a gdy jego pod-pasmo nie ma budżetu - pierwszy kolejny,
+// który go ma (kanały w jednym pod-paśmie dzielą wiadro)
+uint8_t BasicLoRaEx::pick_channel_locked(int64_t now, uint32_t airtime) {
+  const size_t count = this->channels_.size();
+  size_t start;
+  if (this->channel_hopping_ == HOP_SEQUENCE) {
+    start = (LoRaTransport::node_id + this->hop_index_++) % count;
+  } else {
+    start = esp_random() % count;
   }
-  this->disable();
+  for (size_t i = 0; i < count; i++) {
+    const uint8_t channel = (start + i) % count;
+    DutyCycleBucket *bucket = this->find_duty_cycle_locked(this->channels_[channel]);
+    if (bucket == nullptr || bucket->wait_us(now, airtime) == 0) {
+      return channel;
+    }
+  }
+  return start;
+}
 
-  // Ustaw długość payload
-  this->write_register(REG_PAYLOAD_LENGTH, data.size());
+// Z loop(): kanał ramki od węzła id - ostatnio słyszany na końcu listy
+void BasicLoRaEx::remember_peer_channel(uint16_t id, uint8_t channel) {
+  std::lock_guard<reliable::FreeRtosMutex> lock(this->tx_mutex_);
+  auto it = std::find_if(this->peer_channels_.begin(), this->peer_channels_.end(),
+                         [id](const std::pair<uint16_t, uint8_t> &p) { return p.first == id; });
+  if (it != this->peer_channels_.end()) {
+    this->peer_channels_.erase(it);
+  } else if (this->peer_channels_.size() >= MAX_PEER_CHANNELS) {
+    this->peer_channels_.erase(this->peer_channels_.begin());
+  }
+  this->peer_channels_.push_back({id, channel});
+}
 
-  // Przejście do trybu TX
-  this->set_mode(MODE_LONG_RANGE_MODE | MODE_TX);
-  
-  ESP_LOGD(TAG, "Transmitting %d bytes", data.size());
+// NO_CHANNEL - węzeł jeszcze nie nadawał; ACK dostanie kanał przy nadaniu, a odbiorca znajdzie go skanem
+uint8_t BasicLoRaEx::peer_channel_locked(uint16_t id) const {
+  for (const auto &p : this->peer_channels_) {
+    if (p.first == id) {
+      return p.second;
+    }
+  }
+  return NO_CHANNEL;
 }
 
-bool BasicLoRaEx::receive_packet(std::vector<uint8_t> &data) {
-  // Sprawdź flagę RxDone
-  uint8_t irq_flags = this->read_register(REG_IRQ_FLAGS);
-  
-  if (!(irq_flags & IRQ_RX_DONE_MASK)) {
-    return false; // Brak nowych danych
+DutyCycleBucket *BasicLoRaEx::find_duty_cycle_locked(uint32_t frequency) {
+  for (auto &bucket : this->duty_cycle_) {
+    if (bucket.contains(frequency)) {
+      return &bucket;
+    }
   }
+  return nullptr;
+}
 
-  // Sprawdź błąd CRC
-  if (irq_flags & IRQ_PAYLOAD_CRC_ERROR_MASK) {
-    ESP_LOGW(TAG, "CRC error in received packet");
-    this->write_register(REG_IRQ_FLAGS, IRQ_PAYLOAD_CRC_ERROR_MASK);
-    return false;
+int64_t BasicLoRaEx::get_retry_span_us() const {
+  const uint8_t sf = this->adr_.is_enabled() ? this->adr_.get_max_sf() : 0;
+  const int64_t airtime = int64_t(this->get_time_on_air_us(MAX_PACKET_SIZE, sf)) +
+                          this->get_time_on_air_us(LoRaTransport::header_size() + 1, sf) + ACK_TURNAROUND_US;
+  return std::max(this->engine_.get_timeout_us(), airtime) * this->engine_.get_max_retries();
+}
+
+int64_t BasicLoRaEx::get_airtime_remaining_us() {
+  std::lock_guard<reliable::FreeRtosMutex> lock(this->tx_mutex_);
+  if (this->channels_.empty()) {
+    DutyCycleBucket *bucket = this->find_duty_cycle_locked(this->frequency_);
+    return bucket != nullptr ? bucket->remaining_us(esp_timer_get_time()) : -1;
   }
+  // Plan kanałów: największy budżet, jaki może wykorzystać następna ramka
+  int64_t remaining = 0;
+  for (uint32_t channel : this->channels_) {
+    DutyCycleBucket *bucket = this->find_duty_cycle_locked(channel);
+    if (bucket == nullptr) {
+      return -1;
+    }
+    remaining = std::max(remaining, bucket->remaining_us(esp_timer_get_time()));
+  }
+  return remaining;
+}
 
-  // Odczytaj długość pakietu
-  uint8_t packet_length = this->read_register(REG_RX_NB_BYTES);
-  if (packet_length == 0) {
-    this->write_register(REG_IRQ_FLAGS, IRQ_RX_DONE_MASK);
-    return false;
+void BasicLoRaEx::publish_airtime() {
+#ifdef USE_SENSOR
+  if (this->airtime_sensor_ == nullptr) {
+    return;
   }
+  const uint32_t now = millis();
+  if (this->last_airtime_publish_ != 0 && now - this->last_airtime_publish_ < AIRTIME_PUBLISH_INTERVAL_MS) {
+    return;
+  }
+  this->last_airtime_publish_ = now;
+  const int64_t remaining = this->get_airtime_remaining_us();
+  if (remaining >= 0) {
+    this->airtime_sensor_->publish_state(remaining / 1000.0f);
+  }
+#endif
+}
 
-  // Odczytaj adres ostatniego pakietu w FIFO
-  uint8_t fifo_addr = this->read_register(REG_FIFO_RX_CURRENT_ADDR);
-  this->write_register(REG_FIFO_ADDR_PTR, fifo_addr);
+void BasicLoRaEx::start_transmit(const TxFrame &frame) {
+  const std::vector<uint8_t> &data = frame.data;
+  // Przejście do trybu standby
+  this->set_mode(MODE_LONG_RANGE_MODE | MODE_STDBY);
 
-  // Odczytaj dane z FIFO
-  data.clear();
-  data.reserve(packet_length);
-  
-  this->enable();
-  this->write_byte(REG_FIFO & 0x7F);
-  for (int i = 0; i < packet_length; i++) {
-    data.push_back(this->read_byte());
+  // Modulacja ramki (ADR: SF nasłuchu odbiorcy, moc do niego)
+  if (frame.spreading_factor != this->active_sf_) {
+    this->set_spreading_factor_internal(frame.spreading_factor);
   }
-  this->disable();
+  if (frame.tx_power != this->active_tx_power_) {
+    this->set_tx_power_internal(frame.tx_power);
+  }
+  this->tune_channel(frame.channel);
+  this->tx_sf_ = frame.spreading_factor;
+  this->tx_channel_ = frame.channel;
+  this->tx_reply_window_us_ = frame.reply_window_us;
 
-  // Odczytaj RSSI i SNR
-  this->last_rssi_ = this->read_register(REG_PKT_RSSI_VALUE) - 164;
-  int8_t snr_raw = this->read_register(REG_PKT_SNR_VALUE);
-  this->last_snr_ = snr_raw * 0.25;
+  // Reset flagi TxDone (nieobsłużone RxDone zostaje dla handle_radio_irq)
+  this->write_register(REG_IRQ_FLAGS, IRQ_TX_DONE_MASK);
 
-  // Wyczyść flagę RxDone
-  this->write_register(REG_IRQ_FLAGS, IRQ_RX_DONE_MASK);
+  // Ustaw adres FIFO na początek
+  this->write_register(REG_FIFO_ADDR_PTR, 0);
 
-  ESP_LOGD(TAG, "Received %d bytes, RSSI: %d dBm, SNR: %.1f dB", 
-           packet_length, this->last_rssi_, this->last_snr_);
+  // Zapisz dane do FIFO
+  this->write_fifo(data.data(), data.size());
 
-  return true;
+  // Ustaw długość payload
+  this->write_register(REG_PAYLOAD_LENGTH, data.size());
+
+  // TxDone na DIO0 - koniec nadawania budzi zadanie radia bez czekania na watchdog
+  this->write_register(REG_DIO_MAPPING_1, DIO_MAPPING_TX);
+
+  // Przejście do trybu TX
+  this->set_mode(MODE_LONG_RANGE_MODE | MODE_TX);
+  this->radio_state_ = RADIO_TX_ACTIVE;
+
+  ESP_LOGV(TAG, "Transmitting %u bytes on SF%u at %u dBm", (unsigned) data.size(), frame.spreading_factor,
+           frame.tx_power);
 }
 
-void BasicLoRaEx::handle_received_data(const std::vector<uint8_t> &data) {
-  if (data.size() < 10) { // Minimum: peer_mac(6) + type(1) + msg_id(3)
-    ESP_LOGW(TAG, "Received packet too short: %d bytes", data.size());
-    return;
+// CAD na SF ramki - modem wykrywa tylko preambuły nadawane z tym samym SF i szerokością pasma
+void BasicLoRaEx::start_cad(uint8_t sf, uint8_t channel) {
+  this->set_mode(MODE_LONG_RANGE_MODE | MODE_STDBY);
+  if (sf != this->active_sf_) {
+    this->set_spreading_factor_internal(sf);
   }
+  this->tune_channel(channel);
+  this->write_register(REG_IRQ_FLAGS, IRQ_CAD_DONE_MASK | IRQ_CAD_DETECTED_MASK);
+  this->write_register(REG_DIO_MAPPING_1, DIO_MAPPING_CAD);
+  this->set_mode(MODE_LONG_RANGE_MODE | MODE_CAD);
+  this->radio_state_ = RADIO_CAD;
+  this->cad_deadline_ = esp_timer_get_time() + 4 * this->symbol_us(sf) + CAD_WATCHDOG_MARGIN_US;
+}
 
-  // Wyciągnij adres nadawcy
-  std::array<uint8_t, 6> sender_mac;
-  std::copy_n(data.begin(), 6, sender_mac.begin());
-
-  uint8_t packet_type = data[6];
-  std::array<uint8_t, 3> msg_id{data[7], data[8], data[9]};
-
-  // Obsługa ACK (10 bajtów: peer_mac + type(0x01) + msg_id)
-  if (packet_type == 0x01 && data.size() == 10) {
-    bool should_handle_ack = false;
-    
-    if (xSemaphoreTake(this->queue_mutex_, portMAX_DELAY) == pdTRUE) {
-      auto it = std::find_if(this->pending_messages_.begin(), this->pending_messages_.end(),
-        [&](const PendingMessage& m) {
-          return m.mac == sender_mac && m.message_id == msg_id && !m.acked;
-        });
-      
-      if (it != this->pending_messages_.end()) {
-        it->acked = true;
-        should_handle_ack = true;
-        ESP_LOGD(TAG, "ACK received for message %02X%02X%02X", msg_id[0], msg_id[1], msg_id[2]);
-      }
-      xSemaphoreGive(this->queue_mutex_);
-    }
-    
-    if (should_handle_ack) {
-      this->on_recv_ack_callback_.call(sender_mac, msg_id);
+// Wywoływane z handle_radio_irq() po RxDone bez błędu CRC, pod radio_mutex_
+void BasicLoRaEx::receive_packet(uint8_t fifo_addr, uint8_t packet_length) {
+  // Odczytaj dane z FIFO od adresu ostatniego pakietu - najpierw sam adres celu
+  this->write_register(REG_FIFO_ADDR_PTR, fifo_addr);
+  const uint8_t address_size = LoRaTransport::address_size;
+  if (this->implicit_header_) {
+    // Stała długość w eterze - faktyczną długość ramki niesie pierwszy bajt, reszta to dopełnienie
+    uint8_t frame_length;
+    this->read_fifo(&frame_length, 1);
+    if (frame_length >= packet_length) {
+      return;
     }
-    return;
+    packet_length = frame_length;
   }
-
-  // Obsługa danych (type = 0x00)
-  if (packet_type != 0x00) {
-    ESP_LOGW(TAG, "Unknown packet type: 0x%02X", packet_type);
+  if (packet_length < LoRaTransport::header_size()) {
     return;
   }
-
-  // Sprawdź duplikaty
-  int64_t now = esp_timer_get_time();
-  bool is_duplicate = false;
-  
-  if (xSemaphoreTake(this->history_mutex_, portMAX_DELAY) == pdTRUE) {
-    auto &history = this->received_history_;
-    
-    // Usuń stare wpisy (>300s)
-    history.erase(
-      std::remove_if(history.begin(), history.end(),
-        [now](const ReceivedMessageInfo &info) {
-          return (now - info.timestamp) > 300000000; // 300s
-        }),
-      history.end());
-
-    // Sprawdź czy wiadomość już była odebrana
-    is_duplicate = std::any_of(history.begin(), history.end(),
-      [&](const ReceivedMessageInfo &info) {
-        return info.mac == sender_mac && info.data == data;
-      });
-
-    if (!is_duplicate) {
-      constexpr size_t MAX_HISTORY_SIZE = 1000;
-      if (history.size() >= MAX_HISTORY_SIZE) {
-        history.erase(history.begin());
-      }
-      history.push_back({sender_mac, now, data});
-    }
-    
-    xSemaphoreGive(this->history_mutex_);
-  }
-
-  if (is_duplicate) {
-    ESP_LOGD(TAG, "Duplicate message ignored");
+  std::vector<uint8_t> data(packet_length);
+  this->read_fifo(data.data(), address_size);
+  const uint16_t dest = LoRaTransport::read_id(data.data());
+  if (dest != LoRaTransport::node_id && dest != LoRaTransport::broadcast_id()) {
+    // Ramka do innego węzła - bez reszty FIFO, deduplikacji, ACK i callbacków
+    this->foreign_dropped_count_++;
     return;
   }
+  // Wskaźnik FIFO przesuwa się sam - reszta ramki drugą transakcją
+  this->read_fifo(data.data() + address_size, packet_length - address_size);
 
-  // Wyślij ACK
-  this->send_ack(sender_mac, msg_id);
+  // SNR i RSSI pakietu leżą obok siebie (0x19, 0x1A)
+  uint8_t quality[2];
+  this->read_registers(REG_PKT_SNR_VALUE, quality, sizeof(quality));
+  const int8_t snr_x4 = int8_t(quality[0]);
+  this->last_snr_ = snr_x4 * 0.25f;
+  this->last_rssi_ = quality[1] - 164;
 
-  // Przetwórz payload
-  std::vector<uint8_t> payload(data.begin() + 10, data.end());
+  ESP_LOGV(TAG, "Received %d bytes, RSSI: %d dBm, SNR: %.1f dB",
+           packet_length, this->last_rssi_, this->last_snr_);
 
-  // Dekodowanie komendy (payload 4 bajty, pierwszy dwój == ostatni dwój)
-  if (payload.size() == 4 && memcmp(payload.data(), payload.data() + 2, 2) == 0) {
-    int16_t cmd = (payload[0] << 8) | payload[1];
-    this->on_recv_cmd_callback_.call(sender_mac, cmd);
-    ESP_LOGD(TAG, "Command received: %d", cmd);
+  std::lock_guard<reliable::FreeRtosMutex> lock(this->rx_mutex_);
+  if (this->rx_queue_.size() >= MAX_RX_QUEUE) {
+    this->rx_dropped_count_++;
+    return;
   }
+  this->rx_queue_.push_back({std::move(data), snr_x4, this->active_channel_});
+}
 
-  // Przekaż dane do callbacków
-  this->on_recv_data_callback_.call(sender_mac, payload);
-  
-  if (!payload.empty()) {
-    std::string message(payload.begin(), payload.end());
-    this->on_message_callback_.call(sender_mac, message);
+// Obsługa przerwań: ISR tylko budzi zadanie radia - SPI, delay() i logi są poza kontekstem przerwania
+void IRAM_ATTR BasicLoRaEx::dio_isr(BasicLoRaEx *arg) {
+  BaseType_t woken = pdFALSE;
+  vTaskNotifyGiveFromISR(arg->radio_task_, &woken);
+  if (woken) {
+    portYIELD_FROM_ISR();
   }
 }
 
-void BasicLoRaEx::send_ack(const std::array<uint8_t, 6> &peer_mac, const std::array<uint8_t, 3> &msg_id) {
-  std::vector<uint8_t> ack_packet;
-  ack_packet.reserve(10);
-  
-  // peer_mac(6) + type(1) + msg_id(3)
-  ack_packet.insert(ack_packet.end(), peer_mac.begin(), peer_mac.end());
-  ack_packet.push_back(0x01); // Type: ACK
-  ack_packet.insert(ack_packet.end(), msg_id.begin(), msg_id.end());
-  
-  this->transmit_packet(ack_packet);
-  
-  // Powróć do trybu odbioru
-  delay(10);
-  this->set_mode(MODE_LONG_RANGE_MODE | MODE_RX_CONTINUOUS);
-  this->receiving_ = true;
+void BasicLoRaEx::radio_task(void *arg) {
+  BasicLoRaEx *instance = static_cast<BasicLoRaEx *>(arg);
+  uint32_t wake_ms = RADIO_IDLE_CHECK_MS;
+  while (true) {
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(wake_ms));
+    std::lock_guard<reliable::FreeRtosMutex> lock(instance->radio_mutex_);
+    instance->handle_radio_irq();
+    wake_ms = instance->service_tx();
+  }
 }
 
-// Obsługa przerwań
-void IRAM_ATTR BasicLoRaEx::dio0_isr(void *arg) {
-  BasicLoRaEx *instance = static_cast<BasicLoRaEx*>(arg);
-  instance->handle_dio0_interrupt();
-}
+// Jeden odczyt flag IRQ na przebudzenie; kasowane są tylko flagi tu obsłużone
+void BasicLoRaEx::handle_radio_irq() {
+  // 0x10-0x13 jedną transakcją: adres pakietu w FIFO, maska, flagi IRQ, długość pakietu
+  uint8_t status[4];
+  this->read_registers(REG_FIFO_RX_CURRENT_ADDR, status, sizeof(status));
+  const uint8_t irq_flags = status[2];
+  const uint8_t handled = irq_flags & (IRQ_RX_DONE_MASK | IRQ_PAYLOAD_CRC_ERROR_MASK | IRQ_RX_TIMEOUT_MASK |
+                                       IRQ_TX_DONE_MASK | IRQ_CAD_DONE_MASK | IRQ_CAD_DETECTED_MASK);
+  if (handled == 0) {
+    return;
+  }
+  this->write_register(REG_IRQ_FLAGS, handled);
 
-void BasicLoRaEx::handle_dio0_interrupt() {
-  // Przerwanie DIO0 - RxDone lub TxDone
-  uint8_t irq_flags = this->read_register(REG_IRQ_FLAGS);
-  
+  if (irq_flags & IRQ_RX_DONE_MASK) {
+    if (irq_flags & IRQ_PAYLOAD_CRC_ERROR_MASK) {
+      this->crc_error_count_++;
+      ESP_LOGW(TAG, "CRC error in received packet");
+    } else {
+      this->receive_packet(status[0], status[3]);
+    }
+  }
+
+  if (irq_flags & (IRQ_TX_DONE_MASK | IRQ_RX_TIMEOUT_MASK | IRQ_CAD_DONE_MASK)) {
+    // Po TX, CAD (i po timeoucie RX single) modem sam przechodzi do standby. Następną ramkę albo
+    // powrót do odbioru ciągłego wybiera service_tx().
+    this->mode_ = MODE_LONG_RANGE_MODE | MODE_STDBY;
+  }
+  if (this->radio_state_ == RADIO_RX_SINGLE && (irq_flags & (IRQ_RX_DONE_MASK | IRQ_RX_TIMEOUT_MASK))) {
+    // RX single kończy się w standby także po odebranej ramce - skan rusza dalej
+    this->mode_ = MODE_LONG_RANGE_MODE | MODE_STDBY;
+    this->radio_state_ = RADIO_RX;
+  }
   if (irq_flags & IRQ_TX_DONE_MASK) {
-    // Transmisja zakończona
-    this->write_register(REG_IRQ_FLAGS, IRQ_TX_DONE_MASK);
-    
-    // Powróć do trybu odbioru
-    this->set_mode(MODE_LONG_RANGE_MODE | MODE_RX_CONTINUOUS);
-    this->receiving_ = true;
-    
-    ESP_LOGD(TAG, "TX Done");
+    this->radio_state_ = RADIO_RX;
+    if (this->tx_reply_window_us_ != 0) {
+      this->reply_sf_ = this->tx_sf_;
+      this->reply_channel_ = this->tx_channel_;
+      this->reply_until_ = esp_timer_get_time() + this->tx_reply_window_us_;
+    }
+    ESP_LOGV(TAG, "TX Done");
+  }
+  if ((irq_flags & IRQ_CAD_DONE_MASK) && this->radio_state_ == RADIO_SCAN) {
+    this->radio_state_ = RADIO_RX;
+    if (irq_flags & IRQ_CAD_DETECTED_MASK) {
+      // Preambuła na skanowanym kanale - odbiór od razu, zanim się skończy
+      this->scan_detect_count_++;
+      this->write_register(REG_DIO_MAPPING_1, DIO_MAPPING_RX);
+      this->set_mode(MODE_LONG_RANGE_MODE | MODE_RX_SINGLE);
+      this->radio_state_ = RADIO_RX_SINGLE;
+      const int64_t now = esp_timer_get_time();
+      this->rx_sync_deadline_ = now + (this->preamble_length_ + 1) * this->symbol_us(this->active_sf_);
+      this->rx_single_deadline_ =
+          this->rx_sync_deadline_ + this->get_time_on_air_us(MAX_PACKET_SIZE, this->active_sf_);
+    }
+  } else if ((irq_flags & IRQ_CAD_DONE_MASK) && this->radio_state_ == RADIO_CAD) {
+    this->radio_state_ = RADIO_RX;
+    std::lock_guard<reliable::FreeRtosMutex> lock(this->tx_mutex_);
+    if (irq_flags & IRQ_CAD_DETECTED_MASK) {
+      // Zajęty kanał: losowe odczekanie z oknem rosnącym wykładniczo - nadawcy, którzy trafili na
+      // tę samą transmisję, nie ruszą razem po jej końcu
+      this->channel_busy_count_++;
+      const uint8_t exponent = std::min(this->lbt_attempts_, LBT_MAX_BACKOFF_EXPONENT);
+      const uint32_t window = uint32_t(this->lbt_backoff_us_) << exponent;
+      this->lbt_attempts_++;
+      this->lbt_until_ = esp_timer_get_time() + this->lbt_backoff_us_ + esp_random() % window;
+      ESP_LOGV(TAG, "Channel busy, backing off (attempt %u)", this->lbt_attempts_);
+    } else {
+      this->channel_clear_ = true;
+    }
   }
 }
 
@@ -580,19 +1146,11 @@ void BasicLoRaEx::retry_timer_callback(void *arg) {
 }
 
 void BasicLoRaEx::clear_pending_messages() {
-  if (xSemaphoreTake(this->queue_mutex_, portMAX_DELAY) == pdTRUE) {
-    this->pending_messages_.clear();
-    xSemaphoreGive(this->queue_mutex_);
-  }
+  this->engine_.clear();
 }
 
 size_t BasicLoRaEx::get_pending_count() {
-  size_t count = 0;
-  if (xSemaphoreTake(this->queue_mutex_, portMAX_DELAY) == pdTRUE) {
-    count = this->pending_messages_.size();
-    xSemaphoreGive(this->queue_mutex_);
-  }
-  return count;
+  return this->engine_.pending_count();
 }
 
 // Implementacja triggerów
@@ -620,19 +1178,26 @@ OnRecvDataTrigger::OnRecvDataTrigger(BasicLoRaEx *parent) {
   });
 }
 
+OnTopicTrigger::OnTopicTrigger(BasicLoRaEx *parent, uint16_t topic) {
+  parent->add_on_topic_callback(topic, [this](const std::array<uint8_t, 6> mac, const std::vector<uint8_t> data) {
+    trigger(mac, data);
+  });
+}
+
 BasicLoRaEx::~BasicLoRaEx() {
+  if (this->dio0_pin_ != nullptr) {
+    this->dio0_pin_->detach_interrupt();
+  }
+  if (this->dio1_pin_ != nullptr) {
+    this->dio1_pin_->detach_interrupt();
+  }
+  if (this->radio_task_ != nullptr) {
+    vTaskDelete(this->radio_task_);
+  }
   if (this->retry_timer_) {
     esp_timer_stop(this->retry_timer_);
     esp_timer_delete(this->retry_timer_);
   }
-  
-  if (this->queue_mutex_) {
-    vSemaphoreDelete(this->queue_mutex_);
-  }
-  
-  if (this->history_mutex_) {
-    vSemaphoreDelete(this->history_mutex_);
-  }
 }
 
 }  // namespace lora
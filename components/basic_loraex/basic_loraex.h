@@ -4,7 +4,22 @@
 #include "esphome/core/automation.h"
 #include "esphome/core/hal.h"
 #include "esphome/components/spi/spi.h"
+#include "esphome/components/basic_reliable/reliable_engine.h"
+#include "esphome/components/basic_reliable/freertos_mutex.h"
+#include "esphome/components/basic_reliable/exactly_once_store.h"
+#include "esphome/components/basic_reliable/message_schema.h"
+#include "esphome/components/basic_reliable/send_action.h"
+#include "airtime.h"
+#include "adr.h"
+
+#ifdef USE_BINARY_SENSOR
+#include "esphome/components/binary_sensor/binary_sensor.h"
+#endif
+#ifdef USE_SENSOR
+#include "esphome/components/sensor/sensor.h"
+#endif
 #include "esp_timer.h"
+#include "esp_random.h"
 
 // FreeRTOS
 #include "freertos/FreeRTOS.h"
@@ -12,6 +27,7 @@
 #include "freertos/task.h"
 
 #include <array>
+#include <bitset>
 #include <vector>
 #include <string>
 #include <algorithm>
@@ -35,19 +51,24 @@ static const uint8_t REG_FIFO_RX_CURRENT_ADDR = 0x10;
 static const uint8_t REG_IRQ_FLAGS_MASK = 0x11;
 static const uint8_t REG_IRQ_FLAGS = 0x12;
 static const uint8_t REG_RX_NB_BYTES = 0x13;
+static const uint8_t REG_PKT_SNR_VALUE = 0x19;
 static const uint8_t REG_PKT_RSSI_VALUE = 0x1A;
-static const uint8_t REG_PKT_SNR_VALUE = 0x1B;
 static const uint8_t REG_MODEM_CONFIG_1 = 0x1D;
 static const uint8_t REG_MODEM_CONFIG_2 = 0x1E;
 static const uint8_t REG_PREAMBLE_MSB = 0x20;
 static const uint8_t REG_PREAMBLE_LSB = 0x21;
 static const uint8_t REG_PAYLOAD_LENGTH = 0x22;
 static const uint8_t REG_MODEM_CONFIG_3 = 0x26;
-static const uint8_t REG_RSSI_VALUE = 0x1C;
+static const uint8_t REG_RSSI_VALUE = 0x1B;
+static const uint8_t REG_SYMB_TIMEOUT_LSB = 0x1F;
+static const uint8_t REG_DETECTION_OPTIMIZE = 0x31;
+static const uint8_t REG_DETECTION_THRESHOLD = 0x37;
 static const uint8_t REG_DIO_MAPPING_1 = 0x40;
 static const uint8_t REG_DIO_MAPPING_2 = 0x41;
 static const uint8_t REG_VERSION = 0x42;
 static const uint8_t REG_SYNC_WORD = 0x39;
+// Kopia w pamięci obejmuje rejestry 0x00-0x41 (z nich tylko konfiguracyjne - is_shadowed())
+static const size_t REG_SHADOW_SIZE = 0x42;
 
 // Tryby pracy
 static const uint8_t MODE_LONG_RANGE_MODE = 0x80;
@@ -56,27 +77,127 @@ static const uint8_t MODE_STDBY = 0x01;
 static const uint8_t MODE_TX = 0x03;
 static const uint8_t MODE_RX_CONTINUOUS = 0x05;
 static const uint8_t MODE_RX_SINGLE = 0x06;
+static const uint8_t MODE_CAD = 0x07;
+static const uint8_t MODE_MASK = 0x07;
 
 // IRQ flagi
+static const uint8_t IRQ_CAD_DETECTED_MASK = 0x01;
+static const uint8_t IRQ_CAD_DONE_MASK = 0x04;
 static const uint8_t IRQ_TX_DONE_MASK = 0x08;
 static const uint8_t IRQ_PAYLOAD_CRC_ERROR_MASK = 0x20;
 static const uint8_t IRQ_RX_DONE_MASK = 0x40;
+static const uint8_t IRQ_RX_TIMEOUT_MASK = 0x80;
+
+// REG_DIO_MAPPING_1 dla fazy pracy: DIO0 = RxDone / TxDone / CadDone, DIO1 = RxTimeout / CadDetected
+static const uint8_t DIO_MAPPING_RX = 0x00;
+static const uint8_t DIO_MAPPING_TX = 0x40;
+static const uint8_t DIO_MAPPING_CAD = 0xA0;
+
+// Zadanie radia: budzone z przerwania DIO0/DIO1, jedyne miejsce odczytu flag IRQ
+static const uint32_t RADIO_TASK_STACK_SIZE = 4096;
+static const UBaseType_t RADIO_TASK_PRIORITY = 5;
+// Zbocze DIO może umknąć (np. flaga ustawiona przed attach_interrupt) - rzadki odczyt kontrolny
+static const uint32_t RADIO_IDLE_CHECK_MS = 1000;
+// Odebrane ramki czekające na loop(); nadmiarowe nie są potwierdzane, więc nadawca je powtórzy
+static const size_t MAX_RX_QUEUE = 8;
+// Ramki czekające na koniec bieżącej transmisji (ACK przed pozostałymi)
+static const size_t MAX_TX_QUEUE = 8;
+// Brak TxDone po dwukrotności czasu w eterze i tym zapasie oznacza zawieszony modem
+static const int64_t TX_WATCHDOG_MARGIN_US = 100000;
+// CAD trwa ok. dwóch symboli - po czterech i tym zapasie modem uznajemy za zawieszony
+static const int64_t CAD_WATCHDOG_MARGIN_US = 10000;
+// Okno losowania odczekania rośnie jak backoff * 2^próba, najwyżej do tej potęgi
+static const uint8_t LBT_MAX_BACKOFF_EXPONENT = 6;
+// Odbiorca: ramka do loop(), silnik, kolejka TX - doliczane do czasu w eterze ramki i ACK
+static const int64_t ACK_TURNAROUND_US = 100000;
+// Pozostały budżet czasu nadawania publikowany co tyle
+static const uint32_t AIRTIME_PUBLISH_INTERVAL_MS = 10000;
+// Indeks kanału "bez planu kanałów" - ramka idzie na frequency_
+static const uint8_t NO_CHANNEL = 0xFF;
+// Zapamiętane kanały odpowiedzi - najdawniej słyszany peer wypada; bez wpisu odpowiedź znajdzie skan
+static const size_t MAX_PEER_CHANNELS = 32;
+
+// Stan radia, zmieniany tylko przez zadanie radia
+enum RadioState : uint8_t {
+  RADIO_RX = 0,      // odbiór ciągły
+  RADIO_TX_PENDING,  // ramka zdjęta z kolejki, ładowanie FIFO
+  RADIO_TX_ACTIVE,   // nadawanie, czeka na TxDone
+  RADIO_CAD,         // nasłuch przed nadaniem (CAD), czeka na CadDone
+  RADIO_SCAN,        // skanowanie planu kanałów: CAD na kolejnym kanale, czeka na CadDone
+  RADIO_RX_SINGLE,   // skan wykrył preambułę - odbiór jednej ramki na tym kanale
+};
 
-struct PendingMessage {
-  std::array<uint8_t, 6> mac;
-  std::array<uint8_t, 3> message_id;
-  uint8_t retry_count;
-  int64_t timestamp;
-  bool acked;
-  std::vector<uint8_t> payload;
+struct TxFrame {
+  std::vector<uint8_t> data;
+  bool ack;
+  uint8_t spreading_factor;
+  uint8_t tx_power;
+  uint32_t reply_window_us;  // po nadaniu nasłuch odpowiedzi na SF ramki (ADR)
+  uint8_t channel;           // indeks w planie kanałów; NO_CHANNEL - wybór przy nadaniu
 };
 
-struct ReceivedMessageInfo {
-    std::array<uint8_t, 6> mac;
-    int64_t timestamp;
-    std::vector<uint8_t> data;
+struct RxFrame {
+  std::vector<uint8_t> data;
+  int8_t snr_x4;  // SNR pakietu w 1/4 dB
+  uint8_t channel;
+};
+
+enum ChannelHopping : uint8_t {
+  HOP_RANDOM = 0,  // kanał losowany dla każdej ramki
+  HOP_SEQUENCE,    // kolejne kanały, sekwencja przesunięta o node_id
 };
 
+using reliable::EnqueueResult;
+using reliable::MessageId;
+using reliable::OverflowPolicy;
+using reliable::QoS;
+
+// Nagłówek LoRa: cel(1-2) + nadawca(1-2) + typ(1) + message_id(3) [+ temat(2) dla FRAME_TOPIC].
+// Identyfikatory węzłów zamiast MAC; stałe niżej to górne granice (adresy 2-bajtowe).
+static const size_t MAX_ADDRESS_SIZE = 2;
+static const size_t FRAME_HEADER_SIZE = 2 * MAX_ADDRESS_SIZE + 4;
+static const size_t TOPIC_HEADER_SIZE = FRAME_HEADER_SIZE + 2;
+static const size_t MAX_PACKET_SIZE = 255;
+
+class BasicLoRaEx;
+
+// Polityka transportu LoRa dla reliable::ReliableEngine
+struct LoRaTransport {
+  using Address = std::array<uint8_t, 6>;
+  using Mutex = reliable::FreeRtosMutex;
+  static constexpr size_t MTU = MAX_PACKET_SIZE;
+  static constexpr size_t MAX_HEADER_SIZE = TOPIC_HEADER_SIZE;
+  static constexpr const char *TAG = "basic_loraex";
+#ifdef USE_RELIABLE_TRACE
+  static constexpr uint8_t TRACE_SOURCE = reliable::trace::SRC_LORA;
+#endif
+
+  static int64_t now_us() { return esp_timer_get_time(); }
+  static uint32_t random32() { return esp_random(); }
+  static size_t encode_header(uint8_t *out, const Address &peer, const reliable::FrameHeader &header);
+  static size_t decode_header(const uint8_t *data, size_t len, Address &peer, reliable::FrameHeader &header);
+
+  // Adresy węzłów z YAML: jedno radio na urządzenie, więc tablica jest wspólna dla kodowania
+  // nagłówków (statycznego w kontrakcie silnika)
+  static inline uint8_t address_size{1};
+  static inline uint16_t node_id{0};
+  static inline std::vector<std::pair<Address, uint16_t>> nodes;
+  static size_t header_size() { return 2 * address_size + 4; }
+  static uint16_t broadcast_id() { return address_size == 1 ? 0xFF : 0xFFFF; }
+  // 0 = MAC bez identyfikatora
+  static uint16_t node_id_of(const Address &mac);
+  // Węzeł spoza tablicy dostaje stały MAC lokalny 02:4C:52:00:id - odpowiedzi do niego działają
+  static Address mac_of(uint16_t id);
+  static uint16_t read_id(const uint8_t *data) {
+    return address_size == 1 ? data[0] : uint16_t((data[0] << 8) | data[1]);
+  }
+
+  bool send(const Address &peer, const uint8_t *frame, size_t len);
+  void send_ack(const Address &peer, const uint8_t *frame, size_t len);
+  int64_t min_ack_timeout_us(const Address &peer, size_t len);
+
+  BasicLoRaEx *parent;
+};
 class BasicLoRaEx;
 
 class OnMessageTrigger : public ::esphome::Trigger<std::array<uint8_t, 6>, std::string>, public Component {
@@ -99,6 +220,11 @@ class OnRecvDataTrigger : public ::esphome::Trigger<std::array<uint8_t, 6>, std:
     explicit OnRecvDataTrigger(BasicLoRaEx *parent);
 };
 
+class OnTopicTrigger : public ::esphome::Trigger<std::array<uint8_t, 6>, std::vector<uint8_t>>, public Component {
+  public:
+    OnTopicTrigger(BasicLoRaEx *parent, uint16_t topic);
+};
+
 class BasicLoRaEx : public Component, public spi::SPIDevice<spi::BIT_ORDER_MSB_FIRST, spi::CLOCK_POLARITY_LOW, 
                                                            spi::CLOCK_PHASE_LEADING, spi::DATA_RATE_8MHZ> {
  public:
@@ -108,8 +234,8 @@ class BasicLoRaEx : public Component, public spi::SPIDevice<spi::BIT_ORDER_MSB_F
 
   // Konfiguracja pinów
   void set_cs_pin(GPIOPin *cs_pin) { this->cs_pin_ = cs_pin; }
-  void set_dio0_pin(GPIOPin *dio0_pin) { this->dio0_pin_ = dio0_pin; }
-  void set_dio1_pin(GPIOPin *dio1_pin) { this->dio1_pin_ = dio1_pin; }
+  void set_dio0_pin(InternalGPIOPin *dio0_pin) { this->dio0_pin_ = dio0_pin; }
+  void set_dio1_pin(InternalGPIOPin *dio1_pin) { this->dio1_pin_ = dio1_pin; }
   void set_dio2_pin(GPIOPin *dio2_pin) { this->dio2_pin_ = dio2_pin; }
   void set_rst_pin(GPIOPin *rst_pin) { this->rst_pin_ = rst_pin; }
 
@@ -123,22 +249,162 @@ class BasicLoRaEx : public Component, public spi::SPIDevice<spi::BIT_ORDER_MSB_F
   void set_preamble_length(uint16_t length) { this->preamble_length_ = length; }
   void set_enable_crc(bool enable) { this->enable_crc_ = enable; }
   void set_implicit_header(bool implicit) { this->implicit_header_ = implicit; }
+  // Nagłówek niejawny: każda ramka w eterze ma dokładnie tyle bajtów (bajt długości + ramka + dopełnienie)
+  void set_payload_length(uint8_t length) { this->payload_length_ = length; }
+
+  // Limity wypełnienia (duty cycle): jedno wiadro żetonów na pod-pasmo, limit w setnych procenta
+  void add_duty_cycle_band(uint32_t min_frequency, uint32_t max_frequency, uint16_t limit_bp) {
+    this->duty_cycle_.emplace_back(min_frequency, max_frequency, limit_bp);
+  }
+  void set_duty_cycle_window(uint32_t window_ms) { this->duty_cycle_window_us_ = int64_t(window_ms) * 1000; }
+#ifdef USE_SENSOR
+  void set_airtime_sensor(sensor::Sensor *sensor) { this->airtime_sensor_ = sensor; }
+#endif
+  // Czas w eterze ramki o tej długości przy bieżącej modulacji (sf = 0) lub podanym SF
+  uint32_t get_time_on_air_us(size_t len, uint8_t sf = 0) const {
+    return time_on_air_us(this->modulation(sf), this->implicit_header_ ? this->payload_length_ : len);
+  }
+  // Pozostały budżet nadawania w pod-paśmie bieżącej częstotliwości (-1 = pasmo bez limitu)
+  int64_t get_airtime_remaining_us();
+
+  // Nasłuch przed nadaniem: CAD przed każdą ramką, przy zajętym kanale losowe odczekanie
+  // (backoff plus losowo do backoff * 2^próba); po max_attempts zajętych CAD ramka idzie mimo to
+  void set_lbt(bool enabled) { this->lbt_enabled_ = enabled; }
+  void set_lbt_backoff(uint32_t backoff_ms) { this->lbt_backoff_us_ = int64_t(backoff_ms) * 1000; }
+  void set_lbt_max_attempts(uint8_t attempts) { this->lbt_max_attempts_ = attempts; }
+
+  // Plan kanałów: nadawanie na kanale wybranym dla każdej ramki, odbiór skanowaniem CAD po wszystkich
+  // kanałach. FRF liczone raz tutaj - przestrojenie to jeden zapis trzech rejestrów.
+  void add_channel(uint32_t frequency) {
+    const uint64_t frf = (uint64_t(frequency) << 19) / 32000000;
+    this->channels_.push_back(frequency);
+    this->channel_frf_.push_back({uint8_t(frf >> 16), uint8_t(frf >> 8), uint8_t(frf)});
+  }
+  void set_channel_hopping(ChannelHopping hopping) { this->channel_hopping_ = hopping; }
+  size_t get_channel_count() const { return this->channels_.size(); }
+
+  // ADR (adr.h): SF nasłuchu i moc do peerów dobierane z marginesu SNR
+  void set_adr(bool enabled) { this->adr_.set_enabled(enabled); }
+  void set_adr_spreading_factor_range(uint8_t min_sf, uint8_t max_sf) {
+    this->adr_.set_spreading_factor_range(min_sf, max_sf);
+  }
+  void set_adr_margin(uint8_t margin_db) { this->adr_.set_margin_db(margin_db); }
+  void set_adr_min_tx_power(uint8_t power) { this->adr_.set_min_tx_power(power); }
+  void set_adr_report_interval(uint32_t interval_ms) { this->adr_.set_report_interval_us(int64_t(interval_ms) * 1000); }
+  void set_adr_fallback_losses(uint8_t losses) { this->adr_.set_fallback_losses(losses); }
+  uint8_t get_listen_spreading_factor() const {
+    return this->adr_.is_enabled() ? this->adr_.get_listen_sf() : this->spreading_factor_;
+  }
 
   // Konfiguracja komunikacji
   void set_peer_mac(std::array<uint8_t, 6> mac) { this->peer_mac_ = mac; }
-  void set_max_retries(uint8_t max_retries) { this->max_retries_ = max_retries; }
-  void set_timeout_us(int64_t timeout_us) { this->timeout_us_ = timeout_us * 1000; }
+  // Krótkie adresy w nagłówku: własny identyfikator i mapowanie MAC -> identyfikator peerów
+  void set_node_id(uint16_t node_id) { LoRaTransport::node_id = node_id; }
+  void set_address_size(uint8_t size) { LoRaTransport::address_size = size; }
+  void add_node(std::array<uint8_t, 6> mac, uint16_t node_id) { LoRaTransport::nodes.push_back({mac, node_id}); }
+  void set_max_retries(uint8_t max_retries) { this->engine_.set_max_retries(max_retries); }
+  void set_timeout_us(int64_t timeout_us) { this->engine_.set_timeout_us(timeout_us * 1000); }
+  // Jak długo silnik może ponawiać jedną ramkę: wszystkie próby, każda po pełnym timeoucie albo po czasie
+  // najdłuższej ramki i ACK w eterze przy najwolniejszym SF (bez czekania na limit duty cycle)
+  int64_t get_retry_span_us() const;
 
   // API komunikacji (zgodność z ESP-NOW)
-  void send_broadcast(const std::vector<uint8_t> &msg);
-  void send_broadcast_str(const std::string &message);
-  void send_to_peer(const std::vector<uint8_t> &msg);
-  void send_to_peer_str(const std::string &message);
-  void send_lora_str(std::string message, const std::array<uint8_t, 6> &peer_mac);
-  void send_lora(const std::vector<uint8_t> &msg, const std::array<uint8_t, 6> &peer_mac);
-  void send_lora_cmd(int16_t cmd, const std::array<uint8_t, 6> &peer_mac);
+  EnqueueResult send_broadcast(const std::vector<uint8_t> &msg, uint8_t priority = 0);
+  EnqueueResult send_broadcast_str(const std::string &message, uint8_t priority = 0);
+  // QoS jak w basic_espnowex: 0 - bez ACK i bez kolejki, 1 - domyślny, 2 - dokładnie raz
+  EnqueueResult send_to_peer(const std::vector<uint8_t> &msg, uint8_t priority = 0, QoS qos = reliable::QOS_AT_LEAST_ONCE);
+  EnqueueResult send_to_peer_str(const std::string &message, uint8_t priority = 0, QoS qos = reliable::QOS_AT_LEAST_ONCE);
+  EnqueueResult send_lora_str(std::string message, const std::array<uint8_t, 6> &peer_mac, uint8_t priority = 0,
+                              QoS qos = reliable::QOS_AT_LEAST_ONCE);
+  EnqueueResult send_lora(const std::vector<uint8_t> &msg, const std::array<uint8_t, 6> &peer_mac, uint8_t priority = 0,
+                          QoS qos = reliable::QOS_AT_LEAST_ONCE);
+  EnqueueResult send_lora_cmd(int16_t cmd, const std::array<uint8_t, 6> &peer_mac, uint8_t priority = 0,
+                              QoS qos = reliable::QOS_AT_LEAST_ONCE);
+  // Akcje send/send_cmd z YAML (send_action.h): treść bez kopii pośrednich
+  EnqueueResult send_raw(const uint8_t *data, size_t len, const std::array<uint8_t, 6> &peer_mac, uint8_t priority,
+                         QoS qos) {
+    return this->engine_.send(data, len, peer_mac, priority, qos);
+  }
+  EnqueueResult publish_raw(uint16_t topic, const uint8_t *data, size_t len, const std::array<uint8_t, 6> &peer_mac,
+                            uint8_t priority, QoS qos) {
+    return this->engine_.publish(topic, data, len, peer_mac, priority, qos);
+  }
+  EnqueueResult send_cmd(int16_t cmd, const std::array<uint8_t, 6> &peer_mac, uint8_t priority, QoS qos) {
+    return this->send_lora_cmd(cmd, peer_mac, priority, qos);
+  }
+  // Wiadomości ze schematu YAML (messages:) - spakowane pola pod tematem Message::TOPIC, bez sterty
+  template<typename Message>
+  EnqueueResult send_message(const Message &msg, const std::array<uint8_t, 6> &peer_mac, uint8_t priority = 0,
+                             QoS qos = reliable::QOS_AT_LEAST_ONCE) {
+    uint8_t payload[Message::SIZE];
+    msg.encode(payload);
+    return this->engine_.publish(Message::TOPIC, payload, Message::SIZE, peer_mac, priority, qos);
+  }
+  template<typename Message>
+  EnqueueResult send_message_to_peer(const Message &msg, uint8_t priority = 0, QoS qos = reliable::QOS_AT_LEAST_ONCE) {
+    return this->send_message(msg, this->peer_mac_, priority, qos);
+  }
+  const std::array<uint8_t, 6> &get_peer_mac() const { return this->peer_mac_; }
   void clear_pending_messages();
   size_t get_pending_count();
+  uint32_t get_crc_error_count() const { return this->crc_error_count_; }
+  uint32_t get_rx_dropped_count() const { return this->rx_dropped_count_; }
+  // Ramki do innych węzłów odrzucone zaraz po odczycie adresu celu
+  uint32_t get_foreign_dropped_count() const { return this->foreign_dropped_count_; }
+  uint32_t get_tx_dropped_count() const { return this->tx_dropped_count_; }
+  uint32_t get_duty_cycle_dropped_count() const { return this->duty_cycle_dropped_count_; }
+  uint32_t get_channel_busy_count() const { return this->channel_busy_count_; }
+  uint32_t get_lbt_forced_count() const { return this->lbt_forced_count_; }
+  // Preambuły wykryte skanem kanałów (także te, po których nie przyszła poprawna ramka)
+  uint32_t get_scan_detect_count() const { return this->scan_detect_count_; }
+  RadioState get_radio_state() const { return this->radio_state_; }
+
+  // Przejmowanie ramek (basic_bridge, basic_failover): handler zwraca true, jeśli przejął ramkę -
+  // wtedy nie jest ona potwierdzana ani dostarczana lokalnie, a ACK wysyła się przez acknowledge().
+  using ForwardHandler = std::function<bool(const std::array<uint8_t, 6> &, const reliable::FrameHeader &,
+                                            const uint8_t *, size_t)>;
+  void set_forward_handler(ForwardHandler &&handler) { this->forward_handler_ = std::move(handler); }
+  EnqueueResult send_frame(std::vector<uint8_t> &&frame, const std::array<uint8_t, 6> &peer_mac, uint8_t priority = 0) {
+    return this->engine_.enqueue_frame(std::move(frame), peer_mac, priority);
+  }
+  void acknowledge(const std::array<uint8_t, 6> &peer_mac, const MessageId &id, QoS qos = reliable::QOS_AT_LEAST_ONCE) {
+    this->engine_.acknowledge(peer_mac, id, qos);
+  }
+  bool is_pending(const std::array<uint8_t, 6> &peer_mac, const MessageId &id) { return this->engine_.is_pending(peer_mac, id); }
+  bool cancel(const std::array<uint8_t, 6> &peer_mac, const MessageId &id) { return this->engine_.cancel(peer_mac, id); }
+  MessageId generate_message_id() { return this->engine_.generate_message_id(); }
+
+  // Limity kolejki wysyłkowej
+  void set_max_queue_messages(size_t max_messages) { this->engine_.set_max_queue_messages(max_messages); }
+  void set_max_queue_bytes(size_t max_bytes) { this->engine_.set_max_queue_bytes(max_bytes); }
+  void set_overflow_policy(OverflowPolicy policy) { this->engine_.set_overflow_policy(policy); }
+  size_t get_queue_high_water_mark() const { return this->engine_.get_queue_high_water_mark(); }
+  size_t get_queued_bytes() const { return this->engine_.get_queued_bytes(); }
+  uint32_t get_dropped_count() const { return this->engine_.get_dropped_count(); }
+
+  // Stan peerów (circuit breaker): po failure_threshold kolejnych transmisjach bez ACK ramki do
+  // peera czekają w kolejce (lub są odrzucane), a co probe_interval wychodzi jedna próba.
+  void set_peer_failure_threshold(uint8_t threshold) { this->engine_.set_peer_failure_threshold(threshold); }
+  void set_peer_probe_interval(uint32_t interval_ms) { this->engine_.set_peer_probe_interval_us(int64_t(interval_ms) * 1000); }
+  void set_peer_down_policy(reliable::PeerDownPolicy policy) { this->engine_.set_peer_down_policy(policy); }
+  // Kontrola przepływu: ramki dostarczane z loop(), wolne miejsca ogłaszane nadawcom w ACK
+  void set_receive_window(uint8_t window) { this->engine_.set_receive_window(window); }
+  // Skrzynka (bramka): ramki do śpiących peerów czekają na ich pobudkę zamiast przepadać po max_retries
+  void add_sleepy_peer(std::array<uint8_t, 6> peer_mac) { this->engine_.add_sleepy_peer(peer_mac); }
+  void set_mailbox_retention(uint32_t retention_ms) {
+    this->engine_.set_mailbox_retention_us(int64_t(retention_ms) * 1000);
+  }
+  void set_mailbox_capacity(uint8_t capacity) { this->engine_.set_mailbox_capacity(capacity); }
+  // Węzeł: zapytanie bramki (peer_mac) o pocztę bez wysyłania danych
+  EnqueueResult poll_mailbox() {
+    return this->engine_.publish(reliable::MAILBOX_POLL_TOPIC, nullptr, 0, this->peer_mac_);
+  }
+  reliable::PeerState get_peer_state(const std::array<uint8_t, 6> &peer_mac) { return this->engine_.get_peer_state(peer_mac); }
+#ifdef USE_BINARY_SENSOR
+  void add_peer_sensor(std::array<uint8_t, 6> peer_mac, binary_sensor::BinarySensor *sensor) {
+    this->peer_sensors_.push_back({peer_mac, sensor});
+  }
+#endif
 
   // Callbacki automatyzacji
   void add_on_message_callback(std::function<void(std::array<uint8_t,6>, std::string)> &&cb) {
@@ -161,13 +427,22 @@ class BasicLoRaEx : public Component, public spi::SPIDevice<spi::BIT_ORDER_MSB_F
   }
   CallbackManager<void(std::array<uint8_t,6>, std::vector<uint8_t>)> on_recv_data_callback_;
 
+  // Subskrypcje tematów jak w basic_espnowex - indeks posortowany po skrócie, wyszukiwanie binarne w loop()
+  void add_on_topic_callback(uint16_t topic, std::function<void(std::array<uint8_t,6>, std::vector<uint8_t>)> &&cb) {
+    this->engine_.add_topic_callback(topic, std::move(cb));
+  }
+  bool has_topic_subscribers(uint16_t topic) const { return this->engine_.has_topic_subscribers(topic); }
+
   ~BasicLoRaEx();
 
  protected:
+  friend class reliable::ReliableEngine<LoRaTransport, BasicLoRaEx>;
+  friend struct LoRaTransport;
+
   // Hardware
   GPIOPin *cs_pin_{nullptr};
-  GPIOPin *dio0_pin_{nullptr};
-  GPIOPin *dio1_pin_{nullptr};
+  InternalGPIOPin *dio0_pin_{nullptr};
+  InternalGPIOPin *dio1_pin_{nullptr};
   GPIOPin *dio2_pin_{nullptr};
   GPIOPin *rst_pin_{nullptr};
 
@@ -181,48 +456,177 @@ class BasicLoRaEx : public Component, public spi::SPIDevice<spi::BIT_ORDER_MSB_F
   uint16_t preamble_length_{8};
   bool enable_crc_{true};
   bool implicit_header_{false};
+  uint8_t payload_length_{0};
 
   // Parametry komunikacji
   std::array<uint8_t, 6> peer_mac_{{0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF}};
-  uint8_t max_retries_{5};
-  int64_t timeout_us_{200000000}; // 200ms w mikrosekundach
-
-  // Zarządzanie wiadomościami
-  std::vector<PendingMessage> pending_messages_;
-  std::vector<ReceivedMessageInfo> received_history_;
-  SemaphoreHandle_t queue_mutex_;
-  SemaphoreHandle_t history_mutex_;
+
+  // Kolejka, retransmisje i deduplikacja - wspólny silnik z basic_espnowex
+  LoRaTransport transport_{this};
+  reliable::ReliableEngine<LoRaTransport, BasicLoRaEx> engine_{&this->transport_, this};
+  ForwardHandler forward_handler_;
+  reliable::ExactlyOnceStore<std::array<uint8_t, 6>> exactly_once_store_;
   esp_timer_handle_t retry_timer_;
 
+#ifdef USE_BINARY_SENSOR
+  struct PeerSensor {
+    std::array<uint8_t, 6> mac;
+    binary_sensor::BinarySensor *sensor;
+  };
+  std::vector<PeerSensor> peer_sensors_;
+  uint32_t peer_state_epoch_{0};
+#endif
+  void update_peer_sensors();
+
   // Stan LoRa
   bool lora_initialized_{false};
-  bool receiving_{false};
+  RadioState radio_state_{RADIO_RX};
+  int64_t tx_deadline_{0};
+  int64_t cad_deadline_{0};
+  // Modulacja ustawiona w modemie i SF nasłuchu (zmieniane z ADR); pod radio_mutex_
+  uint8_t active_sf_{0};
+  uint8_t active_tx_power_{0};
+  uint8_t rx_sf_{0};
+  // Okno odpowiedzi po ramce nadanej na SF peera: modem słucha na reply_sf_ do reply_until_
+  uint8_t tx_sf_{0};
+  uint32_t tx_reply_window_us_{0};
+  uint8_t reply_sf_{0};
+  int64_t reply_until_{0};
   int last_rssi_{0};
   float last_snr_{0.0};
 
+  // Dostęp do modemu (SPI i tryb pracy): zadanie radia, timer retry i loop()
+  reliable::FreeRtosMutex radio_mutex_;
+  TaskHandle_t radio_task_{nullptr};
+  // Ramki odczytane z FIFO przez zadanie radia, dostarczane do silnika z loop()
+  reliable::FreeRtosMutex rx_mutex_;
+  std::vector<RxFrame> rx_queue_;
+  uint32_t crc_error_count_{0};
+  uint32_t rx_dropped_count_{0};
+  uint32_t foreign_dropped_count_{0};
+  // Ramki do nadania - transmit_packet() z dowolnego zadania, nadaje zadanie radia
+  reliable::FreeRtosMutex tx_mutex_;
+  std::vector<TxFrame> tx_queue_;
+  uint32_t tx_dropped_count_{0};
+  // Duty cycle (pod tx_mutex_): ramka z czoła kolejki czeka do tx_wait_until_ na żetony
+  std::vector<DutyCycleBucket> duty_cycle_;
+  int64_t duty_cycle_window_us_{3600000000LL};
+  int64_t tx_wait_until_{0};
+  uint32_t duty_cycle_dropped_count_{0};
+  // LBT (pod tx_mutex_): stan dotyczy najbliższej transmisji, nie konkretnej ramki
+  bool lbt_enabled_{false};
+  int64_t lbt_backoff_us_{100000};
+  uint8_t lbt_max_attempts_{6};
+  uint8_t lbt_attempts_{0};
+  int64_t lbt_until_{0};
+  bool channel_clear_{false};
+  uint32_t channel_busy_count_{0};
+  uint32_t lbt_forced_count_{0};
+  // Plan kanałów: wybór kanału pod tx_mutex_, strojenie i skan pod radio_mutex_
+  std::vector<uint32_t> channels_;
+  std::vector<std::array<uint8_t, 3>> channel_frf_;
+  ChannelHopping channel_hopping_{HOP_RANDOM};
+  uint16_t hop_index_{0};
+  uint8_t active_channel_{NO_CHANNEL};
+  uint8_t scan_channel_{0};
+  uint8_t tx_channel_{NO_CHANNEL};
+  uint8_t reply_channel_{NO_CHANNEL};
+  int64_t rx_sync_deadline_{0};
+  int64_t rx_single_deadline_{0};
+  uint32_t scan_detect_count_{0};
+  // Kanał ostatniej ramki od każdego węzła (identyfikator, kanał) - na nim wracają ACK, REC i COMP,
+  // także te wysłane później z loop() albo przez acknowledge(); pod tx_mutex_
+  std::vector<std::pair<uint16_t, uint8_t>> peer_channels_;
+#ifdef USE_SENSOR
+  sensor::Sensor *airtime_sensor_{nullptr};
+  uint32_t last_airtime_publish_{0};
+#endif
+
+  // ADR: ogłoszenia nowego SF nasłuchu czekające na ACK; SNR ramki przekazywanej silnikowi
+  AdrControl adr_;
+  std::vector<std::pair<std::array<uint8_t, 6>, MessageId>> adr_announcements_;
+  int8_t rx_snr_x4_{0};
+
+  // Kopia rejestrów konfiguracyjnych: odczyt przed modyfikacją i zapis tej samej wartości bez SPI.
+  // Unieważniana przy resecie modułu.
+  std::array<uint8_t, REG_SHADOW_SIZE> shadow_{};
+  std::bitset<REG_SHADOW_SIZE> shadow_valid_;
+  uint8_t mode_{0xFF};  // ostatnio zapisany REG_OP_MODE
+
   // Funkcje niskopoziomowe SX1278
   void reset_module();
   bool init_lora();
   void set_mode(uint8_t mode);
   uint8_t read_register(uint8_t reg);
   void write_register(uint8_t reg, uint8_t value);
+  // Dostęp blokowy: kolejne rejestry (autoinkrementacja adresu) w jednej transakcji SPI
+  void read_registers(uint8_t reg, uint8_t *out, size_t len);
+  void write_registers(uint8_t reg, const uint8_t *data, size_t len);
+  void read_fifo(uint8_t *out, size_t len);
+  void write_fifo(const uint8_t *data, size_t len);
+  static bool is_shadowed(uint8_t reg);
   void set_frequency_internal();
-  void set_spreading_factor_internal();
+  void set_spreading_factor_internal(uint8_t sf);
   void set_bandwidth_internal();
   void set_coding_rate_internal();
-  void set_tx_power_internal();
-  void handle_dio0_interrupt();
-  
+  void set_tx_power_internal(uint8_t power);
+  void set_low_data_rate_optimize_internal();
+  LoRaModulation modulation(uint8_t sf = 0) const {
+    return {sf != 0 ? sf : this->spreading_factor_, this->bandwidth_, this->coding_rate_, this->preamble_length_,
+            this->enable_crc_, this->implicit_header_};
+  }
+  DutyCycleBucket *find_duty_cycle_locked(uint32_t frequency);
+  void publish_airtime();
+  void handle_radio_irq();
+  void adr_loop();
+  void handle_adr_report(const std::array<uint8_t, 6> &mac, const reliable::FrameHeader &header,
+                         const uint8_t *payload, size_t len);
+
   // Funkcje komunikacji
-  std::array<uint8_t, 3> generate_message_id();
   void process_send_queue();
-  void transmit_packet(const std::vector<uint8_t> &data);
-  bool receive_packet(std::vector<uint8_t> &data);
-  void handle_received_data(const std::vector<uint8_t> &data);
-  void send_ack(const std::array<uint8_t, 6> &peer_mac, const std::array<uint8_t, 3> &msg_id);
+  // sf/tx_power = 0: SF nasłuchu i moc z konfiguracji
+  bool transmit_packet(const uint8_t *data, size_t len, bool ack = false, uint8_t sf = 0, uint8_t tx_power = 0,
+                       uint32_t reply_window_us = 0);
+  uint32_t service_tx();
+  void start_transmit(const TxFrame &frame);
+  void start_cad(uint8_t sf, uint8_t channel);
+  uint32_t service_scan(int64_t now, uint8_t sf);
+  void tune_channel(uint8_t channel);
+  uint32_t channel_frequency(uint8_t channel) const {
+    return channel == NO_CHANNEL ? this->frequency_ : this->channels_[channel];
+  }
+  uint8_t pick_channel_locked(int64_t now, uint32_t airtime);
+  void remember_peer_channel(uint16_t id, uint8_t channel);
+  uint8_t peer_channel_locked(uint16_t id) const;
+  int64_t symbol_us(uint8_t sf) const { return (int64_t(1) << sf) * 1000000 / this->bandwidth_; }
+  void receive_packet(uint8_t fifo_addr, uint8_t packet_length);
+
+  // Zdarzenia z silnika (Sink)
+  bool on_engine_forward(const std::array<uint8_t, 6> &mac, const reliable::FrameHeader &header, const uint8_t *payload,
+                         size_t len) {
+    if (header.type == reliable::FRAME_TOPIC && header.topic == ADR_TOPIC) {
+      this->handle_adr_report(mac, header, payload, len);
+      return true;
+    }
+    return this->forward_handler_ && this->forward_handler_(mac, header, payload, len);
+  }
+  void on_engine_ack(const std::array<uint8_t, 6> &mac, const MessageId &id) {
+    if (this->adr_.is_enabled()) {
+      this->adr_.on_ack(mac);
+    }
+    this->on_recv_ack_callback_.call(mac, id);
+  }
+  void on_engine_cmd(const std::array<uint8_t, 6> &mac, int16_t cmd) { this->on_recv_cmd_callback_.call(mac, cmd); }
+  void on_engine_data(const std::array<uint8_t, 6> &mac, const std::vector<uint8_t> &data) {
+    this->on_recv_data_callback_.call(mac, data);
+  }
+  void on_engine_message(const std::array<uint8_t, 6> &mac, const std::string &msg) {
+    this->on_message_callback_.call(mac, msg);
+  }
 
   // Przerwania i timery
-  static void IRAM_ATTR dio0_isr(void *arg);
+  static void IRAM_ATTR dio_isr(BasicLoRaEx *arg);
+  static void radio_task(void *arg);
   static void retry_timer_callback(void *arg);
 
   static BasicLoRaEx *instance_;
@@ -0,0 +1,25 @@
+import esphome.codegen as cg
+import esphome.config_validation as cv
+from esphome.components import sensor
+from esphome.const import DEVICE_CLASS_DURATION, STATE_CLASS_MEASUREMENT, UNIT_MILLISECOND
+from . import BasicLoRaEx
+
+DEPENDENCIES = ["basic_loraex"]
+
+CONF_BASIC_LORAEX_ID = "basic_loraex_id"
+
+# Pozostały budżet nadawania (duty_cycle) w pod-paśmie częstotliwości radia
+CONFIG_SCHEMA = sensor.sensor_schema(
+    unit_of_measurement=UNIT_MILLISECOND,
+    accuracy_decimals=0,
+    device_class=DEVICE_CLASS_DURATION,
+    state_class=STATE_CLASS_MEASUREMENT,
+).extend({
+    cv.GenerateID(CONF_BASIC_LORAEX_ID): cv.use_id(BasicLoRaEx),
+})
+
+
+async def to_code(config):
+    parent = await cg.get_variable(config[CONF_BASIC_LORAEX_ID])
+    var = await sensor.new_sensor(config)
+    cg.add(parent.set_airtime_sensor(var))
@@ -0,0 +1,435 @@
+import re
+
+import esphome.codegen as cg
+import esphome.config_validation as cv
+from esphome import automation
+from esphome.const import CONF_ID, CONF_MAC_ADDRESS, CONF_NAME, CONF_TRIGGER_ID, CONF_TYPE
+from esphome.core import CORE, EsphomeError
+
+# Komponent pomocniczy (tylko nagłówki): wspólny silnik niezawodnego dostarczania
+# dla basic_espnowex i basic_loraex. Ładowany automatycznie przez AUTO_LOAD.
+
+basic_reliable_ns = cg.esphome_ns.namespace("reliable")
+
+OverflowPolicy = basic_reliable_ns.enum("OverflowPolicy")
+OVERFLOW_POLICIES = {
+    "reject_new": OverflowPolicy.OVERFLOW_REJECT_NEW,
+    "drop_oldest": OverflowPolicy.OVERFLOW_DROP_OLDEST,
+    "drop_lowest_priority": OverflowPolicy.OVERFLOW_DROP_LOWEST_PRIORITY,
+}
+
+PeerDownPolicy = basic_reliable_ns.enum("PeerDownPolicy")
+PEER_DOWN_POLICIES = {
+    "park": PeerDownPolicy.PEER_DOWN_PARK,
+    "reject": PeerDownPolicy.PEER_DOWN_REJECT,
+}
+
+QoS = basic_reliable_ns.enum("QoS")
+QOS_LEVELS = {
+    0: QoS.QOS_AT_MOST_ONCE,
+    1: QoS.QOS_AT_LEAST_ONCE,
+    2: QoS.QOS_EXACTLY_ONCE,
+}
+
+MessageTrigger = basic_reliable_ns.class_("MessageTrigger", automation.Trigger.template())
+SendMessageAction = basic_reliable_ns.class_("SendMessageAction", automation.Action)
+SendAction = basic_reliable_ns.class_("SendAction", automation.Action)
+SendCmdAction = basic_reliable_ns.class_("SendCmdAction", automation.Action)
+
+CONF_TRACE_BUFFER_SIZE = "trace_buffer_size"
+CONF_PEER_HEALTH = "peer_health"
+CONF_FAILURE_THRESHOLD = "failure_threshold"
+CONF_PROBE_INTERVAL = "probe_interval"
+CONF_DOWN_POLICY = "down_policy"
+CONF_RECEIVE_WINDOW = "receive_window"
+CONF_MAILBOX = "mailbox"
+CONF_SLEEPY_PEERS = "peers"
+CONF_RETENTION = "retention"
+CONF_CAPACITY = "capacity"
+
+# Kontrola przepływu odbiorcy: rozmiar kolejki odbiorczej ogłaszany w ACK (0 = wyłączona)
+RECEIVE_WINDOW_SCHEMA = cv.int_range(min=0, max=64)
+
+# Sekcja peer_health: w basic_espnowex i basic_loraex (circuit breaker silnika)
+PEER_HEALTH_SCHEMA = cv.Schema({
+    cv.Optional(CONF_FAILURE_THRESHOLD, default=5): cv.int_range(min=0, max=255),
+    cv.Optional(CONF_PROBE_INTERVAL, default="10s"): cv.positive_time_period_milliseconds,
+    cv.Optional(CONF_DOWN_POLICY, default="park"): cv.enum(PEER_DOWN_POLICIES, lower=True),
+})
+
+
+def mac_expression(mac):
+    mac_ints = [int(x, 16) for x in mac.to_string().split(":")]
+    return cg.RawExpression(f"std::array<uint8_t, 6>{{{', '.join(map(str, mac_ints))}}}")
+
+
+def peer_health_to_code(var, config):
+    cg.add(var.set_peer_failure_threshold(config[CONF_FAILURE_THRESHOLD]))
+    cg.add(var.set_peer_probe_interval(config[CONF_PROBE_INTERVAL].total_milliseconds))
+    cg.add(var.set_peer_down_policy(config[CONF_DOWN_POLICY]))
+
+
+# Sekcja mailbox (bramka): ramki do śpiących peerów czekają na ich pobudkę (uplink lub poll)
+MAILBOX_SCHEMA = cv.Schema({
+    cv.Required(CONF_SLEEPY_PEERS): cv.ensure_list(cv.mac_address),
+    cv.Optional(CONF_RETENTION, default="1h"): cv.All(
+        cv.positive_time_period_milliseconds, cv.Range(max=cv.TimePeriod(days=7))
+    ),
+    cv.Optional(CONF_CAPACITY, default=8): cv.int_range(min=1, max=64),
+})
+
+
+def mailbox_to_code(var, config):
+    for mac in config[CONF_SLEEPY_PEERS]:
+        cg.add(var.add_sleepy_peer(mac_expression(mac)))
+    cg.add(var.set_mailbox_retention(config[CONF_RETENTION].total_milliseconds))
+    cg.add(var.set_mailbox_capacity(config[CONF_CAPACITY]))
+
+
+def validate_power_of_two(value):
+    value = cv.int_range(min=16, max=8192)(value)
+    if value & (value - 1):
+        raise cv.Invalid("trace_buffer_size must be a power of two")
+    return value
+
+
+# Opcjonalna sekcja basic_reliable: - obecność trace_buffer_size włącza binarny ślad zdarzeń
+CONFIG_SCHEMA = cv.Schema({
+    cv.Optional(CONF_TRACE_BUFFER_SIZE): validate_power_of_two,
+})
+
+
+def topic_hash(topic):
+    """FNV-1a (32 bit) złożony do 16 bitów - musi być zgodny z topic_hash() w reliable_engine.h"""
+    h = 0x811C9DC5
+    for b in topic.encode("utf-8"):
+        h ^= b
+        h = (h * 0x01000193) & 0xFFFFFFFF
+    return ((h >> 16) ^ (h & 0xFFFF)) & 0xFFFF
+
+
+# Tematy zarezerwowane przez komponenty (MAILBOX_POLL_TOPIC, ADR_TOPIC, temat basic_failover)
+RESERVED_TOPICS = ("mailbox/poll", "lora/adr", "basic_failover")
+
+
+def validate_topic(value):
+    """Nazwa tematu - różne nazwy w jednej konfiguracji nie mogą mieć tego samego 16-bitowego skrótu,
+    bo subskrybent dostawałby wtedy ramki cudzego tematu"""
+    value = cv.string_strict(value)
+    topics = CORE.data.setdefault("basic_reliable", {}).setdefault("topics", {})
+    if not topics:
+        for name in RESERVED_TOPICS:
+            topics[topic_hash(name)] = name
+    other = topics.setdefault(topic_hash(value), value)
+    if other != value:
+        raise cv.Invalid(f"Topic '{value}' has the same hash 0x{topic_hash(value):04X} as '{other}', rename one of them")
+    return value
+
+
+# Wiadomości ze schematu (messages:) - typ pola: (typ C++ na łączu, rozmiar w bajtach)
+CONF_MESSAGES = "messages"
+CONF_MESSAGE = "message"
+CONF_FIELDS = "fields"
+CONF_SCALE = "scale"
+CONF_OFFSET = "offset"
+CONF_TOPIC = "topic"
+CONF_ON_RECEIVE = "on_receive"
+CONF_VALUES = "values"
+CONF_PRIORITY = "priority"
+CONF_QOS = "qos"
+CONF_DATA = "data"
+CONF_CMD = "cmd"
+
+FIELD_TYPES = {
+    "bool": ("bool", 1),
+    "int8": ("int8_t", 1),
+    "uint8": ("uint8_t", 1),
+    "int16": ("int16_t", 2),
+    "uint16": ("uint16_t", 2),
+    "int32": ("int32_t", 4),
+    "uint32": ("uint32_t", 4),
+    "float": ("float", 4),
+}
+VALUE_TYPES = {
+    "bool": cg.bool_,
+    "float": cg.float_,
+    "int8_t": cg.int8,
+    "uint8_t": cg.uint8,
+    "int16_t": cg.int16,
+    "uint16_t": cg.uint16,
+    "int32_t": cg.int32,
+    "uint32_t": cg.uint32,
+}
+RESERVED_FIELD_NAMES = ("encode", "decode")
+
+
+def valid_identifier(value):
+    value = cv.string_strict(value)
+    if not re.fullmatch(r"[a-z][a-z0-9_]*", value):
+        raise cv.Invalid("Use lowercase snake_case (letters, digits and underscores)")
+    return value
+
+
+def is_scaled(field):
+    return CONF_SCALE in field or CONF_OFFSET in field
+
+
+def field_value_type(field):
+    """Typ pola w strukturze C++: pola skalowane są float, pozostałe mają typ z łącza"""
+    return "float" if is_scaled(field) else FIELD_TYPES[field[CONF_TYPE]][0]
+
+
+def message_size(config):
+    return sum(FIELD_TYPES[f[CONF_TYPE]][1] for f in config[CONF_FIELDS])
+
+
+def message_topic(config):
+    return topic_hash(config.get(CONF_TOPIC, config[CONF_NAME]))
+
+
+def message_struct_name(name):
+    return "".join(part.capitalize() for part in name.split("_")) + "Message"
+
+
+def validate_field(config):
+    if config[CONF_TYPE] in ("bool", "float") and is_scaled(config):
+        raise cv.Invalid("scale and offset only apply to integer fields")
+    if config.get(CONF_SCALE) == 0:
+        raise cv.Invalid("scale must not be zero")
+    return config
+
+
+def messages_schema(max_size):
+    def validate_message(config):
+        names = [f[CONF_NAME] for f in config[CONF_FIELDS]]
+        for name in names:
+            if names.count(name) > 1:
+                raise cv.Invalid(f"Duplicate field '{name}'")
+            if name in RESERVED_FIELD_NAMES:
+                raise cv.Invalid(f"Field name '{name}' is reserved")
+        validate_topic(config.get(CONF_TOPIC, config[CONF_NAME]))
+        if message_size(config) > max_size:
+            raise cv.Invalid(f"Message takes {message_size(config)} bytes, at most {max_size} fit in one frame")
+        return config
+
+    def validate_messages(messages):
+        for i, message in enumerate(messages):
+            for other in messages[:i]:
+                if other[CONF_NAME] == message[CONF_NAME]:
+                    raise cv.Invalid(f"Duplicate message '{message[CONF_NAME]}'")
+                if message_topic(other) == message_topic(message):
+                    raise cv.Invalid(f"Messages '{other[CONF_NAME]}' and '{message[CONF_NAME]}' share a topic hash")
+        return messages
+
+    return cv.All(cv.ensure_list(cv.All(cv.Schema({
+        cv.Required(CONF_NAME): valid_identifier,
+        cv.Optional(CONF_TOPIC): validate_topic,
+        cv.Required(CONF_FIELDS): cv.All(cv.ensure_list(cv.All(cv.Schema({
+            cv.Required(CONF_NAME): valid_identifier,
+            cv.Required(CONF_TYPE): cv.one_of(*FIELD_TYPES, lower=True),
+            cv.Optional(CONF_SCALE): cv.float_,
+            cv.Optional(CONF_OFFSET): cv.float_,
+        }), validate_field)), cv.Length(min=1)),
+        cv.Optional(CONF_ON_RECEIVE): automation.validate_automation({
+            cv.GenerateID(CONF_TRIGGER_ID): cv.declare_id(MessageTrigger),
+        }),
+    }), validate_message)), validate_messages)
+
+
+def message_struct_code(ns, config):
+    """Struktura z polami i spakowanym encode()/decode() - bez tekstu i bez sterty"""
+    members, encode, decode = [], [], []
+    offset = 0
+    for field in config[CONF_FIELDS]:
+        name = field[CONF_NAME]
+        wire, size = FIELD_TYPES[field[CONF_TYPE]]
+        if field[CONF_TYPE] == "bool":
+            members.append(f"bool {name}{{false}};")
+            encode.append(f"out[{offset}] = this->{name} ? 1 : 0;")
+            decode.append(f"this->{name} = in[{offset}] != 0;")
+        elif field[CONF_TYPE] == "float":
+            members.append(f"float {name}{{NAN}};")
+            encode.append(f"reliable::schema::put_float(out + {offset}, this->{name});")
+            decode.append(f"this->{name} = reliable::schema::get_float(in + {offset});")
+        elif is_scaled(field):
+            scale = f"{float(field.get(CONF_SCALE, 1.0))!r}f"
+            shift = f"{float(field.get(CONF_OFFSET, 0.0))!r}f"
+            members.append(f"float {name}{{NAN}};")
+            encode.append(f"reliable::schema::put<{wire}>(out + {offset}, "
+                          f"reliable::schema::to_wire<{wire}>(this->{name}, {scale}, {shift}));")
+            decode.append(f"this->{name} = reliable::schema::from_wire<{wire}>("
+                          f"reliable::schema::get<{wire}>(in + {offset}), {scale}, {shift});")
+        else:
+            members.append(f"{wire} {name}{{0}};")
+            encode.append(f"reliable::schema::put<{wire}>(out + {offset}, this->{name});")
+            decode.append(f"this->{name} = reliable::schema::get<{wire}>(in + {offset});")
+        offset += size
+
+    namespaces = str(ns).split("::")
+    lines = [f"namespace {part} {{" for part in namespaces]
+    lines += [
+        f"struct {message_struct_name(config[CONF_NAME])} {{",
+        f"  static constexpr uint16_t TOPIC = 0x{message_topic(config):04X};",
+        f"  static constexpr size_t SIZE = {offset};",
+    ]
+    lines += [f"  {m}" for m in members]
+    lines += ["  void encode(uint8_t *out) const {"] + [f"    {e}" for e in encode] + ["  }"]
+    lines += ["  bool decode(const uint8_t *in, size_t len) {", "    if (len != SIZE) {", "      return false;", "    }"]
+    lines += [f"    {d}" for d in decode] + ["    return true;", "  }", "};"]
+    lines += [f"}}  // namespace {part}" for part in reversed(namespaces)]
+    return "\n".join(lines)
+
+
+def messages_structs_to_code(ns, messages):
+    """Wołane przed new_Pvariable komponentu - akcje z innych komponentów muszą już widzieć typy"""
+    for message in messages:
+        cg.add_global(cg.RawStatement(message_struct_code(ns, message)))
+
+
+CONF_ON_TOPIC = "on_topic"
+
+
+def on_topic_schema(trigger_type):
+    """Subskrypcje tematów - ten sam schemat dla basic_espnowex i basic_loraex"""
+    return automation.validate_automation({
+        cv.GenerateID(CONF_TRIGGER_ID): cv.declare_id(trigger_type),
+        cv.Required(CONF_TOPIC): validate_topic,
+    })
+
+
+async def topic_triggers_to_code(parent, triggers):
+    # Indeks subskrypcji budowany przy generowaniu kodu: rejestracje posortowane po skrócie tematu
+    for conf in sorted(triggers, key=lambda c: topic_hash(c[CONF_TOPIC])):
+        trigger = cg.new_Pvariable(conf[CONF_TRIGGER_ID], parent, topic_hash(conf[CONF_TOPIC]))
+        await automation.build_automation(
+            trigger,
+            [(cg.std_ns.class_("array").template(cg.uint8, 6), "mac"), (cg.std_vector.template(cg.uint8), "data")],
+            conf,
+        )
+
+
+async def message_triggers_to_code(parent, parent_type, ns, messages):
+    for message in messages:
+        struct = ns.struct(message_struct_name(message[CONF_NAME]))
+        for conf in message.get(CONF_ON_RECEIVE, []):
+            trigger = cg.new_Pvariable(conf[CONF_TRIGGER_ID], cg.TemplateArguments(parent_type, struct), parent)
+            await automation.build_automation(
+                trigger,
+                [(cg.std_ns.class_("array").template(cg.uint8, 6), "mac"), (struct, "msg")],
+                conf,
+            )
+
+
+def send_message_action_schema(parent_type):
+    return cv.Schema({
+        cv.GenerateID(): cv.use_id(parent_type),
+        cv.Required(CONF_MESSAGE): valid_identifier,
+        cv.Optional(CONF_MAC_ADDRESS): cv.mac_address,
+        cv.Optional(CONF_PRIORITY, default=0): cv.uint8_t,
+        cv.Optional(CONF_QOS, default=1): cv.enum(QOS_LEVELS, int=True),
+        cv.Optional(CONF_VALUES, default={}): cv.Schema({
+            valid_identifier: cv.templatable(cv.Any(cv.boolean, cv.float_)),
+        }),
+    })
+
+
+async def send_message_action_to_code(config, action_id, template_arg, args, parent_type, ns, domain):
+    parent = await cg.get_variable(config[CONF_ID])
+    messages = {m[CONF_NAME]: m for m in CORE.config.get(domain, {}).get(CONF_MESSAGES, [])}
+    message = messages.get(config[CONF_MESSAGE])
+    if message is None:
+        raise EsphomeError(f"{domain}: message '{config[CONF_MESSAGE]}' is not declared under messages:")
+    fields = {f[CONF_NAME]: f for f in message[CONF_FIELDS]}
+    for name in config[CONF_VALUES]:
+        if name not in fields:
+            raise EsphomeError(f"{domain}: message '{message[CONF_NAME]}' has no field '{name}'")
+
+    struct = ns.struct(message_struct_name(message[CONF_NAME]))
+    var = cg.new_Pvariable(action_id, cg.TemplateArguments(parent_type, struct, *template_arg), parent)
+    if CONF_MAC_ADDRESS in config:
+        cg.add(var.set_peer_mac(mac_expression(config[CONF_MAC_ADDRESS])))
+    cg.add(var.set_priority(config[CONF_PRIORITY]))
+    cg.add(var.set_qos(config[CONF_QOS]))
+
+    # Jeden builder wypełniający wszystkie pola; lambdy z YAML wołane z argumentami akcji
+    arg_names = ", ".join(name for _, name in args)
+    body = []
+    for name, value in config[CONF_VALUES].items():
+        expr = await cg.templatable(value, args, VALUE_TYPES[field_value_type(fields[name])])
+        if isinstance(expr, cg.LambdaExpression):
+            body.append(f"msg.{name} = ({expr})({arg_names});")
+        else:
+            body.append(f"msg.{name} = {cg.safe_exp(expr)};")
+    builder = cg.LambdaExpression("\n".join(body), [(struct.operator("ref"), "msg")] + list(args), capture="")
+    cg.add(var.set_builder(builder))
+    return var
+
+
+def send_action_schema(parent_type):
+    return cv.Schema({
+        cv.GenerateID(): cv.use_id(parent_type),
+        cv.Exclusive(CONF_MESSAGE, "payload"): cv.templatable(cv.string),
+        cv.Exclusive(CONF_DATA, "payload"): cv.templatable(cv.ensure_list(cv.hex_uint8_t)),
+        cv.Optional(CONF_TOPIC): validate_topic,
+        cv.Optional(CONF_MAC_ADDRESS): cv.mac_address,
+        cv.Optional(CONF_PRIORITY, default=0): cv.uint8_t,
+        cv.Optional(CONF_QOS, default=1): cv.enum(QOS_LEVELS, int=True),
+    }).add_extra(cv.has_exactly_one_key(CONF_MESSAGE, CONF_DATA))
+
+
+async def send_action_to_code(config, action_id, template_arg, args, parent_type):
+    parent = await cg.get_variable(config[CONF_ID])
+    var = cg.new_Pvariable(action_id, cg.TemplateArguments(parent_type, *template_arg), parent)
+    if CONF_MAC_ADDRESS in config:
+        cg.add(var.set_peer_mac(mac_expression(config[CONF_MAC_ADDRESS])))
+    if CONF_TOPIC in config:
+        cg.add(var.set_topic(topic_hash(config[CONF_TOPIC])))
+    cg.add(var.set_priority(config[CONF_PRIORITY]))
+    cg.add(var.set_qos(config[CONF_QOS]))
+
+    if CONF_MESSAGE in config:
+        payload, payload_type = config[CONF_MESSAGE], cg.std_string
+    else:
+        payload, payload_type = config[CONF_DATA], cg.std_vector.template(cg.uint8)
+    if not cg.is_template(payload):
+        # Stała treść: bajty zakodowane teraz, w firmware tylko tablica we flashu
+        data = payload.encode("utf-8") if isinstance(payload, str) else bytes(payload)
+        if data:
+            name = f"{action_id.id}_payload"
+            cg.add_global(cg.RawStatement(f"static const uint8_t {name}[] = {{{', '.join(map(str, data))}}};"))
+            cg.add(var.set_static_payload(cg.RawExpression(name), len(data)))
+    else:
+        lambda_ = await cg.process_lambda(payload, args, return_type=payload_type)
+        if CONF_MESSAGE in config:
+            cg.add(var.set_message(lambda_))
+        else:
+            cg.add(var.set_data(lambda_))
+    return var
+
+
+def send_cmd_action_schema(parent_type):
+    return cv.Schema({
+        cv.GenerateID(): cv.use_id(parent_type),
+        cv.Required(CONF_CMD): cv.templatable(cv.int_range(min=-32768, max=32767)),
+        cv.Optional(CONF_MAC_ADDRESS): cv.mac_address,
+        cv.Optional(CONF_PRIORITY, default=0): cv.uint8_t,
+        cv.Optional(CONF_QOS, default=1): cv.enum(QOS_LEVELS, int=True),
+    })
+
+
+async def send_cmd_action_to_code(config, action_id, template_arg, args, parent_type):
+    parent = await cg.get_variable(config[CONF_ID])
+    var = cg.new_Pvariable(action_id, cg.TemplateArguments(parent_type, *template_arg), parent)
+    if CONF_MAC_ADDRESS in config:
+        cg.add(var.set_peer_mac(mac_expression(config[CONF_MAC_ADDRESS])))
+    cg.add(var.set_priority(config[CONF_PRIORITY]))
+    cg.add(var.set_qos(config[CONF_QOS]))
+    cmd = await cg.templatable(config[CONF_CMD], args, cg.int16)
+    cg.add(var.set_cmd(cmd))
+    return var
+
+
+async def to_code(config):
+    if CONF_TRACE_BUFFER_SIZE in config:
+        cg.add_define("USE_RELIABLE_TRACE")
+        cg.add_define("RELIABLE_TRACE_SIZE", config[CONF_TRACE_BUFFER_SIZE])
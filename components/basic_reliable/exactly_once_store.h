@@ -0,0 +1,41 @@
+#pragma once
+
+// Trwały zapis identyfikatorów QoS 2 odbiorcy (ESPPreferences we flashu) - wspólny dla
+// basic_espnowex i basic_loraex. Zapis następuje tylko wtedy, gdy przyszła nowa wiadomość QoS 2,
+// a NVS sam rozkłada zużycie flasha.
+
+#include "esphome/core/preferences.h"
+#include "reliable_engine.h"
+
+namespace esphome {
+namespace reliable {
+
+template<typename Address> class ExactlyOnceStore {
+ public:
+  template<typename Engine> void setup(uint32_t hash, Engine &engine) {
+    this->pref_ = global_preferences->make_preference<State>(hash, true);
+    State state{};
+    if (this->pref_.load(&state) && state.count <= MAX_EXACTLY_ONCE_RECORDS) {
+      engine.restore_exactly_once(state.records, state.count);
+    }
+  }
+
+  // Wołane z flush_exactly_once() - zapis musi trafić do flasha przed wysłaniem REC
+  bool save(const std::vector<ExactlyOnceRecord<Address>> &records) {
+    State state{};
+    state.count = std::min(records.size(), MAX_EXACTLY_ONCE_RECORDS);
+    std::copy(records.end() - state.count, records.end(), state.records);
+    return this->pref_.save(&state) && global_preferences->sync();
+  }
+
+ protected:
+  struct State {
+    uint8_t count;
+    ExactlyOnceRecord<Address> records[MAX_EXACTLY_ONCE_RECORDS];
+  };
+
+  ESPPreferenceObject pref_;
+};
+
+}  // namespace reliable
+}  // namespace esphome
@@ -0,0 +1,26 @@
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+namespace esphome {
+namespace reliable {
+
+// Mutex FreeRTOS z interfejsem BasicLockable/Lockable (std::lock_guard, std::unique_lock)
+class FreeRtosMutex {
+ public:
+  FreeRtosMutex() : handle_(xSemaphoreCreateMutex()) {}
+  ~FreeRtosMutex() { vSemaphoreDelete(this->handle_); }
+  FreeRtosMutex(const FreeRtosMutex &) = delete;
+  FreeRtosMutex &operator=(const FreeRtosMutex &) = delete;
+
+  void lock() { xSemaphoreTake(this->handle_, portMAX_DELAY); }
+  bool try_lock() { return xSemaphoreTake(this->handle_, 0) == pdTRUE; }
+  void unlock() { xSemaphoreGive(this->handle_); }
+
+ protected:
+  SemaphoreHandle_t handle_;
+};
+
+}  // namespace reliable
+}  // namespace esphome
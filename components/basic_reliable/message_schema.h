@@ -0,0 +1,135 @@
+#pragma once
+
+// Wiadomości o stałym układzie pól deklarowane w YAML (messages:). Struktury z encode()/decode()
+// generuje __init__.py (message_struct_code), tu są tylko wspólne procedury pakowania oraz
+// trigger i akcja parametryzowane typem wiadomości.
+//
+// Wymagania wobec wygenerowanej struktury Message:
+//   static constexpr uint16_t TOPIC;   // skrót tematu, pod którym wiadomość podróżuje
+//   static constexpr size_t SIZE;      // rozmiar spakowanych pól
+//   void encode(uint8_t *out) const;
+//   bool decode(const uint8_t *in, size_t len);  // false - zła długość (inny schemat u nadawcy)
+//
+// Pola na łączu są w little-endian. Pole ze skalą: wartość = surowa * scale + offset; najmniejsza
+// wartość typu ze znakiem (największa bez znaku) oznacza NAN, więc niedostępny odczyt sensora
+// nie zamienia się po drodze w zero.
+
+#include "esphome/core/automation.h"
+#include "reliable_engine.h"
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <type_traits>
+
+namespace esphome {
+namespace reliable {
+namespace schema {
+
+template<typename T> inline void put(uint8_t *out, T value) {
+  using U = typename std::make_unsigned<T>::type;
+  U raw = static_cast<U>(value);
+  for (size_t i = 0; i < sizeof(T); i++) {
+    out[i] = static_cast<uint8_t>(raw);
+    raw = static_cast<U>(raw >> 8);
+  }
+}
+
+template<typename T> inline T get(const uint8_t *in) {
+  using U = typename std::make_unsigned<T>::type;
+  U raw = 0;
+  for (size_t i = sizeof(T); i-- > 0;) {
+    raw = static_cast<U>((raw << 8) | in[i]);
+  }
+  return static_cast<T>(raw);
+}
+
+inline void put_float(uint8_t *out, float value) {
+  uint32_t raw;
+  memcpy(&raw, &value, sizeof(raw));
+  put<uint32_t>(out, raw);
+}
+
+inline float get_float(const uint8_t *in) {
+  const uint32_t raw = get<uint32_t>(in);
+  float value;
+  memcpy(&value, &raw, sizeof(value));
+  return value;
+}
+
+template<typename T> constexpr T nan_marker() {
+  return std::is_signed<T>::value ? std::numeric_limits<T>::min() : std::numeric_limits<T>::max();
+}
+
+// round((value - offset) / scale) z nasyceniem; znacznik NAN jest poza zakresem wartości
+template<typename T> inline T to_wire(float value, float scale, float offset) {
+  if (std::isnan(value)) {
+    return nan_marker<T>();
+  }
+  const double raw = std::round((double(value) - offset) / scale);
+  const double lo = double(std::numeric_limits<T>::min()) + (std::is_signed<T>::value ? 1 : 0);
+  const double hi = double(std::numeric_limits<T>::max()) - (std::is_signed<T>::value ? 0 : 1);
+  return static_cast<T>(std::min(hi, std::max(lo, raw)));
+}
+
+template<typename T> inline float from_wire(T raw, float scale, float offset) {
+  if (raw == nan_marker<T>()) {
+    return NAN;
+  }
+  return float(double(raw) * scale + offset);
+}
+
+}  // namespace schema
+
+// Odbiór wiadomości ze schematu - subskrypcja tematu Message::TOPIC, bez parsowania tekstu.
+// Parent: add_on_topic_callback(uint16_t, std::function<void(Address, std::vector<uint8_t>)>).
+template<typename Parent, typename Message> class MessageTrigger : public Trigger<std::array<uint8_t, 6>, Message> {
+ public:
+  explicit MessageTrigger(Parent *parent) {
+    parent->add_on_topic_callback(Message::TOPIC, [this](std::array<uint8_t, 6> mac, std::vector<uint8_t> data) {
+      Message msg;
+      if (!msg.decode(data.data(), data.size())) {
+        RELIABLE_LOGW("basic_reliable", "Message on topic 0x%04X has %u bytes, schema expects %u", Message::TOPIC,
+                      (unsigned) data.size(), (unsigned) Message::SIZE);
+        return;
+      }
+      this->trigger(mac, msg);
+    });
+  }
+};
+
+// Wysyłka wiadomości ze schematu; pola wypełnia builder wygenerowany z wartości w YAML.
+// Parent: send_message(const Message &, const std::array<uint8_t, 6> &, uint8_t, QoS)
+// i send_message_to_peer(const Message &, uint8_t, QoS).
+template<typename Parent, typename Message, typename... Ts> class SendMessageAction : public Action<Ts...> {
+ public:
+  explicit SendMessageAction(Parent *parent) : parent_(parent) {}
+  void set_builder(std::function<void(Message &, Ts...)> &&builder) { this->builder_ = std::move(builder); }
+  void set_peer_mac(const std::array<uint8_t, 6> &peer_mac) {
+    this->peer_mac_ = peer_mac;
+    this->has_peer_mac_ = true;
+  }
+  void set_priority(uint8_t priority) { this->priority_ = priority; }
+  void set_qos(QoS qos) { this->qos_ = qos; }
+
+  void play(Ts... x) override {
+    Message msg;
+    this->builder_(msg, x...);
+    if (this->has_peer_mac_) {
+      this->parent_->send_message(msg, this->peer_mac_, this->priority_, this->qos_);
+    } else {
+      this->parent_->send_message_to_peer(msg, this->priority_, this->qos_);
+    }
+  }
+
+ protected:
+  Parent *parent_;
+  std::function<void(Message &, Ts...)> builder_;
+  std::array<uint8_t, 6> peer_mac_{};
+  bool has_peer_mac_{false};
+  uint8_t priority_{0};
+  QoS qos_{QOS_AT_LEAST_ONCE};
+};
+
+}  // namespace reliable
+}  // namespace esphome
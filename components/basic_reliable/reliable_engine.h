@@ -0,0 +1,1403 @@
+#pragma once
+
+// Wspólny silnik niezawodnego dostarczania wiadomości dla basic_espnowex i basic_loraex:
+// kolejka wysyłkowa, retransmisje, ACK, deduplikacja, QoS 0-2, kontrola przepływu, stan peerów
+// i skrzynka dla śpiących węzłów. Wszystko, co specyficzne dla radia, dostarcza polityka
+// transportu (parametr szablonu Transport), a zdarzenia odbiera Sink - bez wywołań wirtualnych
+// i bez zależności od ESP-IDF. Kontrakt obu parametrów i opis funkcji: README.md,
+// "Shared Reliability Engine".
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "trace.h"
+
+#ifdef ESP_PLATFORM
+#include "esp_log.h"
+#define RELIABLE_LOGD(tag, ...) ESP_LOGD(tag, __VA_ARGS__)
+#define RELIABLE_LOGW(tag, ...) ESP_LOGW(tag, __VA_ARGS__)
+#else
+#define RELIABLE_LOGD(tag, ...) ((void) 0)
+#define RELIABLE_LOGW(tag, ...) ((void) 0)
+#endif
+
+namespace esphome {
+namespace reliable {
+
+// Typy ramek (wspólne dla obu radiów)
+static const uint8_t FRAME_DATA = 0x00;
+static const uint8_t FRAME_ACK = 0x01;
+static const uint8_t FRAME_TOPIC = 0x02;
+static const uint8_t FRAME_REC = 0x03;   // QoS 2: odbiorca utrwalił identyfikator
+static const uint8_t FRAME_REL = 0x04;   // QoS 2: nadawca zwalnia identyfikator
+static const uint8_t FRAME_COMP = 0x05;  // QoS 2: odbiorca zapomniał identyfikator
+
+// Bity QoS w bajcie typu; QoS 1 nie ustawia żadnego, więc ramki starszych węzłów się nie zmieniają
+static const uint8_t FRAME_TYPE_MASK = 0x3F;
+static const uint8_t FRAME_FLAG_QOS0 = 0x40;
+static const uint8_t FRAME_FLAG_QOS2 = 0x80;
+static const uint8_t FRAME_FLAG_MAIL = 0x80;  // tylko FRAME_ACK: nadawca ACK ma pocztę dla odbiorcy
+
+static const uint8_t NO_CREDITS = 0xFF;  // ACK bez pola kredytów (odbiorca bez kontroli przepływu)
+
+enum QoS : uint8_t {
+  QOS_AT_MOST_ONCE = 0,
+  QOS_AT_LEAST_ONCE,
+  QOS_EXACTLY_ONCE,
+};
+
+using MessageId = std::array<uint8_t, 3>;
+
+struct FrameHeader {
+  uint8_t type{FRAME_DATA};
+  QoS qos{QOS_AT_LEAST_ONCE};  // tylko FRAME_DATA i FRAME_TOPIC
+  MessageId id{};
+  uint16_t topic{0};  // tylko FRAME_TOPIC
+  uint8_t credits{NO_CREDITS};  // tylko FRAME_ACK: wolne miejsca w kolejce odbiorczej
+  bool mail{false};             // tylko FRAME_ACK: skrzynka nadawcy ACK ma ramki dla odbiorcy
+};
+
+// Ramki sterujące składają się z samego nagłówka
+inline bool is_control_frame(uint8_t type) {
+  return type == FRAME_ACK || type == FRAME_REC || type == FRAME_REL || type == FRAME_COMP;
+}
+
+// Bajt typu na łączu - wspólne kodowanie dla transportów
+inline uint8_t encode_frame_type(const FrameHeader &header) {
+  if (header.type == FRAME_ACK) {
+    return header.mail ? FRAME_ACK | FRAME_FLAG_MAIL : FRAME_ACK;
+  }
+  if (header.qos == QOS_AT_MOST_ONCE) {
+    return header.type | FRAME_FLAG_QOS0;
+  }
+  return header.qos == QOS_EXACTLY_ONCE ? header.type | FRAME_FLAG_QOS2 : header.type;
+}
+
+// false - niepoprawna kombinacja bitów QoS
+inline bool decode_frame_type(uint8_t raw, FrameHeader &header) {
+  header.type = raw & FRAME_TYPE_MASK;
+  switch (raw & ~FRAME_TYPE_MASK) {
+    case 0:
+      header.qos = QOS_AT_LEAST_ONCE;
+      return true;
+    case FRAME_FLAG_QOS0:
+      header.qos = QOS_AT_MOST_ONCE;
+      break;
+    case FRAME_FLAG_QOS2:
+      if (header.type == FRAME_ACK) {
+        header.mail = true;  // ten sam bit w ACK to flaga poczty
+        return true;
+      }
+      header.qos = QOS_EXACTLY_ONCE;
+      break;
+    default:
+      return false;
+  }
+  return !is_control_frame(header.type);
+}
+
+// Skrót nazwy tematu: FNV-1a (32 bit) złożony do 16 bitów.
+// Ta sama funkcja jest w basic_reliable/__init__.py (topic_hash) - obie muszą dawać identyczny wynik.
+inline uint16_t topic_hash(const std::string &topic) {
+  uint32_t hash = 0x811C9DC5;
+  for (char c : topic) {
+    hash ^= static_cast<uint8_t>(c);
+    hash *= 0x01000193;
+  }
+  return static_cast<uint16_t>((hash >> 16) ^ (hash & 0xFFFF));
+}
+
+// Gotowa ramka: nagłówek transportu + payload, jedna alokacja.
+// Jedyne miejsce składania ramek do kolejki - silnik, basic_bridge, basic_failover i ADR.
+template<typename Transport>
+std::vector<uint8_t> build_frame(const typename Transport::Address &peer, const FrameHeader &header,
+                                 const uint8_t *payload, size_t len) {
+  uint8_t raw_header[Transport::MAX_HEADER_SIZE];
+  const size_t header_len = Transport::encode_header(raw_header, peer, header);
+  std::vector<uint8_t> frame;
+  frame.reserve(header_len + len);
+  frame.insert(frame.end(), raw_header, raw_header + header_len);
+  frame.insert(frame.end(), payload, payload + len);
+  return frame;
+}
+
+// Zapytanie o pocztę od śpiącego węzła - temat zarezerwowany, topic_hash("mailbox/poll")
+static const uint16_t MAILBOX_POLL_TOPIC = 0x96A1;
+
+// Zachowanie przy przepełnieniu kolejki wysyłkowej
+enum OverflowPolicy : uint8_t {
+  OVERFLOW_REJECT_NEW = 0,           // odrzuć nową wiadomość
+  OVERFLOW_DROP_OLDEST,              // usuń najstarszą wiadomość z kolejki
+  OVERFLOW_DROP_LOWEST_PRIORITY,     // usuń wiadomość o najniższym priorytecie (najstarszą wśród równych)
+};
+
+// Wynik umieszczenia wiadomości w kolejce
+enum EnqueueResult : uint8_t {
+  ENQUEUE_OK = 0,
+  ENQUEUE_OK_DROPPED,  // przyjęta, ale kosztem usunięcia innej wiadomości
+  ENQUEUE_REJECTED,    // odrzucona - brak miejsca w kolejce lub w budżecie pamięci
+  ENQUEUE_PEER_DOWN,   // odrzucona - peer niedostępny (PEER_DOWN_REJECT), poza oknem próby
+};
+
+inline bool is_enqueued(EnqueueResult result) { return result == ENQUEUE_OK || result == ENQUEUE_OK_DROPPED; }
+
+// Dostępność peera z punktu widzenia nadawcy
+enum PeerState : uint8_t {
+  PEER_UNKNOWN = 0,  // brak ACK i brak błędów
+  PEER_UP,
+  PEER_DOWN,  // obwód otwarty - tylko okresowe próby
+};
+
+// Co zrobić z nowymi wiadomościami do niedostępnego peera
+enum PeerDownPolicy : uint8_t {
+  PEER_DOWN_PARK = 0,  // przyjmij do kolejki, wyjdzie z najbliższą próbą lub po powrocie peera
+  PEER_DOWN_REJECT,    // odrzuć od razu (ENQUEUE_PEER_DOWN)
+};
+
+// Klucz koalescencji: wiadomości z tym samym kluczem do tego samego peera zastępują się w kolejce
+static const uint32_t NO_COALESCE_KEY = 0xFFFFFFFF;
+static const uint32_t COALESCE_CMD_FLAG = 0x10000;  // komendy mają osobną przestrzeń kluczy
+
+static const int64_t HISTORY_WINDOW_US = 300000000;  // 300 s
+static const size_t MAX_HISTORY_SIZE = 1000;
+static const uint8_t MAX_SEND_FAILURES = 3;  // odrzucenia przez warstwę łącza (np. brak peera)
+static const size_t MAX_EXACTLY_ONCE_RECORDS = 16;  // identyfikatory QoS 2 utrwalone i czekające na utrwalenie
+static const size_t MAX_HELD_DELIVERIES = 8;        // wiadomości QoS 2 czekające na utrwalenie
+static const uint8_t MAX_RECEIVE_WINDOW = 64;
+static const int64_t ZERO_WINDOW_PROBE_US = 1000000;  // zerowe okno: jedna ramka-próba co tyle
+static const size_t MAX_CREDIT_PEERS = 16;
+// Jak długo po ramce od śpiącego peera uznajemy, że nasłuchuje - cała skrzynka wychodzi w tym oknie
+static const int64_t MAILBOX_LISTEN_US = 20000;
+
+template<typename Address> struct PendingMessage {
+  Address mac;
+  MessageId message_id;
+  uint8_t send_failures;
+  uint8_t retry_count;
+  uint8_t priority;
+  int64_t timestamp;
+  int64_t created{0};  // dopisanie do kolejki - retencja skrzynki
+  bool acked;
+  uint32_t coalesce_key{NO_COALESCE_KEY};
+  QoS qos{QOS_AT_LEAST_ONCE};
+  bool released{false};          // QoS 2: REC odebrany, w kolejce jest już ramka REL
+  std::vector<uint8_t> payload;  // kompletna ramka z nagłówkiem
+};
+
+// Identyfikator QoS 2 zapamiętany przez odbiorcę do czasu REL
+template<typename Address> struct ExactlyOnceRecord {
+  Address mac;
+  MessageId id;
+};
+
+// Wiadomość QoS 2 wstrzymana do utrwalenia identyfikatora
+template<typename Address> struct HeldDelivery {
+  Address mac;
+  FrameHeader header;
+  bool forwarded;  // przejęta przez most - tylko REC, bez lokalnego dostarczenia
+  std::vector<uint8_t> payload;
+};
+
+// Okno ogłoszone przez odbiorcę w ostatnim ACK
+template<typename Address> struct PeerCredit {
+  Address mac;
+  uint8_t credits;
+  int64_t updated;
+};
+
+// Śpiący peer ze skrzynką na bramce
+template<typename Address> struct SleepyPeer {
+  Address mac;
+  int64_t awake_since;  // początek bieżącego okna nasłuchu - ramka idzie raz na pobudkę
+  int64_t awake_until;
+};
+
+// Ramka przyjęta przy włączonej kontroli przepływu, czeka na process_inbox()
+template<typename Address> struct InboxEntry {
+  Address mac;
+  FrameHeader header;
+  std::vector<uint8_t> payload;
+};
+
+template<typename Address> struct PeerHealth {
+  Address mac;
+  PeerState state;
+  uint8_t failures;  // kolejne transmisje bez ACK
+  int64_t next_probe;
+};
+
+template<typename Address> struct ReceivedMessageInfo {
+  Address mac;
+  int64_t timestamp;
+  std::vector<uint8_t> data;
+};
+
+template<typename Address> struct TopicSubscription {
+  uint16_t topic;
+  std::function<void(Address, std::vector<uint8_t>)> callback;
+};
+
+template<typename Transport, typename Sink> class ReliableEngine {
+ public:
+  using Address = typename Transport::Address;
+  using Pending = PendingMessage<Address>;
+  using Mutex = typename Transport::Mutex;
+
+  ReliableEngine(Transport *transport, Sink *sink) : transport_(transport), sink_(sink) {}
+
+  // Konfiguracja
+  void set_max_retries(uint8_t max_retries) { this->max_retries_ = max_retries; }
+  void set_timeout_us(int64_t timeout_us) { this->timeout_us_ = timeout_us; }
+  void set_max_queue_messages(size_t max_messages) { this->max_queue_messages_ = max_messages; }
+  void set_max_queue_bytes(size_t max_bytes) { this->max_queue_bytes_ = max_bytes; }
+  void set_overflow_policy(OverflowPolicy policy) { this->overflow_policy_ = policy; }
+  // Timeout retransmisji liczony z mierzonego RTT zamiast stałego timeout_us
+  void set_adaptive_timeout(bool adaptive) { this->adaptive_timeout_ = adaptive; }
+  // Circuit breaker per peer; failure_threshold 0 wyłącza śledzenie stanu peerów
+  void set_peer_failure_threshold(uint8_t threshold) { this->peer_failure_threshold_ = threshold; }
+  void set_peer_probe_interval_us(int64_t interval_us) { this->peer_probe_interval_us_ = interval_us; }
+  void set_peer_down_policy(PeerDownPolicy policy) { this->peer_down_policy_ = policy; }
+  // Kontrola przepływu odbiorcy: rozmiar kolejki odbiorczej ogłaszany w ACK; 0 = dostarczanie od razu
+  void set_receive_window(uint8_t window) { this->receive_window_ = std::min(window, MAX_RECEIVE_WINDOW); }
+  // Skrzynka (bramka): ramki do śpiącego peera czekają na jego pobudkę zamiast wyczerpywać próby
+  void add_sleepy_peer(const Address &peer) { this->sleepy_.push_back({peer, 0, 0}); }
+  void set_mailbox_retention_us(int64_t retention_us) { this->mailbox_retention_us_ = retention_us; }
+  void set_mailbox_capacity(uint8_t capacity) { this->mailbox_capacity_ = capacity; }
+  // Węzeł: jak długo po ACK z flagą poczty (i po każdej ramce z poczty) czekać na następną
+  void set_mail_window_us(int64_t window_us) { this->mail_window_us_ = window_us; }
+  bool awaiting_mail() {
+    std::lock_guard<Mutex> lock(this->queue_mutex_);
+    return Transport::now_us() < this->mail_until_;
+  }
+
+  uint8_t get_max_retries() const { return this->max_retries_; }
+  int64_t get_timeout_us() const { return this->timeout_us_; }
+  size_t get_queue_high_water_mark() const { return this->queue_high_water_mark_; }
+  size_t get_queued_bytes() const { return this->queued_bytes_; }
+  uint32_t get_dropped_count() const { return this->dropped_count_; }
+  uint32_t get_srtt_us() const { return this->srtt_us_; }
+  size_t get_inbox_size() {
+    std::lock_guard<Mutex> lock(this->history_mutex_);
+    return this->inbox_.size();
+  }
+  void set_srtt_us(uint32_t srtt_us) { this->srtt_us_ = srtt_us; }
+
+  PeerState get_peer_state(const Address &peer) {
+    std::lock_guard<Mutex> lock(this->queue_mutex_);
+    const PeerHealth<Address> *health = this->find_peer_locked(peer);
+    return health == nullptr ? PEER_UNKNOWN : health->state;
+  }
+  // Licznik zmian stanu peerów - tanie sprawdzenie z loop(), czy trzeba odświeżyć sensory
+  uint32_t get_peer_state_epoch() const { return this->peer_state_epoch_.load(std::memory_order_relaxed); }
+
+  // Wysyłanie
+  EnqueueResult send(const std::vector<uint8_t> &msg, const Address &peer, uint8_t priority = 0,
+                     QoS qos = QOS_AT_LEAST_ONCE) {
+    return this->send(msg.data(), msg.size(), peer, priority, qos);
+  }
+
+  EnqueueResult send(const uint8_t *msg, size_t len, const Address &peer, uint8_t priority = 0,
+                     QoS qos = QOS_AT_LEAST_ONCE) {
+    FrameHeader header;
+    header.type = FRAME_DATA;
+    header.qos = qos;
+    return this->enqueue(header, msg, len, peer, priority, NO_COALESCE_KEY);
+  }
+
+  EnqueueResult publish(uint16_t topic, const std::vector<uint8_t> &msg, const Address &peer, uint8_t priority = 0,
+                        QoS qos = QOS_AT_LEAST_ONCE) {
+    return this->publish(topic, msg.data(), msg.size(), peer, priority, qos);
+  }
+
+  EnqueueResult publish(uint16_t topic, const uint8_t *msg, size_t len, const Address &peer, uint8_t priority = 0,
+                        QoS qos = QOS_AT_LEAST_ONCE) {
+    FrameHeader header;
+    header.type = FRAME_TOPIC;
+    header.qos = qos;
+    header.topic = topic;
+    return this->enqueue(header, msg, len, peer, priority, NO_COALESCE_KEY);
+  }
+
+  EnqueueResult send_cmd(int16_t cmd, const Address &peer, uint8_t priority = 0, QoS qos = QOS_AT_LEAST_ONCE) {
+    const uint8_t msg[4] = {static_cast<uint8_t>((cmd >> 8) & 0xFF), static_cast<uint8_t>(cmd & 0xFF),
+                            static_cast<uint8_t>((cmd >> 8) & 0xFF), static_cast<uint8_t>(cmd & 0xFF)};
+    // Koalescencja tylko dla QoS 1 - przy QoS 2 każda komenda (np. przełączenie) liczy się osobno
+    const uint32_t key = qos == QOS_AT_LEAST_ONCE ? COALESCE_CMD_FLAG | static_cast<uint16_t>(cmd) : NO_COALESCE_KEY;
+    if (key != NO_COALESCE_KEY) {
+      std::lock_guard<Mutex> lock(this->queue_mutex_);
+      // Identyczna niepotwierdzona komenda do tego peera już czeka - resetujemy jej stan zamiast dublować
+      Pending *pending = this->find_coalesced_locked(peer, key);
+      if (pending != nullptr) {
+        pending->send_failures = 0;
+        pending->retry_count = 0;
+        pending->timestamp = Transport::now_us();
+        return ENQUEUE_OK;
+      }
+    }
+    FrameHeader header;
+    header.type = FRAME_DATA;
+    header.qos = qos;
+    return this->enqueue(header, msg, sizeof(msg), peer, priority, key);
+  }
+
+  // "Ostatnia wartość wygrywa": nowsza wiadomość z tym samym kluczem zastępuje niepotwierdzoną
+  EnqueueResult send_latest(uint16_t key, const std::vector<uint8_t> &msg, const Address &peer,
+                            uint8_t priority = 0) {
+    FrameHeader header;
+    header.type = FRAME_DATA;
+    EnqueueResult result = ENQUEUE_REJECTED;
+    {
+      std::lock_guard<Mutex> lock(this->queue_mutex_);
+      Pending *pending = this->find_coalesced_locked(peer, key);
+      if (pending == nullptr) {
+        result = this->enqueue_locked(header, msg.data(), msg.size(), peer, priority, key);
+      } else {
+        // Nowy message_id - spóźniony ACK starej wartości nie może potwierdzić nowej
+        header.id = this->generate_message_id();
+        std::vector<uint8_t> frame = reliable::build_frame<Transport>(peer, header, msg.data(), msg.size());
+        if (frame.size() <= Transport::MTU &&
+            this->queued_bytes_ - pending->payload.size() + frame.size() <= this->max_queue_bytes_) {
+          this->queued_bytes_ = this->queued_bytes_ - pending->payload.size() + frame.size();
+          pending->message_id = header.id;
+          pending->payload = std::move(frame);
+          pending->priority = priority;
+          pending->send_failures = 0;
+          pending->retry_count = 0;
+          pending->timestamp = Transport::now_us();
+          result = ENQUEUE_OK;
+          RELIABLE_TRACE(Transport::TRACE_SOURCE, EV_COALESCE, peer.data(), header.id.data(), priority,
+                         this->pending_.size(), pending->payload.size());
+        }
+      }
+    }
+    if (is_enqueued(result)) {
+      this->process_queue();
+    }
+    return result;
+  }
+
+  void clear() {
+    std::lock_guard<Mutex> lock(this->queue_mutex_);
+    this->pending_.clear();
+    this->queued_bytes_ = 0;
+    this->coalesce_index_.clear();
+  }
+
+  size_t pending_count() {
+    std::lock_guard<Mutex> lock(this->queue_mutex_);
+    return this->pending_.size();
+  }
+
+  // Iteracja po kolejce pod blokadą (np. zapis do pamięci RTC)
+  template<typename F> void for_each_pending(F &&f) {
+    std::lock_guard<Mutex> lock(this->queue_mutex_);
+    for (const auto &msg : this->pending_) {
+      f(msg);
+    }
+  }
+
+  // Przywrócenie wcześniej zakodowanej ramki do kolejki (np. z pamięci RTC)
+  bool restore_pending(const Address &peer, const uint8_t *frame, size_t len, uint8_t retry_count, uint8_t priority) {
+    Address header_peer = peer;
+    FrameHeader header;
+    if (Transport::decode_header(frame, len, header_peer, header) == 0) {
+      return false;
+    }
+    std::lock_guard<Mutex> lock(this->queue_mutex_);
+    if (this->make_room_locked(len, priority) == ENQUEUE_REJECTED) {
+      return false;
+    }
+    // Ramka REL to druga faza QoS 2 - w nagłówku nie ma bitów QoS
+    const bool released = header.type == FRAME_REL;
+    Pending &pending = this->push_locked(peer, header.id, priority, NO_COALESCE_KEY,
+                                         released ? QOS_EXACTLY_ONCE : header.qos,
+                                         std::vector<uint8_t>(frame, frame + len));
+    pending.released = released;
+    pending.retry_count = retry_count;
+    pending.timestamp = 0;  // natychmiastowa retransmisja
+    return true;
+  }
+
+  // Przejęcie gotowej ramki (nagłówek z message_id + payload) bez kopiowania - np. z mostu między radiami
+  EnqueueResult enqueue_frame(std::vector<uint8_t> &&frame, const Address &peer, uint8_t priority = 0) {
+    Address header_peer = peer;
+    FrameHeader header;
+    if (frame.size() > Transport::MTU || Transport::decode_header(frame.data(), frame.size(), header_peer, header) == 0 ||
+        is_control_frame(header.type)) {
+      return ENQUEUE_REJECTED;
+    }
+    if (header.qos == QOS_AT_MOST_ONCE) {
+      return this->transmit_unacknowledged(peer, header, frame.data(), frame.size());
+    }
+    EnqueueResult result;
+    {
+      std::lock_guard<Mutex> lock(this->queue_mutex_);
+      result = this->rejects_peer_locked(peer) ? ENQUEUE_PEER_DOWN : this->make_room_locked(frame.size(), priority);
+      if (is_enqueued(result)) {
+        this->push_locked(peer, header.id, priority, NO_COALESCE_KEY, header.qos, std::move(frame));
+      }
+    }
+    if (is_enqueued(result)) {
+      this->process_queue();
+    }
+    return result;
+  }
+
+  // Czy wiadomość wciąż czeka na potwierdzenie (false = potwierdzona, porzucona lub nieznana)
+  bool is_pending(const Address &peer, const MessageId &id) {
+    std::lock_guard<Mutex> lock(this->queue_mutex_);
+    return std::any_of(this->pending_.begin(), this->pending_.end(), [&](const Pending &m) {
+      return !m.acked && !m.released && m.mac == peer && m.message_id == id;
+    });
+  }
+
+  // Wycofanie niepotwierdzonej wiadomości - bez dalszych retransmisji (np. poszła innym radiem).
+  // false = już potwierdzona, porzucona lub nieznana.
+  bool cancel(const Address &peer, const MessageId &id) {
+    std::lock_guard<Mutex> lock(this->queue_mutex_);
+    for (auto &msg : this->pending_) {
+      if (!msg.acked && !msg.released && msg.mac == peer && msg.message_id == id) {
+        msg.acked = true;  // sprzątanie jak po ACK w process_queue
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Jawne potwierdzenie ramki przejętej przez on_engine_forward. Dla QoS 2 identyfikator trafia do
+  // utrwalenia, a REC wychodzi z flush_exactly_once().
+  void acknowledge(const Address &peer, const MessageId &id, QoS qos = QOS_AT_LEAST_ONCE) {
+    if (qos == QOS_EXACTLY_ONCE) {
+      const ExactlyOnceStatus status = this->exactly_once_status(peer, id);
+      if (status == EXACTLY_ONCE_RECORDED) {
+        this->send_control(peer, FRAME_REC, id);
+      } else if (status == EXACTLY_ONCE_NEW) {
+        FrameHeader header;
+        header.qos = qos;
+        header.id = id;
+        this->hold_delivery(peer, header, nullptr, 0, true);
+      }
+    } else if (qos == QOS_AT_LEAST_ONCE) {
+      this->send_ack(peer, id);
+    }
+  }
+
+  // QoS 2 po stronie odbiorcy: wołane z pętli komponentu. persist(records) dostaje komplet
+  // identyfikatorów do trwałego zapisu; dopiero po nim wstrzymane wiadomości są dostarczane
+  // i potwierdzane przez REC. Powtórzenia DATA w trakcie zapisu są ignorowane.
+  template<typename Persist> void flush_exactly_once(Persist &&persist) {
+    std::vector<ExactlyOnceRecord<Address>> records;
+    size_t count;
+    {
+      std::lock_guard<Mutex> lock(this->history_mutex_);
+      count = this->held_.size();
+      if (count == 0) {
+        return;
+      }
+      records = this->exactly_once_;
+      for (size_t i = 0; i < count; i++) {
+        append_record(records, {this->held_[i].mac, this->held_[i].header.id});
+      }
+    }
+    if (!persist(records)) {
+      RELIABLE_LOGW(Transport::TAG, "QoS 2 state not persisted, duplicates after reboot are possible");
+    }
+    std::vector<HeldDelivery<Address>> held;
+    {
+      std::lock_guard<Mutex> lock(this->history_mutex_);
+      // Wiadomości wstrzymane w trakcie zapisu czekają na następne wywołanie
+      held.assign(std::make_move_iterator(this->held_.begin()), std::make_move_iterator(this->held_.begin() + count));
+      this->held_.erase(this->held_.begin(), this->held_.begin() + count);
+      for (const auto &delivery : held) {
+        append_record(this->exactly_once_, {delivery.mac, delivery.header.id});
+      }
+    }
+    for (const auto &delivery : held) {
+      this->send_control(delivery.mac, FRAME_REC, delivery.header.id);
+      if (!delivery.forwarded) {
+        this->deliver(delivery.mac, delivery.header, delivery.payload);
+      }
+    }
+  }
+
+  // Identyfikatory QoS 2 wczytane z pamięci trwałej przy starcie
+  void restore_exactly_once(const ExactlyOnceRecord<Address> *records, size_t count) {
+    std::lock_guard<Mutex> lock(this->history_mutex_);
+    for (size_t i = 0; i < count && this->exactly_once_.size() < MAX_EXACTLY_ONCE_RECORDS; i++) {
+      append_record(this->exactly_once_, records[i]);
+    }
+  }
+
+  // Kontrola przepływu po stronie odbiorcy: dostarczenie odłożonych ramek, wołane z pętli komponentu.
+  // Peery zatrzymane zerowym oknem dostają potem ponowny ACK swojej ostatniej ramki z nowym oknem.
+  void process_inbox() {
+    std::vector<InboxEntry<Address>> inbox;
+    {
+      std::lock_guard<Mutex> lock(this->history_mutex_);
+      if (this->inbox_.empty() && this->stalled_.empty()) {
+        return;
+      }
+      inbox.swap(this->inbox_);
+    }
+    for (const auto &entry : inbox) {
+      this->deliver(entry.mac, entry.header, entry.payload);
+    }
+    std::vector<std::pair<Address, MessageId>> stalled;
+    {
+      std::lock_guard<Mutex> lock(this->history_mutex_);
+      stalled.swap(this->stalled_);
+    }
+    for (const auto &peer : stalled) {
+      this->send_ack(peer.first, peer.second);
+    }
+  }
+
+  // Obsługa kolejki: sprzątanie i (re)transmisje. Nie blokuje - jeśli kolejka jest zajęta, pomija cykl.
+  void process_queue() {
+    const int64_t now = Transport::now_us();
+    const int64_t timeout = this->retransmit_timeout_us();
+
+    std::unique_lock<Mutex> lock(this->queue_mutex_, std::try_to_lock);
+    if (!lock.owns_lock()) {
+      return;
+    }
+    // Usuń potwierdzone lub przekroczone limity czasu
+    this->pending_.erase(std::remove_if(this->pending_.begin(), this->pending_.end(),
+                                        [now, timeout, this](const Pending &m) {
+                                          // Ramki w skrzynce wygasają po czasie, nie po liczbie prób
+                                          const bool held = this->find_sleepy_locked(m.mac) != nullptr;
+                                          bool expired =
+                                              m.acked || (held ? now - m.created > this->mailbox_retention_us_
+                                                               : now - m.timestamp > this->ack_timeout_us(m, timeout) &&
+                                                                     m.retry_count >= this->max_retries_);
+                                          if (expired) {
+                                            this->queued_bytes_ -= m.payload.size();
+                                            if (!m.acked) {
+                                              this->peer_failed_locked(m.mac, now);
+                                              RELIABLE_TRACE(Transport::TRACE_SOURCE, EV_EXPIRE, m.mac.data(),
+                                                             m.message_id.data(), m.retry_count,
+                                                             this->pending_.size(), m.payload.size());
+                                            }
+                                          }
+                                          return expired;
+                                        }),
+                         this->pending_.end());
+    this->reindex_coalesced_locked();
+
+    for (auto &msg : this->pending_) {
+      if (msg.acked) {
+        continue;
+      }
+      const SleepyPeer<Address> *sleepy = this->find_sleepy_locked(msg.mac);
+      if (sleepy != nullptr) {
+        // Skrzynka: tylko w oknie nasłuchu peera, raz na pobudkę (niepotwierdzona - przy następnej)
+        if (now >= sleepy->awake_until || (msg.retry_count != 0 && msg.timestamp >= sleepy->awake_since)) {
+          continue;
+        }
+      } else if (msg.retry_count >= this->max_retries_ ||
+                 (msg.retry_count != 0 && (now - msg.timestamp) <= this->ack_timeout_us(msg, timeout))) {
+        // Pierwsza transmisja od razu, kolejne po upływie timeoutu
+        continue;
+      }
+      // Kontrola przepływu: nowa ramka czeka, dopóki odbiorca nie ogłosi wolnego miejsca
+      if (msg.retry_count == 0 && !msg.released && !this->has_credit_locked(msg.mac, now)) {
+        continue;
+      }
+      PeerHealth<Address> *health = this->find_peer_locked(msg.mac);
+      if (health != nullptr && health->state == PEER_DOWN) {
+        // Obwód otwarty: ramka czeka, tylko jedna próba na probe_interval
+        if (now < health->next_probe) {
+          continue;
+        }
+        health->next_probe = now + this->peer_probe_interval_us_;
+      }
+      // Retransmisja oznacza, że poprzednia próba nie doczekała się ACK (śpiący peer po prostu spał)
+      if (msg.retry_count != 0 && sleepy == nullptr) {
+        this->peer_failed_locked(msg.mac, now);
+      }
+      if (!this->transport_->send(msg.mac, msg.payload.data(), msg.payload.size())) {
+        RELIABLE_TRACE(Transport::TRACE_SOURCE, EV_TX_FAIL, msg.mac.data(), msg.message_id.data(),
+                       msg.send_failures + 1, this->pending_.size(), msg.payload.size());
+        if (++msg.send_failures > MAX_SEND_FAILURES) {
+          msg.acked = true;  // Wymuszenie usunięcia z kolejki
+        }
+        continue;
+      }
+      if (msg.retry_count < 0xFF) {
+        msg.retry_count++;
+      }
+      msg.timestamp = now;
+      RELIABLE_TRACE(Transport::TRACE_SOURCE, EV_TX, msg.mac.data(), msg.message_id.data(), msg.retry_count,
+                     this->pending_.size(), msg.payload.size());
+      RELIABLE_LOGD(Transport::TAG, "Transmit ID %02X%02X%02X, attempt %d", msg.message_id[0], msg.message_id[1],
+                    msg.message_id[2], msg.retry_count);
+    }
+  }
+
+  // Ścieżka odbioru: ACK, deduplikacja, potwierdzenie i przekazanie do odbiorców.
+  // link_src - adres nadawcy z warstwy łącza (jeśli radio go zna).
+  void on_frame(const Address &link_src, const uint8_t *data, size_t len) {
+    Address sender = link_src;
+    FrameHeader header;
+    const size_t header_len = Transport::decode_header(data, len, sender, header);
+    if (header_len == 0) {
+      RELIABLE_LOGW(Transport::TAG, "Invalid message format");
+      return;
+    }
+    // Ramka od śpiącego peera otwiera jego okno nasłuchu - poczta wychodzi zaraz po jej obsłudze (i ACK)
+    const bool deliver_mail = this->wake_sleepy_peer(sender, header);
+    this->dispatch_frame(sender, header, data, header_len, len);
+    if (deliver_mail) {
+      this->process_queue();
+    }
+  }
+
+  // Subskrypcje tematów - posortowane po skrócie, wyszukiwanie binarne w on_frame
+  void add_topic_callback(uint16_t topic, std::function<void(Address, std::vector<uint8_t>)> &&cb) {
+    auto pos = std::upper_bound(this->topic_subscriptions_.begin(), this->topic_subscriptions_.end(), topic,
+                                [](uint16_t t, const TopicSubscription<Address> &sub) { return t < sub.topic; });
+    this->topic_subscriptions_.insert(pos, TopicSubscription<Address>{topic, std::move(cb)});
+  }
+
+  bool has_topic_subscribers(uint16_t topic) const {
+    auto it = this->topic_lower_bound(topic);
+    return it != this->topic_subscriptions_.end() && it->topic == topic;
+  }
+
+  MessageId generate_message_id() {
+    uint32_t random_part = Transport::random32();
+    int64_t timestamp = Transport::now_us();
+    return {static_cast<uint8_t>((random_part ^ timestamp) & 0xFF),
+            static_cast<uint8_t>((random_part >> 8 ^ timestamp >> 8) & 0xFF),
+            static_cast<uint8_t>((random_part >> 16 ^ timestamp >> 16) & 0xFF)};
+  }
+
+ protected:
+  void dispatch_frame(const Address &sender, const FrameHeader &header, const uint8_t *data, size_t header_len,
+                      size_t len) {
+    switch (header.type) {
+      case FRAME_ACK:
+        this->handle_ack(sender, header.id, header.credits, header.mail);
+        return;
+      case FRAME_REC:
+        this->handle_rec(sender, header.id);
+        return;
+      case FRAME_REL:
+        this->handle_rel(sender, header.id);
+        return;
+      case FRAME_COMP:
+        this->handle_comp(sender, header.id);
+        return;
+      case FRAME_DATA:
+      case FRAME_TOPIC:
+        break;
+      default:
+        RELIABLE_LOGW(Transport::TAG, "Unknown frame type 0x%02X", header.type);
+        return;
+    }
+    RELIABLE_TRACE(Transport::TRACE_SOURCE, EV_RX, sender.data(), header.id.data(), header.type, 0, len);
+    if (this->peer_failure_threshold_ != 0) {
+      std::lock_guard<Mutex> lock(this->queue_mutex_);
+      this->peer_alive_locked(sender);
+    }
+
+    // Zapytanie o pocztę - tylko ACK (z flagą poczty), pobudkę obsłużył już wake_sleepy_peer
+    if (header.type == FRAME_TOPIC && header.topic == MAILBOX_POLL_TOPIC) {
+      if (header.qos == QOS_AT_LEAST_ONCE) {
+        this->send_ack(sender, header.id);
+      }
+      return;
+    }
+
+    // QoS 2: identyfikator już utrwalony - odbiorca ma tę wiadomość, REC mógł zaginąć.
+    // Wstrzymana (jeszcze nieutrwalona) - REC wyjdzie po zapisie, powtórzenie pomijamy.
+    if (header.qos == QOS_EXACTLY_ONCE) {
+      const ExactlyOnceStatus status = this->exactly_once_status(sender, header.id);
+      if (status != EXACTLY_ONCE_NEW) {
+        RELIABLE_TRACE(Transport::TRACE_SOURCE, EV_RX_DUP, sender.data(), header.id.data(), header.type, 0, len);
+        if (status == EXACTLY_ONCE_RECORDED) {
+          this->send_control(sender, FRAME_REC, header.id);
+        }
+        return;
+      }
+    }
+
+    // Ramka przejęta (most) - potwierdzenie wyśle przejmujący, gdy dostarczy ją dalej
+    if (this->sink_->on_engine_forward(sender, header, data + header_len, len - header_len)) {
+      RELIABLE_TRACE(Transport::TRACE_SOURCE, EV_FORWARD, sender.data(), header.id.data(), header.type, 0, len);
+      return;
+    }
+
+    if (header.qos == QOS_EXACTLY_ONCE) {
+      this->hold_delivery(sender, header, data + header_len, len - header_len, false);
+      return;
+    }
+
+    // Kontrola przepływu: pełna kolejka odbiorcza - bez ACK i bez wpisu w historii, nadawca powtórzy
+    // ramkę. Sprawdzenie i dopisanie niżej nie ścigają się: kolejkę opróżnia tylko process_inbox().
+    const bool queued = this->receive_window_ != 0;
+    if (queued && this->inbox_full()) {
+      RELIABLE_TRACE(Transport::TRACE_SOURCE, EV_RX_FULL, sender.data(), header.id.data(), header.type, 0, len);
+      return;
+    }
+
+    // Temat bez subskrybentów - potwierdzony, ale nic nie kopiujemy
+    bool accepted = header.type != FRAME_TOPIC || this->has_topic_subscribers(header.topic);
+
+    // QoS 0 nie ma retransmisji, więc nie ma czego deduplikować
+    if (accepted && header.qos == QOS_AT_LEAST_ONCE && this->is_duplicate(sender, data, len)) {
+      RELIABLE_TRACE(Transport::TRACE_SOURCE, EV_RX_DUP, sender.data(), header.id.data(), header.type, 0, len);
+      RELIABLE_LOGD(Transport::TAG, "Duplicate message ignored");
+      accepted = false;
+    }
+    if (accepted && queued) {
+      std::lock_guard<Mutex> lock(this->history_mutex_);
+      this->inbox_.push_back({sender, header, std::vector<uint8_t>(data + header_len, data + len)});
+    }
+
+    // Potwierdzenie wysyłamy także dla duplikatów - poprzedni ACK mógł zaginąć
+    if (header.qos == QOS_AT_LEAST_ONCE) {
+      this->send_ack(sender, header.id);
+    }
+
+    if (accepted && !queued) {
+      this->deliver(sender, header, std::vector<uint8_t>(data + header_len, data + len));
+    }
+  }
+
+  struct CoalesceKey {
+    Address mac;
+    uint32_t key;
+    bool operator==(const CoalesceKey &other) const { return key == other.key && mac == other.mac; }
+  };
+  struct CoalesceKeyHash {
+    size_t operator()(const CoalesceKey &k) const {
+      uint32_t h = k.key;
+      for (uint8_t b : k.mac) {
+        h = h * 31 + b;
+      }
+      return h;
+    }
+  };
+
+  int64_t retransmit_timeout_us() const {
+    // Przy adaptacyjnym timeoucie wystarczy kilka zmierzonych RTT
+    if (this->adaptive_timeout_ && this->srtt_us_ != 0) {
+      return std::min<int64_t>(this->timeout_us_, std::max<int64_t>(3 * int64_t(this->srtt_us_), 3000));
+    }
+    return this->timeout_us_;
+  }
+  // Wolne radio (LoRa) nie zdąży z ACK szybciej niż trwa sama transmisja ramki i odpowiedzi
+  int64_t ack_timeout_us(const Pending &msg, int64_t timeout) {
+    return std::max<int64_t>(timeout, this->transport_->min_ack_timeout_us(msg.mac, msg.payload.size()));
+  }
+
+  EnqueueResult enqueue(FrameHeader &header, const uint8_t *msg, size_t len, const Address &peer, uint8_t priority,
+                        uint32_t coalesce_key) {
+    if (header.qos == QOS_AT_MOST_ONCE) {
+      return this->send_unacknowledged(header, msg, len, peer);
+    }
+    EnqueueResult result;
+    {
+      std::lock_guard<Mutex> lock(this->queue_mutex_);
+      result = this->enqueue_locked(header, msg, len, peer, priority, coalesce_key);
+    }
+    if (is_enqueued(result)) {
+      this->process_queue();
+    }
+    return result;
+  }
+
+  EnqueueResult enqueue_locked(FrameHeader &header, const uint8_t *msg, size_t len, const Address &peer,
+                               uint8_t priority, uint32_t coalesce_key) {
+    if (this->rejects_peer_locked(peer)) {
+      return ENQUEUE_PEER_DOWN;
+    }
+    header.id = this->generate_message_id();
+    std::vector<uint8_t> frame = reliable::build_frame<Transport>(peer, header, msg, len);
+    if (frame.size() > Transport::MTU) {
+      RELIABLE_LOGW(Transport::TAG, "Frame of %u bytes exceeds MTU", (unsigned) frame.size());
+      return ENQUEUE_REJECTED;
+    }
+    EnqueueResult result = this->make_room_locked(frame.size(), priority);
+    if (result == ENQUEUE_REJECTED) {
+      RELIABLE_LOGW(Transport::TAG, "Send queue full (%u msgs, %u B), message rejected",
+                    (unsigned) this->max_queue_messages_, (unsigned) this->max_queue_bytes_);
+      return result;
+    }
+    this->push_locked(peer, header.id, priority, coalesce_key, header.qos, std::move(frame));
+    return result;
+  }
+
+  // QoS 0: ramka z nagłówkiem składana na stosie i wysyłana od razu - bez kolejki i bez blokad
+  EnqueueResult send_unacknowledged(FrameHeader &header, const uint8_t *msg, size_t len, const Address &peer) {
+    header.id = this->generate_message_id();
+    uint8_t frame[Transport::MTU];
+    const size_t header_len = Transport::encode_header(frame, peer, header);
+    if (header_len + len > Transport::MTU) {
+      RELIABLE_LOGW(Transport::TAG, "Frame of %u bytes exceeds MTU", (unsigned) (header_len + len));
+      return ENQUEUE_REJECTED;
+    }
+    if (len != 0) {
+      memcpy(frame + header_len, msg, len);
+    }
+    return this->transmit_unacknowledged(peer, header, frame, header_len + len);
+  }
+
+  // header służy tylko śladowi - bez USE_RELIABLE_TRACE nieużywany
+  EnqueueResult transmit_unacknowledged(const Address &peer, [[maybe_unused]] const FrameHeader &header,
+                                        const uint8_t *frame, size_t len) {
+    if (!this->transport_->send(peer, frame, len)) {
+      RELIABLE_TRACE(Transport::TRACE_SOURCE, EV_TX_FAIL, peer.data(), header.id.data(), 1, 0, len);
+      return ENQUEUE_REJECTED;
+    }
+    RELIABLE_TRACE(Transport::TRACE_SOURCE, EV_TX, peer.data(), header.id.data(), 0, 0, len);
+    return ENQUEUE_OK;
+  }
+
+  // Dopisanie ramki do kolejki; wywołujący zapewnił miejsce przez make_room_locked
+  Pending &push_locked(const Address &peer, const MessageId &id, uint8_t priority, uint32_t coalesce_key, QoS qos,
+                       std::vector<uint8_t> &&frame) {
+    if (!this->sleepy_.empty()) {
+      this->trim_mailbox_locked(peer);
+    }
+    Pending pending{};
+    pending.mac = peer;
+    pending.message_id = id;
+    pending.priority = priority;
+    pending.timestamp = Transport::now_us();
+    pending.created = pending.timestamp;
+    pending.acked = false;
+    pending.coalesce_key = coalesce_key;
+    pending.qos = qos;
+    pending.payload = std::move(frame);
+    this->queued_bytes_ += pending.payload.size();
+    this->pending_.push_back(std::move(pending));
+    if (coalesce_key != NO_COALESCE_KEY) {
+      this->coalesce_index_[CoalesceKey{peer, coalesce_key}] = this->pending_.size() - 1;
+    }
+    this->queue_high_water_mark_ = std::max(this->queue_high_water_mark_, this->pending_.size());
+    RELIABLE_TRACE(Transport::TRACE_SOURCE, EV_ENQUEUE, peer.data(), id.data(), priority, this->pending_.size(),
+                   this->pending_.back().payload.size());
+    return this->pending_.back();
+  }
+
+  EnqueueResult make_room_locked(size_t bytes, uint8_t priority) {
+    if (bytes > this->max_queue_bytes_) {
+      return ENQUEUE_REJECTED;
+    }
+    auto is_full = [&]() {
+      return this->pending_.size() + 1 > this->max_queue_messages_ ||
+             this->queued_bytes_ + bytes > this->max_queue_bytes_;
+    };
+    if (!is_full()) {
+      return ENQUEUE_OK;
+    }
+    // Potwierdzone wiadomości czekające na sprzątanie w process_queue zwalniamy od razu
+    for (auto it = this->pending_.begin(); it != this->pending_.end();) {
+      if (it->acked) {
+        this->queued_bytes_ -= it->payload.size();
+        it = this->pending_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+    this->reindex_coalesced_locked();
+
+    bool dropped = false;
+    while (is_full()) {
+      if (this->pending_.empty() || this->overflow_policy_ == OVERFLOW_REJECT_NEW) {
+        return ENQUEUE_REJECTED;
+      }
+      auto victim = this->pending_.begin();  // najstarsza
+      if (this->overflow_policy_ == OVERFLOW_DROP_LOWEST_PRIORITY) {
+        victim = std::min_element(this->pending_.begin(), this->pending_.end(),
+                                  [](const Pending &a, const Pending &b) { return a.priority < b.priority; });
+        if (victim->priority > priority) {
+          return ENQUEUE_REJECTED;  // nowa wiadomość ma najniższy priorytet
+        }
+      }
+      this->queued_bytes_ -= victim->payload.size();
+      RELIABLE_TRACE(Transport::TRACE_SOURCE, EV_DROP, victim->mac.data(), victim->message_id.data(), victim->priority,
+                     this->pending_.size(), victim->payload.size());
+      this->pending_.erase(victim);
+      this->reindex_coalesced_locked();  // indeksy za usuniętym elementem się przesunęły
+      this->dropped_count_++;
+      dropped = true;
+    }
+    return dropped ? ENQUEUE_OK_DROPPED : ENQUEUE_OK;
+  }
+
+  Pending *find_coalesced_locked(const Address &mac, uint32_t key) {
+    auto it = this->coalesce_index_.find(CoalesceKey{mac, key});
+    if (it == this->coalesce_index_.end() || it->second >= this->pending_.size()) {
+      return nullptr;
+    }
+    Pending &pending = this->pending_[it->second];
+    if (pending.acked) {
+      return nullptr;
+    }
+    return &pending;
+  }
+
+  void reindex_coalesced_locked() {
+    this->coalesce_index_.clear();
+    for (size_t i = 0; i < this->pending_.size(); i++) {
+      const Pending &m = this->pending_[i];
+      if (m.coalesce_key != NO_COALESCE_KEY && !m.acked) {
+        this->coalesce_index_[CoalesceKey{m.mac, m.coalesce_key}] = i;
+      }
+    }
+  }
+
+  static bool is_broadcast(const Address &peer) {
+    return std::all_of(peer.begin(), peer.end(), [](uint8_t b) { return b == 0xFF; });
+  }
+
+  PeerHealth<Address> *find_peer_locked(const Address &peer) {
+    if (this->peer_failure_threshold_ == 0) {
+      return nullptr;
+    }
+    auto it = std::find_if(this->peers_.begin(), this->peers_.end(),
+                           [&](const PeerHealth<Address> &h) { return h.mac == peer; });
+    return it == this->peers_.end() ? nullptr : &*it;
+  }
+
+  PeerHealth<Address> *track_peer_locked(const Address &peer) {
+    PeerHealth<Address> *health = this->find_peer_locked(peer);
+    // Broadcast nie jest potwierdzany - nie ma czego śledzić
+    if (health != nullptr || this->peer_failure_threshold_ == 0 || is_broadcast(peer)) {
+      return health;
+    }
+    this->peers_.push_back({peer, PEER_UNKNOWN, 0, 0});
+    return &this->peers_.back();
+  }
+
+  void set_peer_state_locked(PeerHealth<Address> &health, PeerState state) {
+    if (health.state == state) {
+      return;
+    }
+    health.state = state;
+    this->peer_state_epoch_.fetch_add(1, std::memory_order_relaxed);
+    RELIABLE_LOGD(Transport::TAG, "Peer %02X:%02X:%02X:%02X:%02X:%02X %s", health.mac[0], health.mac[1],
+                  health.mac[2], health.mac[3], health.mac[4], health.mac[5], state == PEER_UP ? "up" : "down");
+  }
+
+  void peer_failed_locked(const Address &peer, int64_t now) {
+    PeerHealth<Address> *health = this->track_peer_locked(peer);
+    if (health == nullptr) {
+      return;
+    }
+    if (health->failures < 0xFF) {
+      health->failures++;
+    }
+    if (health->state != PEER_DOWN && health->failures >= this->peer_failure_threshold_) {
+      health->next_probe = now + this->peer_probe_interval_us_;
+      this->set_peer_state_locked(*health, PEER_DOWN);
+    }
+  }
+
+  void peer_alive_locked(const Address &peer) {
+    PeerHealth<Address> *health = this->track_peer_locked(peer);
+    if (health == nullptr) {
+      return;
+    }
+    health->failures = 0;
+    this->set_peer_state_locked(*health, PEER_UP);
+  }
+
+  SleepyPeer<Address> *find_sleepy_locked(const Address &peer) {
+    for (auto &sleepy : this->sleepy_) {
+      if (sleepy.mac == peer) {
+        return &sleepy;
+      }
+    }
+    return nullptr;
+  }
+
+  bool has_mail_locked(const Address &peer) const {
+    return std::any_of(this->pending_.begin(), this->pending_.end(),
+                       [&](const Pending &m) { return !m.acked && m.mac == peer; });
+  }
+
+  // Bramka: peer nasłuchuje (true - czeka na niego poczta). Węzeł: ramka z poczty przedłuża czekanie.
+  bool wake_sleepy_peer(const Address &peer, const FrameHeader &header) {
+    if (this->sleepy_.empty() && this->mail_window_us_ == 0) {
+      return false;
+    }
+    std::lock_guard<Mutex> lock(this->queue_mutex_);
+    const int64_t now = Transport::now_us();
+    if (!is_control_frame(header.type) && now < this->mail_until_) {
+      this->mail_until_ = now + this->mail_window_us_;
+    }
+    SleepyPeer<Address> *sleepy = this->find_sleepy_locked(peer);
+    if (sleepy == nullptr) {
+      return false;
+    }
+    if (now >= sleepy->awake_until) {
+      sleepy->awake_since = now;
+    }
+    sleepy->awake_until = now + MAILBOX_LISTEN_US;
+    return this->has_mail_locked(peer);
+  }
+
+  // Pełna skrzynka - najstarsza ramka do tego peera ustępuje nowej
+  void trim_mailbox_locked(const Address &peer) {
+    if (this->find_sleepy_locked(peer) == nullptr) {
+      return;
+    }
+    const size_t held = std::count_if(this->pending_.begin(), this->pending_.end(),
+                                      [&](const Pending &m) { return !m.acked && m.mac == peer; });
+    if (held < this->mailbox_capacity_) {
+      return;
+    }
+    auto victim = std::find_if(this->pending_.begin(), this->pending_.end(),
+                               [&](const Pending &m) { return !m.acked && m.mac == peer; });
+    this->queued_bytes_ -= victim->payload.size();
+    RELIABLE_TRACE(Transport::TRACE_SOURCE, EV_DROP, victim->mac.data(), victim->message_id.data(), victim->priority,
+                   this->pending_.size(), victim->payload.size());
+    this->pending_.erase(victim);
+    this->reindex_coalesced_locked();
+    this->dropped_count_++;
+  }
+
+  // Fail-fast dla niedostępnego peera; w oknie próby wiadomość jest przyjmowana i staje się próbą
+  bool rejects_peer_locked(const Address &peer) {
+    if (this->peer_down_policy_ != PEER_DOWN_REJECT) {
+      return false;
+    }
+    const PeerHealth<Address> *health = this->find_peer_locked(peer);
+    return health != nullptr && health->state == PEER_DOWN && Transport::now_us() < health->next_probe;
+  }
+
+  void handle_ack(const Address &sender, const MessageId &id, uint8_t credits, bool mail) {
+    bool should_handle_ack = false;
+    bool flow_control;
+    {
+      std::lock_guard<Mutex> lock(this->queue_mutex_);
+      if (mail) {
+        this->mail_until_ = Transport::now_us() + this->mail_window_us_;  // bramka zaraz wyśle pocztę
+      }
+      // Okno aktualizuje każdy ACK od peera, także ponowny ACK już potwierdzonej ramki
+      flow_control = this->update_credit_locked(sender, credits);
+      auto it = std::find_if(this->pending_.begin(), this->pending_.end(),
+                             [&](const Pending &m) { return m.mac == sender && m.message_id == id; });
+      if (it != this->pending_.end() && !it->acked) {
+        it->acked = true;
+        this->peer_alive_locked(sender);
+        // Pomiar RTT od ostatniej transmisji (EWMA 1/8)
+        uint32_t rtt = Transport::now_us() - it->timestamp;
+        this->srtt_us_ = this->srtt_us_ == 0 ? rtt : (7 * this->srtt_us_ + rtt) / 8;
+        RELIABLE_TRACE(Transport::TRACE_SOURCE, EV_ACK_RX, sender.data(), id.data(), it->retry_count,
+                       this->pending_.size(), it->payload.size());
+        should_handle_ack = true;
+      }
+    }
+    if (flow_control) {
+      this->process_queue();  // zwolnione miejsce w oknie - ramki czekające w kolejce mogą iść
+    }
+    if (should_handle_ack) {
+      RELIABLE_LOGD(Transport::TAG, "ACK received for message %02X%02X%02X", id[0], id[1], id[2]);
+      this->sink_->on_engine_ack(sender, id);
+    }
+  }
+
+  // false - peer nie ogłasza okna (brak kontroli przepływu)
+  bool update_credit_locked(const Address &peer, uint8_t credits) {
+    auto it = std::find_if(this->credits_.begin(), this->credits_.end(),
+                           [&](const PeerCredit<Address> &c) { return c.mac == peer; });
+    if (credits == NO_CREDITS) {
+      if (it != this->credits_.end()) {
+        this->credits_.erase(it);  // odbiorca wyłączył kontrolę przepływu (np. nowa konfiguracja)
+      }
+      return false;
+    }
+    if (it == this->credits_.end()) {
+      if (this->credits_.size() >= MAX_CREDIT_PEERS) {
+        this->credits_.erase(this->credits_.begin());
+      }
+      this->credits_.push_back({peer, credits, 0});
+      it = this->credits_.end() - 1;
+    }
+    it->credits = credits;
+    it->updated = Transport::now_us();
+    return true;
+  }
+
+  bool has_credit_locked(const Address &peer, int64_t now) {
+    auto credit = std::find_if(this->credits_.begin(), this->credits_.end(),
+                               [&](const PeerCredit<Address> &c) { return c.mac == peer; });
+    if (credit == this->credits_.end()) {
+      return true;
+    }
+    size_t allowed = credit->credits;
+    // Aktualizacja okna mogła zaginąć - przy zerowym oknie co jakiś czas jedna ramka jako próba
+    if (allowed == 0 && now - credit->updated >= ZERO_WINDOW_PROBE_US) {
+      allowed = 1;
+    }
+    const size_t in_flight = std::count_if(this->pending_.begin(), this->pending_.end(), [&](const Pending &m) {
+      return !m.acked && !m.released && m.retry_count != 0 && m.mac == peer;
+    });
+    return in_flight < allowed;
+  }
+
+  // REC od odbiorcy QoS 2: wiadomość dostarczona, w miejsce DATA w kolejce wchodzi REL
+  void handle_rec(const Address &sender, const MessageId &id) {
+    RELIABLE_TRACE(Transport::TRACE_SOURCE, EV_QOS2_RX, sender.data(), id.data(), FRAME_REC, 0, 0);
+    bool known = false;
+    bool delivered = false;
+    {
+      std::lock_guard<Mutex> lock(this->queue_mutex_);
+      auto it = std::find_if(this->pending_.begin(), this->pending_.end(), [&](const Pending &m) {
+        return m.qos == QOS_EXACTLY_ONCE && m.mac == sender && m.message_id == id;
+      });
+      known = it != this->pending_.end() && !it->acked;
+      if (known && !it->released) {
+        const int64_t now = Transport::now_us();
+        FrameHeader header;
+        header.type = FRAME_REL;
+        header.id = id;
+        std::vector<uint8_t> frame = reliable::build_frame<Transport>(sender, header, nullptr, 0);
+        this->queued_bytes_ = this->queued_bytes_ - it->payload.size() + frame.size();
+        it->payload = std::move(frame);
+        it->released = true;
+        it->send_failures = 0;
+        it->retry_count = 0;
+        uint32_t rtt = now - it->timestamp;
+        this->srtt_us_ = this->srtt_us_ == 0 ? rtt : (7 * this->srtt_us_ + rtt) / 8;
+        it->timestamp = now;
+        this->peer_alive_locked(sender);
+        delivered = true;
+      }
+    }
+    if (!known) {
+      // Nadawca już zapomniał wiadomość (np. po restarcie) - zwalniamy identyfikator u odbiorcy
+      this->send_control(sender, FRAME_REL, id);
+    } else if (delivered) {
+      this->process_queue();
+      this->sink_->on_engine_ack(sender, id);
+    }
+  }
+
+  // REL od nadawcy QoS 2: identyfikator nie będzie już powtórzony. Usunięcie trafi do pamięci
+  // trwałej przy następnym zapisie - do tego czasu zostaje tam tylko nieszkodliwy wpis.
+  void handle_rel(const Address &sender, const MessageId &id) {
+    RELIABLE_TRACE(Transport::TRACE_SOURCE, EV_QOS2_RX, sender.data(), id.data(), FRAME_REL, 0, 0);
+    {
+      std::lock_guard<Mutex> lock(this->history_mutex_);
+      auto &records = this->exactly_once_;
+      records.erase(std::remove_if(records.begin(), records.end(),
+                                   [&](const ExactlyOnceRecord<Address> &r) { return r.mac == sender && r.id == id; }),
+                    records.end());
+    }
+    this->send_control(sender, FRAME_COMP, id);
+  }
+
+  void handle_comp(const Address &sender, const MessageId &id) {
+    RELIABLE_TRACE(Transport::TRACE_SOURCE, EV_QOS2_RX, sender.data(), id.data(), FRAME_COMP, 0, 0);
+    std::lock_guard<Mutex> lock(this->queue_mutex_);
+    for (auto &msg : this->pending_) {
+      if (msg.released && !msg.acked && msg.mac == sender && msg.message_id == id) {
+        msg.acked = true;
+        this->peer_alive_locked(sender);
+        return;
+      }
+    }
+  }
+
+  // ACK z kontrolą przepływu niesie wolne miejsca w kolejce odbiorczej
+  void send_ack(const Address &peer, const MessageId &id) {
+    FrameHeader header;
+    header.type = FRAME_ACK;
+    header.id = id;
+    if (this->receive_window_ != 0) {
+      std::lock_guard<Mutex> lock(this->history_mutex_);
+      header.credits = this->inbox_.size() < this->receive_window_ ? this->receive_window_ - this->inbox_.size() : 0;
+      if (header.credits == 0) {
+        auto it = std::find_if(this->stalled_.begin(), this->stalled_.end(),
+                               [&](const std::pair<Address, MessageId> &s) { return s.first == peer; });
+        if (it == this->stalled_.end()) {
+          this->stalled_.push_back({peer, id});
+        } else {
+          it->second = id;
+        }
+      }
+    }
+    if (!this->sleepy_.empty()) {
+      std::lock_guard<Mutex> lock(this->queue_mutex_);
+      header.mail = this->find_sleepy_locked(peer) != nullptr && this->has_mail_locked(peer);
+    }
+    this->send_control(peer, header);
+  }
+
+  void send_control(const Address &peer, uint8_t type, const MessageId &id) {
+    FrameHeader header;
+    header.type = type;
+    header.id = id;
+    this->send_control(peer, header);
+  }
+
+  // Ramka sterująca (ACK, REC, REL, COMP) - sam nagłówek, bez kolejki
+  void send_control(const Address &peer, const FrameHeader &header) {
+    uint8_t frame[Transport::MAX_HEADER_SIZE];
+    const size_t len = Transport::encode_header(frame, peer, header);
+    this->transport_->send_ack(peer, frame, len);
+    if (header.type == FRAME_ACK) {
+      RELIABLE_TRACE(Transport::TRACE_SOURCE, EV_ACK_TX, peer.data(), header.id.data(), header.credits, 0, len);
+    } else {
+      RELIABLE_TRACE(Transport::TRACE_SOURCE, EV_QOS2_TX, peer.data(), header.id.data(), header.type, 0, len);
+    }
+  }
+
+  bool inbox_full() {
+    std::lock_guard<Mutex> lock(this->history_mutex_);
+    return this->inbox_.size() >= this->receive_window_;
+  }
+
+  void deliver(const Address &sender, const FrameHeader &header, const std::vector<uint8_t> &payload) {
+    if (header.type == FRAME_TOPIC) {
+      auto it = this->topic_lower_bound(header.topic);
+      for (; it != this->topic_subscriptions_.end() && it->topic == header.topic; ++it) {
+        it->callback(sender, payload);
+      }
+      return;
+    }
+
+    // Komenda: payload 4 bajty, pierwsza para == druga para (big-endian)
+    if (payload.size() == 4 && memcmp(payload.data(), payload.data() + 2, 2) == 0) {
+      int16_t cmd = (payload[0] << 8) | payload[1];
+      this->sink_->on_engine_cmd(sender, cmd);
+    }
+    this->sink_->on_engine_data(sender, payload);
+    if (!payload.empty()) {
+      this->sink_->on_engine_message(sender, std::string(payload.begin(), payload.end()));
+    }
+  }
+
+  enum ExactlyOnceStatus : uint8_t {
+    EXACTLY_ONCE_NEW = 0,
+    EXACTLY_ONCE_HELD,      // czeka na utrwalenie
+    EXACTLY_ONCE_RECORDED,  // utrwalony, REC wysłany
+  };
+
+  ExactlyOnceStatus exactly_once_status(const Address &sender, const MessageId &id) {
+    std::lock_guard<Mutex> lock(this->history_mutex_);
+    if (std::any_of(this->exactly_once_.begin(), this->exactly_once_.end(),
+                    [&](const ExactlyOnceRecord<Address> &r) { return r.mac == sender && r.id == id; })) {
+      return EXACTLY_ONCE_RECORDED;
+    }
+    if (std::any_of(this->held_.begin(), this->held_.end(),
+                    [&](const HeldDelivery<Address> &h) { return h.mac == sender && h.header.id == id; })) {
+      return EXACTLY_ONCE_HELD;
+    }
+    return EXACTLY_ONCE_NEW;
+  }
+
+  void hold_delivery(const Address &sender, const FrameHeader &header, const uint8_t *payload, size_t len,
+                     bool forwarded) {
+    ExactlyOnceRecord<Address> oldest;
+    {
+      std::lock_guard<Mutex> lock(this->history_mutex_);
+      if (this->held_.size() >= MAX_HELD_DELIVERIES) {
+        // Bez REC - nadawca powtórzy wiadomość, gdy zapis nadrobi
+        RELIABLE_LOGW(Transport::TAG, "QoS 2 backlog full, frame deferred");
+        return;
+      }
+      if (this->exactly_once_.size() + this->held_.size() < MAX_EXACTLY_ONCE_RECORDS) {
+        this->held_.push_back({sender, header, forwarded, std::vector<uint8_t>(payload, payload + len)});
+        return;
+      }
+      // Wszystkie rekordy żywe (zgubione REL, wielu nadawców). Usunięcie któregoś dostarczyłoby jego
+      // powtórzenie drugi raz, więc ramka czeka bez REC, a ponowny REC najstarszego rekordu prosi
+      // nadawcę o REL - także nadawcę, który już go zapomniał.
+      oldest = this->exactly_once_.front();
+    }
+    RELIABLE_LOGW(Transport::TAG, "QoS 2 records full, frame deferred");
+    this->send_control(oldest.mac, FRAME_REC, oldest.id);
+  }
+
+  // Miejsce zapewnia hold_delivery() - rekordy nie są wypierane
+  static void append_record(std::vector<ExactlyOnceRecord<Address>> &records, const ExactlyOnceRecord<Address> &record) {
+    records.push_back(record);
+  }
+
+  bool is_duplicate(const Address &sender, const uint8_t *data, size_t len) {
+    const int64_t now = Transport::now_us();
+    std::lock_guard<Mutex> lock(this->history_mutex_);
+    auto &history = this->received_history_;
+    // Usuń stare wpisy (>300s)
+    history.erase(std::remove_if(history.begin(), history.end(),
+                                 [now](const ReceivedMessageInfo<Address> &info) {
+                                   return (now - info.timestamp) > HISTORY_WINDOW_US;
+                                 }),
+                  history.end());
+
+    bool duplicate = std::any_of(history.begin(), history.end(), [&](const ReceivedMessageInfo<Address> &info) {
+      return info.mac == sender && info.data.size() == len && std::equal(info.data.begin(), info.data.end(), data);
+    });
+    if (!duplicate) {
+      if (history.size() >= MAX_HISTORY_SIZE) {
+        history.erase(history.begin());
+      }
+      history.push_back({sender, now, std::vector<uint8_t>(data, data + len)});
+    }
+    return duplicate;
+  }
+
+  typename std::vector<TopicSubscription<Address>>::const_iterator topic_lower_bound(uint16_t topic) const {
+    return std::lower_bound(this->topic_subscriptions_.begin(), this->topic_subscriptions_.end(), topic,
+                            [](const TopicSubscription<Address> &sub, uint16_t t) { return sub.topic < t; });
+  }
+
+  Transport *transport_;
+  Sink *sink_;
+
+  std::vector<Pending> pending_;
+  std::vector<PeerHealth<Address>> peers_;
+  std::unordered_map<CoalesceKey, size_t, CoalesceKeyHash> coalesce_index_;
+  std::vector<ReceivedMessageInfo<Address>> received_history_;
+  std::vector<ExactlyOnceRecord<Address>> exactly_once_;  // pod history_mutex_
+  std::vector<HeldDelivery<Address>> held_;               // pod history_mutex_
+  std::vector<InboxEntry<Address>> inbox_;                 // pod history_mutex_
+  std::vector<std::pair<Address, MessageId>> stalled_;     // pod history_mutex_: peery z zerowym oknem
+  std::vector<PeerCredit<Address>> credits_;               // pod queue_mutex_
+  std::vector<TopicSubscription<Address>> topic_subscriptions_;
+  Mutex queue_mutex_;
+  Mutex history_mutex_;
+
+  uint8_t max_retries_{5};
+  int64_t timeout_us_{200000};
+  bool adaptive_timeout_{false};
+  uint32_t srtt_us_{0};  // wygładzony czas ACK (0 = brak pomiaru)
+
+  uint8_t peer_failure_threshold_{0};
+  int64_t peer_probe_interval_us_{10000000};
+  PeerDownPolicy peer_down_policy_{PEER_DOWN_PARK};
+  std::atomic<uint32_t> peer_state_epoch_{0};
+
+  uint8_t receive_window_{0};
+
+  std::vector<SleepyPeer<Address>> sleepy_;  // pod queue_mutex_ (lista stała po konfiguracji)
+  int64_t mailbox_retention_us_{3600000000LL};
+  uint8_t mailbox_capacity_{8};
+  int64_t mail_window_us_{0};
+  int64_t mail_until_{0};  // pod queue_mutex_
+
+  size_t max_queue_messages_{32};
+  size_t max_queue_bytes_{4096};
+  OverflowPolicy overflow_policy_{OVERFLOW_DROP_OLDEST};
+  size_t queued_bytes_{0};
+  size_t queue_high_water_mark_{0};
+  uint32_t dropped_count_{0};
+};
+
+}  // namespace reliable
+}  // namespace esphome
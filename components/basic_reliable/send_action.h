@@ -0,0 +1,104 @@
+#pragma once
+
+// Akcje send i send_cmd z YAML, wspólne dla basic_espnowex i basic_loraex.
+//
+// Stała treść (tekst lub bajty w YAML) jest kodowana przez __init__.py do tablicy static const -
+// akcja wstawia do kolejki tylko nagłówek z nowym message_id i tę tablicę, bez std::string
+// i std::vector po drodze. Treść z lambdy (message/data) jest wyliczana przy każdym wywołaniu.
+//
+// Parent: send_raw(const uint8_t *, size_t, const std::array<uint8_t, 6> &, uint8_t, QoS),
+// publish_raw(uint16_t, const uint8_t *, size_t, const std::array<uint8_t, 6> &, uint8_t, QoS),
+// send_cmd(int16_t, const std::array<uint8_t, 6> &, uint8_t, QoS) i get_peer_mac().
+
+#include "esphome/core/automation.h"
+#include "reliable_engine.h"
+
+#include <array>
+#include <string>
+#include <vector>
+
+namespace esphome {
+namespace reliable {
+
+template<typename Parent, typename... Ts> class SendAction : public Action<Ts...> {
+ public:
+  explicit SendAction(Parent *parent) : parent_(parent) {}
+  void set_static_payload(const uint8_t *payload, size_t len) {
+    this->static_payload_ = payload;
+    this->static_len_ = len;
+  }
+  void set_message(std::function<std::string(Ts...)> &&message) { this->message_ = std::move(message); }
+  void set_data(std::function<std::vector<uint8_t>(Ts...)> &&data) { this->data_ = std::move(data); }
+  void set_topic(uint16_t topic) {
+    this->topic_ = topic;
+    this->has_topic_ = true;
+  }
+  void set_peer_mac(const std::array<uint8_t, 6> &peer_mac) {
+    this->peer_mac_ = peer_mac;
+    this->has_peer_mac_ = true;
+  }
+  void set_priority(uint8_t priority) { this->priority_ = priority; }
+  void set_qos(QoS qos) { this->qos_ = qos; }
+
+  void play(Ts... x) override {
+    if (this->message_) {
+      const std::string message = this->message_(x...);
+      this->transmit(reinterpret_cast<const uint8_t *>(message.data()), message.size());
+    } else if (this->data_) {
+      const std::vector<uint8_t> data = this->data_(x...);
+      this->transmit(data.data(), data.size());
+    } else {
+      this->transmit(this->static_payload_, this->static_len_);
+    }
+  }
+
+ protected:
+  void transmit(const uint8_t *payload, size_t len) {
+    const std::array<uint8_t, 6> &peer = this->has_peer_mac_ ? this->peer_mac_ : this->parent_->get_peer_mac();
+    if (this->has_topic_) {
+      this->parent_->publish_raw(this->topic_, payload, len, peer, this->priority_, this->qos_);
+    } else {
+      this->parent_->send_raw(payload, len, peer, this->priority_, this->qos_);
+    }
+  }
+
+  Parent *parent_;
+  const uint8_t *static_payload_{nullptr};
+  size_t static_len_{0};
+  std::function<std::string(Ts...)> message_;
+  std::function<std::vector<uint8_t>(Ts...)> data_;
+  uint16_t topic_{0};
+  bool has_topic_{false};
+  std::array<uint8_t, 6> peer_mac_{};
+  bool has_peer_mac_{false};
+  uint8_t priority_{0};
+  QoS qos_{QOS_AT_LEAST_ONCE};
+};
+
+// Komenda jest już kodowana na stosie (4 bajty) i zachowuje koalescencję silnika
+template<typename Parent, typename... Ts> class SendCmdAction : public Action<Ts...> {
+ public:
+  explicit SendCmdAction(Parent *parent) : parent_(parent) {}
+  TEMPLATABLE_VALUE(int16_t, cmd)
+  void set_peer_mac(const std::array<uint8_t, 6> &peer_mac) {
+    this->peer_mac_ = peer_mac;
+    this->has_peer_mac_ = true;
+  }
+  void set_priority(uint8_t priority) { this->priority_ = priority; }
+  void set_qos(QoS qos) { this->qos_ = qos; }
+
+  void play(Ts... x) override {
+    const std::array<uint8_t, 6> &peer = this->has_peer_mac_ ? this->peer_mac_ : this->parent_->get_peer_mac();
+    this->parent_->send_cmd(this->cmd_.value(x...), peer, this->priority_, this->qos_);
+  }
+
+ protected:
+  Parent *parent_;
+  std::array<uint8_t, 6> peer_mac_{};
+  bool has_peer_mac_{false};
+  uint8_t priority_{0};
+  QoS qos_{QOS_AT_LEAST_ONCE};
+};
+
+}  // namespace reliable
+}  // namespace esphome
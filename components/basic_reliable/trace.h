@@ -0,0 +1,189 @@
+#pragma once
+
+// Binarny ślad zdarzeń ścieżki wysyłki/odbioru (włączany przez USE_RELIABLE_TRACE).
+//
+// Każde zdarzenie to 16-bajtowy rekord zapisywany do bufora kołowego w RAM - bez formatowania,
+// bez blokad (indeks zapisu to licznik atomowy), więc można go wołać z zadania WiFi i z pętli.
+// Bez USE_RELIABLE_TRACE makro RELIABLE_TRACE rozwija się do ((void) 0), a argumenty nie są
+// nawet obliczane. Zrzut: trace::dump() (linie "TRC <hex>" w logu) lub trace::for_each();
+// dekoder po stronie Linuksa: tools/trace_decode.py.
+
+#include <cstdint>
+
+#ifdef USE_RELIABLE_TRACE
+
+#include <array>
+#include <atomic>
+#include <cstring>
+
+#ifdef ESP_PLATFORM
+#include "esp_log.h"
+#include "esp_timer.h"
+#else
+#include <chrono>
+#endif
+
+#ifndef RELIABLE_TRACE_SIZE
+#define RELIABLE_TRACE_SIZE 256
+#endif
+
+namespace esphome {
+namespace reliable {
+namespace trace {
+
+static_assert((RELIABLE_TRACE_SIZE & (RELIABLE_TRACE_SIZE - 1)) == 0, "RELIABLE_TRACE_SIZE must be a power of two");
+
+// Źródło zdarzenia (2 najstarsze bity pola event)
+enum Source : uint8_t {
+  SRC_ESPNOW = 0,
+  SRC_LORA = 1,
+  SRC_BRIDGE = 2,
+};
+
+// Numery zdarzeń - muszą się zgadzać z EVENTS w tools/trace_decode.py
+enum Event : uint8_t {
+  EV_ENQUEUE = 1,   // arg = priorytet
+  EV_COALESCE,      // zastąpienie niepotwierdzonej wartości (send_latest)
+  EV_DROP,          // usunięcie z kolejki przy przepełnieniu / backpressure mostu
+  EV_TX,            // arg = numer próby
+  EV_TX_FAIL,       // odrzucone przez warstwę łącza, arg = licznik błędów
+  EV_EXPIRE,        // wyczerpany limit prób
+  EV_ACK_RX,
+  EV_ACK_TX,        // arg = ogłoszone okno odbiorcy (0xFF = bez kontroli przepływu)
+  EV_RX,            // arg = typ ramki
+  EV_RX_DUP,
+  EV_FORWARD,       // ramka przejęta przez most
+  EV_SEND_DONE,     // callback warstwy łącza, arg = status (0 = OK)
+  EV_PEER,          // nowy wpis w tablicy peerów; MAC w polach id/arg/len
+  EV_QOS2_RX,       // ramka potwierdzenia QoS 2 (REC/REL/COMP), arg = typ ramki
+  EV_QOS2_TX,
+  EV_RX_FULL,        // kolejka odbiorcza pełna - ramka bez ACK, nadawca ją powtórzy
+};
+
+struct __attribute__((packed)) TraceRecord {
+  uint32_t timestamp_us;  // młodsze 32 bity zegara (zawija się co ~71 min)
+  uint16_t seq;           // numer rekordu - wykrywanie nadpisania przy zrzucie
+  uint8_t event;          // (źródło << 6) | zdarzenie
+  uint8_t peer;           // indeks w tablicy peerów, 0xFF = brak
+  uint8_t msg_id[3];
+  uint8_t arg;
+  uint16_t queue_depth;
+  uint16_t len;
+};
+static_assert(sizeof(TraceRecord) == 16, "TraceRecord must stay 16 bytes");
+
+static const uint8_t MAX_TRACE_PEERS = 32;
+static const uint8_t NO_PEER = 0xFF;
+
+struct TraceBuffer {
+  TraceRecord records[RELIABLE_TRACE_SIZE];
+  std::atomic<uint32_t> head{0};
+  uint8_t peers[MAX_TRACE_PEERS][6];
+  std::atomic<uint8_t> peer_count{0};
+};
+
+inline TraceBuffer g_trace;
+
+inline uint32_t now_us() {
+#ifdef ESP_PLATFORM
+  return static_cast<uint32_t>(esp_timer_get_time());
+#else
+  return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+                                   std::chrono::steady_clock::now().time_since_epoch())
+                                   .count());
+#endif
+}
+
+inline void write(uint8_t event, uint8_t peer, const uint8_t *msg_id, uint8_t arg, uint16_t queue_depth, uint16_t len) {
+  const uint32_t slot = g_trace.head.fetch_add(1, std::memory_order_relaxed);
+  TraceRecord &rec = g_trace.records[slot & (RELIABLE_TRACE_SIZE - 1)];
+  rec.timestamp_us = now_us();
+  rec.seq = static_cast<uint16_t>(slot);
+  rec.event = event;
+  rec.peer = peer;
+  if (msg_id != nullptr) {
+    memcpy(rec.msg_id, msg_id, 3);
+  } else {
+    memset(rec.msg_id, 0, 3);
+  }
+  rec.arg = arg;
+  rec.queue_depth = queue_depth;
+  rec.len = len;
+}
+
+// Indeks peera; nowy MAC dostaje kolejny wolny wpis i rekord EV_PEER.
+// Równoległe dopisanie tego samego MAC może dać dwa indeksy - dekoder je scala.
+inline uint8_t peer_index(const uint8_t *mac) {
+  if (mac == nullptr) {
+    return NO_PEER;
+  }
+  const uint8_t count = g_trace.peer_count.load(std::memory_order_acquire);
+  for (uint8_t i = 0; i < count && i < MAX_TRACE_PEERS; i++) {
+    if (memcmp(g_trace.peers[i], mac, 6) == 0) {
+      return i;
+    }
+  }
+  if (count >= MAX_TRACE_PEERS) {
+    return NO_PEER;
+  }
+  const uint8_t index = g_trace.peer_count.fetch_add(1, std::memory_order_acq_rel);
+  if (index >= MAX_TRACE_PEERS) {
+    return NO_PEER;
+  }
+  memcpy(g_trace.peers[index], mac, 6);
+  write(EV_PEER, index, mac, mac[3], 0, static_cast<uint16_t>((mac[4] << 8) | mac[5]));
+  return index;
+}
+
+inline void record(uint8_t source, uint8_t event, const uint8_t *mac, const uint8_t *msg_id, uint8_t arg,
+                   size_t queue_depth, size_t len) {
+  write(static_cast<uint8_t>((source << 6) | event), peer_index(mac), msg_id, arg,
+        static_cast<uint16_t>(queue_depth), static_cast<uint16_t>(len));
+}
+
+// Rekordy od najstarszego zachowanego do najnowszego
+template<typename F> void for_each(F &&f) {
+  const uint32_t head = g_trace.head.load(std::memory_order_acquire);
+  const uint32_t first = head > RELIABLE_TRACE_SIZE ? head - RELIABLE_TRACE_SIZE : 0;
+  for (uint32_t i = first; i < head; i++) {
+    f(g_trace.records[i & (RELIABLE_TRACE_SIZE - 1)]);
+  }
+}
+
+inline void clear() { g_trace.head.store(0, std::memory_order_release); }
+
+#ifdef ESP_PLATFORM
+// Zrzut do logu: tablica peerów ("TRP") i rekordy ("TRC") jako hex - wejście dla trace_decode.py
+inline void dump() {
+  static const char *const TAG = "reliable_trace";
+  const uint8_t peers = g_trace.peer_count.load(std::memory_order_acquire);
+  for (uint8_t i = 0; i < peers && i < MAX_TRACE_PEERS; i++) {
+    const uint8_t *mac = g_trace.peers[i];
+    ESP_LOGI(TAG, "TRP %u %02X:%02X:%02X:%02X:%02X:%02X", i, mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+  }
+  for_each([](const TraceRecord &rec) {
+    static const char HEX[] = "0123456789abcdef";
+    char line[2 * sizeof(TraceRecord) + 1];
+    const uint8_t *raw = reinterpret_cast<const uint8_t *>(&rec);
+    for (size_t i = 0; i < sizeof(TraceRecord); i++) {
+      line[2 * i] = HEX[raw[i] >> 4];
+      line[2 * i + 1] = HEX[raw[i] & 0x0F];
+    }
+    line[sizeof(line) - 1] = '\0';
+    ESP_LOGI(TAG, "TRC %s", line);
+  });
+}
+#endif
+
+}  // namespace trace
+}  // namespace reliable
+}  // namespace esphome
+
+#define RELIABLE_TRACE(source, event, mac, msg_id, arg, queue_depth, len) \
+  ::esphome::reliable::trace::record(source, ::esphome::reliable::trace::event, mac, msg_id, arg, queue_depth, len)
+
+#else
+
+#define RELIABLE_TRACE(source, event, mac, msg_id, arg, queue_depth, len) ((void) 0)
+
+#endif  // USE_RELIABLE_TRACE
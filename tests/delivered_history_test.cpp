@@ -0,0 +1,108 @@
+// Testy historii dostarczonych wiadomości basic_failover na hoście
+
+#include "delivered_history.h"
+
+#include <array>
+#include <cstdio>
+#include <vector>
+
+using namespace esphome::failover;
+
+using MessageId = std::array<uint8_t, 3>;
+
+static int failures = 0;
+
+#define CHECK(cond) \
+  do { \
+    if (!(cond)) { \
+      std::printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+      failures++; \
+    } \
+  } while (0)
+
+static const size_t PEERS = 2;
+static const size_t MAX_PENDING = 16;
+static const int64_t TTL_US = 150000 + 5 * 1500000;  // termin przełączenia + 5 prób LoRa
+
+static MessageId message_id(size_t n) { return {uint8_t(n >> 16), uint8_t(n >> 8), uint8_t(n)}; }
+
+// Jak BasicFailover::on_frame: znany identyfikator to kopia z drugiego radia, nowy jest dostarczany
+struct Receiver {
+  Receiver() {
+    this->history.set_ttl_us(TTL_US);
+    this->history.set_capacity(256);
+  }
+  void on_frame(uint8_t peer, const MessageId &id, int64_t now) {
+    if (this->history.contains(peer, id, now)) {
+      this->duplicates++;
+      return;
+    }
+    this->history.remember(peer, id, now);
+    this->delivered.push_back(id);
+  }
+
+  DeliveredHistory<MessageId> history;
+  std::vector<MessageId> delivered;
+  size_t duplicates{0};
+};
+
+static void test_more_messages_than_pending_within_ttl() {
+  Receiver rx;
+  const size_t messages = 4 * MAX_PENDING * PEERS;
+  int64_t now = 1000;
+  for (size_t n = 0; n < messages; n++) {
+    rx.on_frame(uint8_t(n % PEERS), message_id(n), now);
+    now += 10000;  // wszystkie w obrębie jednego TTL
+  }
+  CHECK(now - 1000 < TTL_US);
+  CHECK(rx.delivered.size() == messages);
+  CHECK(rx.history.get_evicted_count() == 0);
+
+  // Kopie przez drugie radio - także najstarszej wiadomości - tylko potwierdzane
+  for (size_t n = 0; n < messages; n++) {
+    rx.on_frame(uint8_t(n % PEERS), message_id(n), now);
+  }
+  CHECK(rx.delivered.size() == messages && rx.duplicates == messages);
+}
+
+static void test_same_id_from_other_peer_is_new() {
+  Receiver rx;
+  rx.on_frame(0, message_id(7), 1000);
+  rx.on_frame(1, message_id(7), 1000);
+  CHECK(rx.delivered.size() == 2 && rx.duplicates == 0);
+}
+
+static void test_ids_expire_after_ttl() {
+  Receiver rx;
+  rx.on_frame(0, message_id(1), 1000);
+  rx.on_frame(0, message_id(1), 1000 + TTL_US);
+  CHECK(rx.duplicates == 1);
+  rx.on_frame(0, message_id(2), 1000 + TTL_US + 1);
+  CHECK(rx.history.size() == 1);  // pierwszy identyfikator wygasł
+}
+
+static void test_flood_forgets_oldest() {
+  Receiver rx;
+  rx.history.set_capacity(MAX_PENDING);
+  for (size_t n = 0; n <= MAX_PENDING; n++) {
+    rx.on_frame(0, message_id(n), 1000);
+  }
+  // Nowa wiadomość nigdy nie czeka na miejsce - zapominany jest najstarszy identyfikator
+  CHECK(rx.delivered.size() == MAX_PENDING + 1);
+  CHECK(rx.history.size() == MAX_PENDING && rx.history.get_evicted_count() == 1);
+  CHECK(!rx.history.contains(0, message_id(0), 1000));
+  CHECK(rx.history.contains(0, message_id(MAX_PENDING), 1000));
+}
+
+int main() {
+  test_more_messages_than_pending_within_ttl();
+  test_same_id_from_other_peer_is_new();
+  test_ids_expire_after_ttl();
+  test_flood_forgets_oldest();
+  if (failures != 0) {
+    std::printf("%d check(s) failed\n", failures);
+    return 1;
+  }
+  std::printf("all tests passed\n");
+  return 0;
+}
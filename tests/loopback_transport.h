@@ -0,0 +1,139 @@
+#pragma once
+
+// Transport testowy silnika na hoście: std::mutex zamiast muteksu FreeRTOS, zegar sterowany
+// z testu i "eter" w postaci kolejki ramek, które test przenosi między węzłami (albo gubi).
+// Nagłówek jak w basic_espnowex: typ(1) + message_id(3) [+ temat(2) | kredyty(1)].
+
+#include "reliable_engine.h"
+
+#include <deque>
+
+namespace esphome {
+namespace reliable {
+namespace test {
+
+using Address = std::array<uint8_t, 6>;
+
+// Czas płynie tylko wtedy, gdy test go przesunie
+struct FakeClock {
+  static inline int64_t now = 1000;
+  static void advance(int64_t us) { now += us; }
+};
+
+struct WireFrame {
+  Address peer;
+  std::vector<uint8_t> data;
+};
+
+struct LoopbackTransport {
+  using Address = test::Address;
+  using Mutex = std::mutex;
+  static constexpr size_t MTU = 250;
+  static constexpr size_t MAX_HEADER_SIZE = 6;
+  static constexpr const char *TAG = "test";
+  static constexpr uint8_t TRACE_SOURCE = 0;
+
+  static int64_t now_us() { return FakeClock::now; }
+  // Deterministyczny xorshift - identyfikatory różnią się także przy stojącym zegarze
+  static uint32_t random32() {
+    static uint32_t state = 0x12345678;
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+  }
+
+  static size_t encode_header(uint8_t *out, const Address &, const FrameHeader &header) {
+    out[0] = encode_frame_type(header);
+    std::copy(header.id.begin(), header.id.end(), out + 1);
+    if (header.type == FRAME_ACK && header.credits != NO_CREDITS) {
+      out[4] = header.credits;
+      return 5;
+    }
+    if (header.type != FRAME_TOPIC) {
+      return 4;
+    }
+    out[4] = header.topic >> 8;
+    out[5] = header.topic & 0xFF;
+    return 6;
+  }
+
+  static size_t decode_header(const uint8_t *data, size_t len, Address &, FrameHeader &header) {
+    if (len < 4 || !decode_frame_type(data[0], header)) {
+      return 0;
+    }
+    header.id = {data[1], data[2], data[3]};
+    if (header.type == FRAME_ACK) {
+      if (len == 5) {
+        header.credits = data[4];
+        return 5;
+      }
+      return 4;
+    }
+    if (header.type == FRAME_TOPIC) {
+      if (len < 6) {
+        return 0;
+      }
+      header.topic = (data[4] << 8) | data[5];
+      return 6;
+    }
+    return 4;
+  }
+
+  bool send(const Address &peer, const uint8_t *frame, size_t len) {
+    this->wire.push_back({peer, std::vector<uint8_t>(frame, frame + len)});
+    return true;
+  }
+  void send_ack(const Address &peer, const uint8_t *frame, size_t len) { this->send(peer, frame, len); }
+  int64_t min_ack_timeout_us(const Address &, size_t) { return 0; }
+
+  std::deque<WireFrame> wire;
+};
+
+// Zdarzenia silnika zapisywane do sprawdzenia w teście
+struct RecordingSink {
+  bool on_engine_forward(const Address &, const FrameHeader &, const uint8_t *, size_t) { return false; }
+  void on_engine_ack(const Address &, const MessageId &id) { this->acks.push_back(id); }
+  void on_engine_cmd(const Address &, int16_t cmd) { this->cmds.push_back(cmd); }
+  void on_engine_data(const Address &, const std::vector<uint8_t> &payload) { this->data.push_back(payload); }
+  void on_engine_message(const Address &, const std::string &) {}
+
+  std::vector<MessageId> acks;
+  std::vector<int16_t> cmds;
+  std::vector<std::vector<uint8_t>> data;
+};
+
+using Engine = ReliableEngine<LoopbackTransport, RecordingSink>;
+
+// Węzeł: adres, transport, odbiorca zdarzeń i silnik
+struct Node {
+  explicit Node(const Address &address) : address(address), engine(&transport, &sink) {}
+
+  Address address;
+  LoopbackTransport transport;
+  RecordingSink sink;
+  Engine engine;
+};
+
+// Przenosi wszystkie ramki nadane przez from do to; zwraca ich liczbę
+inline size_t pump(Node &from, Node &to) {
+  size_t count = 0;
+  while (!from.transport.wire.empty()) {
+    WireFrame frame = std::move(from.transport.wire.front());
+    from.transport.wire.pop_front();
+    to.engine.on_frame(from.address, frame.data.data(), frame.data.size());
+    count++;
+  }
+  return count;
+}
+
+// Gubi wszystkie ramki nadane przez węzeł; zwraca ich liczbę
+inline size_t drop(Node &node) {
+  const size_t count = node.transport.wire.size();
+  node.transport.wire.clear();
+  return count;
+}
+
+}  // namespace test
+}  // namespace reliable
+}  // namespace esphome
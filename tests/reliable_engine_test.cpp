@@ -0,0 +1,232 @@
+// Testy silnika basic_reliable na hoście: dwa węzły połączone transportem pętli zwrotnej
+
+#include "loopback_transport.h"
+
+#include <cstdio>
+
+using namespace esphome::reliable;
+using namespace esphome::reliable::test;
+
+static int failures = 0;
+
+#define CHECK(cond) \
+  do { \
+    if (!(cond)) { \
+      std::printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+      failures++; \
+    } \
+  } while (0)
+
+static const Address A = {0x02, 0, 0, 0, 0, 0x0A};
+static const Address B = {0x02, 0, 0, 0, 0, 0x0B};
+static const int64_t TIMEOUT_US = 100000;
+
+static MessageId frame_id(const WireFrame &frame) { return {frame.data[1], frame.data[2], frame.data[3]}; }
+static uint8_t frame_type(const WireFrame &frame) { return frame.data[0] & FRAME_TYPE_MASK; }
+
+static void test_enqueue_and_ack() {
+  Node a(A), b(B);
+  CHECK(a.engine.send({'h', 'i'}, B) == ENQUEUE_OK);
+  CHECK(a.engine.pending_count() == 1);
+  CHECK(a.transport.wire.size() == 1);  // pierwsza transmisja od razu, bez czekania na process_queue
+  const MessageId id = frame_id(a.transport.wire.front());
+
+  CHECK(pump(a, b) == 1);
+  CHECK(b.sink.data.size() == 1 && b.sink.data[0] == std::vector<uint8_t>({'h', 'i'}));
+  CHECK(b.transport.wire.size() == 1 && frame_type(b.transport.wire.front()) == FRAME_ACK);
+
+  CHECK(pump(b, a) == 1);
+  CHECK(a.sink.acks.size() == 1 && a.sink.acks[0] == id);
+  a.engine.process_queue();
+  CHECK(a.engine.pending_count() == 0);
+}
+
+static void test_retransmit_and_expiry() {
+  Node a(A);
+  a.engine.set_timeout_us(TIMEOUT_US);
+  a.engine.set_max_retries(3);
+  a.engine.send({'x'}, B);
+  size_t transmissions = drop(a);
+
+  // Przed upływem timeoutu nic nie jest powtarzane
+  FakeClock::advance(TIMEOUT_US / 2);
+  a.engine.process_queue();
+  CHECK(a.transport.wire.empty());
+
+  for (int i = 0; i < 10; i++) {
+    FakeClock::advance(TIMEOUT_US + 1);
+    a.engine.process_queue();
+    transmissions += drop(a);
+  }
+  CHECK(transmissions == 3);  // max_retries liczy wszystkie transmisje
+  CHECK(a.engine.pending_count() == 0);
+  CHECK(a.sink.acks.empty());
+}
+
+static void test_duplicate_is_acknowledged_again() {
+  Node a(A), b(B);
+  a.engine.set_timeout_us(TIMEOUT_US);
+  a.engine.send({'d'}, B);
+  pump(a, b);
+  CHECK(drop(b) == 1);  // ACK ginie
+
+  FakeClock::advance(TIMEOUT_US + 1);
+  a.engine.process_queue();
+  CHECK(pump(a, b) == 1);
+  CHECK(b.sink.data.size() == 1);       // powtórzenie nie jest dostarczane drugi raz...
+  CHECK(b.transport.wire.size() == 1);  // ...ale jest potwierdzane, żeby nadawca przestał
+  pump(b, a);
+  CHECK(a.sink.acks.size() == 1);
+}
+
+static void test_qos_at_most_once() {
+  Node a(A), b(B);
+  CHECK(a.engine.send({'q'}, B, 0, QOS_AT_MOST_ONCE) == ENQUEUE_OK);
+  CHECK(a.engine.pending_count() == 0);
+  CHECK(a.transport.wire.size() == 1 && (a.transport.wire.front().data[0] & FRAME_FLAG_QOS0));
+  const WireFrame copy = a.transport.wire.front();
+  pump(a, b);
+  b.engine.on_frame(A, copy.data.data(), copy.data.size());
+  CHECK(b.sink.data.size() == 2);  // bez historii odbioru
+  CHECK(b.transport.wire.empty());  // i bez ACK
+}
+
+static void test_qos_exactly_once() {
+  Node a(A), b(B);
+  a.engine.set_timeout_us(TIMEOUT_US);
+  size_t persists = 0;
+  auto persist = [&](const std::vector<ExactlyOnceRecord<Address>> &) {
+    persists++;
+    return true;
+  };
+
+  a.engine.send({'e'}, B, 0, QOS_EXACTLY_ONCE);
+  const WireFrame data = a.transport.wire.front();
+  pump(a, b);
+  CHECK(b.sink.data.empty() && b.transport.wire.empty());  // czeka na trwały zapis identyfikatora
+
+  b.engine.flush_exactly_once(persist);
+  CHECK(persists == 1 && b.sink.data.size() == 1);
+  CHECK(b.transport.wire.size() == 1 && frame_type(b.transport.wire.front()) == FRAME_REC);
+  drop(b);  // REC ginie
+
+  FakeClock::advance(TIMEOUT_US + 1);
+  a.engine.process_queue();
+  pump(a, b);  // powtórzona DATA - tylko ponowny REC
+  b.engine.flush_exactly_once(persist);
+  CHECK(b.sink.data.size() == 1 && persists == 1);
+  CHECK(b.transport.wire.size() == 1 && frame_type(b.transport.wire.front()) == FRAME_REC);
+
+  pump(b, a);
+  CHECK(a.sink.acks.size() == 1 && a.sink.acks[0] == frame_id(data));
+  CHECK(a.transport.wire.size() == 1 && frame_type(a.transport.wire.front()) == FRAME_REL);
+  pump(a, b);
+  CHECK(b.transport.wire.size() == 1 && frame_type(b.transport.wire.front()) == FRAME_COMP);
+  pump(b, a);
+  a.engine.process_queue();
+  CHECK(a.engine.pending_count() == 0);
+}
+
+static void test_qos_exactly_once_records_full() {
+  Node a(A), b(B);
+  a.engine.set_timeout_us(TIMEOUT_US);
+  auto persist = [](const std::vector<ExactlyOnceRecord<Address>> &) { return true; };
+
+  // Tablica identyfikatorów pełna: wszystkie REC giną, więc żaden rekord nie dostał REL
+  WireFrame first;
+  for (size_t i = 0; i < MAX_EXACTLY_ONCE_RECORDS; i++) {
+    a.engine.send({uint8_t(i)}, B, 0, QOS_EXACTLY_ONCE);
+    if (i == 0) {
+      first = a.transport.wire.front();
+    }
+    pump(a, b);
+    b.engine.flush_exactly_once(persist);
+  }
+  CHECK(b.sink.data.size() == MAX_EXACTLY_ONCE_RECORDS);
+  drop(b);
+
+  // Kolejna wiadomość czeka bez REC; zamiast niej REC najstarszego rekordu prosi o jego REL
+  a.engine.send({'n'}, B, 0, QOS_EXACTLY_ONCE);
+  pump(a, b);
+  b.engine.flush_exactly_once(persist);
+  CHECK(b.sink.data.size() == MAX_EXACTLY_ONCE_RECORDS);
+  CHECK(b.transport.wire.size() == 1 && frame_type(b.transport.wire.front()) == FRAME_REC &&
+        frame_id(b.transport.wire.front()) == frame_id(first));
+
+  // Najstarszy rekord nie został wyparty - jego powtórzenie nie jest dostarczane drugi raz
+  b.engine.on_frame(A, first.data.data(), first.data.size());
+  CHECK(b.sink.data.size() == MAX_EXACTLY_ONCE_RECORDS);
+
+  // REL zwalnia miejsce, a retransmisja wstrzymanej wiadomości zostaje dostarczona
+  pump(b, a);
+  CHECK(a.transport.wire.size() == 1 && frame_type(a.transport.wire.front()) == FRAME_REL);
+  pump(a, b);
+  pump(b, a);
+  FakeClock::advance(TIMEOUT_US + 1);
+  a.engine.process_queue();
+  pump(a, b);
+  b.engine.flush_exactly_once(persist);
+  CHECK(b.sink.data.size() == MAX_EXACTLY_ONCE_RECORDS + 1 && b.sink.data.back() == std::vector<uint8_t>({'n'}));
+}
+
+static void test_coalescing() {
+  Node a(A), b(B);
+  // Ta sama niepotwierdzona komenda nie jest dublowana
+  a.engine.send_cmd(7, B);
+  a.engine.send_cmd(7, B);
+  CHECK(a.engine.pending_count() == 1);
+  a.engine.send_cmd(8, B);
+  CHECK(a.engine.pending_count() == 2);
+  // Przy QoS 2 liczy się każda komenda
+  a.engine.send_cmd(9, B, 0, QOS_EXACTLY_ONCE);
+  a.engine.send_cmd(9, B, 0, QOS_EXACTLY_ONCE);
+  CHECK(a.engine.pending_count() == 4);
+  a.engine.clear();
+  drop(a);
+
+  // Ostatnia wartość wygrywa, a ACK starej wartości nie potwierdza nowej
+  a.engine.send_latest(1, {'1'}, B);
+  const WireFrame old_value = a.transport.wire.front();
+  drop(a);
+  a.engine.send_latest(1, {'2'}, B);
+  CHECK(a.engine.pending_count() == 1);
+  b.engine.on_frame(A, old_value.data.data(), old_value.data.size());
+  pump(b, a);
+  a.engine.process_queue();
+  CHECK(a.engine.pending_count() == 1);
+  pump(a, b);
+  pump(b, a);
+  a.engine.process_queue();
+  CHECK(a.engine.pending_count() == 0);
+  CHECK(b.sink.data.size() == 2 && b.sink.data[1] == std::vector<uint8_t>({'2'}));
+}
+
+static void test_topic_subscription() {
+  Node a(A), b(B);
+  size_t hits = 0;
+  b.engine.add_topic_callback(topic_hash("sensors/temperature"), [&](Address, std::vector<uint8_t>) { hits++; });
+  a.engine.publish(topic_hash("sensors/temperature"), {'t'}, B);
+  a.engine.publish(topic_hash("sensors/humidity"), {'h'}, B);
+  CHECK(pump(a, b) == 2);
+  CHECK(hits == 1 && b.sink.data.empty());  // temat bez subskrybenta: tylko ACK
+  CHECK(pump(b, a) == 2);
+  a.engine.process_queue();
+  CHECK(a.engine.pending_count() == 0);
+}
+
+int main() {
+  test_enqueue_and_ack();
+  test_retransmit_and_expiry();
+  test_duplicate_is_acknowledged_again();
+  test_qos_at_most_once();
+  test_qos_exactly_once();
+  test_qos_exactly_once_records_full();
+  test_coalescing();
+  test_topic_subscription();
+  if (failures != 0) {
+    std::printf("%d check(s) failed\n", failures);
+    return 1;
+  }
+  std::printf("all tests passed\n");
+  return 0;
+}
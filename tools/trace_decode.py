@@ -0,0 +1,198 @@
+#!/usr/bin/env python3
+"""Dekoder binarnego śladu zdarzeń basic_reliable (components/basic_reliable/trace.h).
+
+Wejście: log z liniami "TRP <idx> <mac>" i "TRC <32 znaki hex>" (wynik trace::dump(),
+np. zapis `esphome logs`) albo surowy plik z rekordami po 16 bajtów (--raw).
+
+Wyjście: oś czasu zdarzeń i rozbicie opóźnień na wiadomość (kolejka -> pierwsza
+transmisja -> ACK, liczba prób) ze statystykami.
+
+    tools/trace_decode.py gateway.log
+    tools/trace_decode.py --raw trace.bin --peers peers.txt --no-timeline
+"""
+
+import argparse
+import re
+import struct
+import sys
+from collections import defaultdict
+
+RECORD = struct.Struct("<IHBB3sBHH")
+
+# Muszą się zgadzać z trace::Event i trace::Source w trace.h
+EVENTS = {
+    1: "ENQUEUE",
+    2: "COALESCE",
+    3: "DROP",
+    4: "TX",
+    5: "TX_FAIL",
+    6: "EXPIRE",
+    7: "ACK_RX",
+    8: "ACK_TX",
+    9: "RX",
+    10: "RX_DUP",
+    11: "FORWARD",
+    12: "SEND_DONE",
+    13: "PEER",
+    14: "QOS2_RX",
+    15: "QOS2_TX",
+    16: "RX_FULL",
+}
+SOURCES = {0: "espnow", 1: "lora", 2: "bridge", 3: "?"}
+EV_PEER = 13
+NO_PEER = 0xFF
+
+TRC_RE = re.compile(r"TRC ([0-9a-fA-F]{32})")
+TRP_RE = re.compile(r"TRP (\d+) ([0-9A-Fa-f:]{17})")
+
+
+def parse_log(lines):
+    records, peers = [], {}
+    for line in lines:
+        m = TRP_RE.search(line)
+        if m:
+            peers[int(m.group(1))] = m.group(2).upper()
+            continue
+        m = TRC_RE.search(line)
+        if m:
+            records.append(bytes.fromhex(m.group(1)))
+    return records, peers
+
+
+def parse_raw(data):
+    size = RECORD.size
+    return [data[i:i + size] for i in range(0, len(data) - size + 1, size)], {}
+
+
+def decode(raw_records, peers):
+    """Zwraca (zdarzenia, liczba brakujących rekordów)."""
+    events = []
+    last_ts, epoch = None, 0
+    last_seq, lost = None, 0
+    for raw in raw_records:
+        ts, seq, event, peer, msg_id, arg, depth, length = RECORD.unpack(raw)
+        if last_seq is not None:
+            lost += ((seq - last_seq) & 0xFFFF) - 1
+        last_seq = seq
+        # 32-bitowy zegar zawija się co ~71 min - zakładamy monotoniczność w obrębie zrzutu
+        if last_ts is not None and ts < last_ts and last_ts - ts > 0x80000000:
+            epoch += 1 << 32
+        last_ts = ts
+        source, kind = event >> 6, event & 0x3F
+        if kind == EV_PEER:
+            mac = msg_id + bytes([arg, length >> 8, length & 0xFF])
+            peers.setdefault(peer, ":".join(f"{b:02X}" for b in mac))
+            continue
+        events.append({
+            "t": epoch + ts,
+            "seq": seq,
+            "source": SOURCES[source],
+            "event": EVENTS.get(kind, f"EV{kind}"),
+            "peer": peer,
+            "id": msg_id.hex().upper(),
+            "arg": arg,
+            "depth": depth,
+            "len": length,
+        })
+    return events, lost
+
+
+def peer_name(peers, index):
+    if index == NO_PEER:
+        return "-"
+    return peers.get(index, f"peer#{index}")
+
+
+def print_timeline(events, peers, out):
+    if not events:
+        return
+    t0 = events[0]["t"]
+    out.write(f"{'t [ms]':>12} {'src':6} {'event':9} {'peer':17} {'id':6} {'arg':>3} {'queue':>5} {'len':>4}\n")
+    for ev in events:
+        out.write(f"{(ev['t'] - t0) / 1000:12.3f} {ev['source']:6} {ev['event']:9} "
+                  f"{peer_name(peers, ev['peer']):17} {ev['id']:6} {ev['arg']:3d} {ev['depth']:5d} {ev['len']:4d}\n")
+
+
+def percentile(values, p):
+    values = sorted(values)
+    if not values:
+        return 0.0
+    k = min(len(values) - 1, int(round(p / 100.0 * (len(values) - 1))))
+    return values[k]
+
+
+def latency_report(events, peers, out):
+    messages = defaultdict(dict)
+    for ev in events:
+        if ev["event"] not in ("ENQUEUE", "TX", "ACK_RX", "EXPIRE", "DROP"):
+            continue
+        key = (ev["source"], ev["peer"], ev["id"])
+        msg = messages[key]
+        if ev["event"] == "ENQUEUE":
+            msg.setdefault("enqueue", ev["t"])
+        elif ev["event"] == "TX":
+            msg.setdefault("first_tx", ev["t"])
+            msg["last_tx"] = ev["t"]
+            msg["attempts"] = ev["arg"]
+        elif ev["event"] == "ACK_RX":
+            msg.setdefault("ack", ev["t"])
+        else:
+            msg["lost"] = ev["event"]
+
+    by_source = defaultdict(lambda: defaultdict(list))
+    for (source, _peer, _id), msg in messages.items():
+        stats = by_source[source]
+        if "enqueue" in msg and "first_tx" in msg:
+            stats["queue"].append(msg["first_tx"] - msg["enqueue"])
+        if "ack" in msg and "last_tx" in msg:
+            stats["rtt"].append(msg["ack"] - msg["last_tx"])
+        if "ack" in msg and "enqueue" in msg:
+            stats["total"].append(msg["ack"] - msg["enqueue"])
+        if "attempts" in msg:
+            stats["attempts"].append(msg["attempts"])
+        if "lost" in msg:
+            stats["lost"].append(1)
+
+    out.write("\nLatency breakdown [ms] (p50 / p90 / max):\n")
+    for source, stats in sorted(by_source.items()):
+        out.write(f"  {source}: {len(stats['attempts'])} transmitted, {len(stats['lost'])} expired/dropped\n")
+        for name, label in (("queue", "enqueue -> first TX"), ("rtt", "last TX -> ACK"), ("total", "enqueue -> ACK")):
+            values = stats[name]
+            if values:
+                out.write(f"    {label:20} {percentile(values, 50) / 1000:8.3f} {percentile(values, 90) / 1000:8.3f} "
+                          f"{max(values) / 1000:8.3f}  (n={len(values)})\n")
+        if stats["attempts"]:
+            retried = sum(1 for a in stats["attempts"] if a > 1)
+            out.write(f"    {'attempts':20} avg {sum(stats['attempts']) / len(stats['attempts']):.2f}, "
+                      f"{retried} needed a retransmission\n")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("input", help="log file with TRC/TRP lines, '-' for stdin, or a raw dump with --raw")
+    parser.add_argument("--raw", action="store_true", help="input is a binary dump of 16-byte records")
+    parser.add_argument("--peers", help="file with 'TRP <idx> <mac>' lines (for --raw dumps)")
+    parser.add_argument("--no-timeline", action="store_true", help="only print the latency breakdown")
+    args = parser.parse_args()
+
+    if args.raw:
+        with open(args.input, "rb") as f:
+            raw_records, peers = parse_raw(f.read())
+    else:
+        stream = sys.stdin if args.input == "-" else open(args.input, encoding="utf-8", errors="replace")
+        with stream:
+            raw_records, peers = parse_log(stream)
+    if args.peers:
+        with open(args.peers, encoding="utf-8") as f:
+            peers.update(parse_log(f)[1])
+
+    events, lost = decode(raw_records, peers)
+    if not args.no_timeline:
+        print_timeline(events, peers, sys.stdout)
+    if lost:
+        sys.stdout.write(f"\n{lost} records overwritten or missing (ring buffer wrapped during capture)\n")
+    latency_report(events, peers, sys.stdout)
+
+
+if __name__ == "__main__":
+    main()